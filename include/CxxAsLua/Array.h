@@ -0,0 +1,137 @@
+#pragma once
+
+#include "CxxAsLua/Userdata.h"
+#include <cstdint>
+#include <vector>
+
+namespace CxxAsLua {
+
+//the element types arrays can hold, and what they're called
+template<typename T> struct ArrayElementName;
+template<> struct ArrayElementName<double> { static const char* get() { return "float64"; } };
+template<> struct ArrayElementName<float> { static const char* get() { return "float32"; } };
+template<> struct ArrayElementName<int32_t> { static const char* get() { return "int32"; } };
+template<> struct ArrayElementName<int64_t> { static const char* get() { return "int64"; } };
+template<> struct ArrayElementName<uint8_t> { static const char* get() { return "uint8"; } };
+
+//storing a number into an integer array without undefined behavior for NaN or out-of-range values
+template<typename T, bool isInteger = std::is_integral<T>::value>
+struct ArrayElementCast {
+	static T exec(double d) { return (T)d; }
+};
+
+template<typename T>
+struct ArrayElementCast<T, true> {
+	static T exec(double d) {
+		if (!(d >= -9223372036854775808. && d < 9223372036854775808.)) return 0;
+		return (T)(int64_t)d;
+	}
+};
+
+/*
+dense array of numbers, as a userdata whose C++ type is the Object_Details_Array<T> itself
+indexed 1..n like a table, but each element is a raw T rather than an Object
+
+the elements are either owned (moved in from a std::vector or allocated), or a view onto someone else's memory
+'owner' keeps them alive either way, and is null for views the caller promises to outlive
+*/
+template<typename T>
+struct Object_Details_Array : public Object_Details_Userdata {
+	typedef Object_Details_Userdata Super;
+public:
+	T* data;
+	size_t size;
+	std::shared_ptr<void> owner;
+
+	//zero-filled
+	explicit Object_Details_Array(size_t size_)
+	: Super(&UserdataType<Object_Details_Array>::id, this), data(nullptr), size(0)
+	{
+		std::shared_ptr<std::vector<T>> v = std::make_shared<std::vector<T>>(size_);
+		data = v->data();
+		size = v->size();
+		owner = v;
+	}
+
+	//takes over the vector's buffer, the elements aren't copied
+	explicit Object_Details_Array(std::vector<T>&& v_)
+	: Super(&UserdataType<Object_Details_Array>::id, this), data(nullptr), size(0)
+	{
+		std::shared_ptr<std::vector<T>> v = std::make_shared<std::vector<T>>(std::move(v_));
+		data = v->data();
+		size = v->size();
+		owner = v;
+	}
+
+	Object_Details_Array(T* data_, size_t size_, std::shared_ptr<void> owner_)
+	: Super(&UserdataType<Object_Details_Array>::id, this), data(data_), size(size_), owner(owner_) {}
+
+	T* begin() { return data; }
+	T* end() { return data + size; }
+	const T* begin() const { return data; }
+	const T* end() const { return data + size; }
+
+	virtual std::string explicit_to_string() const {
+		std::ostringstream ss;
+		ss << ArrayElementName<T>::get() << " array: 0x" << std::hex << this;
+		return ss.str();
+	}
+
+	//keys 1..size map to elements, other numbers read as nil
+	//non-number keys fall through to the metatable
+	virtual bool rawget(const Object& key, Object& value) const {
+		if (key.details->typeIndex != Object::TYPE_NUMBER) return false;
+		double k = static_cast<const Object_Details_Number*>(key.details.get())->value;
+		if (k >= 1 && k <= (double)size && k == (double)(size_t)k) {
+			value = Object((double)data[(size_t)k - 1]);
+		} else {
+			value = nil;
+		}
+		return true;
+	}
+
+	virtual bool rawset(const Object& key, const Object& value) {
+		if (key.details->typeIndex != Object::TYPE_NUMBER) return false;
+		double k = static_cast<const Object_Details_Number*>(key.details.get())->value;
+		if (!(k >= 1 && k <= (double)size && k == (double)(size_t)k)) {
+			throw std::runtime_error("array index out of range");
+		}
+		double v;
+		if (!value.tonumber(v)) {
+			throw std::runtime_error(std::string("attempt to store a ") + value.type() + " value in a number array");
+		}
+		data[(size_t)k - 1] = ArrayElementCast<T>::exec(v);
+		return true;
+	}
+
+	virtual bool rawlen(double& out) const {
+		out = (double)size;
+		return true;
+	}
+};
+
+//a new zero-filled array of 'size' elements
+template<typename T>
+Object array(size_t size) {
+	return Object(std::make_shared<Object_Details_Array<T>>(size));
+}
+
+//an array that takes over v's buffer
+template<typename T>
+Object array(std::vector<T>&& v) {
+	return Object(std::make_shared<Object_Details_Array<T>>(std::move(v)));
+}
+
+//an array viewing 'size' elements at 'data', which 'owner' keeps alive (if the caller doesn't)
+template<typename T>
+Object array(T* data, size_t size, std::shared_ptr<void> owner = nullptr) {
+	return Object(std::make_shared<Object_Details_Array<T>>(data, size, owner));
+}
+
+//the array inside 'o', or null if 'o' isn't an array of T
+template<typename T>
+Object_Details_Array<T>* toarray(const Object& o) {
+	return testudata<Object_Details_Array<T>>(o);
+}
+
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "CxxAsLua/Object.h"
+#include <atomic>
+
+namespace CxxAsLua {
+
+/*
+constants laid out at compile time, instead of built by global constructors before main
+everything here is constant-initialized, so it's ready before any constructor runs, in any translation unit
+*/
+
+/*
+details in static storage, never destroyed, so other statics can use them from their constructors and destructors
+Objects made from them don't own them: making and copying one doesn't allocate or touch a reference count
+	static StaticDetails<Object_Details_Number> two(2.);
+	Object o = two.get();
+*/
+template<typename Details>
+union StaticDetails {
+	mutable Details details;
+
+	template<typename... Args>
+	constexpr StaticDetails(Args... args) : details(args...) {}
+	~StaticDetails() {}
+
+	//a pointer to the details that owns nothing
+	std::shared_ptr<Object_Details> share() const { return std::shared_ptr<Object_Details>(std::shared_ptr<Object_Details>(), &details); }
+	Object get() const { return Object(share()); }
+	operator Object() const { return get(); }
+};
+
+typedef StaticDetails<Object_Details_Number> ConstantNumber;
+
+/*
+a string literal, whose Object is made the first time it's used and then kept for good
+until then it's just the characters, with nothing to run at startup
+	static const ConstantString name("__index");
+	t[name]
+*/
+struct ConstantString {
+	const char* chars;
+	size_t size;
+
+	template<size_t N>
+	constexpr ConstantString(const char (&s)[N]) : chars(s), size(N - 1), object(nullptr) {}
+
+	const Object& get() const {
+		Object* o = object.load(std::memory_order_acquire);
+		return o ? *o : make();
+	}
+	operator const Object&() const { return get(); }
+
+protected:
+	mutable std::atomic<Object*> object;
+	const Object& make() const;
+};
+
+struct ConstantField;
+
+//a constant table's value: a number, boolean, string, function, a global Object, a library or another constant table
+struct ConstantValue {
+	enum Kind { NUMBER, BOOLEAN, STRING, FUNCTION, OBJECT, LIBRARY, TABLE };
+	Kind kind;
+	double number;
+	const char* chars;
+	size_t size;
+	VarArg (*func)(const VarArg&);
+	const Object* object;
+	const Library* library;
+	const ConstantField* fields;
+
+	constexpr ConstantValue(double number_) : kind(NUMBER), number(number_), chars(nullptr), size(0), func(nullptr), object(nullptr), library(nullptr), fields(nullptr) {}
+	constexpr ConstantValue(int number_) : kind(NUMBER), number(number_), chars(nullptr), size(0), func(nullptr), object(nullptr), library(nullptr), fields(nullptr) {}
+	constexpr ConstantValue(bool value) : kind(BOOLEAN), number(value), chars(nullptr), size(0), func(nullptr), object(nullptr), library(nullptr), fields(nullptr) {}
+	template<size_t N>
+	constexpr ConstantValue(const char (&s)[N]) : kind(STRING), number(0), chars(s), size(N - 1), func(nullptr), object(nullptr), library(nullptr), fields(nullptr) {}
+	constexpr ConstantValue(VarArg (*func_)(const VarArg&)) : kind(FUNCTION), number(0), chars(nullptr), size(0), func(func_), object(nullptr), library(nullptr), fields(nullptr) {}
+	//read when the table is made, so it can be a global that isn't constructed yet
+	constexpr ConstantValue(const Object* object_) : kind(OBJECT), number(0), chars(nullptr), size(0), func(nullptr), object(object_), library(nullptr), fields(nullptr) {}
+	constexpr ConstantValue(const Library* library_) : kind(LIBRARY), number(0), chars(nullptr), size(0), func(nullptr), object(nullptr), library(library_), fields(nullptr) {}
+	template<size_t N>
+	constexpr ConstantValue(const ConstantField (&fields_)[N]) : kind(TABLE), number(0), chars(nullptr), size(N), func(nullptr), object(nullptr), library(nullptr), fields(fields_) {}
+
+	Object get() const;
+};
+
+struct ConstantField {
+	const char* name;
+	ConstantValue value;
+};
+
+/*
+a table described by an array of fields in read-only memory, made when it's asked for
+each call makes a new table, so callers are free to change theirs
+	static const ConstantField lib[] = {
+		{"version", 2},
+		{"run", run},
+	};
+	Object t = constantTable(lib);
+*/
+Object constantTable(const ConstantField* fields, size_t count);
+
+template<size_t N>
+Object constantTable(const ConstantField (&fields)[N]) { return constantTable(fields, N); }
+
+}
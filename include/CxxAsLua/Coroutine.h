@@ -0,0 +1,90 @@
+#pragma once
+
+#include "CxxAsLua/Object.h"
+#include <exception>
+
+namespace CxxAsLua {
+
+struct CoroutineContext;
+
+//stackful coroutine, Lua's "thread" type
+struct Object_Details_Thread : public Object_Details {
+	typedef Object_Details Super;
+public:
+	enum Status {
+		STATUS_SUSPENDED,
+		STATUS_RUNNING,
+		STATUS_NORMAL,	//resumed another coroutine and is waiting on it
+		STATUS_DEAD
+	};
+
+	Object func;
+	Status status;
+
+	//arguments passed in by resume, values passed out by yield / return
+	VarArg transfer;
+
+	//set if the function threw, passed on by resume
+	std::exception_ptr error;
+
+	//the coroutine that resumed this one
+	Object_Details_Thread* previous;
+
+	//for coroutine.running()
+	std::weak_ptr<Object_Details> self;
+
+	/*
+	set when a suspended coroutine is destroyed, so its stack unwinds:
+	its yield throws an exception that a catch(...) in the body should rethrow
+	a body that swallows it anyway gets it thrown again from every later yield,
+	and whatever it returns is dropped, so the stack still ends and goes back to the pool
+	*/
+	bool killing;
+
+	//the machine context and stack, only held while the coroutine is alive
+	std::unique_ptr<CoroutineContext> context;
+
+	Object_Details_Thread(const Object& func_);
+	virtual ~Object_Details_Thread();
+
+	virtual std::string type() const;
+	virtual bool to_boolean() const;
+	virtual std::string explicit_to_string() const;
+
+	std::string statusName() const;
+};
+
+//the running coroutine on this thread, or null if in the main thread
+Object_Details_Thread* currentCoroutine();
+
+//returns 'true' and the yielded or returned values in 'results'
+//or 'false' and the thrown exception in 'error'
+bool resumeCoroutine(const Object& co, const VarArg& args, VarArg& results, std::exception_ptr& error);
+
+VarArg yieldCoroutine(const VarArg& args);
+
+/*
+stacks are mmap'd with a guard page
+once a coroutine finishes, its stack goes back into a per-thread pool for the next one
+*/
+void setCoroutineStackSize(size_t size);
+
+/*
+the lowest address the running code's stack can grow down to:
+just above the current coroutine's guard page, or the end of the thread's own stack
+for code that recurses on its input (like the Lua VM) to raise an error before it overflows
+*/
+const char* stackLimit();
+
+struct Coroutine : public Library {
+	LibraryField create, resume, yield, status, wrap, running, isyieldable;
+
+	constexpr Coroutine() : Library(makeTable)
+	, create(this, "create"), resume(this, "resume"), yield(this, "yield"), status(this, "status"), wrap(this, "wrap"), running(this, "running"), isyieldable(this, "isyieldable")
+	{}
+
+	static Object makeTable();
+};
+extern Coroutine coroutine;
+
+}
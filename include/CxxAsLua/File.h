@@ -0,0 +1,86 @@
+#pragma once
+
+#include "CxxAsLua/Object.h"
+#include <cstdio>
+
+namespace CxxAsLua {
+
+/*
+the C++ side of a file handle, as returned by io.open, held in a userdata
+
+files opened only for reading are mmap'd, and reads are served out of the mapping:
+lines are found with memchr and copied once, straight into the string Object
+everything else (writing, pipes, the standard streams, files that can't be mapped) goes through a FILE*
+*/
+struct File {
+	FILE* fp;
+	bool standard;	//stdin, stdout or stderr, which close() leaves open
+
+	//the mapping of a read-only file, and the read position within it
+	const char* map;
+	size_t mapSize;
+	size_t pos;
+
+	bool closed;
+
+	//getline's buffer, for reading lines through 'fp'
+	char* lineBuffer;
+	size_t lineCapacity;
+
+	File();
+	~File();
+	File(const File&) = delete;
+	File& operator=(const File&) = delete;
+
+	//on failure returns 'false' with errno set
+	bool open(const std::string& path, const std::string& mode);
+
+	//one of the standard streams
+	void wrap(FILE* fp_);
+
+	bool close();
+
+	/*
+	the next line, without copying it, for C++ callers
+	's' points into the mapping (or the line buffer when not mapped) and is valid until the next read or close
+	'keepNewline' as in read("L")
+	returns 'false' at the end of the file
+	*/
+	bool readLine(const char*& s, size_t& n, bool keepNewline = false);
+
+	//the rest of the file, as read("a")
+	std::string readAll();
+
+	//up to 'count' bytes, as read(count), 'false' at the end of the file
+	bool readBytes(size_t count, std::string& s);
+
+	//a numeral, as read("n")
+	bool readNumber(double& d);
+
+	//Lua's file:read formats, 'false' (and nil) when one fails
+	bool read(const Object& format, Object& result, int arg);
+
+	//on failure these return 'false' with errno set
+	bool write(const char* s, size_t n);
+	bool write(const Object& o);
+	bool seek(int whence, int64_t offset, int64_t& position);
+	bool flush();
+};
+
+//the File in a file handle, or null if 'o' isn't one
+File* tofile(const Object& o);
+
+//the handle for 'fp', which is never closed
+Object fileHandle(FILE* fp);
+
+//Lua's io.open, returning the handle, or nil, the error message and errno
+VarArg openFile(const std::string& path, const std::string& mode);
+
+//the functions for IO in Object.h that deal with files
+VarArg ioClose(const VarArg& args);
+VarArg ioLines(const VarArg& args);
+VarArg ioOpen(const VarArg& args);
+VarArg ioRead(const VarArg& args);
+VarArg ioType(const VarArg& args);
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "CxxAsLua/Object.h"
+#include <functional>
+#include <memory>
+
+namespace CxxAsLua {
+
+/*
+receives a JSON document's parts in order, as the SAX reader finds them
+strings and keys are only valid during the call
+*/
+struct JSONHandler {
+	virtual ~JSONHandler();
+	virtual void null() = 0;
+	virtual void boolean(bool b) = 0;
+	virtual void number(double d) = 0;
+	virtual void string(const char* s, size_t n) = 0;
+	virtual void startObject() = 0;
+	virtual void key(const char* s, size_t n) = 0;
+	virtual void endObject() = 0;
+	virtual void startArray() = 0;
+	virtual void endArray() = 0;
+};
+
+//reads one JSON value, which must be all of 'data' except for whitespace, throwing on errors
+void parseJSON(const char* data, size_t size, JSONHandler& handler);
+
+/*
+decodes a JSON document into Objects
+objects and arrays become tables, built as they're read without an intermediate tree
+arrays are indexed from 1, keys are interned so repeated keys share one string
+null becomes nil, so it's left out of objects and leaves a hole in arrays
+*/
+Object decodeJSON(const char* data, size_t size);
+Object decodeJSON(const Object& s);
+
+/*
+appends the JSON for 'o' to 'out'
+tables whose keys are exactly 1..n (n > 0) are written as arrays, other tables as objects
+object keys must be strings or numbers, and numbers must be finite
+tables referring back to themselves throw
+*/
+void encodeJSON(const Object& o, std::string& out);
+Object encodeJSON(const Object& o);
+
+struct JSONStreamParser;
+
+/*
+decodes input as it arrives, in chunks of any size
+if the input is a top-level array each element is passed to 'callback' once it is complete, so only one element is held at a time
+otherwise each top-level value is, as with newline-delimited JSON
+parsing picks up where the last chunk left off, so each byte is read once however the input is split
+and values are built as they arrive, rather than buffered until they're complete
+*/
+struct JSONStream {
+	std::function<void(const Object&)> callback;
+
+	JSONStream(std::function<void(const Object&)> callback_);
+	~JSONStream();
+
+	void feed(const char* data, size_t size);
+	void feed(const std::string& s);
+
+	//checks the input ended at the end of a value
+	void finish();
+
+private:
+	std::unique_ptr<JSONStreamParser> parser;
+};
+
+struct JSON : public Library {
+	LibraryField decode, encode;
+
+	constexpr JSON() : Library(makeTable)
+	, decode(this, "decode"), encode(this, "encode")
+	{}
+
+	static Object makeTable();
+};
+extern JSON json;
+
+}
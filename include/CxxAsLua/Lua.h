@@ -0,0 +1,42 @@
+#pragma once
+
+#include "CxxAsLua/Object.h"
+#include <stdexcept>
+
+namespace CxxAsLua {
+
+/*
+running Lua source
+chunks are compiled to register bytecode (see LuaBytecode.h) and run by a VM over the same Objects as C++ code,
+so Lua functions, tables and metatables pass freely between the two
+*/
+
+//errors raised while running Lua code, whose message already says where
+//their value is the message, so pcall returns it as Lua's would
+struct LuaError : public Error {
+	explicit LuaError(const std::string& message) : Error(Object(message)) {}
+};
+
+/*
+the globals Lua chunks see by default: the base functions (print, type, pairs, setmetatable, load ...)
+and the math, io, coroutine, json, string and table libraries
+*/
+Object& luaEnvironment();
+
+/*
+compiles a chunk into a function, throwing a LuaError on syntax errors
+with no chunkname, messages name the chunk by its first line
+globals are looked up in luaEnvironment(), or in 'env' when one is given -- even a nil one, as in Lua
+*/
+Object load(const std::string& chunk, const std::string& chunkname = std::string());
+Object load(const std::string& chunk, const std::string& chunkname, const Object& env);
+Object loadstring(const std::string& chunk, const std::string& chunkname = std::string());
+
+//compiles a file, skipping a first line starting with '#'
+Object loadfile(const std::string& path);
+Object loadfile(const std::string& path, const Object& env);
+
+//runs a file, returning what it returns
+VarArg dofile(const std::string& path);
+
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "CxxAsLua/Object.h"
+#include <cstdint>
+#include <vector>
+
+namespace CxxAsLua {
+
+/*
+the register machine that compiled Lua runs on (see Lua.h)
+
+instructions are 32 bits, laid out as in Lua 5.1:
+	op: 6 bits, A: 8 bits, C: 9 bits, B: 9 bits
+	or op, A and an 18 bit Bx, which is signed (sBx) for jumps
+R(x) is register x of the running function, K(x) is constant x
+RK(x) is a constant if x >= LUA_RK_CONSTANT, otherwise a register
+
+captured locals don't live in registers but in heap cells, so closures share them and they outlive the call
+each time a captured local's declaration runs it gets a new cell, so closures made in a loop each see their own
+*/
+#define LUA_OPCODES(X)\
+	X(MOVE)		/* A B		R(A) = R(B) */\
+	X(LOADK)	/* A Bx		R(A) = K(Bx) */\
+	X(LOADBOOL)	/* A B C	R(A) = (bool)B; if C then skip the next instruction */\
+	X(LOADNIL)	/* A B		R(A) ... R(A+B) = nil */\
+	X(GETUPVAL)	/* A B		R(A) = the value in upvalue B */\
+	X(SETUPVAL)	/* A B		the value in upvalue B = R(A) */\
+	X(NEWCELL)	/* B		cell B = a new cell holding nil */\
+	X(GETCELL)	/* A B		R(A) = the value in cell B */\
+	X(SETCELL)	/* A B		the value in cell B = R(A) */\
+	X(GETGLOBAL)	/* A Bx		R(A) = env[K(Bx)] */\
+	X(SETGLOBAL)	/* A Bx		env[K(Bx)] = R(A) */\
+	X(GETTABLE)	/* A B C	R(A) = R(B)[RK(C)] */\
+	X(SETTABLE)	/* A B C	R(A)[RK(B)] = RK(C) */\
+	X(NEWTABLE)	/* A		R(A) = {} */\
+	X(SELF)		/* A B C	R(A+1) = R(B); R(A) = R(B)[RK(C)] */\
+	X(ADD)		/* A B C	R(A) = RK(B) + RK(C) */\
+	X(SUB)\
+	X(MUL)\
+	X(DIV)\
+	X(MOD)\
+	X(POW)\
+	X(IDIV)\
+	X(BAND)\
+	X(BOR)\
+	X(BXOR)\
+	X(SHL)\
+	X(SHR)\
+	X(UNM)		/* A B		R(A) = -R(B) */\
+	X(NOT)\
+	X(LEN)\
+	X(BNOT)\
+	X(CONCAT)	/* A B C	R(A) = R(B) .. ... .. R(C) */\
+	X(JMP)		/* sBx		pc += sBx */\
+	X(EQ)		/* A B C	if (RK(B) == RK(C)) != A then skip the next instruction */\
+	X(LT)\
+	X(LE)\
+	X(TEST)		/* A C		if (bool)R(A) != C then skip the next instruction */\
+	X(CALL)		/* A B C	R(A) ... R(A+C-2) = R(A)(R(A+1) ... R(A+B-1)), B = 0 passes up to top, C = 0 sets top */\
+	X(TAILCALL)	/* A B		return R(A)(R(A+1) ... R(A+B-1)), made by Object::call's loop */\
+	X(RETURN)	/* A B		return R(A) ... R(A+B-2), B = 0 returns up to top */\
+	X(FORPREP)	/* A sBx	R(A) -= R(A+2); pc += sBx */\
+	X(FORLOOP)	/* A sBx	R(A) += R(A+2); if R(A) <?= R(A+1) then { pc += sBx; R(A+3) = R(A) } */\
+	X(TFORLOOP)	/* A C		R(A+3) ... R(A+2+C) = R(A)(R(A+1), R(A+2)); if R(A+3) ~= nil then R(A+2) = R(A+3) else skip the next instruction */\
+	X(SETLIST)	/* A B C	R(A)[(C-1)*LUA_FIELDS_PER_FLUSH+i] = R(A+i), 1 <= i <= B, B = 0 sets up to top, C = 0 takes C from the next instruction */\
+	X(CLOSURE)	/* A Bx		R(A) = a closure of function prototype Bx */\
+	X(VARARG)	/* A B		R(A) ... R(A+B-2) = vararg, B = 0 sets up to top */
+
+enum LuaOpcode {
+#define LUA_OPCODE_ENUM(name) LUA_OP_##name,
+	LUA_OPCODES(LUA_OPCODE_ENUM)
+#undef LUA_OPCODE_ENUM
+	LUA_NUM_OPCODES
+};
+
+extern const char* const luaOpcodeNames[LUA_NUM_OPCODES];
+
+enum {
+	LUA_SIZE_OP = 6,
+	LUA_SIZE_A = 8,
+	LUA_SIZE_B = 9,
+	LUA_SIZE_C = 9,
+	LUA_SIZE_Bx = LUA_SIZE_B + LUA_SIZE_C,
+
+	LUA_POS_A = LUA_SIZE_OP,
+	LUA_POS_C = LUA_POS_A + LUA_SIZE_A,
+	LUA_POS_B = LUA_POS_C + LUA_SIZE_C,
+	LUA_POS_Bx = LUA_POS_C,
+
+	LUA_MAXARG_A = (1 << LUA_SIZE_A) - 1,
+	LUA_MAXARG_B = (1 << LUA_SIZE_B) - 1,
+	LUA_MAXARG_C = (1 << LUA_SIZE_C) - 1,
+	LUA_MAXARG_Bx = (1 << LUA_SIZE_Bx) - 1,
+	LUA_MAXARG_sBx = LUA_MAXARG_Bx >> 1,
+
+	//B and C at or above this are constants
+	LUA_RK_CONSTANT = 1 << (LUA_SIZE_B - 1),
+
+	//registers a function can use, leaving room for LOADNIL's and CALL's offsets
+	LUA_MAX_REGISTERS = 250,
+
+	//table constructor items stored per SETLIST
+	LUA_FIELDS_PER_FLUSH = 50,
+};
+
+inline uint32_t luaCodeABC(LuaOpcode op, int a, int b, int c) {
+	return (uint32_t)op | ((uint32_t)a << LUA_POS_A) | ((uint32_t)b << LUA_POS_B) | ((uint32_t)c << LUA_POS_C);
+}
+inline uint32_t luaCodeABx(LuaOpcode op, int a, int bx) {
+	return (uint32_t)op | ((uint32_t)a << LUA_POS_A) | ((uint32_t)bx << LUA_POS_Bx);
+}
+inline uint32_t luaCodeAsBx(LuaOpcode op, int a, int sbx) {
+	return luaCodeABx(op, a, sbx + LUA_MAXARG_sBx);
+}
+
+inline LuaOpcode luaGetOp(uint32_t i) { return (LuaOpcode)(i & ((1 << LUA_SIZE_OP) - 1)); }
+inline int luaGetA(uint32_t i) { return (i >> LUA_POS_A) & LUA_MAXARG_A; }
+inline int luaGetB(uint32_t i) { return (i >> LUA_POS_B) & LUA_MAXARG_B; }
+inline int luaGetC(uint32_t i) { return (i >> LUA_POS_C) & LUA_MAXARG_C; }
+inline int luaGetBx(uint32_t i) { return (i >> LUA_POS_Bx) & LUA_MAXARG_Bx; }
+inline int luaGetsBx(uint32_t i) { return luaGetBx(i) - LUA_MAXARG_sBx; }
+
+//a compiled function
+/*
+where a global was last found in its environment table, so reading it again skips the search
+it's good for as long as the table's version is the one it saw (see Object_Details_Table::version)
+and it holds on to the table, so another can't take its place at the same address
+*/
+struct LuaGlobalSlot {
+	std::shared_ptr<Object_Details> table;
+	uint64_t version = 0;
+	Object* value = nullptr;
+};
+
+struct LuaProto {
+	std::vector<uint32_t> code;
+	std::vector<int> lines;	//the source line of each instruction
+	std::vector<Object> constants;
+	std::vector<std::shared_ptr<LuaProto>> protos;	//functions defined inside this one
+
+	//where each upvalue of a closure of this function comes from when it is made
+	struct Upvalue {
+		bool fromCell;	//a cell of the enclosing function, otherwise one of its upvalues
+		int index;
+	};
+	std::vector<Upvalue> upvalues;
+
+	int numParams = 0;
+	bool isVararg = false;
+	int maxStack = 0;
+	int numCells = 0;
+
+	//one for each constant, used by the GETGLOBAL and SETGLOBAL naming it
+	//a cache filled in as the function runs, so it's mutable in a proto that's otherwise fixed once compiled
+	mutable std::vector<LuaGlobalSlot> globalSlots;
+
+	std::string source;	//the chunk name, as shown in messages
+	int line = 0;	//where it was defined, 0 for the main chunk
+
+	//one line per instruction, for debugging the compiler
+	std::string disassemble() const;
+};
+
+/*
+parses and compiles a chunk, throwing a std::runtime_error with the position on syntax errors
+'chunkname' follows Lua: "=name" is shown as-is, "@file" as the file name, anything else as [string "..."]
+*/
+std::shared_ptr<LuaProto> compileLua(const char* source, size_t size, const std::string& chunkname);
+
+//the name for chunkname as it appears in messages
+std::string luaChunkId(const std::string& chunkname);
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "CxxAsLua/Lua.h"
+#include "CxxAsLua/LuaBytecode.h"
+#include <cmath>
+#include <initializer_list>
+
+namespace CxxAsLua {
+
+/*
+Lua's semantics for operations on Objects, as the VM runs them
+for code translated from Lua (see LuaTranslator.h), which has to behave the same as the chunk would under load()
+these throw std::runtime_error with Lua's messages, without a position
+*/
+
+//nil and false are false, everything else is true
+inline bool luaTruthy(const Object& o) {
+	switch (o.details->typeIndex) {
+	case Object::TYPE_NIL:
+		return false;
+	case Object::TYPE_BOOLEAN:
+		return static_cast<const Object_Details_Boolean*>(o.details.get())->value;
+	default:
+		return true;
+	}
+}
+
+//a % b for numbers, which has the sign of b
+inline double luaMod(double a, double b) {
+	double m = ::fmod(a, b);
+	if (m != 0 && (m < 0) != (b < 0)) m += b;
+	return m;
+}
+
+//t[key] and t[key] = value, with __index and __newindex
+Object luaIndex(Object t, const Object& key);
+void luaSetIndex(Object t, const Object& key, const Object& value);
+
+//without metamethods, erasing the key for a nil value, on a table
+void luaRawSet(const Object& t, const Object& key, const Object& value);
+
+/*
+globals through a LuaGlobalSlot: env[name] and env[name] = value
+while the slot is good these don't search the table, or even hash the name
+*/
+inline Object* luaCachedGlobal(const Object& env, const LuaGlobalSlot& slot) {
+	if (slot.table.get() != env.details.get() || slot.version != static_cast<const Object_Details_Table*>(slot.table.get())->version) return nullptr;
+	//set to nil by code that doesn't erase, so the key's missing as far as Lua is concerned
+	return slot.value->is_nil() ? nullptr : slot.value;
+}
+
+Object luaFindGlobal(const Object& env, const Object& name, LuaGlobalSlot& slot);
+
+inline Object luaGetGlobal(const Object& env, const Object& name, LuaGlobalSlot& slot) {
+	const Object* v = luaCachedGlobal(env, slot);
+	return v ? *v : luaFindGlobal(env, name, slot);
+}
+
+inline void luaSetGlobal(const Object& env, const Object& name, const Object& value, LuaGlobalSlot& slot) {
+	//an existing key is overwritten without __newindex, as Lua does, unless it's being removed
+	Object* v = value.is_nil() ? nullptr : luaCachedGlobal(env, slot);
+	if (v) {
+		*v = value;
+	} else {
+		//a new key is found on its next read, and a removed one has bumped the version
+		luaSetIndex(env, name, value);
+	}
+}
+
+//op is one of LUA_OP_ADD through LUA_OP_SHR
+Object luaArithmetic(LuaOpcode op, const Object& a, const Object& b);
+Object luaUnm(const Object& a);
+Object luaBnot(const Object& a);
+Object luaLen(const Object& o);
+
+//first .. ... .. first[n-1]
+Object luaConcat(const Object* first, int n);
+inline Object luaConcat(std::initializer_list<Object> values) { return luaConcat(values.begin(), (int)values.size()); }
+
+bool luaEquals(const Object& a, const Object& b);
+bool luaLessThan(const Object& a, const Object& b);
+bool luaLessEqual(const Object& a, const Object& b);
+
+//with __tostring, and numbers as print shows them
+Object luaToString(const Object& o);
+
+//a table constructor: its positional items, its keyed ones, and the values of a trailing call or ... if there is one
+Object luaMakeTable(std::initializer_list<Object> items, std::initializer_list<std::pair<Object, Object>> fields = {}, const VarArg& rest = VarArg());
+
+//a 'for' loop's initial value, limit or step, converting strings as Lua does
+double luaForNumber(const Object& o, const char* what);
+
+//the arguments after the first 'skip', which are a vararg function's ...
+VarArg luaVarargs(const VarArg& args, size_t skip);
+
+//head followed by all of tail, for calls and returns ending in a call or ...
+VarArg luaAppend(VarArg head, const VarArg& tail);
+
+//self:name(args)
+VarArg luaCallMethod(const Object& self, const Object& name, const VarArg& args);
+
+}
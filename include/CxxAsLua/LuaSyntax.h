@@ -0,0 +1,146 @@
+#pragma once
+
+#include "CxxAsLua/Object.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace CxxAsLua {
+
+/*
+the parsed form of a Lua chunk, shared by the bytecode compiler (LuaBytecode.h) and the C++ translator (LuaTranslator.h)
+*/
+
+//the lexer's tokens, which are also the 'op' of unary and binary expressions
+enum LuaTokenType {
+	//single-character tokens are their character
+	LUA_TK_AND = 257, LUA_TK_BREAK, LUA_TK_DO, LUA_TK_ELSE, LUA_TK_ELSEIF, LUA_TK_END,
+	LUA_TK_FALSE, LUA_TK_FOR, LUA_TK_FUNCTION, LUA_TK_GOTO, LUA_TK_IF, LUA_TK_IN,
+	LUA_TK_LOCAL, LUA_TK_NIL, LUA_TK_NOT, LUA_TK_OR, LUA_TK_REPEAT, LUA_TK_RETURN,
+	LUA_TK_THEN, LUA_TK_TRUE, LUA_TK_UNTIL, LUA_TK_WHILE,
+	LUA_TK_IDIV, LUA_TK_CONCAT, LUA_TK_DOTS, LUA_TK_EQ, LUA_TK_GE, LUA_TK_LE, LUA_TK_NE,
+	LUA_TK_SHL, LUA_TK_SHR, LUA_TK_DBCOLON,
+	LUA_TK_EOS, LUA_TK_NUMBER, LUA_TK_NAME, LUA_TK_STRING
+};
+
+/*
+syntax tree
+names are resolved while parsing, so each use of a local points at its declaration
+*/
+
+struct LuaFuncNode;
+
+struct LuaLocal {
+	std::string name;
+	LuaFuncNode* func;
+	bool captured = false;	//used by an inner function, so it lives in a cell
+
+	//set by the bytecode compiler
+	int reg = -1;
+	int cell = -1;
+};
+
+enum LuaExprKind {
+	LUA_EXPR_NIL,
+	LUA_EXPR_TRUE,
+	LUA_EXPR_FALSE,
+	LUA_EXPR_NUMBER,
+	LUA_EXPR_STRING,
+	LUA_EXPR_VARARG,
+	LUA_EXPR_FUNCTION,
+	LUA_EXPR_TABLE,	//list holds the values, keys the keys (null for positional items)
+	LUA_EXPR_BINARY,	//a op b
+	LUA_EXPR_UNARY,	//op a
+	LUA_EXPR_LOCAL,
+	LUA_EXPR_UPVALUE,
+	LUA_EXPR_GLOBAL,	//string is the name
+	LUA_EXPR_INDEX,	//a[b]
+	LUA_EXPR_CALL,	//a(list)
+	LUA_EXPR_METHOD,	//a:string(list)
+	LUA_EXPR_PAREN,	//(a), truncated to one value
+};
+
+struct LuaExpr {
+	LuaExprKind kind;
+	int line;
+	double number = 0;
+	std::string string;
+	int op = 0;
+	LuaLocal* local = nullptr;
+	int upvalue = -1;
+	LuaExpr* a = nullptr;
+	LuaExpr* b = nullptr;
+	std::vector<LuaExpr*> list;
+	std::vector<LuaExpr*> keys;
+	LuaFuncNode* func = nullptr;
+};
+
+enum LuaStatKind {
+	LUA_STAT_LOCAL,	//local locals = exprs
+	LUA_STAT_LOCALFUNCTION,	//local function locals[0] exprs[0]
+	LUA_STAT_ASSIGN,	//targets = exprs
+	LUA_STAT_CALL,	//exprs[0]
+	LUA_STAT_DO,	//blocks[0]
+	LUA_STAT_WHILE,	//while exprs[0] do blocks[0] end
+	LUA_STAT_REPEAT,	//repeat blocks[0] until exprs[0]
+	LUA_STAT_IF,	//if exprs[0] then blocks[0] elseif exprs[1] then blocks[1] ... else blocks[exprs.size()] end
+	LUA_STAT_NUMFOR,	//for locals[0] = exprs[0], exprs[1], exprs[2] (optional) do blocks[0] end
+	LUA_STAT_GENFOR,	//for locals in exprs do blocks[0] end
+	LUA_STAT_RETURN,
+	LUA_STAT_BREAK,
+	LUA_STAT_GOTO,
+	LUA_STAT_LABEL,
+};
+
+struct LuaBlock;
+
+struct LuaStat {
+	LuaStatKind kind;
+	int line;
+	std::vector<LuaLocal*> locals;
+	std::vector<LuaExpr*> targets;
+	std::vector<LuaExpr*> exprs;
+	std::vector<LuaBlock*> blocks;
+	std::string label;
+};
+
+struct LuaBlock {
+	std::vector<LuaStat*> stats;
+};
+
+struct LuaFuncNode {
+	LuaFuncNode* parent = nullptr;
+	std::vector<LuaLocal*> params;
+	bool isVararg = false;
+	LuaBlock* body = nullptr;
+	int line = 0;
+
+	struct Upvalue {
+		LuaLocal* local;
+		int parentUpvalue;	//-1 if it's a local of the parent
+	};
+	std::vector<Upvalue> upvalues;
+
+	//locals in scope at the point being parsed
+	std::vector<LuaLocal*> actives;
+};
+
+//a parsed chunk, which owns all of its nodes
+struct LuaSyntaxTree {
+	std::vector<std::unique_ptr<LuaExpr>> exprs;
+	std::vector<std::unique_ptr<LuaStat>> stats;
+	std::vector<std::unique_ptr<LuaBlock>> blocks;
+	std::vector<std::unique_ptr<LuaFuncNode>> funcs;
+	std::vector<std::unique_ptr<LuaLocal>> locals;
+
+	std::string chunkId;	//as shown in messages, see luaChunkId
+	LuaFuncNode* main = nullptr;
+};
+
+/*
+parses a chunk, throwing a std::runtime_error with the position on syntax errors
+goto and label checks happen later, in compileLua
+*/
+std::unique_ptr<LuaSyntaxTree> parseLua(const char* source, size_t size, const std::string& chunkname);
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+namespace CxxAsLua {
+
+/*
+translates a Lua chunk into C++ against this library, ahead of time
+
+the output is a source file defining
+	VarArg <functionName>(const VarArg& args)
+which runs the chunk with luaEnvironment() as its globals, as load(source)(args) would
+it includes "CxxAsLua/LuaRuntime.h", so Lua's semantics are the VM's
+
+what makes it faster than the VM:
+*) locals are typed: ones only ever holding numbers are doubles, the rest Objects
+	and captured locals that are assigned after their declaration are upvalues (see Object.h), the rest are captured by value
+*) 'local function's that are only ever called (never passed around, reassigned or vararg),
+	and only use other such functions, become static C++ functions called directly,
+	with double parameters and return values where every call and return allows it
+*) constant expressions are folded, including locals that are numbers and never reassigned
+*) math functions and ipairs are called directly, as long as the chunk doesn't assign those globals
+	(so other code mustn't replace them either)
+
+what it doesn't do that the VM does:
+*) runtime errors don't say the chunk and line
+*) calls from static functions aren't tail calls, and deep recursion isn't caught before it overflows the stack
+
+throws a std::runtime_error for source that load() would reject
+*/
+std::string translateLua(const std::string& source, const std::string& chunkname, const std::string& functionName);
+
+}
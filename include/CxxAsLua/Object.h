@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <atomic>
 #include <map>
 #include <memory>
 #include <initializer_list>
@@ -9,6 +10,11 @@
 #include <functional>
 #include <iostream>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "CxxAsLua/SmallVector.h"
 
 namespace CxxAsLua {
 
@@ -40,11 +46,86 @@ struct ObjectIsType;
 
 struct Access;
 
+//numeric types that are read and written as raw doubles
+//(char types are excluded, those convert to/from strings)
+template<typename T> struct ObjectIsNumberType {
+	enum { value = std::is_arithmetic<T>::value
+		&& !std::is_same<T, bool>::value
+		&& !std::is_same<T, char>::value
+		&& !std::is_same<T, signed char>::value
+		&& !std::is_same<T, unsigned char>::value
+		&& !std::is_same<T, wchar_t>::value
+		&& !std::is_same<T, char16_t>::value
+		&& !std::is_same<T, char32_t>::value };
+};
+
+//arithmetic expression templates, defined after Object
+template<typename Derived> struct ObjectExprOps;
+template<typename A, typename B, typename Op> struct ObjectArith;
+template<typename T, typename Cmp, typename Enable = void> struct ObjectCompare;
+template<typename E> struct ObjectUnmExpr;
+struct ObjectExprRef;
+struct ObjectOpAdd;
+struct ObjectOpSub;
+struct ObjectOpMul;
+struct ObjectOpDiv;
+struct ObjectOpMod;
+struct ObjectOpPow;
+struct ObjectCmpEq;
+struct ObjectCmpNe;
+struct ObjectCmpLt;
+struct ObjectCmpGt;
+struct ObjectCmpLe;
+struct ObjectCmpGe;
+
+/*
+type-erased storage for anything an Object can call
+small callables (function pointers, most lambdas) are stored inline, larger ones go on the heap
+calling convention: arguments are read by reference, results are written into a caller-provided VarArg
+*/
+struct Callable {
+	typedef void (*Invoke)(const Callable& self, const VarArg& args, VarArg& results);
+
+	enum { BUFFER_SIZE = 4 * sizeof(void*) };
+
+	Callable();
+	Callable(const Callable& x);
+	Callable(Callable&& x);
+	~Callable();
+
+	Callable& operator=(const Callable& x);
+	Callable& operator=(Callable&& x);
+
+	//store a copy of 't', to be called through 'invoke_'
+	template<typename T> static Callable create(const T& t, Invoke invoke_);
+
+	//retrieve what was stored by create<T>()
+	template<typename T> const T& target() const;
+
+	void operator()(const VarArg& args, VarArg& results) const { invoke(*this, args, results); }
+	explicit operator bool() const { return invoke != nullptr; }
+
+public:	//protected:
+	enum ManageOp { MANAGE_COPY, MANAGE_MOVE, MANAGE_DESTROY };
+	typedef void (*Manage)(ManageOp op, Callable& dst, Callable* src);
+
+	union Storage {
+		alignas(std::max_align_t) unsigned char buffer[BUFFER_SIZE];
+		void* heap;
+	} storage;
+
+	Invoke invoke;
+
+	//null for trivially-copyable inline targets (function pointers, lambdas capturing only primitives)
+	// so they copy with a memcpy and need no destructor
+	Manage manage;
+};
+
 struct Object {
 
 	typedef intptr_t Int;
 	typedef std::map<Object, Object, MapCompare> Map;
-	typedef std::function<VarArg(VarArg)> Function;
+	typedef Callable Function;
 
 public:	//protected:
 
@@ -96,6 +177,9 @@ public:
 	template<typename ReturnType, typename... Args> Object(ReturnType (*func)(Args...));
 	template<typename T, typename std::enable_if<supports_call<T>::value>::type...> Object(const T& t);
 
+	//evaluates an arithmetic expression built by the operators below
+	template<typename Derived> Object(const ObjectExprOps<Derived>& e);
+
 	/* non-function, non-primitive ... userdata?
 	template<
 		typename T,
@@ -147,6 +231,9 @@ public:
 	template<typename T, typename std::enable_if<supports_call<T>::value>::type...>
 	Object& operator=(const T& t);
 
+	//if the result is a number and this holds the only reference to a number, it is overwritten in place
+	template<typename Derived> Object& operator=(const ObjectExprOps<Derived>& e);
+
 	//using VarArg's cast operator instead
 	// for some reason, enabling this makes things fail more often
 	//Object& operator=(const VarArg& x);
@@ -188,6 +275,8 @@ public:
 	bool is_table() const;
 	bool is_function() const;
 	bool is_nil() const;
+	bool is_thread() const;
+	bool is_userdata() const;
 
 	template<typename T> bool is_type() const;
 
@@ -210,7 +299,13 @@ public:
 	template<typename... Args>
 	VarArg operator()(Args... args) const;
 	
-	VarArg call(VarArg args);
+	VarArg call(const VarArg& args);
+
+	//same as above, but writes into a caller-provided 'results' instead of returning a new VarArg
+	void call(const VarArg& args, VarArg& results);
+
+	//makes a single call, which may leave a pending tailcall() in 'results'
+	void dispatch(const VarArg& args, VarArg& results);
 	
 	VarArgRef operator,(Object& o);
 	VarArg operator,(const Object& o) const;
@@ -222,6 +317,8 @@ public:
 		TYPE_BOOLEAN,
 		TYPE_FUNCTION,
 		TYPE_NIL,
+		TYPE_THREAD,
+		TYPE_USERDATA,
 		NUM_TYPES
 	};
 
@@ -238,32 +335,43 @@ public:
 		const std::string& event
 	);
 	
+	//computes func(a, b) if both are numbers, otherwise calls the metamethod for 'event'
+	template<typename Func>
 	static Object invokeNumberMetaBinary(
-		Object a,
-		Object b,
-		const std::string& event,
-		std::function<double(double,double)> func
+		const Object& a,
+		const Object& b,
+		const char* event,
+		Func func
 	);
 
-	static Object invokeStringMetaBinary(
-		Object op1,
-		Object op2,
-		const std::string& event,
-		std::function<bool(const Object&)> testType,
-		std::function<std::string(std::string,std::string)> func
+	//the slow half of invokeNumberMetaBinary: calls the metamethod or throws
+	static Object invokeArithmeticHandler(
+		const Object& a,
+		const Object& b,
+		const std::string& event
+	);
+
+	//for concatenating anything other than strings and numbers: calls __concat or throws
+	static Object invokeConcatHandler(
+		const Object& a,
+		const Object& b
 	);
 
-	//TODO these technically do their test by attempting conversion...
-	template<typename T> Object operator+(const T& o) const;
-	template<typename T> Object operator-(const T& o) const;
-	template<typename T> Object operator*(const T& o) const;
-	template<typename T> Object operator/(const T& o) const;
-	template<typename T> Object operator%(const T& o) const;
-	template<typename T> Object pow(const T& o) const;
+	//for when op is not a number: calls its metamethod or throws
+	static Object invokeNumberMetaUnary(const Object& op, const std::string& event);
+
+	//these return unevaluated expressions (see ObjectExprOps), which must be assigned or converted before the statement ends
+	//a chain such as x*x*x-x-1 is computed in one go when it is assigned or converted to an Object
+	template<typename T> typename ObjectArith<Object, T, ObjectOpAdd>::Type operator+(const T& o) const;
+	template<typename T> typename ObjectArith<Object, T, ObjectOpSub>::Type operator-(const T& o) const;
+	template<typename T> typename ObjectArith<Object, T, ObjectOpMul>::Type operator*(const T& o) const;
+	template<typename T> typename ObjectArith<Object, T, ObjectOpDiv>::Type operator/(const T& o) const;
+	template<typename T> typename ObjectArith<Object, T, ObjectOpMod>::Type operator%(const T& o) const;
+	template<typename T> typename ObjectArith<Object, T, ObjectOpPow>::Type pow(const T& o) const;
 	
-	Object operator-() const;
+	ObjectUnmExpr<ObjectExprRef> operator-() const;
 		
-	Object concat(const Object& o) const;
+	template<typename T> Object concat(const T& o) const;
 
 	Object len() const;
 
@@ -273,8 +381,15 @@ public:
 		const std::string& event
 	);
 
-	template<typename T> Object operator==(const T& o) const;
-	template<typename T> Object operator!=(const T& o) const;
+	//comparisons once both sides are Objects, metamethods included
+	static Object equals(const Object& op1, const Object& op2);
+	static Object lessThan(const Object& op1, const Object& op2);
+	static Object lessEqual(const Object& op1, const Object& op2);
+
+	//these compare against C++ numbers directly (see ObjectCompare)
+	//against C++ numbers these are the free operators after the class (see CXXASLUA_RIGHT_COMPARE)
+	template<typename T> typename std::enable_if<!ObjectIsNumberType<T>::value, Object>::type operator==(const T& o) const;
+	template<typename T> typename std::enable_if<!ObjectIsNumberType<T>::value, Object>::type operator!=(const T& o) const;
 	template<typename T> Object operator<(const T& o) const;
 	template<typename T> Object operator>(const T& o) const;
 	template<typename T> Object operator<=(const T& o) const;
@@ -319,7 +434,12 @@ public:
 	//...and moving them all outside Object means they can't have access to Object's typedefs
 	//   ...unless I forward-declare all these, and move all Object's function bodies to after this... 
 	std::shared_ptr<Object_Details> metatable;
-	
+
+	//which Object_Details_* subclass this is, so type tests don't need a dynamic_cast
+	const Object::Type_t typeIndex;
+
+	//constexpr so details can be laid out at compile time (see Constant.h)
+	constexpr Object_Details(Object::Type_t typeIndex_) : metatable(), typeIndex(typeIndex_) {}
 	virtual ~Object_Details();
 
 	virtual std::string type() const;
@@ -335,21 +455,28 @@ public:
 	virtual std::string explicit_to_string() const;
 
 	virtual bool compare(const Object& o) const;
+
+	//built-in indexing and length, for userdata that have them (like typed arrays)
+	//these return 'false' to fall back on the __index, __newindex and __len metamethods
+	virtual bool rawget(const Object& key, Object& value) const;
+	virtual bool rawset(const Object& key, const Object& value);
+	virtual bool rawlen(double& out) const;
 };
 
-template<typename T>
+template<typename T, Object::Type_t typeIndex_>
 struct Object_Details_Type : public Object_Details {
 	typedef Object_Details Super;
 public:
 	T value;
 
 public:
-	Object_Details_Type() : Super(), value(T()) {}
-	Object_Details_Type(const T& value_) : Super(), value(value_) {}
+	Object_Details_Type() : Super(typeIndex_), value(T()) {}
+	constexpr Object_Details_Type(const T& value_) : Super(typeIndex_), value(value_) {}
+	Object_Details_Type(T&& value_) : Super(typeIndex_), value(std::move(value_)) {}
 };
 
-struct Object_Details_Number : public Object_Details_Type<double> {
-	typedef Object_Details_Type<double> Super;
+struct Object_Details_Number : public Object_Details_Type<double, Object::TYPE_NUMBER> {
+	typedef Object_Details_Type<double, Object::TYPE_NUMBER> Super;
 public:
 	using Super::Super;
 	
@@ -358,10 +485,18 @@ public:
 	virtual std::string to_string() const;
 	virtual bool to_boolean() const;
 	virtual bool compare(const Object& o) const;
+
+	//how numbers are written when converted to strings
+	static std::string format(double value);
+
+	//same, into a caller's buffer of at least formatSize chars, without allocating
+	//returns the length written
+	static const size_t formatSize = 32;
+	static size_t format(double value, char* buf);
 };
 
-struct Object_Details_String : public Object_Details_Type<std::string> {
-	typedef Object_Details_Type<std::string> Super;
+struct Object_Details_String : public Object_Details_Type<std::string, Object::TYPE_STRING> {
+	typedef Object_Details_Type<std::string, Object::TYPE_STRING> Super;
 public:
 	using Super::Super;
 	
@@ -374,10 +509,15 @@ public:
 	virtual bool compare(const Object& o) const;
 };
 
-struct Object_Details_Table : public Object_Details_Type<Object::Map> {
-	typedef Object_Details_Type<Object::Map> Super;
+struct Object_Details_Table : public Object_Details_Type<Object::Map, Object::TYPE_TABLE> {
+	typedef Object_Details_Type<Object::Map, Object::TYPE_TABLE> Super;
 public:
 	using Super::Super;
+
+	//bumped whenever a key is removed, the only change that moves a value in the map
+	//so caches of where a value lives (see LuaGlobalSlot) know to look again
+	//code that erases from 'value' itself has to bump it too
+	uint64_t version = 0;
 	
 	virtual std::string type() const;
 	
@@ -389,8 +529,8 @@ public:
 	virtual bool compare(const Object& o) const;
 };
 
-struct Object_Details_Boolean : public Object_Details_Type<bool> {
-	typedef Object_Details_Type<bool> Super;
+struct Object_Details_Boolean : public Object_Details_Type<bool, Object::TYPE_BOOLEAN> {
+	typedef Object_Details_Type<bool, Object::TYPE_BOOLEAN> Super;
 public:
 	using Super::Super;
 	
@@ -403,8 +543,8 @@ public:
 	virtual bool compare(const Object& o) const;
 };
 
-struct Object_Details_Function : public Object_Details_Type<Object::Function> {
-	typedef Object_Details_Type<Object::Function> Super;
+struct Object_Details_Function : public Object_Details_Type<Object::Function, Object::TYPE_FUNCTION> {
+	typedef Object_Details_Type<Object::Function, Object::TYPE_FUNCTION> Super;
 public:
 	using Super::Super;
 
@@ -421,7 +561,7 @@ public:
 struct Object_Details_Nil : public Object_Details {
 	typedef Object_Details Super;
 public:
-	using Super::Super;
+	constexpr Object_Details_Nil() : Super(Object::TYPE_NIL) {}
 	
 	virtual std::string type() const;
 	
@@ -432,6 +572,440 @@ public:
 
 std::ostream& operator<<(std::ostream& o, const Object& x);
 
+/*
+arithmetic expression templates
+
+Object's arithmetic operators build a tree of these instead of computing each step into a new Object
+when the tree is assigned or converted to an Object:
+- if every leaf converts to a number then the whole tree is computed on doubles
+- otherwise it is evaluated node by node, with metamethods, the same as before
+
+every node provides:
+	bool number(double& out) const;	//'true' and the result if everything underneath is a number
+	Object eval() const;	//the result, using metamethods where needed
+
+nodes reference their Object operands, so they mustn't outlive the statement that built them
+don't keep one in an 'auto' variable: give it a type, which evaluates it
+	auto y = x * 2 + 1;	//wrong: y still refers to x, or to a temporary that's already gone
+	Object y = x * 2 + 1;	//right
+the same goes for a lambda's deduced return type, which would return references to its own locals
+	[](Object x) { Object y = x + 1; return y * 2; }	//wrong, and refused when made into an Object
+	[](Object x)->Object { Object y = x + 1; return y * 2; }	//right
+*/
+
+struct ObjectOpAdd {
+	static double exec(double a, double b) { return a + b; }
+	static const char* event() { return "__add"; }
+};
+
+struct ObjectOpSub {
+	static double exec(double a, double b) { return a - b; }
+	static const char* event() { return "__sub"; }
+};
+
+struct ObjectOpMul {
+	static double exec(double a, double b) { return a * b; }
+	static const char* event() { return "__mul"; }
+};
+
+struct ObjectOpDiv {
+	static double exec(double a, double b) { return a / b; }
+	static const char* event() { return "__div"; }
+};
+
+struct ObjectOpMod {
+	static double exec(double a, double b) { return Object::lmod(a, b); }
+	static const char* event() { return "__mod"; }
+};
+
+struct ObjectOpPow {
+	static double exec(double a, double b) { return ::pow(a, b); }
+	static const char* event() { return "__pow"; }
+};
+
+//leaf: an Object operand, referenced rather than copied
+//this is why an expression mustn't be stored with 'auto': the Object may be gone by the time it's evaluated
+struct ObjectExprRef {
+	const Object& o;
+	ObjectExprRef(const Object& o_) : o(o_) {}
+	bool number(double& out) const {
+		if (o.details->typeIndex == Object::TYPE_NUMBER) {
+			out = static_cast<const Object_Details_Number*>(o.details.get())->value;
+			return true;
+		}
+		return o.tonumber(out);
+	}
+	Object eval() const { return o; }
+};
+
+//leaf: a C++ number, kept as a double
+struct ObjectExprNumber {
+	double value;
+	ObjectExprNumber(double value_) : value(value_) {}
+	bool number(double& out) const { out = value; return true; }
+	Object eval() const { return Object(value); }
+};
+
+//leaf: anything else (strings, Access, VarArg ...), converted to an Object up front
+struct ObjectExprValue {
+	Object o;
+	ObjectExprValue(const Object& o_) : o(o_) {}
+	bool number(double& out) const { return ObjectExprRef(o).number(out); }
+	Object eval() const { return o; }
+};
+
+//how each operand type is held in an expression
+template<typename T, typename Enable = void>
+struct ObjectExprLeaf {
+	typedef ObjectExprValue Type;
+	static Type make(const T& t) { return Type(Object(t)); }
+};
+
+template<typename T>
+struct ObjectExprLeaf<T, typename std::enable_if<std::is_base_of<Object, T>::value>::type> {
+	typedef ObjectExprRef Type;
+	static Type make(const T& t) { return Type(t); }
+};
+
+template<typename T>
+struct ObjectExprLeaf<T, typename std::enable_if<ObjectIsNumberType<T>::value>::type> {
+	typedef ObjectExprNumber Type;
+	static Type make(const T& t) { return Type((double)t); }
+};
+
+//whether T is an expression node, rather than a value
+template<typename T>
+struct ObjectIsExpr : public std::is_base_of<ObjectExprOps<T>, T> {};
+
+//sub-expressions are held by value
+template<typename T>
+struct ObjectExprLeaf<T, typename std::enable_if<ObjectIsExpr<T>::value>::type> {
+	typedef T Type;
+	static const Type& make(const T& t) { return t; }
+};
+
+template<typename A, typename B, typename Op>
+struct ObjectBinaryExpr;
+
+template<typename A, typename B, typename Op>
+struct ObjectArith {
+	typedef ObjectBinaryExpr<typename ObjectExprLeaf<A>::Type, typename ObjectExprLeaf<B>::Type, Op> Type;
+	static Type exec(const A& a, const B& b) {
+		return Type(ObjectExprLeaf<A>::make(a), ObjectExprLeaf<B>::make(b));
+	}
+};
+
+/*
+comparison operators
+each provides the comparison on doubles, and on Objects for everything else
+*/
+
+struct ObjectCmpEq {
+	static bool exec(double a, double b) { return a == b; }
+	static Object call(const Object& a, const Object& b) { return Object::equals(a, b); }
+};
+
+struct ObjectCmpNe {
+	static bool exec(double a, double b) { return a != b; }
+	static Object call(const Object& a, const Object& b) { return Object(!Object::equals(a, b)); }
+};
+
+struct ObjectCmpLt {
+	static bool exec(double a, double b) { return a < b; }
+	static Object call(const Object& a, const Object& b) { return Object::lessThan(a, b); }
+};
+
+struct ObjectCmpGt {
+	static bool exec(double a, double b) { return a > b; }
+	static Object call(const Object& a, const Object& b) { return Object::lessThan(b, a); }
+};
+
+struct ObjectCmpLe {
+	static bool exec(double a, double b) { return a <= b; }
+	static Object call(const Object& a, const Object& b) { return Object::lessEqual(a, b); }
+};
+
+struct ObjectCmpGe {
+	static bool exec(double a, double b) { return a >= b; }
+	static Object call(const Object& a, const Object& b) { return Object::lessEqual(b, a); }
+};
+
+//comparing an Object against a T
+//by default the T is converted to an Object
+template<typename T, typename Cmp, typename Enable>
+struct ObjectCompare {
+	static Object exec(const Object& a, const T& b) { return Cmp::call(a, Object(b)); }
+};
+
+template<typename T, typename Cmp>
+struct ObjectCompare<T, Cmp, typename std::enable_if<std::is_base_of<Object, T>::value>::type> {
+	static Object exec(const Object& a, const Object& b) { return Cmp::call(a, b); }
+};
+
+//C++ numbers are compared against the Object's number without being boxed
+//a number is never equal to a non-number, and ordering a non-number falls back to the Object path
+template<typename T, typename Cmp>
+struct ObjectCompare<T, Cmp, typename std::enable_if<ObjectIsNumberType<T>::value>::type> {
+	static Object exec(const Object& a, T b) {
+		if (a.details->typeIndex == Object::TYPE_NUMBER) {
+			return Object(Cmp::exec(static_cast<const Object_Details_Number*>(a.details.get())->value, (double)b));
+		}
+		return Cmp::call(a, Object(b));
+	}
+};
+
+//comparing an expression against a T
+//the expression is evaluated to an Object first, unless both sides are numbers
+template<typename E, typename T, typename Cmp, typename Enable = void>
+struct ObjectExprCompare {
+	static Object exec(const E& e, const T& b) { return ObjectCompare<T, Cmp>::exec(Object(e), b); }
+};
+
+template<typename E, typename T, typename Cmp>
+struct ObjectExprCompare<E, T, Cmp, typename std::enable_if<ObjectIsNumberType<T>::value>::type> {
+	static Object exec(const E& e, T b) {
+		double d;
+		if (e.number(d)) return Object(Cmp::exec(d, (double)b));
+		return ObjectCompare<T, Cmp>::exec(Object(e), b);
+	}
+};
+
+//operators shared by all expression nodes
+template<typename Derived>
+struct ObjectExprOps {
+	const Derived& derived() const { return static_cast<const Derived&>(*this); }
+
+	template<typename T> typename ObjectArith<Derived, T, ObjectOpAdd>::Type operator+(const T& o) const { return ObjectArith<Derived, T, ObjectOpAdd>::exec(derived(), o); }
+	template<typename T> typename ObjectArith<Derived, T, ObjectOpSub>::Type operator-(const T& o) const { return ObjectArith<Derived, T, ObjectOpSub>::exec(derived(), o); }
+	template<typename T> typename ObjectArith<Derived, T, ObjectOpMul>::Type operator*(const T& o) const { return ObjectArith<Derived, T, ObjectOpMul>::exec(derived(), o); }
+	template<typename T> typename ObjectArith<Derived, T, ObjectOpDiv>::Type operator/(const T& o) const { return ObjectArith<Derived, T, ObjectOpDiv>::exec(derived(), o); }
+	template<typename T> typename ObjectArith<Derived, T, ObjectOpMod>::Type operator%(const T& o) const { return ObjectArith<Derived, T, ObjectOpMod>::exec(derived(), o); }
+	template<typename T> typename ObjectArith<Derived, T, ObjectOpPow>::Type pow(const T& o) const { return ObjectArith<Derived, T, ObjectOpPow>::exec(derived(), o); }
+
+	ObjectUnmExpr<Derived> operator-() const { return ObjectUnmExpr<Derived>(derived()); }
+
+	template<typename T> typename std::enable_if<!ObjectIsNumberType<T>::value, Object>::type operator==(const T& o) const { return ObjectExprCompare<Derived, T, ObjectCmpEq>::exec(derived(), o); }
+	template<typename T> typename std::enable_if<!ObjectIsNumberType<T>::value, Object>::type operator!=(const T& o) const { return ObjectExprCompare<Derived, T, ObjectCmpNe>::exec(derived(), o); }
+	template<typename T> Object operator<(const T& o) const { return ObjectExprCompare<Derived, T, ObjectCmpLt>::exec(derived(), o); }
+	template<typename T> Object operator>(const T& o) const { return ObjectExprCompare<Derived, T, ObjectCmpGt>::exec(derived(), o); }
+	template<typename T> Object operator<=(const T& o) const { return ObjectExprCompare<Derived, T, ObjectCmpLe>::exec(derived(), o); }
+	template<typename T> Object operator>=(const T& o) const { return ObjectExprCompare<Derived, T, ObjectCmpGe>::exec(derived(), o); }
+
+	//everything else evaluates first
+	Object concat(const Object& o) const { return Object(*this).concat(o); }
+};
+
+template<typename A, typename B, typename Op>
+struct ObjectBinaryExpr : public ObjectExprOps<ObjectBinaryExpr<A, B, Op>> {
+	A a;
+	B b;
+
+	ObjectBinaryExpr(const A& a_, const B& b_) : a(a_), b(b_) {}
+
+	bool number(double& out) const {
+		double x, y;
+		if (!a.number(x) || !b.number(y)) return false;
+		out = Op::exec(x, y);
+		return true;
+	}
+
+	Object eval() const {
+		double d;
+		if (number(d)) return Object(d);
+		return Object::invokeNumberMetaBinary(a.eval(), b.eval(), Op::event(), Op::exec);
+	}
+};
+
+template<typename E>
+struct ObjectUnmExpr : public ObjectExprOps<ObjectUnmExpr<E>> {
+	E e;
+
+	ObjectUnmExpr(const E& e_) : e(e_) {}
+
+	bool number(double& out) const {
+		double x;
+		if (!e.number(x)) return false;
+		out = -x;
+		return true;
+	}
+
+	Object eval() const {
+		double d;
+		if (number(d)) return Object(d);
+		return Object::invokeNumberMetaUnary(e.eval(), "__unm");
+	}
+};
+
+template<typename Func>
+Object Object::invokeNumberMetaBinary(const Object& op1, const Object& op2, const char* event, Func func) {
+	double o1, o2;
+	if (op1.tonumber(o1) && op2.tonumber(o2)) return Object(func(o1, o2));
+	return invokeArithmeticHandler(op1, op2, event);
+}
+
+template<typename Derived>
+Object::Object(const ObjectExprOps<Derived>& e) {
+	double d;
+	if (e.derived().number(d)) {
+		details = std::make_shared<Object_Details_Number>(d);
+	} else {
+		details = e.derived().eval().details;
+	}
+}
+
+template<typename Derived>
+Object& Object::operator=(const ObjectExprOps<Derived>& e) {
+	double d;
+	if (e.derived().number(d)) {
+		//nobody else can see our number, so skip the allocation
+		if (details->typeIndex == TYPE_NUMBER && details.use_count() == 1 && !details->metatable) {
+			static_cast<Object_Details_Number*>(details.get())->value = d;
+		} else {
+			details = std::make_shared<Object_Details_Number>(d);
+		}
+	} else {
+		details = e.derived().eval().details;
+	}
+	return *this;
+}
+
+template<typename T> typename ObjectArith<Object, T, ObjectOpAdd>::Type Object::operator+(const T& o) const { return ObjectArith<Object, T, ObjectOpAdd>::exec(*this, o); }
+template<typename T> typename ObjectArith<Object, T, ObjectOpSub>::Type Object::operator-(const T& o) const { return ObjectArith<Object, T, ObjectOpSub>::exec(*this, o); }
+template<typename T> typename ObjectArith<Object, T, ObjectOpMul>::Type Object::operator*(const T& o) const { return ObjectArith<Object, T, ObjectOpMul>::exec(*this, o); }
+template<typename T> typename ObjectArith<Object, T, ObjectOpDiv>::Type Object::operator/(const T& o) const { return ObjectArith<Object, T, ObjectOpDiv>::exec(*this, o); }
+template<typename T> typename ObjectArith<Object, T, ObjectOpMod>::Type Object::operator%(const T& o) const { return ObjectArith<Object, T, ObjectOpMod>::exec(*this, o); }
+template<typename T> typename ObjectArith<Object, T, ObjectOpPow>::Type Object::pow(const T& o) const { return ObjectArith<Object, T, ObjectOpPow>::exec(*this, o); }
+
+inline ObjectUnmExpr<ObjectExprRef> Object::operator-() const { return ObjectUnmExpr<ObjectExprRef>(ObjectExprRef(*this)); }
+
+template<typename Derived>
+std::ostream& operator<<(std::ostream& o, const ObjectExprOps<Derived>& x) {
+	return o << Object(x);
+}
+
+/*
+operators with a C++ number on the left, as in 2*x or 1 < x
+these take the same paths as the Object-on-the-left operators, so the number isn't boxed
+*/
+
+#define CXXASLUA_LEFT_ARITH(op, Op)\
+template<typename T, typename std::enable_if<ObjectIsNumberType<T>::value>::type...>\
+typename ObjectArith<T, Object, Op>::Type operator op(const T& a, const Object& b) {\
+	return ObjectArith<T, Object, Op>::exec(a, b);\
+}\
+template<typename T, typename Derived, typename std::enable_if<ObjectIsNumberType<T>::value>::type...>\
+typename ObjectArith<T, Derived, Op>::Type operator op(const T& a, const ObjectExprOps<Derived>& b) {\
+	return ObjectArith<T, Derived, Op>::exec(a, b.derived());\
+}
+
+CXXASLUA_LEFT_ARITH(+, ObjectOpAdd)
+CXXASLUA_LEFT_ARITH(-, ObjectOpSub)
+CXXASLUA_LEFT_ARITH(*, ObjectOpMul)
+CXXASLUA_LEFT_ARITH(/, ObjectOpDiv)
+CXXASLUA_LEFT_ARITH(%, ObjectOpMod)
+#undef CXXASLUA_LEFT_ARITH
+
+//a < b is evaluated as b > a, and so on
+#define CXXASLUA_LEFT_COMPARE(op, Cmp)\
+template<typename T, typename std::enable_if<ObjectIsNumberType<T>::value>::type...>\
+Object operator op(T a, const Object& b) {\
+	return ObjectCompare<T, Cmp>::exec(b, a);\
+}\
+template<typename T, typename Derived, typename std::enable_if<ObjectIsNumberType<T>::value>::type...>\
+Object operator op(T a, const ObjectExprOps<Derived>& b) {\
+	return ObjectExprCompare<Derived, T, Cmp>::exec(b.derived(), a);\
+}
+
+CXXASLUA_LEFT_COMPARE(==, ObjectCmpEq)
+CXXASLUA_LEFT_COMPARE(!=, ObjectCmpNe)
+CXXASLUA_LEFT_COMPARE(<, ObjectCmpGt)
+CXXASLUA_LEFT_COMPARE(>, ObjectCmpLt)
+CXXASLUA_LEFT_COMPARE(<=, ObjectCmpGe)
+CXXASLUA_LEFT_COMPARE(>=, ObjectCmpLe)
+#undef CXXASLUA_LEFT_COMPARE
+
+/*
+== and != against a C++ number on the right are free functions too, mirroring the ones above
+C++20 also tries 1 == x reversed for x == 1 and x != 1, and prefers it over a member template
+these are picked instead, as the non-rewritten candidate, since neither is more specialized
+*/
+#define CXXASLUA_RIGHT_COMPARE(op, Cmp)\
+template<typename T, typename std::enable_if<ObjectIsNumberType<T>::value>::type...>\
+Object operator op(const Object& a, T b) {\
+	return ObjectCompare<T, Cmp>::exec(a, b);\
+}\
+template<typename T, typename Derived, typename std::enable_if<ObjectIsNumberType<T>::value>::type...>\
+Object operator op(const ObjectExprOps<Derived>& a, T b) {\
+	return ObjectExprCompare<Derived, T, Cmp>::exec(a.derived(), b);\
+}
+
+CXXASLUA_RIGHT_COMPARE(==, ObjectCmpEq)
+CXXASLUA_RIGHT_COMPARE(!=, ObjectCmpNe)
+#undef CXXASLUA_RIGHT_COMPARE
+
+//one side of a concatenation
+//append() adds it to the string if it is a string or number, box() is for the __concat fallback
+template<typename T, typename Enable = void>
+struct ObjectConcatPiece;
+
+template<typename T>
+struct ObjectConcatPiece<T, typename std::enable_if<std::is_base_of<Object, T>::value>::type> {
+	static bool append(std::string& s, const Object& o) {
+		switch (o.details->typeIndex) {
+		case Object::TYPE_STRING:
+			s += static_cast<const Object_Details_String*>(o.details.get())->value;
+			return true;
+		case Object::TYPE_NUMBER: {
+			char buf[Object_Details_Number::formatSize];
+			s.append(buf, Object_Details_Number::format(static_cast<const Object_Details_Number*>(o.details.get())->value, buf));
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+	static const Object& box(const Object& o) { return o; }
+};
+
+template<typename T>
+struct ObjectConcatPiece<T, typename std::enable_if<
+	std::is_same<typename std::decay<T>::type, std::string>::value
+	|| std::is_same<typename std::decay<T>::type, const char*>::value
+	|| std::is_same<typename std::decay<T>::type, char*>::value
+>::type> {
+	static bool append(std::string& s, const T& t) { s += t; return true; }
+	static Object box(const T& t) { return Object(t); }
+};
+
+template<typename T>
+struct ObjectConcatPiece<T, typename std::enable_if<ObjectIsNumberType<T>::value>::type> {
+	static bool append(std::string& s, T t) {
+		char buf[Object_Details_Number::formatSize];
+		s.append(buf, Object_Details_Number::format((double)t, buf));
+		return true;
+	}
+	static Object box(T t) { return Object(t); }
+};
+
+//anything else goes through an Object
+template<typename T, typename Enable>
+struct ObjectConcatPiece {
+	static bool append(std::string& s, const T& t) { return ObjectConcatPiece<Object>::append(s, Object(t)); }
+	static Object box(const T& t) { return Object(t); }
+};
+
+//Lua's a .. b, for any mix of Objects, C++ strings and C++ numbers
+template<typename A, typename B>
+Object concat(const A& a, const B& b) {
+	std::string s;
+	if (ObjectConcatPiece<A>::append(s, a) && ObjectConcatPiece<B>::append(s, b)) {
+		return Object(std::make_shared<Object_Details_String>(std::move(s)));
+	}
+	return Object::invokeConcatHandler(ObjectConcatPiece<A>::box(a), ObjectConcatPiece<B>::box(b));
+}
+
+template<typename T> Object Object::concat(const T& o) const { return CxxAsLua::concat(*this, o); }
+
 
 template<typename ObjectType> struct InObjectTypeMap;
 template<> struct InObjectTypeMap<Object> { typedef Object Type; };
@@ -495,8 +1069,16 @@ struct VarArgType {
 	typedef ReturnEmptyMap<ObjectType> ReturnEmpty;
 	typedef InitializerListOptionMap<ObjectType> InitializerListOption;
 
+	//number of arguments/results stored without a heap allocation
+	enum { INLINE_SIZE = 6 };
+	typedef SmallVector<ObjectType, INLINE_SIZE> Objects;
+
 public:
-	std::vector<ObjectType> objects;
+	Objects objects;
+
+	//set by tailcall(): objects[0] is the function to call next, the rest are its arguments
+	//Object::call keeps calling these in a loop instead of growing the stack
+	bool tailcall = false;
 
 public:
 
@@ -505,11 +1087,11 @@ public:
 
 	VarArgType(const VarArg& o);
 	VarArgType(const VarArgRef& o);
-	
-	//gives the "use of deleted function" bug(?) in gcc
-	//VarArgType(const VarArgType&& x);
+	VarArgType(VarArgType&& x) : objects(std::move(x.objects)), tailcall(x.tailcall) {}
 
-	VarArgType operator,(InObjectType o);
+	//appending to a temporary (as in (a, b, c)) reuses its storage
+	VarArgType operator,(InObjectType o) const &;
+	VarArgType operator,(InObjectType o) &&;
 
 	template<typename... Args>
 	std::tuple<Args...> toTuple() const;
@@ -568,8 +1150,8 @@ void VarArgAssignOperator<ObjectType, OtherObjectType>::exec(
 	//...only if necessary		
 	VarArgBufferSource<OtherObjectType> buffer(srcVarArg);
 
-	typename std::vector<Object>::const_iterator src = buffer.src.objects.begin();
-	typename std::vector<ObjectType>::iterator dst = dstVarArg.objects.begin();
+	typename VarArg::Objects::const_iterator src = buffer.src.objects.begin();
+	typename VarArgType<ObjectType>::Objects::iterator dst = dstVarArg.objects.begin();
 	for (; src != buffer.src.objects.end() && dst != dstVarArg.objects.end(); ++src, ++dst) {
 		ObjectGetRef<ObjectType>::get(*dst) = *src;			
 	}
@@ -589,15 +1171,30 @@ struct RecursiveTupleToVarArg<size, size, Args...> {
 	static void exec(const std::tuple<Args...>&, VarArg&) {}
 };
 
+//append each argument to a VarArg, converting as it goes
+template<typename... Args>
+struct VarArgAppend;
+
+template<>
+struct VarArgAppend<> {
+	template<typename ObjectType>
+	static void exec(VarArgType<ObjectType>& dest) {}
+};
+
+template<typename T, typename... Args>
+struct VarArgAppend<T, Args...> {
+	template<typename ObjectType>
+	static void exec(VarArgType<ObjectType>& dest, const T& t, const Args&... args) {
+		dest.objects.emplace_back(t);
+		VarArgAppend<Args...>::exec(dest, args...);
+	}
+};
+
 template<typename ObjectType, typename... Args>
 struct VarArgTypeConstructor {
 	static void exec(VarArgType<ObjectType>& dest, Args... args) {
-		std::tuple<Args...> t(args...);
-		RecursiveTupleToVarArg<
-			0,
-			std::tuple_size<std::tuple<Args...>>::value,
-			Args...
-		>::exec(t, dest);
+		dest.objects.reserve(sizeof...(Args));
+		VarArgAppend<Args...>::exec(dest, args...);
 	}
 };
 
@@ -630,11 +1227,12 @@ VarArgType<ObjectType>::VarArgType(Args... args) {
 
 template<>
 inline VarArgType<Object>::VarArgType(const VarArgType<Object>& x)
-: objects(x.objects) {}
+: objects(x.objects), tailcall(x.tailcall) {}
 
 template<>
 inline VarArgType<Object>::VarArgType(const VarArgType<std::reference_wrapper<Object>>& x)
 {
+	objects.reserve(x.objects.size());
 	for (const std::reference_wrapper<Object>& o : x.objects) objects.push_back(o.get());
 }
 
@@ -659,12 +1257,18 @@ VarArgType<ObjectType>::VarArgType(const VarArgType&& x)
 */
 
 template<typename ObjectType>
-VarArgType<ObjectType> VarArgType<ObjectType>::operator,(InObjectType o) {
+VarArgType<ObjectType> VarArgType<ObjectType>::operator,(InObjectType o) const & {
 	VarArgType result(*this);
 	result.objects.push_back(o);
 	return result;
 }
 
+template<typename ObjectType>
+VarArgType<ObjectType> VarArgType<ObjectType>::operator,(InObjectType o) && {
+	objects.push_back(o);
+	return std::move(*this);
+}
+
 template<typename ObjectType>
 typename VarArgType<ObjectType>::InObjectType VarArgType<ObjectType>::get() const {
 	
@@ -822,66 +1426,205 @@ template<int ...> struct seq {};
 template<int N, int ...S> struct gens : gens<N-1, N-1, S...> {};
 template<int ...S> struct gens<0, S...>{ typedef seq<S...> type; };
 
-template<typename Callable, typename ReturnType, typename... Args>
-struct DelayDispatch {
-public://protected:
-	Callable func;
-	std::tuple<Args...> params;
+//Callable storage: inline if it fits, otherwise on the heap
+template<typename T, bool fitsInline, bool isTrivial>
+struct CallableStorage;
 
-public:
-	DelayDispatch(
-		Callable func_,
-		const std::tuple<Args...>&& params_)
-	: func(func_), params(params_) {}
+//trivially-copyable and small enough: memcpy'd around, no manager needed
+template<typename T>
+struct CallableStorage<T, true, true> {
+	static void construct(Callable& c, const T& t) {
+		new(c.storage.buffer) T(t);
+		c.manage = nullptr;
+	}
+	static const T& get(const Callable& c) { return *reinterpret_cast<const T*>(c.storage.buffer); }
+};
 
-	ReturnType delayed_dispatch() const {
-		return callFunc(typename gens<sizeof...(Args)>::type());
+template<typename T>
+struct CallableStorage<T, true, false> {
+	static void construct(Callable& c, const T& t) {
+		new(c.storage.buffer) T(t);
+		c.manage = manage;
 	}
+	static const T& get(const Callable& c) { return *reinterpret_cast<const T*>(c.storage.buffer); }
+	static void manage(Callable::ManageOp op, Callable& dst, Callable* src) {
+		switch (op) {
+		case Callable::MANAGE_COPY:
+			new(dst.storage.buffer) T(get(*src));
+			break;
+		case Callable::MANAGE_MOVE:
+			new(dst.storage.buffer) T(std::move(*reinterpret_cast<T*>(src->storage.buffer)));
+			reinterpret_cast<T*>(src->storage.buffer)->~T();
+			break;
+		case Callable::MANAGE_DESTROY:
+			reinterpret_cast<T*>(dst.storage.buffer)->~T();
+			break;
+		}
+	}
+};
 
-protected:
-	template<int... S>
-	ReturnType callFunc(seq<S...>) const {
-		return func(std::get<S>(params)...);
+template<typename T, bool isTrivial>
+struct CallableStorage<T, false, isTrivial> {
+	static void construct(Callable& c, const T& t) {
+		c.storage.heap = new T(t);
+		c.manage = manage;
+	}
+	static const T& get(const Callable& c) { return *static_cast<const T*>(c.storage.heap); }
+	static void manage(Callable::ManageOp op, Callable& dst, Callable* src) {
+		switch (op) {
+		case Callable::MANAGE_COPY:
+			dst.storage.heap = new T(get(*src));
+			break;
+		case Callable::MANAGE_MOVE:
+			dst.storage.heap = src->storage.heap;
+			src->storage.heap = nullptr;
+			break;
+		case Callable::MANAGE_DESTROY:
+			delete static_cast<T*>(dst.storage.heap);
+			break;
+		}
 	}
 };
 
-template<typename Callable, typename ReturnType>
-struct VarArgForReturnOfDelayedDispatch {
-	template<typename... Args>
-	static VarArg exec(const DelayDispatch<Callable, ReturnType, Args...>& save) {
-		return VarArg(save.delayed_dispatch()); 
+template<typename T>
+struct CallableStorageFor {
+	typedef CallableStorage<
+		T,
+		sizeof(T) <= Callable::BUFFER_SIZE
+			&& alignof(std::max_align_t) % alignof(T) == 0
+			&& std::is_nothrow_move_constructible<T>::value,
+		std::is_trivially_copyable<T>::value
+	> Type;
+};
+
+template<typename T>
+Callable Callable::create(const T& t, Invoke invoke_) {
+	Callable c;
+	CallableStorageFor<T>::Type::construct(c, t);
+	c.invoke = invoke_;
+	return c;
+}
+
+template<typename T>
+const T& Callable::target() const {
+	return CallableStorageFor<T>::Type::get(*this);
+}
+
+//converting an argument to the C++ parameter type of the function being called
+//by default use Object's cast operators
+template<typename T, typename Enable = void>
+struct ArgCast {
+	static T exec(const Object& o) { return (T)o; }
+};
+
+//Object parameters are passed straight through
+template<>
+struct ArgCast<Object> {
+	static const Object& exec(const Object& o) { return o; }
+};
+
+template<>
+struct ArgCast<bool> {
+	static bool exec(const Object& o) {
+		switch (o.details->typeIndex) {
+		case Object::TYPE_NIL: return false;
+		case Object::TYPE_BOOLEAN: return static_cast<const Object_Details_Boolean*>(o.details.get())->value;
+		default: return o.details->to_boolean();
+		}
+	}
+};
+
+//numeric parameters read the number directly when the type tag matches
+template<typename T>
+struct ArgCast<T, typename std::enable_if<ObjectIsNumberType<T>::value>::type> {
+	static T exec(const Object& o) {
+		if (o.details->typeIndex == Object::TYPE_NUMBER) {
+			return (T)static_cast<const Object_Details_Number*>(o.details.get())->value;
+		}
+		return (T)o;
+	}
+};
+
+template<>
+struct ArgCast<std::string> {
+	static std::string exec(const Object& o) {
+		if (o.details->typeIndex == Object::TYPE_STRING) {
+			return static_cast<const Object_Details_String*>(o.details.get())->value;
+		}
+		return (std::string)o;
+	}
+};
+
+//storing the return value of a function in the results
+template<typename ReturnType>
+struct CallableReturn {
+	template<typename T, typename... Args>
+	static void exec(VarArg& results, const T& t, Args&&... args) {
+		results.objects.emplace_back(t(std::forward<Args>(args)...));
 	}
 };
 
-//specialization for converting *->VarArg
 //if the return type is VarArg then don't wrap it in another VarArg
-template<typename Callable>
-struct VarArgForReturnOfDelayedDispatch<Callable, VarArg> {
-	template<typename... Args>
-	static VarArg exec(const DelayDispatch<Callable, VarArg, Args...>& save) {
-		return save.delayed_dispatch();
+template<>
+struct CallableReturn<VarArg> {
+	template<typename T, typename... Args>
+	static void exec(VarArg& results, const T& t, Args&&... args) {
+		//not operator=, that one assigns element-wise
+		VarArg returned = t(std::forward<Args>(args)...);
+		results.objects = std::move(returned.objects);
+		results.tailcall = returned.tailcall;
 	}
 };
 
 //if the return type is void then return an empty VarArg
-template<typename Callable>
-struct VarArgForReturnOfDelayedDispatch<Callable, void> {
-	template<typename... Args>
-	static VarArg exec(const DelayDispatch<Callable, void, Args...>& save) {
-		save.delayed_dispatch(); 
-		return VarArg();
+template<>
+struct CallableReturn<void> {
+	template<typename T, typename... Args>
+	static void exec(VarArg& results, const T& t, Args&&... args) {
+		t(std::forward<Args>(args)...);
 	}
 };
 
+//generated per signature: reads each argument out of the VarArg by index and calls 't' directly
+template<typename T, typename ReturnType, typename... Args>
+struct CallableThunk {
+	static void exec(const Callable& self, const VarArg& args, VarArg& results) {
+		call(self.target<T>(), args, results, typename gens<sizeof...(Args)>::type());
+	}
+
+	template<int... S>
+	static void call(const T& t, const VarArg& args, VarArg& results, seq<S...>) {
+		//missing arguments are nil
+		CallableReturn<ReturnType>::exec(results, t,
+			ArgCast<typename std::decay<Args>::type>::exec(
+				(size_t)S < args.objects.size() ? args.objects[S] : nil)...);
+	}
+};
+
+//specialization for VarArg->* functions: the whole argument list is passed as-is
+template<typename T, typename ReturnType>
+struct CallableThunk<T, ReturnType, VarArg> {
+	static void exec(const Callable& self, const VarArg& args, VarArg& results) {
+		CallableReturn<ReturnType>::exec(results, self.target<T>(), args);
+	}
+};
+
+template<typename T, typename ReturnType>
+struct CallableThunk<T, ReturnType, const VarArg&> {
+	static void exec(const Callable& self, const VarArg& args, VarArg& results) {
+		CallableReturn<ReturnType>::exec(results, self.target<T>(), args);
+	}
+};
+
+//the callable is stored as-is inside the Object_Details_Function's Callable, no wrapping lambda
 template<typename T, typename ReturnType, typename... Args>
 struct AssignCallable {
+	static_assert(!ObjectIsExpr<ReturnType>::value,
+		"this function returns an arithmetic expression, which references locals that are gone once it returns: give it an Object return type (->Object)");
+
 	static void exec(Object& o, const T& t) {
 		o.details = std::make_shared<Object_Details_Function>(
-			[t](VarArg args)->VarArg{
-				DelayDispatch<T, ReturnType, Args...> save(t, args.toTuple<Args...>());
-				return VarArgForReturnOfDelayedDispatch<T, ReturnType>::template exec<Args...>(save);
-			}
-		);
+			Callable::create(t, CallableThunk<T, ReturnType, Args...>::exec));
 	}
 };
 
@@ -916,9 +1659,7 @@ Object::operator std::function<void(Args...)>() {
 template<typename T, typename F>
 struct AssignCallableToObject;
 
-//notice that,
-//because this entire process is deferred,
-//it is making a copy of T (as it is passed to DelayDispatch)
+//notice that T is copied once, into the Callable's storage
 template<typename T, typename ReturnType, typename... Args>
 struct AssignCallableToObject<T, ReturnType (T::*)(Args...) const> {
 	static void exec(Object& o, const T& t) {
@@ -969,8 +1710,8 @@ struct Access {
 	//...hmm...
 	template<typename... Args>
 	VarArg operator()(Args... args) {
-		std::tuple<Args...> t(args...);
-		VarArg vargs = tupleToVarArg<Args...>(t);
+		VarArg vargs;
+		VarArgAppend<Args...>::exec(vargs, args...);
 		return get().call(vargs);
 	}
 
@@ -995,11 +1736,9 @@ template<typename T> Object Access::operator%(const T& t) const { return get() %
 
 template<typename... Args>
 VarArg Object::operator()(Args... args) const {
-	return const_cast<Object*>(this)->call(
-		tupleToVarArg<Args...>(
-			std::tuple<Args...>(args...)
-		)
-	);
+	VarArg vargs;
+	VarArgAppend<Args...>::exec(vargs, args...);
+	return const_cast<Object*>(this)->call(vargs);
 }
 
 template<>
@@ -1007,100 +1746,12 @@ inline VarArg Object::operator()(VarArg args) const {
 	return const_cast<Object*>(this)->call(args);
 }
 
-template<typename T> Object Object::operator+(const T& o) const { return invokeNumberMetaBinary(*this, o, "__add", std::plus<double>()); }
-template<typename T> Object Object::operator-(const T& o) const { return invokeNumberMetaBinary(*this, o, "__sub", std::minus<double>()); }
-template<typename T> Object Object::operator*(const T& o) const { return invokeNumberMetaBinary(*this, o, "__mul", std::multiplies<double>()); }
-template<typename T> Object Object::operator/(const T& o) const { return invokeNumberMetaBinary(*this, o, "__div", std::divides<double>()); }
-template<typename T> Object Object::operator%(const T& o) const { return invokeNumberMetaBinary(*this, o, "__mod", lmod); }
-template<typename T> Object Object::pow(const T& o) const { return invokeNumberMetaBinary(*this, o, "__pow", ::pow); }
-
-template<typename T>
-Object Object::operator==(const T& o) const {
-	const Object& op1 = *this;
-	Object op2 = Object(o);
-	if (op1.getTypeIndex() != op2.getTypeIndex()) return false;
-	if (op1.details.get() == op2.details.get()) return true;	//compare pointers, used for tables and functions ... and any other primitive
-	if (!(is_table() || is_function())) {	//otherwise use built-in primitive compare
-		return Object(details->compare(op2));
-	}
-	//by here it's a table (or function) and isn't identical, so fall back on metamethods
-	Object h = getCompareHandler(op1, op2, "__eq");
-	if (h) {
-		return h(op1, op2);
-	} else {
-		return false;
-	}
-}
-
-template<typename T>
-Object Object::operator!=(const T& o) const {
-	return Object(!operator==(o));
-}
-
-template<typename T>
-Object Object::operator<(const T& o) const { 
-	const Object& op1 = *this;
-	Object op2(o);
-
-	int ai = op1.getTypeIndex();
-	int bi = op2.getTypeIndex();
-
-	if (ai == bi) {
-		switch (ai) {
-		case TYPE_NUMBER:
-			return Object(op1.details->to_number() < op2.details->to_number());
-		case TYPE_STRING:
-			return Object(op1.details->to_string() < op2.details->to_string());
-		}
-	}
-
-	Object h = getCompareHandler(op1, op2, "__lt");
-	if (h) {
-		return h(op1, op2);
-	} else {
-		throw std::bad_cast();
-	}
-}
-
-template<typename T>
-Object Object::operator>(const T& o) const {
-	return Object(o) < *this;
-}
-
-template<typename T>
-Object Object::operator<=(const T& o) const {
-	const Object& op1 = *this;
-	Object op2(o);
-
-	int ai = op1.getTypeIndex();
-	int bi = op2.getTypeIndex();
-
-	if (ai == bi) {
-		switch (ai) {
-		case TYPE_NUMBER:
-			return Object(op1.details->to_number() <= op2.details->to_number());
-		case TYPE_STRING:
-			return Object(op1.details->to_string() <= op2.details->to_string());
-		}
-	}
-
-	Object h = getCompareHandler(op1, op2, "__le");
-	if (h) {
-		return h(op1, op2);
-	} else {
-		h = getCompareHandler(op1, op2, "__lt");
-		if (h) {
-			return !(Object)h(op2, op1);
-		} else {
-			throw std::bad_cast();
-		}
-	}
-}
-
-template<typename T>
-Object Object::operator>=(const T& o) const {
-	return Object(o) <= *this;
-}
+template<typename T> typename std::enable_if<!ObjectIsNumberType<T>::value, Object>::type Object::operator==(const T& o) const { return ObjectCompare<T, ObjectCmpEq>::exec(*this, o); }
+template<typename T> typename std::enable_if<!ObjectIsNumberType<T>::value, Object>::type Object::operator!=(const T& o) const { return ObjectCompare<T, ObjectCmpNe>::exec(*this, o); }
+template<typename T> Object Object::operator<(const T& o) const { return ObjectCompare<T, ObjectCmpLt>::exec(*this, o); }
+template<typename T> Object Object::operator>(const T& o) const { return ObjectCompare<T, ObjectCmpGt>::exec(*this, o); }
+template<typename T> Object Object::operator<=(const T& o) const { return ObjectCompare<T, ObjectCmpLe>::exec(*this, o); }
+template<typename T> Object Object::operator>=(const T& o) const { return ObjectCompare<T, ObjectCmpGe>::exec(*this, o); }
 
 //logical
 template<typename T> const Object& Object::operator&&(const T& o) const { if (!details->to_boolean()) return *this; return o; }
@@ -1116,11 +1767,12 @@ template<typename T> Object Object::operator~() const { return Object(~(Int)deta
 template<typename T> Object Object::operator^(const T& o) const { return Object((Int)details->to_number() ^ (Int)Object(o).details->to_number()); }
 template<typename T> Object Object::operator<<(const T& o) const { return Object((Int)details->to_number() << (Int)Object(o).details->to_number()); }
 template<typename T> Object Object::operator>>(const T& o) const { return Object((Int)details->to_number() >> (Int)Object(o).details->to_number()); }
-template<typename T> Object& Object::operator+=(const T& o) { details = std::make_shared<Object_Details_Number>(details->to_number() + Object(o).details->to_number()); return *this; }
-template<typename T> Object& Object::operator-=(const T& o) { details = std::make_shared<Object_Details_Number>(details->to_number() - Object(o).details->to_number()); return *this; }
-template<typename T> Object& Object::operator*=(const T& o) { details = std::make_shared<Object_Details_Number>(details->to_number() * Object(o).details->to_number()); return *this; }
-template<typename T> Object& Object::operator/=(const T& o) { details = std::make_shared<Object_Details_Number>(details->to_number() / Object(o).details->to_number()); return *this; }
-template<typename T> Object& Object::operator%=(const T& o) { details = std::make_shared<Object_Details_Number>(lmod(details->to_number(), Object(o).details->to_number())); return *this; }
+//arithmetic assignment goes through the expression templates, so n += 1 updates n's number in place when it can
+template<typename T> Object& Object::operator+=(const T& o) { return *this = *this + o; }
+template<typename T> Object& Object::operator-=(const T& o) { return *this = *this - o; }
+template<typename T> Object& Object::operator*=(const T& o) { return *this = *this * o; }
+template<typename T> Object& Object::operator/=(const T& o) { return *this = *this / o; }
+template<typename T> Object& Object::operator%=(const T& o) { return *this = *this % o; }
 template<typename T> Object& Object::operator>>=(const T& o) { details = std::make_shared<Object_Details_Number>((Int)details->to_number() >> (Int)Object(o).details->to_number()); return *this; }
 template<typename T> Object& Object::operator<<=(const T& o) { details = std::make_shared<Object_Details_Number>((Int)details->to_number() << (Int)Object(o).details->to_number()); return *this; }
 template<typename T> Object& Object::operator&=(const T& o) { details = std::make_shared<Object_Details_Number>((Int)details->to_number() & (Int)Object(o).details->to_number()); return *this; }
@@ -1131,6 +1783,64 @@ Object tostring(Object o);
 
 Object type(Object o);
 
+/*
+standard output, for print and io.write
+written straight into C stdio's stdout buffer, so it stays in order with std::cout and printf
+it's flushed when the buffer fills, by io.flush(), or at exit
+*/
+void writeOutput(const char* s, size_t n);
+void writeOutput(const std::string& s);
+void writeOutput(double d);
+void writeOutput(const Object& o);
+void flushOutput();
+
+/*
+gives stdout a large buffer, for programs that print a lot
+the library never changes stdio by itself, so call this first thing in main, before anything is written
+terminals stay line-buffered so prompts and progress still show up as they're printed
+returns false if stdio refused
+*/
+bool bufferOutput(size_t size = 1 << 16);
+
+//how print writes each kind of C++ value
+template<typename T, typename Enable = void>
+struct ObjectOutputPiece {
+	static void exec(const T& t) {
+		std::ostringstream ss;
+		ss << t;
+		writeOutput(ss.str());
+	}
+};
+
+template<typename T>
+struct ObjectOutputPiece<T, typename std::enable_if<std::is_base_of<Object, T>::value>::type> {
+	static void exec(const Object& o) { writeOutput(o); }
+};
+
+template<typename T>
+struct ObjectOutputPiece<T, typename std::enable_if<
+	std::is_same<typename std::decay<T>::type, std::string>::value
+	|| std::is_same<typename std::decay<T>::type, const char*>::value
+	|| std::is_same<typename std::decay<T>::type, char*>::value
+>::type> {
+	static void exec(const std::string& s) { writeOutput(s); }
+	static void exec(const char* s) { writeOutput(s, strlen(s)); }
+};
+
+template<typename T>
+struct ObjectOutputPiece<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+	static void exec(T t) { writeOutput((double)t); }
+};
+
+//integers are written in full, as std::cout would
+template<typename T>
+struct ObjectOutputPiece<T, typename std::enable_if<ObjectIsNumberType<T>::value && std::is_integral<T>::value>::type> {
+	static void exec(T t) {
+		std::string s = std::is_signed<T>::value ? std::to_string((long long)t) : std::to_string((unsigned long long)t);
+		writeOutput(s);
+	}
+};
+
 //hmm... it'd be nice if there was a convenient vector wrapper (operator, => VarArg)
 // that would also cast correctly between C++ primitives and Objects ...
 #if 1
@@ -1142,46 +1852,102 @@ inline void printnext() {}
 
 template<typename T, typename ...Args>
 void printnext(const T& o, Args... args) {
-	std::cout << "\t" << o;
+	writeOutput("\t", 1);
+	ObjectOutputPiece<T>::exec(o);
 	printnext(args...);
 }
 
+//like Lua's print: tab-separated, newline-terminated
+//lines aren't flushed individually, see writeOutput
 template<typename... Args>
 void print(Args... args);
 
 template<>
 inline void print() {
-	std::cout << std::endl;
+	writeOutput("\n", 1);
 }
 
 template<typename T>
 void print(const T& o) {
-	std::cout << o;
-	std::cout << std::endl;
+	ObjectOutputPiece<T>::exec(o);
+	writeOutput("\n", 1);
 }
 
 template<typename T, typename... Args>
 void print(const T& o, Args&&... args) {
-	std::cout << o;
+	ObjectOutputPiece<T>::exec(o);
 	printnext(std::forward<Args>(args)...);
-	std::cout << std::endl;
+	writeOutput("\n", 1);
 }
 
 template<>
 #endif
 inline void print(const VarArg& args) {
-	std::string sep = "";
+	const char* sep = "";
 	for (const Object& o : args.objects) {
-		std::cout << sep;
-		std::cout << o;
+		writeOutput(sep, strlen(sep));
+		writeOutput(o);
 		sep = "\t";
 	}
-	std::cout << std::endl;
+	writeOutput("\n", 1);
+}
+
+/*
+return tailcall(f, args...) from a function instead of return f(args...)
+and the call is made after the current function has returned, by Object::call's loop
+so tail-recursive functions run in constant stack space, like Lua's proper tail calls
+only meaningful as the return value of a function returning VarArg
+*/
+template<typename... Args>
+VarArg tailcall(const Object& f, Args... args) {
+	VarArg results;
+	results.objects.reserve(1 + sizeof...(Args));
+	results.objects.push_back(f);
+	VarArgAppend<Args...>::exec(results, args...);
+	results.tailcall = true;
+	return results;
 }
 
 Object getmetatable(Object x);
+//x must be a table or userdata: other values can share their details, so they can't have a metatable of their own
 Object setmetatable(Object x, Object m);
 
+/*
+an error whose value is any Object, as Lua's error() raises, so it can carry a table of details rather than a message
+what() makes a message only when one is asked for, so code that just catches the value never formats a string
+*/
+struct Error : public std::exception {
+	Object value;
+
+	explicit Error(const Object& value_) : value(value_) {}
+	const char* what() const noexcept override;
+
+protected:
+	mutable std::string message;
+};
+
+//raises 'value' as an Error
+[[noreturn]] void error(const Object& value);
+
+/*
+calls f, returning true and its results, or false and the error: an Error's value, or another exception's message
+nothing is added to the call itself, so it costs the same as f(args...) until something is thrown
+*/
+VarArg pcall(const Object& f, const VarArg& args);
+
+template<typename... Args>
+VarArg pcall(const Object& f, Args... args) {
+	return pcall(f, VarArg(args...));
+}
+
+//the same, except an error is passed to 'handler', and what it returns follows false
+VarArg xpcall(const Object& f, const Object& handler, const VarArg& args);
+
+template<typename... Args>
+VarArg xpcall(const Object& f, const Object& handler, Args... args) {
+	return xpcall(f, handler, VarArg(args...));
+}
+
 typedef Object local;
 
 /*
@@ -1223,25 +1989,177 @@ considerations:
 
 pass-by-reference crashes if an inner function references an object -- because the function fizzles
 pass-by-equality might work, but it messes with any previous object scope assignment
+closure() and upvalue below do both: capture by value, and share what's declared as an upvalue
 
 returning implicit (no ->) causes the compiler to struggle when matching
 returning Object casts all things correctly, but prevents multiple return
 */
 #define function(args...) [&](function_args(args))->VarArg 
 
+/*
+closure(args...) is function(args...) capturing by value, so it can outlive the scope it was made in
+locals are copied in when it's made, and upvalues (below) are shared with everything else that has them
+*/
+#define closure(args...) [=](function_args(args))->VarArg
+
+/*
+a local that closures share, as Lua's upvalues are
+its value lives in a cell on the heap: copies of an Upvalue are the same variable, which lasts as long as any of them
+	upvalue n = 0;
+	local counter = closure() { n = n + 1; return n; };
+a closure kept in an upvalue it uses itself, as recursive ones are, stays alive until that upvalue is cleared
+*/
+struct Upvalue {
+	std::shared_ptr<Object> cell;
+
+	Upvalue() : cell(std::make_shared<Object>()) {}
+	Upvalue(const Upvalue& x) : cell(x.cell) {}
+	template<typename T> Upvalue(const T& value) : cell(std::make_shared<Object>(value)) {}
+
+	//assigning sets the variable, for every copy, so it works on the const copies closures capture
+	const Upvalue& operator=(const Upvalue& x) const { *cell = *x.cell; return *this; }
+	template<typename T> const Upvalue& operator=(const T& value) const { *cell = value; return *this; }
+
+	Object& get() const { return *cell; }
+	operator Object&() const { return *cell; }
+	Object& operator*() const { return *cell; }
+	Object* operator->() const { return cell.get(); }
+	explicit operator bool() const { return (bool)*cell; }
+
+	template<typename T> auto operator+(const T& t) const -> decltype(std::declval<const Object&>() + t) { return get() + t; }
+	template<typename T> auto operator-(const T& t) const -> decltype(std::declval<const Object&>() - t) { return get() - t; }
+	template<typename T> auto operator*(const T& t) const -> decltype(std::declval<const Object&>() * t) { return get() * t; }
+	template<typename T> auto operator/(const T& t) const -> decltype(std::declval<const Object&>() / t) { return get() / t; }
+	template<typename T> auto operator%(const T& t) const -> decltype(std::declval<const Object&>() % t) { return get() % t; }
+	ObjectUnmExpr<ObjectExprRef> operator-() const { return -get(); }
+
+	template<typename T> Object operator==(const T& t) const { return get() == t; }
+	template<typename T> Object operator!=(const T& t) const { return get() != t; }
+	template<typename T> Object operator<(const T& t) const { return get() < t; }
+	template<typename T> Object operator>(const T& t) const { return get() > t; }
+	template<typename T> Object operator<=(const T& t) const { return get() <= t; }
+	template<typename T> Object operator>=(const T& t) const { return get() >= t; }
+
+	template<typename T> Object concat(const T& t) const { return get().concat(t); }
 
-//custom classes for exposing table members as C++ members...
-struct Math : public Object {
-	Access abs, acos, asin, atan, atan2, ceil, cos, cosh, deg, exp, floor, fmod,
-		frexp, huge, ldexp, log, log10, max, min, mod, modf, pi, pow, rad,
-		random, randomseed, sin, sinh, sqrt, tan, tanh;
-	Math();
+	template<typename... Args>
+	VarArg operator()(Args... args) const {
+		VarArg vargs;
+		VarArgAppend<Args...>::exec(vargs, args...);
+		return get().call(vargs);
+	}
+
+	Access operator[](Object key) const { return get()[key]; }
+	Access operator[](const char* key) const { return get()[key]; }
+};
+
+typedef Upvalue upvalue;
+
+//upvalues in arithmetic are read where they live, like Objects
+template<>
+struct ObjectExprLeaf<Upvalue, void> {
+	typedef ObjectExprRef Type;
+	static Type make(const Upvalue& t) { return Type(*t.cell); }
+};
+
+
+/*
+a library's table (math, io ...), made the first time it's used rather than by a global constructor
+so programs only pay for the libraries they touch
+it stands in for the table's Object: it converts to one, and can be indexed like one
+*/
+struct Library {
+	constexpr Library(Object (*make_)()) : make(make_), table(nullptr) {}
+
+	const Object& get() const {
+		Object* t = table.load(std::memory_order_acquire);
+		return t ? *t : load();
+	}
+	operator const Object&() const { return get(); }
+
+	Access operator[](Object key) const;
+	Access operator[](const char* key) const;
+
+protected:
+	Object (*make)();
+	mutable std::atomic<Object*> table;	//never freed, like any other global
+	const Object& load() const;
+};
+
+/*
+custom classes for exposing table members as C++ members...
+each keeps where its value lives in its library's table, along with the table's version (see Object_Details_Table::version),
+so math.floor(x) doesn't search the table on every call
+assigning math["floor"] later writes to that same place, so it's seen, and removing a key bumps the version, so it's looked up again
+a member missing from the table is looked up every time
+*/
+struct LibraryField {
+	constexpr LibraryField(const Library* library_, const char* name_) : library(library_), name(name_), value(nullptr), version(0) {}
+
+	const Object& get() const {
+		const Object* v = value.load(std::memory_order_acquire);
+		if (v
+			&& version.load(std::memory_order_relaxed) == static_cast<const Object_Details_Table*>(library->get().details.get())->version
+			//set to nil by code that doesn't erase, so it's missing as far as Lua is concerned
+			&& v->details->typeIndex != Object::TYPE_NIL
+		) {
+			return *v;
+		}
+		return load();
+	}
+	operator const Object&() const { return get(); }
+
+	template<typename... Args>
+	VarArg operator()(Args... args) const {
+		VarArg vargs;
+		VarArgAppend<Args...>::exec(vargs, args...);
+		return const_cast<Object&>(get()).call(vargs);
+	}
+
+	//help C++ along with its casting, as Access does
+	template<typename T> Object operator+(const T& t) const { return get() + t; }
+	template<typename T> Object operator-(const T& t) const { return get() - t; }
+	template<typename T> Object operator*(const T& t) const { return get() * t; }
+	template<typename T> Object operator/(const T& t) const { return get() / t; }
+	template<typename T> Object operator%(const T& t) const { return get() % t; }
+
+protected:
+	const Library* library;
+	const char* name;
+	mutable std::atomic<const Object*> value;	//in the library's table
+	mutable std::atomic<uint64_t> version;	//of the table when 'value' was found
+	const Object& load() const;
+};
+
+struct Math : public Library {
+	LibraryField abs, acos, asin, atan, atan2, ceil, cos, cosh, deg, dot, exp, floor, fmod,
+		frexp, huge, ldexp, log, log10, map, max, maxof, min, minof, mod, modf, pi, pow, rad,
+		random, random_fill, randomseed, sin, sinh, sqrt, sum, tan, tanh;
+
+	constexpr Math() : Library(makeTable)
+	, abs(this, "abs"), acos(this, "acos"), asin(this, "asin"), atan(this, "atan"), atan2(this, "atan2")
+	, ceil(this, "ceil"), cos(this, "cos"), cosh(this, "cosh"), deg(this, "deg"), dot(this, "dot")
+	, exp(this, "exp"), floor(this, "floor"), fmod(this, "fmod"), frexp(this, "frexp"), huge(this, "huge")
+	, ldexp(this, "ldexp"), log(this, "log"), log10(this, "log10"), map(this, "map"), max(this, "max")
+	, maxof(this, "maxof"), min(this, "min"), minof(this, "minof"), mod(this, "mod"), modf(this, "modf")
+	, pi(this, "pi"), pow(this, "pow"), rad(this, "rad"), random(this, "random"), random_fill(this, "random_fill")
+	, randomseed(this, "randomseed"), sin(this, "sin"), sinh(this, "sinh"), sqrt(this, "sqrt"), sum(this, "sum")
+	, tan(this, "tan"), tanh(this, "tanh")
+	{}
+
+	static Object makeTable();
 };
 extern Math math;
 
-struct IO : public Object {
-	Access write;
-	IO();
+//also has the "stdin", "stdout", "stderr" handles and "type", which aren't members to avoid the stdio macros and Object::type
+struct IO : public Library {
+	LibraryField close, flush, lines, open, read, write;
+
+	constexpr IO() : Library(makeTable)
+	, close(this, "close"), flush(this, "flush"), lines(this, "lines"), open(this, "open"), read(this, "read"), write(this, "write")
+	{}
+
+	static Object makeTable();
 };
 extern IO io;
 
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace CxxAsLua {
+
+/*
+xoshiro256** generator behind math.random, the same one Lua 5.4 uses
+seeding and range reduction follow Lua 5.4 as well, so a given seed produces the same numbers
+*/
+struct RandomState {
+	uint64_t s[4];
+
+	//seeded with randomize()
+	RandomState();
+
+	uint64_t next();
+
+	//seed from the time and the state's address, like Lua 5.4 does on startup
+	//or math.randomseed() with no arguments, which returns the two seeds it picked
+	void randomize();
+	void randomize(uint64_t& n1, uint64_t& n2);
+
+	//Lua 5.4's math.randomseed(n1, n2)
+	void seed(uint64_t n1, uint64_t n2);
+
+	//uniform in [0, 1)
+	double nextFloat();
+
+	//uniform in [0, n], from 'ran' and as many more draws as it takes to avoid bias
+	uint64_t project(uint64_t ran, uint64_t n);
+
+	//uniform in [low, up], low <= up
+	int64_t nextInRange(int64_t low, int64_t up);
+};
+
+//each thread has its own, so calls don't contend on a lock the way ::rand() does
+RandomState& randomState();
+
+//fill a buffer with what math.random() or math.random(low, up) would return
+void randomFill(double* dst, size_t n);
+void randomFill(double* dst, size_t n, int64_t low, int64_t up);
+
+}
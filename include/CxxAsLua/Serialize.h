@@ -0,0 +1,60 @@
+#pragma once
+
+#include "CxxAsLua/Userdata.h"
+#include <vector>
+
+namespace CxxAsLua {
+
+/*
+binary serialization of nil, booleans, numbers, strings and tables
+
+layout:
+	"CXLB", a version byte
+	the string table: a varint count, then each string as a varint length and its bytes
+	the root value
+	each table's entries, as a varint count then keys and values, in order of table id
+	the tables' offsets into the file (8 bytes each, little-endian), then how many tables there are (8 bytes)
+
+each value is a tag byte, then for integers a zigzag varint, for other numbers 8 bytes, and for strings and tables a varint id
+so equal strings are stored once, and tables shared or cyclic in the graph are stored once and come back shared
+
+functions, userdata and threads can't be serialized, and metatables aren't stored
+*/
+Object serialize(const Object& o);
+
+//builds the whole graph, throwing if the data isn't valid
+Object deserialize(const char* data, size_t size);
+Object deserialize(const Object& bytes);
+
+struct SerializedData;
+
+/*
+a table in a mapped snapshot, materialized from the mapping the first time it's indexed
+its subtables are snapshot tables too, so only the parts of a graph that are used get built
+read-only: assigning to one throws
+*/
+struct Object_Details_SnapshotTable : public Object_Details_Userdata {
+	typedef Object_Details_Userdata Super;
+public:
+	std::shared_ptr<SerializedData> source;
+	size_t id;
+
+	mutable bool loaded;
+	mutable Object::Map value;
+
+	Object_Details_SnapshotTable(std::shared_ptr<SerializedData> source_, size_t id_);
+
+	virtual std::string explicit_to_string() const;
+	virtual Object::Map to_table() const;
+
+	virtual bool rawget(const Object& key, Object& result) const;
+	virtual bool rawset(const Object& key, const Object& v);
+	virtual bool rawlen(double& out) const;
+
+	void load() const;
+};
+
+//maps a file written from serialize(), returning its root value with tables as snapshot tables
+Object mapSnapshot(const std::string& path);
+
+}
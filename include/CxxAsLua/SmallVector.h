@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <initializer_list>
+#include <type_traits>
+
+namespace CxxAsLua {
+
+/*
+vector with the first N elements stored inline
+only spills to the heap once more than N elements are added
+used for VarArg, where most argument and return lists are short
+*/
+template<typename T, size_t N>
+struct SmallVector {
+	typedef T value_type;
+	typedef T* iterator;
+	typedef const T* const_iterator;
+	typedef size_t size_type;
+
+protected:
+	T* ptr;
+	size_t count;
+	size_t cap;
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type inlineBuffer[N];
+
+	T* inlineData() { return reinterpret_cast<T*>(inlineBuffer); }
+	bool isInline() const { return ptr == reinterpret_cast<const T*>(inlineBuffer); }
+
+	void grow(size_t newCap) {
+		moveTo(static_cast<T*>(::operator new(newCap * sizeof(T))), newCap);
+	}
+
+	void moveTo(T* newPtr, size_t newCap) {
+		for (size_t i = 0; i < count; ++i) {
+			new(newPtr + i) T(std::move(ptr[i]));
+			ptr[i].~T();
+		}
+		if (!isInline()) ::operator delete(ptr);
+		ptr = newPtr;
+		cap = newCap;
+	}
+
+	//leaves 'x' empty
+	void steal(SmallVector& x) {
+		if (x.isInline()) {
+			for (size_t i = 0; i < x.count; ++i) {
+				new(ptr + i) T(std::move(x.ptr[i]));
+				x.ptr[i].~T();
+			}
+		} else {
+			ptr = x.ptr;
+			cap = x.cap;
+			x.ptr = x.inlineData();
+			x.cap = N;
+		}
+		count = x.count;
+		x.count = 0;
+	}
+
+public:
+	SmallVector() : ptr(inlineData()), count(0), cap(N) {}
+
+	SmallVector(const SmallVector& x) : ptr(inlineData()), count(0), cap(N) {
+		reserve(x.count);
+		for (const T& t : x) new(ptr + count++) T(t);
+	}
+
+	SmallVector(SmallVector&& x) : ptr(inlineData()), count(0), cap(N) {
+		steal(x);
+	}
+
+	SmallVector(std::initializer_list<T> x) : ptr(inlineData()), count(0), cap(N) {
+		reserve(x.size());
+		for (const T& t : x) new(ptr + count++) T(t);
+	}
+
+	~SmallVector() {
+		clear();
+		if (!isInline()) ::operator delete(ptr);
+	}
+
+	SmallVector& operator=(const SmallVector& x) {
+		if (this != &x) {
+			clear();
+			reserve(x.count);
+			for (const T& t : x) new(ptr + count++) T(t);
+		}
+		return *this;
+	}
+
+	SmallVector& operator=(SmallVector&& x) {
+		if (this != &x) {
+			clear();
+			if (!isInline()) {
+				::operator delete(ptr);
+				ptr = inlineData();
+				cap = N;
+			}
+			steal(x);
+		}
+		return *this;
+	}
+
+	SmallVector& operator=(std::initializer_list<T> x) {
+		clear();
+		reserve(x.size());
+		for (const T& t : x) new(ptr + count++) T(t);
+		return *this;
+	}
+
+	iterator begin() { return ptr; }
+	iterator end() { return ptr + count; }
+	const_iterator begin() const { return ptr; }
+	const_iterator end() const { return ptr + count; }
+
+	T* data() { return ptr; }
+	const T* data() const { return ptr; }
+
+	size_t size() const { return count; }
+	size_t capacity() const { return cap; }
+	bool empty() const { return !count; }
+
+	T& operator[](size_t i) { return ptr[i]; }
+	const T& operator[](size_t i) const { return ptr[i]; }
+
+	T& front() { return ptr[0]; }
+	const T& front() const { return ptr[0]; }
+	T& back() { return ptr[count-1]; }
+	const T& back() const { return ptr[count-1]; }
+
+	void reserve(size_t n) {
+		if (n > cap) grow(n);
+	}
+
+	template<typename... Args>
+	T& emplace_back(Args&&... args) {
+		if (count == cap) {
+			//'args' might live in our own storage, so the new element is made before the old ones move
+			size_t newCap = cap * 2;
+			T* newPtr = static_cast<T*>(::operator new(newCap * sizeof(T)));
+			try {
+				new(newPtr + count) T(std::forward<Args>(args)...);
+			} catch (...) {
+				::operator delete(newPtr);
+				throw;
+			}
+			moveTo(newPtr, newCap);
+		} else {
+			new(ptr + count) T(std::forward<Args>(args)...);
+		}
+		return ptr[count++];
+	}
+
+	void push_back(const T& t) { emplace_back(t); }
+
+	void push_back(T&& t) { emplace_back(std::move(t)); }
+
+	void pop_back() {
+		ptr[--count].~T();
+	}
+
+	iterator insert(const_iterator pos, const T& t) {
+		size_t index = pos - ptr;
+		T copy(t);
+		if (count == cap) grow(cap * 2);
+		if (index == count) {
+			new(ptr + count) T(std::move(copy));
+		} else {
+			new(ptr + count) T(std::move(ptr[count-1]));
+			for (size_t i = count-1; i > index; --i) {
+				ptr[i] = std::move(ptr[i-1]);
+			}
+			ptr[index] = std::move(copy);
+		}
+		++count;
+		return ptr + index;
+	}
+
+	iterator erase(const_iterator pos) {
+		size_t index = pos - ptr;
+		for (size_t i = index; i + 1 < count; ++i) {
+			ptr[i] = std::move(ptr[i+1]);
+		}
+		pop_back();
+		return ptr + index;
+	}
+
+	void clear() {
+		for (size_t i = 0; i < count; ++i) ptr[i].~T();
+		count = 0;
+	}
+};
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "CxxAsLua/Object.h"
+
+namespace CxxAsLua {
+
+/*
+Lua's string library, which Lua code also reaches through strings' methods, as in s:upper()
+patterns and format strings are compiled the first time they're used and kept, so one used in a loop is only parsed once
+*/
+
+//also has "char", which isn't a member since it's a keyword
+struct String : public Library {
+	LibraryField byte, find, format, gmatch, gsub, len, lower, match, rep, reverse, sub, upper;
+
+	constexpr String() : Library(makeTable)
+	, byte(this, "byte"), find(this, "find"), format(this, "format"), gmatch(this, "gmatch"), gsub(this, "gsub")
+	, len(this, "len"), lower(this, "lower"), match(this, "match"), rep(this, "rep"), reverse(this, "reverse")
+	, sub(this, "sub"), upper(this, "upper")
+	{}
+
+	static Object makeTable();
+};
+extern String string;
+
+}
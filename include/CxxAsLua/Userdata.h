@@ -0,0 +1,99 @@
+#pragma once
+
+#include "CxxAsLua/Object.h"
+#include <utility>
+
+namespace CxxAsLua {
+
+//identifies the C++ type inside a userdata by the address of UserdataType<T>::id
+//so checking a userdata's type is a pointer compare, no RTTI
+template<typename T>
+struct UserdataType {
+	static const char id;
+};
+
+template<typename T>
+const char UserdataType<T>::id = 0;
+
+/*
+C++ data held by an Object, Lua's "userdata" type
+'ptr' points at the C++ object, of the type 'typeId' names
+it lives either inside a subclass (see Object_Details_UserdataValue) or elsewhere (a light userdata, which doesn't own it)
+light userdata are values, as in Lua: two for the same pointer are equal, and the same table key
+
+methods and operators come from its metatable, as in Lua
+*/
+struct Object_Details_Userdata : public Object_Details {
+	typedef Object_Details Super;
+public:
+	const void* typeId;
+	void* ptr;
+	bool light;
+
+	Object_Details_Userdata(const void* typeId_, void* ptr_, bool light_ = false)
+	: Super(Object::TYPE_USERDATA), typeId(typeId_), ptr(ptr_), light(light_) {}
+
+	virtual std::string type() const { return "userdata"; }
+	virtual bool to_boolean() const { return true; }
+
+	virtual std::string explicit_to_string() const {
+		std::ostringstream ss;
+		ss << "userdata: 0x" << std::hex << ptr;
+		return ss.str();
+	}
+};
+
+//a T stored in the same allocation as the details, destroyed along with them
+template<typename T>
+struct Object_Details_UserdataValue : public Object_Details_Userdata {
+	typedef Object_Details_Userdata Super;
+public:
+	T value;
+
+	template<typename... Args>
+	Object_Details_UserdataValue(Args&&... args)
+	: Super(&UserdataType<T>::id, nullptr), value(std::forward<Args>(args)...)
+	{
+		ptr = &value;
+	}
+};
+
+//construct a T inside a new userdata
+template<typename T, typename... Args>
+Object newuserdata(Args&&... args) {
+	return Object(std::make_shared<Object_Details_UserdataValue<T>>(std::forward<Args>(args)...));
+}
+
+//refer to a T that someone else owns, and which must outlive the Object
+template<typename T>
+Object lightuserdata(T* p) {
+	return Object(std::make_shared<Object_Details_Userdata>(&UserdataType<T>::id, (void*)p, true));
+}
+
+//o's details if it's a light userdata, otherwise null
+inline const Object_Details_Userdata* tolightuserdata(const Object& o) {
+	if (o.details->typeIndex != Object::TYPE_USERDATA) return nullptr;
+	const Object_Details_Userdata* u = static_cast<const Object_Details_Userdata*>(o.details.get());
+	return u->light ? u : nullptr;
+}
+
+//the T inside 'o', or null if 'o' isn't a userdata holding a T
+template<typename T>
+T* testudata(const Object& o) {
+	if (o.details->typeIndex != Object::TYPE_USERDATA) return nullptr;
+	Object_Details_Userdata* u = static_cast<Object_Details_Userdata*>(o.details.get());
+	if (u->typeId != &UserdataType<T>::id) return nullptr;
+	return static_cast<T*>(u->ptr);
+}
+
+//same as above, but throws if 'o' doesn't hold a T
+template<typename T>
+T& checkudata(const Object& o) {
+	T* p = testudata<T>(o);
+	if (!p) {
+		throw std::runtime_error(std::string("bad argument (userdata of a different type expected, got ") + o.type() + ")");
+	}
+	return *p;
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "CxxAsLua/Object.h"
+#include <vector>
+
+namespace CxxAsLua {
+
+/*
+kernels over contiguous doubles, for the bulk math functions
+these use AVX or SSE2, whichever the compiler is targeting, and plain loops otherwise
+*/
+
+double vectorSum(const double* x, size_t n);
+double vectorDot(const double* a, const double* b, size_t n);
+double vectorMin(const double* x, size_t n);	//n must be > 0
+double vectorMax(const double* x, size_t n);	//n must be > 0
+
+//dst[i] = op(src[i]), dst may be src
+typedef void (*VectorUnaryOp)(double* dst, const double* src, size_t n);
+
+//looks up the kernel for a math library function name, or null if there isn't one
+VectorUnaryOp vectorUnaryOp(const std::string& name);
+
+/*
+the numbers t[1], t[2], ... for the kernels, as 'data' and 'n'
+float64 arrays are used in place
+tables are stored in a std::map, so there is no array part to run kernels over directly
+instead their values are gathered into 'buffer' up to the first missing index, as are other arrays' converted elements
+
+returns 'false' if any of those values isn't a number
+*/
+bool numbersOf(const Object& t, std::vector<double>& buffer, const double*& data, size_t& n);
+
+//builds {x[0], x[1], ...}
+Object vectorToTable(const double* x, size_t n);
+
+}
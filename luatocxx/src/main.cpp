@@ -0,0 +1,65 @@
+#include "CxxAsLua/LuaTranslator.h"
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+/*
+luatocxx input.lua [output.cpp [functionName]]
+translates a Lua chunk into C++ (see LuaTranslator.h), writing to stdout without an output file
+the function is named after the input file unless given
+*/
+
+//the file's name without directories or extension, as an identifier
+static std::string functionNameFor(const std::string& path) {
+	size_t start = path.find_last_of("/\\");
+	start = start == std::string::npos ? 0 : start + 1;
+	size_t end = path.find('.', start);
+	std::string name = path.substr(start, end == std::string::npos ? std::string::npos : end - start);
+	for (char& c : name) {
+		if (!isalnum((unsigned char)c)) c = '_';
+	}
+	if (name.empty() || isdigit((unsigned char)name[0])) name = "lua_" + name;
+	return name;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2 || argc > 4) {
+		std::cerr << "usage: " << argv[0] << " input.lua [output.cpp [functionName]]" << std::endl;
+		return 1;
+	}
+	std::string input = argv[1];
+	std::ifstream in(input, std::ios::binary);
+	if (!in) {
+		std::cerr << "cannot open " << input << std::endl;
+		return 1;
+	}
+	std::stringstream source;
+	source << in.rdbuf();
+	std::string code = source.str();
+	//like loadfile, skip a first line starting with '#'
+	if (!code.empty() && code[0] == '#') {
+		size_t eol = code.find('\n');
+		code = eol == std::string::npos ? std::string() : code.substr(eol);
+	}
+
+	std::string translated;
+	try {
+		translated = CxxAsLua::translateLua(code, "@" + input, argc > 3 ? argv[3] : functionNameFor(input));
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	if (argc < 3) {
+		std::cout << translated;
+		return 0;
+	}
+	std::ofstream out(argv[2], std::ios::binary);
+	out << translated;
+	if (!out) {
+		std::cerr << "cannot write " << argv[2] << std::endl;
+		return 1;
+	}
+	return 0;
+}
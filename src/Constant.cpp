@@ -0,0 +1,44 @@
+#include "CxxAsLua/Constant.h"
+
+namespace CxxAsLua {
+
+const Object& ConstantString::make() const {
+	Object* o = new Object(std::string(chars, size));
+	Object* expected = nullptr;
+	//another thread got there first
+	if (!object.compare_exchange_strong(expected, o, std::memory_order_acq_rel)) {
+		delete o;
+		return *expected;
+	}
+	return *o;
+}
+
+Object ConstantValue::get() const {
+	switch (kind) {
+	case NUMBER:
+		return Object(number);
+	case BOOLEAN:
+		return Object(number != 0);
+	case STRING:
+		return Object(std::string(chars, size));
+	case FUNCTION:
+		return Object(func);
+	case OBJECT:
+		return *object;
+	case LIBRARY:
+		return library->get();
+	case TABLE:
+		return constantTable(fields, size);
+	}
+	return nil;
+}
+
+Object constantTable(const ConstantField* fields, size_t count) {
+	std::shared_ptr<Object_Details_Table> t = std::make_shared<Object_Details_Table>();
+	for (size_t i = 0; i < count; ++i) {
+		t->value[Object(fields[i].name)] = fields[i].value.get();
+	}
+	return Object(std::shared_ptr<Object_Details>(t));
+}
+
+}
@@ -0,0 +1,370 @@
+#include "CxxAsLua/Coroutine.h"
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <vector>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define COROUTINE_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define COROUTINE_ASAN 1
+#endif
+#endif
+#if COROUTINE_ASAN
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+namespace CxxAsLua {
+
+//thrown out of yield to unwind a suspended coroutine that is being destroyed
+struct CoroutineKill {};
+
+static size_t coroutineStackSize = 256 * 1024;
+
+void setCoroutineStackSize(size_t size) {
+	coroutineStackSize = size;
+}
+
+struct CoroutineStack {
+	void* base;
+	size_t size;	//including the guard page
+};
+
+/*
+finished coroutines hand their stacks back here, so creating a coroutine doesn't mmap each time
+kept trivially-destructible so coroutines destroyed during static destruction can still release into it
+*/
+struct CoroutineStackPool {
+	enum { MAX_POOLED = 64 };
+	CoroutineStack stacks[MAX_POOLED];
+	size_t count;
+	bool closed;	//the thread is exiting, stop pooling
+
+	CoroutineStack acquire() {
+		size_t pageSize = sysconf(_SC_PAGESIZE);
+		size_t size = ((coroutineStackSize + pageSize - 1) / pageSize + 1) * pageSize;
+		while (count) {
+			CoroutineStack s = stacks[--count];
+			if (s.size == size) return s;
+			munmap(s.base, s.size);	//left over from before a setCoroutineStackSize()
+		}
+		CoroutineStack s;
+		s.size = size;
+		s.base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+		if (s.base == MAP_FAILED) throw std::runtime_error("failed to allocate coroutine stack");
+		//stacks grow down, so an overflow runs into this
+		mprotect(s.base, pageSize, PROT_NONE);
+		return s;
+	}
+
+	void release(const CoroutineStack& s) {
+		if (!closed && count < MAX_POOLED) {
+			stacks[count++] = s;
+		} else {
+			munmap(s.base, s.size);
+		}
+	}
+
+	void close() {
+		while (count) {
+			CoroutineStack& s = stacks[--count];
+			munmap(s.base, s.size);
+		}
+		closed = true;
+	}
+};
+
+static thread_local CoroutineStackPool stackPool;
+
+//unmaps the pooled stacks when the thread exits
+static thread_local struct CoroutineStackPoolCloser {
+	~CoroutineStackPoolCloser() { stackPool.close(); }
+} stackPoolCloser;
+
+static thread_local Object_Details_Thread* current = nullptr;
+
+//what coroutine.running() returns outside any coroutine, made the first time it's asked for
+//it has no function or stack, and is never suspended, so it can't be resumed
+static thread_local std::shared_ptr<Object_Details_Thread> mainThread;
+
+static Object mainCoroutine() {
+	if (!mainThread) {
+		mainThread = std::make_shared<Object_Details_Thread>(nil);
+		mainThread->status = Object_Details_Thread::STATUS_RUNNING;
+		mainThread->self = mainThread;
+	}
+	return Object(std::shared_ptr<Object_Details>(mainThread));
+}
+
+struct CoroutineContext {
+	ucontext_t context;
+	ucontext_t resumer;
+	CoroutineStack stack;
+	//the resumer's stack, for the sanitizer
+	const void* resumerBottom;
+	size_t resumerSize;
+};
+
+/*
+ASan has to be told when the stack changes under it,
+or exceptions thrown on a coroutine's stack leave it reporting errors that aren't there
+*/
+static void stackLeave(void** fake, const void* bottom, size_t size) {
+#if COROUTINE_ASAN
+	__sanitizer_start_switch_fiber(fake, bottom, size);
+#else
+	(void)fake; (void)bottom; (void)size;
+#endif
+}
+
+static void stackEnter(void* fake, const void** bottom, size_t* size) {
+#if COROUTINE_ASAN
+	__sanitizer_finish_switch_fiber(fake, bottom, size);
+#else
+	(void)fake; (void)bottom; (void)size;
+#endif
+}
+
+Object_Details_Thread* currentCoroutine() {
+	return current;
+}
+
+const char* stackLimit() {
+	static const size_t pageSize = sysconf(_SC_PAGESIZE);
+	if (current) return (const char*)current->context->stack.base + pageSize;
+	//the thread's own stack doesn't move, so it is only looked up once
+	static thread_local const char* threadLimit = nullptr;
+	if (!threadLimit) {
+		pthread_attr_t attr;
+		void* addr = nullptr;
+		size_t size = 0;
+		if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+			pthread_attr_getstack(&attr, &addr, &size);
+			pthread_attr_destroy(&attr);
+		}
+		size_t guard = 64 * 1024;	//for signal handlers and whatever the library itself needs
+		threadLimit = (const char*)addr + guard;
+	}
+	return threadLimit;
+}
+
+//kept separate from coroutineEntry so all its locals are destroyed before the context ends
+static void coroutineRun(Object_Details_Thread* co) {
+	try {
+		VarArg args(std::move(co->transfer));
+		co->transfer.objects.clear();
+		co->func.call(args, co->transfer);
+	} catch (CoroutineKill&) {
+	} catch (...) {
+		//nobody is left to see an error thrown while being killed
+		if (!co->killing) co->error = std::current_exception();
+	}
+	//the body may have swallowed the kill and returned anyway: nobody wants those values either
+	if (co->killing || co->error) co->transfer.objects.clear();
+}
+
+//returning from here goes to uc_link, which is the resumer
+static void coroutineEntry() {
+	Object_Details_Thread* co = current;
+	CoroutineContext* ctx = co->context.get();
+	stackEnter(nullptr, &ctx->resumerBottom, &ctx->resumerSize);
+	coroutineRun(co);
+	co->status = Object_Details_Thread::STATUS_DEAD;
+	stackLeave(nullptr, ctx->resumerBottom, ctx->resumerSize);	//null: this stack is done with
+}
+
+//switch into 'co' until it yields, returns or throws
+static void switchTo(Object_Details_Thread* co) {
+	co->previous = current;
+	if (current) current->status = Object_Details_Thread::STATUS_NORMAL;
+	current = co;
+	co->status = Object_Details_Thread::STATUS_RUNNING;
+
+	CoroutineContext* ctx = co->context.get();
+	void* fake = nullptr;
+	stackLeave(&fake, ctx->stack.base, ctx->stack.size);
+	swapcontext(&ctx->resumer, &ctx->context);
+	stackEnter(fake, nullptr, nullptr);
+
+	current = co->previous;
+	if (current) current->status = Object_Details_Thread::STATUS_RUNNING;
+	co->previous = nullptr;
+
+	if (co->status == Object_Details_Thread::STATUS_DEAD) {
+		stackPool.release(ctx->stack);
+		co->context.reset();
+	}
+}
+
+Object_Details_Thread::Object_Details_Thread(const Object& func_)
+: Super(Object::TYPE_THREAD),
+	func(func_),
+	status(STATUS_SUSPENDED),
+	previous(nullptr),
+	killing(false)
+{}
+
+Object_Details_Thread::~Object_Details_Thread() {
+	//suspended partway through: unwind its stack so everything on it gets destroyed
+	if (context && status == STATUS_SUSPENDED) {
+		killing = true;
+		switchTo(this);
+	}
+}
+
+std::string Object_Details_Thread::type() const { return "thread"; }
+
+bool Object_Details_Thread::to_boolean() const { return true; }
+
+std::string Object_Details_Thread::explicit_to_string() const {
+	std::ostringstream ss;
+	ss << "thread: 0x" << std::hex << this;
+	return ss.str();
+}
+
+std::string Object_Details_Thread::statusName() const {
+	//the main thread is running unless it has resumed a coroutine
+	if (this == mainThread.get()) return current ? "normal" : "running";
+	switch (status) {
+	case STATUS_SUSPENDED: return "suspended";
+	case STATUS_RUNNING: return "running";
+	case STATUS_NORMAL: return "normal";
+	case STATUS_DEAD: return "dead";
+	}
+	return "dead";
+}
+
+static Object_Details_Thread* toThread(const Object& co, const char* funcName) {
+	if (!co.is_thread()) {
+		throw std::runtime_error(
+			std::string("bad argument #1 to '")
+			+ funcName +
+			std::string("' (coroutine expected)"));
+	}
+	return static_cast<Object_Details_Thread*>(co.details.get());
+}
+
+bool resumeCoroutine(const Object& coObj, const VarArg& args, VarArg& results, std::exception_ptr& error) {
+	Object_Details_Thread* co = toThread(coObj, "resume");
+	if (co->status == Object_Details_Thread::STATUS_DEAD) {
+		error = std::make_exception_ptr(std::runtime_error("cannot resume dead coroutine"));
+		return false;
+	}
+	if (co->status != Object_Details_Thread::STATUS_SUSPENDED) {
+		error = std::make_exception_ptr(std::runtime_error("cannot resume non-suspended coroutine"));
+		return false;
+	}
+
+	if (!co->context) {
+		//first resume: give it a stack
+		(void)&stackPoolCloser;	//odr-use, so it is constructed for this thread
+		std::unique_ptr<CoroutineContext> ctx(new CoroutineContext());
+		ctx->stack = stackPool.acquire();
+		getcontext(&ctx->context);
+		ctx->context.uc_stack.ss_sp = ctx->stack.base;
+		ctx->context.uc_stack.ss_size = ctx->stack.size;
+		ctx->context.uc_link = &ctx->resumer;
+		makecontext(&ctx->context, coroutineEntry, 0);
+		co->context = std::move(ctx);
+	}
+
+	co->transfer.objects = args.objects;
+	switchTo(co);
+
+	results.objects = std::move(co->transfer.objects);
+	co->transfer.objects.clear();
+	if (co->error) {
+		error = co->error;
+		co->error = nullptr;
+		return false;
+	}
+	return true;
+}
+
+VarArg yieldCoroutine(const VarArg& args) {
+	Object_Details_Thread* co = current;
+	if (!co) throw std::runtime_error("attempt to yield from outside a coroutine");
+	//a body that caught the kill and yields again is unwound again, instead of suspending with nobody to resume it
+	if (co->killing) throw CoroutineKill();
+
+	co->transfer.objects = args.objects;
+	co->status = Object_Details_Thread::STATUS_SUSPENDED;
+	CoroutineContext* ctx = co->context.get();
+	void* fake = nullptr;
+	stackLeave(&fake, ctx->resumerBottom, ctx->resumerSize);
+	swapcontext(&ctx->context, &ctx->resumer);
+	stackEnter(fake, &ctx->resumerBottom, &ctx->resumerSize);	//it may be a different resumer this time
+
+	if (co->killing) throw CoroutineKill();
+	VarArg results(std::move(co->transfer));
+	co->transfer.objects.clear();
+	return results;
+}
+
+//what resume returns for an error, as pcall does
+static Object errorValue(const std::exception_ptr& error) {
+	try {
+		std::rethrow_exception(error);
+	} catch (Error& e) {
+		return e.value;
+	} catch (std::exception& e) {
+		return e.what();
+	} catch (...) {
+		return "unknown error";
+	}
+}
+
+Object Coroutine::makeTable() {
+	return Object({
+		{"create", [=](Object f)->Object {
+			if (!f.is_function()) throw std::runtime_error("bad argument #1 to 'create' (function expected)");
+			std::shared_ptr<Object_Details_Thread> co = std::make_shared<Object_Details_Thread>(f);
+			co->self = co;
+			return Object(std::shared_ptr<Object_Details>(co));
+		}},
+		{"resume", [=](VarArg args)->VarArg {
+			Object co = args[1];
+			VarArg coargs;
+			for (size_t i = 1; i < args.objects.size(); ++i) {
+				coargs.objects.push_back(args.objects[i]);
+			}
+			VarArg results;
+			std::exception_ptr error;
+			if (!resumeCoroutine(co, coargs, results, error)) {
+				return VarArg(false, errorValue(error));
+			}
+			results.objects.insert(results.objects.begin(), Object(true));
+			return results;
+		}},
+		{"yield", [=](VarArg args)->VarArg {
+			return yieldCoroutine(args);
+		}},
+		{"status", [=](Object co)->Object {
+			return toThread(co, "status")->statusName();
+		}},
+		{"wrap", [=](Object f)->Object {
+			Object co = coroutine.create(f);
+			return [=](VarArg args)->VarArg {
+				VarArg results;
+				std::exception_ptr error;
+				if (!resumeCoroutine(co, args, results, error)) {
+					std::rethrow_exception(error);
+				}
+				return results;
+			};
+		}},
+		{"running", [=]()->VarArg {
+			if (!current) return VarArg(mainCoroutine(), true);
+			return VarArg(Object(current->self.lock()), false);
+		}},
+		{"isyieldable", [=]()->bool {
+			return current != nullptr;
+		}}
+	});
+}
+
+Coroutine coroutine;
+
+}
@@ -0,0 +1,475 @@
+#include "CxxAsLua/File.h"
+#include "CxxAsLua/Userdata.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace CxxAsLua {
+
+File::File()
+: fp(nullptr)
+, standard(false)
+, map(nullptr)
+, mapSize(0)
+, pos(0)
+, closed(true)
+, lineBuffer(nullptr)
+, lineCapacity(0)
+{}
+
+File::~File() {
+	if (!closed && !standard) close();
+	free(lineBuffer);
+}
+
+bool File::open(const std::string& path, const std::string& mode) {
+	if (mode == "r" || mode == "rb") {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+			if (st.st_size == 0) {
+				::close(fd);
+				closed = false;
+				return true;
+			}
+			void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+				::close(fd);
+				map = (const char*)p;
+				mapSize = (size_t)st.st_size;
+				closed = false;
+				return true;
+			}
+		}
+		//not something that can be mapped, read it the usual way
+		fp = fdopen(fd, "rb");
+		if (!fp) {
+			int e = errno;
+			::close(fd);
+			errno = e;
+			return false;
+		}
+		closed = false;
+		return true;
+	}
+
+	fp = fopen(path.c_str(), mode.c_str());
+	if (!fp) return false;
+	closed = false;
+	return true;
+}
+
+void File::wrap(FILE* fp_) {
+	fp = fp_;
+	standard = true;
+	closed = false;
+}
+
+bool File::close() {
+	bool ok = true;
+	if (map) munmap((void*)map, mapSize);
+	if (fp && !standard) ok = fclose(fp) == 0;
+	map = nullptr;
+	mapSize = 0;
+	pos = 0;
+	fp = nullptr;
+	closed = true;
+	return ok;
+}
+
+bool File::readLine(const char*& s, size_t& n, bool keepNewline) {
+	if (!fp) {
+		if (pos >= mapSize) return false;
+		s = map + pos;
+		const char* nl = (const char*)memchr(s, '\n', mapSize - pos);
+		if (nl) {
+			n = nl - s;
+			pos += n + 1;
+			if (keepNewline) ++n;
+		} else {
+			n = mapSize - pos;
+			pos = mapSize;
+		}
+		return true;
+	}
+	ssize_t got = getline(&lineBuffer, &lineCapacity, fp);
+	if (got < 0) return false;
+	s = lineBuffer;
+	n = (size_t)got;
+	if (!keepNewline && n && s[n-1] == '\n') --n;
+	return true;
+}
+
+std::string File::readAll() {
+	if (!fp) {
+		if (pos >= mapSize) return std::string();
+		std::string s(map + pos, mapSize - pos);
+		pos = mapSize;
+		return s;
+	}
+	std::string s;
+	char buffer[65536];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+		s.append(buffer, got);
+	}
+	return s;
+}
+
+bool File::readBytes(size_t count, std::string& s) {
+	if (!fp) {
+		if (pos >= mapSize) return false;
+		size_t n = std::min(count, mapSize - pos);
+		s.assign(map + pos, n);
+		pos += n;
+		return true;
+	}
+	if (count == 0) {
+		//only tests for the end of the file
+		int c = getc(fp);
+		if (c == EOF) return false;
+		ungetc(c, fp);
+		s.clear();
+		return true;
+	}
+	s.resize(count);
+	size_t got = fread(&s[0], 1, count, fp);
+	s.resize(got);
+	return got > 0;
+}
+
+/*
+reads the longest prefix of the input that could be a numeral, the way Lua's read_number does
+then converts it, so "0x1p4", "1e5" and "-.5" are read but "inf" and "nan" are not
+*/
+struct FileNumberReader {
+	enum { MAX_LENGTH = 200 };
+	File& f;
+	char buffer[MAX_LENGTH + 1];
+	int n;
+	int c;	//the look-ahead character
+
+	FileNumberReader(File& f_) : f(f_), n(0), c(EOF) {}
+
+	int get() {
+		if (!f.fp) return f.pos < f.mapSize ? (unsigned char)f.map[f.pos++] : EOF;
+		return getc(f.fp);
+	}
+
+	void unget() {
+		if (c == EOF) return;
+		if (!f.fp) {
+			--f.pos;
+		} else {
+			ungetc(c, f.fp);
+		}
+	}
+
+	bool next() {
+		if (n >= MAX_LENGTH) {
+			buffer[0] = 0;	//too long to be a number
+			return false;
+		}
+		buffer[n++] = (char)c;
+		c = get();
+		return true;
+	}
+
+	bool test2(const char* set) {
+		if (c == set[0] || c == set[1]) return next();
+		return false;
+	}
+
+	int digits(bool hex) {
+		int count = 0;
+		while ((hex ? isxdigit(c) : isdigit(c)) && next()) ++count;
+		return count;
+	}
+
+	bool read(double& d) {
+		do { c = get(); } while (c != EOF && isspace(c));
+		int count = 0;
+		bool hex = false;
+		test2("-+");
+		if (test2("00")) {
+			if (test2("xX")) {
+				hex = true;
+			} else {
+				count = 1;
+			}
+		}
+		count += digits(hex);
+		if (test2("..")) count += digits(hex);
+		if (count > 0 && test2(hex ? "pP" : "eE")) {
+			test2("-+");
+			digits(false);
+		}
+		unget();
+		buffer[n] = 0;
+		if (!buffer[0]) return false;
+		char* end = nullptr;
+		d = strtod(buffer, &end);
+		return *end == 0;
+	}
+};
+
+bool File::readNumber(double& d) {
+	return FileNumberReader(*this).read(d);
+}
+
+bool File::read(const Object& format, Object& result, int arg) {
+	double count;
+	if (format.is_number() && format.tonumber(count)) {
+		std::string s;
+		if (!readBytes(count > 0 ? (size_t)count : 0, s)) return false;
+		result = Object(std::move(s));
+		return true;
+	}
+	if (!format.is_string()) {
+		throw std::runtime_error("bad argument #" + std::to_string(arg) + " to 'read' (invalid format)");
+	}
+	const char* p = static_cast<const Object_Details_String*>(format.details.get())->value.c_str();
+	if (*p == '*') ++p;	//Lua 5.1's "*l" etc.
+	switch (*p) {
+	case 'n': {
+		double d;
+		if (!readNumber(d)) return false;
+		result = Object(d);
+		return true;
+	}
+	case 'l':
+	case 'L': {
+		const char* s;
+		size_t n;
+		if (!readLine(s, n, *p == 'L')) return false;
+		result = Object(std::string(s, n));
+		return true;
+	}
+	case 'a':
+		result = Object(readAll());
+		return true;
+	default:
+		throw std::runtime_error("bad argument #" + std::to_string(arg) + " to 'read' (invalid format)");
+	}
+}
+
+bool File::write(const char* s, size_t n) {
+	if (!fp) {
+		errno = EBADF;	//read-only
+		return false;
+	}
+	return fwrite(s, 1, n, fp) == n;
+}
+
+bool File::write(const Object& o) {
+	switch (o.details->typeIndex) {
+	case Object::TYPE_STRING: {
+		const std::string& s = static_cast<const Object_Details_String*>(o.details.get())->value;
+		return write(s.data(), s.size());
+	}
+	case Object::TYPE_NUMBER: {
+		char buf[Object_Details_Number::formatSize];
+		return write(buf, Object_Details_Number::format(static_cast<const Object_Details_Number*>(o.details.get())->value, buf));
+	}
+	default: {
+		std::string s = o.tostring();
+		return write(s.data(), s.size());
+	}
+	}
+}
+
+bool File::seek(int whence, int64_t offset, int64_t& position) {
+	if (!fp) {
+		int64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (int64_t)pos : (int64_t)mapSize;
+		if (base + offset < 0) {
+			errno = EINVAL;
+			return false;
+		}
+		pos = (size_t)(base + offset);
+		position = (int64_t)pos;
+		return true;
+	}
+	if (fseeko(fp, (off_t)offset, whence) != 0) return false;
+	position = (int64_t)ftello(fp);
+	return true;
+}
+
+bool File::flush() {
+	return !fp || fflush(fp) == 0;
+}
+
+
+//Lua's luaL_fileresult: 'success', or nil, the error message and errno
+static VarArg fileResult(bool ok, const Object& success, const std::string& name = std::string()) {
+	if (ok) return success;
+	int e = errno;
+	std::string message = strerror(e);
+	if (!name.empty()) message = name + ": " + message;
+	return VarArg(nil, message, (double)e);
+}
+
+static File& checkFile(const Object& o, const char* func) {
+	File* f = tofile(o);
+	if (!f) throw std::runtime_error(std::string("bad argument #1 to '") + func + "' (FILE* expected, got " + o.type() + ")");
+	if (f->closed) throw std::runtime_error("attempt to use a closed file");
+	return *f;
+}
+
+//the results of read(args[first], args[first+1], ...), up to the first that fails
+static VarArg readFormats(File& f, const VarArg& args, int first) {
+	VarArg results;
+	int n = (int)args.len();
+	if (n < first) {
+		//the default "l", the common case for lines(), without parsing a format
+		const char* s;
+		size_t len;
+		results.objects.push_back(f.readLine(s, len) ? Object(std::string(s, len)) : nil);
+		return results;
+	}
+	for (int i = first; i <= n; ++i) {
+		Object value;
+		bool ok = f.read(args[i], value, i);
+		results.objects.push_back(ok ? value : nil);
+		if (!ok) break;
+	}
+	return results;
+}
+
+//calls read(formats...) on 'handle' each time, closing it at the end of the file if 'closeAtEnd'
+static Object linesIterator(Object handle, VarArg formats, bool closeAtEnd) {
+	return [=](VarArg)->VarArg{
+		File* f = tofile(handle);
+		if (f->closed) throw std::runtime_error("file is already closed");
+		VarArg results = readFormats(*f, formats, 1);
+		if (closeAtEnd && results.objects[0].is_nil()) f->close();
+		return results;
+	};
+}
+
+static VarArg fileClose(const VarArg& args) {
+	File& f = checkFile(args[1], "close");
+	if (f.standard) return VarArg(nil, "cannot close standard file");
+	return fileResult(f.close(), true);
+}
+
+static const Object& fileMetatable() {
+	static Object metatable = Object({
+		{"__index", Object({
+			{"close", [](VarArg args)->VarArg{
+				return fileClose(args);
+			}},
+			{"flush", [](VarArg args)->VarArg{
+				Object self = args[1];
+				return fileResult(checkFile(self, "flush").flush(), self);
+			}},
+			{"lines", [](VarArg args)->VarArg{
+				Object self = args[1];
+				checkFile(self, "lines");
+				VarArg formats;
+				for (size_t i = 1; i < args.objects.size(); ++i) formats.objects.push_back(args.objects[i]);
+				return linesIterator(self, std::move(formats), false);
+			}},
+			{"read", [](VarArg args)->VarArg{
+				return readFormats(checkFile(args[1], "read"), args, 2);
+			}},
+			{"seek", [](VarArg args)->VarArg{
+				Object self = args[1];
+				File& f = checkFile(self, "seek");
+				static const char* names[] = {"set", "cur", "end"};
+				static const int whences[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+				std::string name = args[2].is_nil() ? "cur" : (std::string)args[2];
+				int i = 0;
+				while (i < 3 && name != names[i]) ++i;
+				if (i == 3) throw std::runtime_error("bad argument #2 to 'seek' (invalid option '" + name + "')");
+				double offset = 0;
+				if (!args[3].is_nil() && (!args[3].tonumber(offset) || offset != std::floor(offset))) {
+					throw std::runtime_error("bad argument #3 to 'seek' (number has no integer representation)");
+				}
+				int64_t position = 0;
+				bool ok = f.seek(whences[i], (int64_t)offset, position);
+				return fileResult(ok, (double)position);
+			}},
+			{"write", [](VarArg args)->VarArg{
+				Object self = args[1];
+				File& f = checkFile(self, "write");
+				for (size_t i = 1; i < args.objects.size(); ++i) {
+					if (!f.write(args.objects[i])) return fileResult(false, nil);
+				}
+				return self;
+			}},
+		})},
+	});
+	return metatable;
+}
+
+File* tofile(const Object& o) {
+	return testudata<File>(o);
+}
+
+Object fileHandle(FILE* fp) {
+	Object handle = newuserdata<File>();
+	tofile(handle)->wrap(fp);
+	setmetatable(handle, fileMetatable());
+	return handle;
+}
+
+//Lua's l_checkmode: [rwa]%+?b*
+static bool validMode(const std::string& mode) {
+	const char* p = mode.c_str();
+	if (!*p || !strchr("rwa", *p++)) return false;
+	if (*p == '+') ++p;
+	return strspn(p, "b") == strlen(p);
+}
+
+VarArg openFile(const std::string& path, const std::string& mode) {
+	if (!validMode(mode)) throw std::runtime_error("bad argument #2 to 'open' (invalid mode)");
+	Object handle = newuserdata<File>();
+	if (!tofile(handle)->open(path, mode)) return fileResult(false, nil, path);
+	setmetatable(handle, fileMetatable());
+	return handle;
+}
+
+VarArg ioClose(const VarArg& args) {
+	if (args.objects.empty()) return VarArg(nil, "cannot close standard file");	//the default output is always stdout
+	return fileClose(args);
+}
+
+VarArg ioLines(const VarArg& args) {
+	VarArg formats;
+	for (size_t i = 1; i < args.objects.size(); ++i) formats.objects.push_back(args.objects[i]);
+	if (args[1].is_nil()) {
+		return linesIterator(fileHandle(stdin), std::move(formats), false);
+	}
+	std::string path = args[1];
+	Object handle = newuserdata<File>();
+	if (!tofile(handle)->open(path, "r")) {
+		throw std::runtime_error(path + ": " + strerror(errno));
+	}
+	setmetatable(handle, fileMetatable());
+	return linesIterator(handle, std::move(formats), true);
+}
+
+VarArg ioOpen(const VarArg& args) {
+	if (!args[1].is_string()) throw std::runtime_error("bad argument #1 to 'open' (string expected, got " + args[1].type() + ")");
+	return openFile(args[1], args[2].is_nil() ? "r" : (std::string)args[2]);
+}
+
+VarArg ioRead(const VarArg& args) {
+	static Object in = fileHandle(stdin);
+	return readFormats(*tofile(in), args, 1);
+}
+
+VarArg ioType(const VarArg& args) {
+	File* f = tofile(args[1]);
+	if (!f) return nil;
+	return Object(f->closed ? "closed file" : "file");
+}
+
+}
@@ -0,0 +1,866 @@
+#include "CxxAsLua/JSON.h"
+#include "CxxAsLua/Vectorized.h"
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <unordered_map>
+
+namespace CxxAsLua {
+
+JSONHandler::~JSONHandler() {}
+
+//thrown when a parse that isn't final runs out of input, so a stream can wait for more
+struct JSONNeedMore {};
+
+template<typename Handler>
+struct JSONParser {
+	enum { MAX_DEPTH = 1000 };
+
+	const char* begin;
+	const char* p;
+	const char* end;
+	size_t offset;	//of 'begin' in the whole input
+	bool final;	//otherwise more input may follow 'end'
+	Handler& h;
+	int depth;
+	std::string scratch;	//strings with escapes are decoded into this
+
+	JSONParser(const char* data, size_t size, size_t offset_, bool final_, Handler& h_)
+	: begin(data), p(data), end(data + size), offset(offset_), final(final_), h(h_), depth(0) {}
+
+	[[noreturn]] void error(const char* what) {
+		if (p >= end && !final) throw JSONNeedMore();
+		throw std::runtime_error("JSON error at offset " + std::to_string(offset + (p - begin)) + ": " + what);
+	}
+
+	static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+	void skipSpace() {
+		while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) ++p;
+	}
+
+	void value() {
+		skipSpace();
+		if (p == end) error("unexpected end of input");
+		switch (*p) {
+		case '{':
+			object();
+			return;
+		case '[':
+			array();
+			return;
+		case '"': {
+			const char* s;
+			size_t n;
+			string(s, n);
+			h.string(s, n);
+			return;
+		}
+		case 't':
+			literal("true", 4);
+			h.boolean(true);
+			return;
+		case 'f':
+			literal("false", 5);
+			h.boolean(false);
+			return;
+		case 'n':
+			literal("null", 4);
+			h.null();
+			return;
+		default:
+			number();
+			return;
+		}
+	}
+
+	void literal(const char* word, size_t n) {
+		size_t avail = end - p;
+		if (memcmp(p, word, std::min(n, avail)) != 0) error("invalid value");
+		if (avail < n) {
+			p = end;
+			error("unexpected end of input");
+		}
+		p += n;
+	}
+
+	void object() {
+		if (++depth > MAX_DEPTH) error("too deeply nested");
+		++p;
+		h.startObject();
+		skipSpace();
+		if (p < end && *p == '}') {
+			++p;
+		} else {
+			for (;;) {
+				skipSpace();
+				if (p == end) error("unexpected end of input");
+				if (*p != '"') error("expected a string key");
+				const char* s;
+				size_t n;
+				string(s, n);
+				h.key(s, n);
+				skipSpace();
+				if (p == end) error("unexpected end of input");
+				if (*p != ':') error("expected ':'");
+				++p;
+				value();
+				skipSpace();
+				if (p == end) error("unexpected end of input");
+				if (*p == ',') {
+					++p;
+					continue;
+				}
+				if (*p == '}') {
+					++p;
+					break;
+				}
+				error("expected ',' or '}'");
+			}
+		}
+		--depth;
+		h.endObject();
+	}
+
+	void array() {
+		if (++depth > MAX_DEPTH) error("too deeply nested");
+		++p;
+		h.startArray();
+		skipSpace();
+		if (p < end && *p == ']') {
+			++p;
+		} else {
+			for (;;) {
+				value();
+				skipSpace();
+				if (p == end) error("unexpected end of input");
+				if (*p == ',') {
+					++p;
+					continue;
+				}
+				if (*p == ']') {
+					++p;
+					break;
+				}
+				error("expected ',' or ']'");
+			}
+		}
+		--depth;
+		h.endArray();
+	}
+
+	uint32_t hex4() {
+		if (end - p < 4) {
+			p = end;
+			error("unexpected end of input");
+		}
+		uint32_t v = 0;
+		for (int i = 0; i < 4; ++i) {
+			char c = *p++;
+			v <<= 4;
+			if (c >= '0' && c <= '9') v |= c - '0';
+			else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+			else error("invalid \\u escape");
+		}
+		return v;
+	}
+
+	void utf8(uint32_t c) {
+		if (c < 0x80) {
+			scratch += (char)c;
+		} else if (c < 0x800) {
+			scratch += (char)(0xC0 | (c >> 6));
+			scratch += (char)(0x80 | (c & 0x3F));
+		} else if (c < 0x10000) {
+			scratch += (char)(0xE0 | (c >> 12));
+			scratch += (char)(0x80 | ((c >> 6) & 0x3F));
+			scratch += (char)(0x80 | (c & 0x3F));
+		} else {
+			scratch += (char)(0xF0 | (c >> 18));
+			scratch += (char)(0x80 | ((c >> 12) & 0x3F));
+			scratch += (char)(0x80 | ((c >> 6) & 0x3F));
+			scratch += (char)(0x80 | (c & 0x3F));
+		}
+	}
+
+	//strings without escapes are passed straight out of the input
+	void string(const char*& s, size_t& n) {
+		++p;
+		const char* start = p;
+		while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) ++p;
+		if (p == end) error("unterminated string");
+		if (*p == '"') {
+			s = start;
+			n = p - start;
+			++p;
+			return;
+		}
+		scratch.assign(start, p);
+		for (;;) {
+			if (p == end) error("unterminated string");
+			char c = *p;
+			if ((unsigned char)c < 0x20) error("control character in string");
+			++p;
+			if (c == '"') break;
+			if (c != '\\') {
+				scratch += c;
+				continue;
+			}
+			if (p == end) error("unterminated string");
+			switch (*p++) {
+			case '"': scratch += '"'; break;
+			case '\\': scratch += '\\'; break;
+			case '/': scratch += '/'; break;
+			case 'b': scratch += '\b'; break;
+			case 'f': scratch += '\f'; break;
+			case 'n': scratch += '\n'; break;
+			case 'r': scratch += '\r'; break;
+			case 't': scratch += '\t'; break;
+			case 'u': {
+				uint32_t c = hex4();
+				if (c >= 0xD800 && c < 0xDC00) {
+					if (end - p < 2) {
+						p = end;
+						error("unexpected end of input");
+					}
+					if (p[0] != '\\' || p[1] != 'u') error("unpaired surrogate");
+					p += 2;
+					uint32_t low = hex4();
+					if (low < 0xDC00 || low >= 0xE000) error("unpaired surrogate");
+					c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+				} else if (c >= 0xDC00 && c < 0xE000) {
+					error("unpaired surrogate");
+				}
+				utf8(c);
+				break;
+			}
+			default:
+				--p;
+				error("invalid escape");
+			}
+		}
+		s = scratch.data();
+		n = scratch.size();
+	}
+
+	void number() {
+		const char* start = p;
+		bool negative = false;
+		if (*p == '-') {
+			negative = true;
+			++p;
+		}
+		if (p == end) error("unexpected end of input");
+		if (*p == '0') {
+			++p;
+		} else if (*p >= '1' && *p <= '9') {
+			while (p < end && isDigit(*p)) ++p;
+		} else {
+			error("invalid value");
+		}
+		bool integer = true;
+		if (p < end && *p == '.') {
+			integer = false;
+			++p;
+			if (p < end && !isDigit(*p)) error("invalid number");
+			while (p < end && isDigit(*p)) ++p;
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			integer = false;
+			++p;
+			if (p < end && (*p == '+' || *p == '-')) ++p;
+			if (p < end && !isDigit(*p)) error("invalid number");
+			while (p < end && isDigit(*p)) ++p;
+		}
+		if (p == end && !final) throw JSONNeedMore();	//more digits may follow
+		if (!isDigit(p[-1])) error("invalid number");
+
+		//up to 15 digits fit a double exactly, so add them up directly
+		size_t digits = p - start - (negative ? 1 : 0);
+		if (integer && digits <= 15) {
+			int64_t v = 0;
+			for (const char* q = start + (negative ? 1 : 0); q < p; ++q) v = v * 10 + (*q - '0');
+			double d = (double)v;
+			h.number(negative ? -d : d);
+			return;
+		}
+		char buffer[64];
+		size_t length = p - start;
+		if (length < sizeof(buffer)) {
+			memcpy(buffer, start, length);
+			buffer[length] = 0;
+			h.number(strtod(buffer, nullptr));
+		} else {
+			h.number(strtod(std::string(start, length).c_str(), nullptr));
+		}
+	}
+
+	//the value must be all of the input, apart from whitespace
+	void document() {
+		value();
+		skipSpace();
+		if (p != end) error("unexpected characters after the value");
+	}
+};
+
+void parseJSON(const char* data, size_t size, JSONHandler& handler) {
+	JSONParser<JSONHandler> parser(data, size, 0, true, handler);
+	parser.document();
+}
+
+
+//builds tables directly as the parser reads
+struct JSONBuilder {
+	enum { MAX_KEYS = 4096 };
+
+	struct Frame {
+		Object table;
+		Object::Map* map;
+		double index;	//for arrays, the last index used, -1 for objects
+		Object key;
+	};
+	std::vector<Frame> stack;
+	Object result;
+	std::unordered_map<std::string, Object>& keys;
+
+	JSONBuilder(std::unordered_map<std::string, Object>& keys_) : keys(keys_) {
+		stack.reserve(16);
+	}
+
+	void add(const Object& v) {
+		if (stack.empty()) {
+			result = v;
+			return;
+		}
+		Frame& f = stack.back();
+		if (f.index >= 0) {
+			f.index += 1;
+			//indexes come in order, so each goes at the end of the map
+			if (!v.is_nil()) f.map->emplace_hint(f.map->end(), Object(f.index), v);
+		} else {
+			if (v.is_nil()) return;
+			//emplace rather than operator[], which would construct a nil first
+			std::pair<Object::Map::iterator, bool> i = f.map->emplace(f.key, v);
+			if (!i.second) i.first->second = v;	//repeated key, the last one wins
+		}
+	}
+
+	void null() { add(nil); }
+	void boolean(bool b) { add(Object(b)); }
+	void number(double d) { add(Object(d)); }
+	void string(const char* s, size_t n) { add(Object(std::make_shared<Object_Details_String>(std::string(s, n)))); }
+
+	void key(const char* s, size_t n) {
+		std::string k(s, n);
+		std::unordered_map<std::string, Object>::iterator i = keys.find(k);
+		if (i == keys.end()) {
+			if (keys.size() >= MAX_KEYS) keys.clear();	//inputs whose keys are data rather than field names
+			Object o(std::make_shared<Object_Details_String>(k));
+			i = keys.insert(std::make_pair(std::move(k), o)).first;
+		}
+		stack.back().key = i->second;
+	}
+
+	void start(bool isArray) {
+		std::shared_ptr<Object_Details_Table> t = std::make_shared<Object_Details_Table>();
+		Frame f;
+		f.map = &t->value;
+		f.table = Object(t);
+		f.index = isArray ? 0 : -1;
+		stack.push_back(std::move(f));
+	}
+
+	void finish() {
+		Object t = std::move(stack.back().table);
+		stack.pop_back();
+		add(t);
+	}
+
+	void startObject() { start(false); }
+	void endObject() { finish(); }
+	void startArray() { start(true); }
+	void endArray() { finish(); }
+};
+
+Object decodeJSON(const char* data, size_t size) {
+	std::unordered_map<std::string, Object> keys;
+	JSONBuilder builder(keys);
+	JSONParser<JSONBuilder> parser(data, size, 0, true, builder);
+	parser.document();
+	return builder.result;
+}
+
+Object decodeJSON(const Object& s) {
+	if (!s.is_string()) throw std::runtime_error("bad argument #1 to 'decode' (string expected, got " + s.type() + ")");
+	const std::string& str = static_cast<const Object_Details_String*>(s.details.get())->value;
+	return decodeJSON(str.data(), str.size());
+}
+
+
+struct JSONWriter {
+	std::string& out;
+	std::vector<const Object_Details*> visiting;	//the tables being written, to catch cycles
+
+	JSONWriter(std::string& out_) : out(out_) {}
+
+	void string(const std::string& s) {
+		static const char hex[] = "0123456789abcdef";
+		out += '"';
+		const char* p = s.data();
+		const char* end = p + s.size();
+		const char* run = p;
+		for (; p < end; ++p) {
+			unsigned char c = (unsigned char)*p;
+			if (c >= 0x20 && c != '"' && c != '\\') continue;
+			out.append(run, p);
+			switch (c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\b': out += "\\b"; break;
+			case '\f': out += "\\f"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				out += "\\u00";
+				out += hex[c >> 4];
+				out += hex[c & 15];
+			}
+			run = p + 1;
+		}
+		out.append(run, end);
+		out += '"';
+	}
+
+	//the shortest of %.15g, %.16g and %.17g that reads back as the same number
+	void number(double d) {
+		if (!std::isfinite(d)) throw std::runtime_error("cannot encode inf or nan as JSON");
+		char buffer[32];
+		int n;
+		if (d == std::floor(d) && std::fabs(d) < 1e15) {
+			n = snprintf(buffer, sizeof(buffer), "%.0f", d);
+		} else {
+			for (int precision = 15; ; ++precision) {
+				n = snprintf(buffer, sizeof(buffer), "%.*g", precision, d);
+				if (precision == 17 || strtod(buffer, nullptr) == d) break;
+			}
+		}
+		out.append(buffer, n);
+	}
+
+	void table(const Object& t) {
+		const Object_Details* details = t.details.get();
+		for (const Object_Details* v : visiting) {
+			if (v == details) throw std::runtime_error("cannot encode a table that refers to itself as JSON");
+		}
+		visiting.push_back(details);
+
+		const Object::Map& map = static_cast<const Object_Details_Table*>(details)->value;
+		//number keys sort first, so an array's keys are the first map.size() keys
+		bool isArray = !map.empty();
+		double i = 0;
+		for (const Object::Map::value_type& pair : map) {
+			if (pair.first.details->typeIndex != Object::TYPE_NUMBER
+				|| static_cast<const Object_Details_Number*>(pair.first.details.get())->value != ++i)
+			{
+				isArray = false;
+				break;
+			}
+		}
+
+		if (isArray) {
+			out += '[';
+			const char* sep = "";
+			for (const Object::Map::value_type& pair : map) {
+				out += sep;
+				value(pair.second);
+				sep = ",";
+			}
+			out += ']';
+		} else {
+			out += '{';
+			const char* sep = "";
+			for (const Object::Map::value_type& pair : map) {
+				out += sep;
+				const Object& k = pair.first;
+				if (k.details->typeIndex == Object::TYPE_STRING) {
+					string(static_cast<const Object_Details_String*>(k.details.get())->value);
+				} else if (k.details->typeIndex == Object::TYPE_NUMBER) {
+					out += '"';
+					number(static_cast<const Object_Details_Number*>(k.details.get())->value);
+					out += '"';
+				} else {
+					throw std::runtime_error("cannot encode a table with " + k.type() + " keys as JSON");
+				}
+				out += ':';
+				value(pair.second);
+				sep = ",";
+			}
+			out += '}';
+		}
+		visiting.pop_back();
+	}
+
+	void value(const Object& o) {
+		switch (o.details->typeIndex) {
+		case Object::TYPE_NIL:
+			out += "null";
+			return;
+		case Object::TYPE_BOOLEAN:
+			out += static_cast<const Object_Details_Boolean*>(o.details.get())->value ? "true" : "false";
+			return;
+		case Object::TYPE_NUMBER:
+			number(static_cast<const Object_Details_Number*>(o.details.get())->value);
+			return;
+		case Object::TYPE_STRING:
+			string(static_cast<const Object_Details_String*>(o.details.get())->value);
+			return;
+		case Object::TYPE_TABLE:
+			table(o);
+			return;
+		default: {
+			//typed arrays are written as arrays of numbers
+			std::vector<double> buffer;
+			const double* data;
+			size_t n;
+			if (o.is_userdata() && numbersOf(o, buffer, data, n)) {
+				out += '[';
+				for (size_t i = 0; i < n; ++i) {
+					if (i) out += ',';
+					number(data[i]);
+				}
+				out += ']';
+				return;
+			}
+			throw std::runtime_error("cannot encode a " + o.type() + " value as JSON");
+		}
+		}
+	}
+};
+
+void encodeJSON(const Object& o, std::string& out) {
+	JSONWriter writer(out);
+	writer.value(o);
+}
+
+Object encodeJSON(const Object& o) {
+	std::string out;
+	encodeJSON(o, out);
+	return Object(std::make_shared<Object_Details_String>(std::move(out)));
+}
+
+
+/*
+the stream's parser, which keeps its place between chunks so no input is read twice
+containers are built by a JSONBuilder whose stack persists across feeds
+a string, number or literal split between chunks is collected in 'token', and parsed by JSONParser once it's complete
+*/
+struct JSONStreamParser {
+	enum Top {
+		TOP_START,
+		TOP_VALUES,	//a sequence of top-level values
+		TOP_ARRAY_FIRST,	//after the top-level '['
+		TOP_ARRAY_VALUE,	//after a ','
+		TOP_ARRAY_COMMA,	//after an element
+		TOP_END,	//after the top-level ']'
+	};
+	//what comes next inside the innermost container
+	enum Expect {
+		EXPECT_VALUE,
+		EXPECT_FIRST_VALUE,	//after '[', a value or ']'
+		EXPECT_FIRST_KEY,	//after '{', a key or '}'
+		EXPECT_KEY,
+		EXPECT_COLON,
+		EXPECT_COMMA,	//',' or the container's end
+	};
+	enum Token {
+		TOKEN_NONE,
+		TOKEN_STRING,
+		TOKEN_NUMBER,
+		TOKEN_LITERAL,
+	};
+
+	std::unordered_map<std::string, Object> keys;	//interned across elements
+	JSONBuilder builder;
+	Top top;
+	Expect expect;
+	Token tokenKind;
+	bool tokenIsKey;
+	bool escape;	//the string token so far ends in an unescaped '\'
+	std::string token;	//the part of an unfinished token from earlier chunks
+	size_t tokenOffset;	//in the whole input
+	size_t tokenStart;	//in the current chunk, while 'token' is empty
+	size_t offset;	//of the current chunk in the whole input
+
+	JSONStreamParser()
+	: builder(keys), top(TOP_START), expect(EXPECT_VALUE), tokenKind(TOKEN_NONE), tokenIsKey(false), escape(false), tokenOffset(0), tokenStart(0), offset(0) {}
+
+	[[noreturn]] void error(size_t at, const char* what) {
+		throw std::runtime_error("JSON error at offset " + std::to_string(at) + ": " + what);
+	}
+
+	static bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+	//a value has been added to the innermost container, or finished at the top level
+	void valueDone(const std::function<void(const Object&)>& callback) {
+		if (!builder.stack.empty()) {
+			expect = EXPECT_COMMA;
+			return;
+		}
+		if (top != TOP_VALUES) top = TOP_ARRAY_COMMA;
+		Object result = std::move(builder.result);
+		builder.result = nil;
+		callback(result);
+	}
+
+	void startToken(Token kind, bool isKey, size_t at) {
+		tokenKind = kind;
+		tokenIsKey = isKey;
+		escape = false;
+		tokenOffset = at;
+		tokenStart = at - offset;
+	}
+
+	//parses a whole token, from the input if it was all in one chunk or else from 'token'
+	void finishToken(const char* s, size_t n, const std::function<void(const Object&)>& callback) {
+		tokenKind = TOKEN_NONE;
+		JSONParser<JSONBuilder> parser(s, n, tokenOffset, true, builder);
+		if (tokenIsKey) {
+			const char* k;
+			size_t kn;
+			parser.string(k, kn);
+			builder.key(k, kn);
+			expect = EXPECT_COLON;
+			return;
+		}
+		parser.value();
+		if (parser.p != parser.end) parser.error("invalid value");
+		valueDone(callback);
+	}
+
+	//finds where the unfinished token ends in data[i, n), returning false if it may go on past this chunk
+	bool scanToken(const char* data, size_t i, size_t n, size_t& e) {
+		switch (tokenKind) {
+		case TOKEN_STRING:
+			for (; i < n; ++i) {
+				if (escape) {
+					escape = false;
+				} else if (data[i] == '\\') {
+					escape = true;
+				} else if (data[i] == '"') {
+					e = i + 1;
+					return true;
+				}
+			}
+			return false;
+		case TOKEN_NUMBER:
+			while (i < n && (JSONParser<JSONBuilder>::isDigit(data[i]) || data[i] == '-' || data[i] == '+' || data[i] == '.' || data[i] == 'e' || data[i] == 'E')) ++i;
+			break;
+		default:
+			while (i < n && data[i] >= 'a' && data[i] <= 'z') ++i;
+			break;
+		}
+		//a number or literal reaching the end of the chunk may go on in the next one
+		e = i;
+		return i < n;
+	}
+
+	void open(bool isArray, size_t at) {
+		if (builder.stack.size() >= (size_t)JSONParser<JSONBuilder>::MAX_DEPTH) error(at, "too deeply nested");
+		if (isArray) {
+			builder.startArray();
+			expect = EXPECT_FIRST_VALUE;
+		} else {
+			builder.startObject();
+			expect = EXPECT_FIRST_KEY;
+		}
+	}
+
+	void close(const std::function<void(const Object&)>& callback) {
+		builder.finish();
+		valueDone(callback);
+	}
+
+	//c starts a value: containers are opened, anything else begins a token
+	void startValue(char c, size_t at) {
+		switch (c) {
+		case '{':
+			open(false, at);
+			return;
+		case '[':
+			open(true, at);
+			return;
+		case '"':
+			startToken(TOKEN_STRING, false, at);
+			return;
+		default:
+			if (c == '-' || JSONParser<JSONBuilder>::isDigit(c)) {
+				startToken(TOKEN_NUMBER, false, at);
+			} else if (c >= 'a' && c <= 'z') {
+				startToken(TOKEN_LITERAL, false, at);
+			} else {
+				error(at, "invalid value");
+			}
+		}
+	}
+
+	void feed(const char* data, size_t n, const std::function<void(const Object&)>& callback) {
+		size_t i = 0;
+		while (i < n) {
+			if (tokenKind != TOKEN_NONE) {
+				//a token begun in this chunk is parsed in place, one carried over from earlier chunks is completed in 'token'
+				size_t e;
+				if (!scanToken(data, i, n, e)) break;
+				if (token.empty()) {
+					finishToken(data + tokenStart, e - tokenStart, callback);
+				} else {
+					token.append(data, e);
+					std::string whole;
+					whole.swap(token);
+					finishToken(whole.data(), whole.size(), callback);
+				}
+				i = e;
+				continue;
+			}
+
+			char c = data[i];
+			if (isSpace(c)) {
+				++i;
+				continue;
+			}
+			size_t at = offset + i;
+
+			if (builder.stack.empty()) {
+				//between top-level values
+				switch (top) {
+				case TOP_START:
+					if (c == '[') {
+						++i;
+						top = TOP_ARRAY_FIRST;
+					} else {
+						top = TOP_VALUES;
+					}
+					continue;
+				case TOP_ARRAY_FIRST:
+					if (c == ']') {
+						++i;
+						top = TOP_END;
+						continue;
+					}
+					break;
+				case TOP_ARRAY_COMMA:
+					if (c == ',') {
+						top = TOP_ARRAY_VALUE;
+					} else if (c == ']') {
+						top = TOP_END;
+					} else {
+						error(at, "expected ',' or ']'");
+					}
+					++i;
+					continue;
+				case TOP_END:
+					error(at, "unexpected characters after the value");
+				default:
+					break;
+				}
+				startValue(c, at);
+				++i;
+				continue;
+			}
+
+			switch (expect) {
+			case EXPECT_FIRST_VALUE:
+				if (c == ']') {
+					close(callback);
+					break;
+				}
+				//fall through
+			case EXPECT_VALUE:
+				startValue(c, at);
+				break;
+			case EXPECT_FIRST_KEY:
+				if (c == '}') {
+					close(callback);
+					break;
+				}
+				//fall through
+			case EXPECT_KEY:
+				if (c != '"') error(at, "expected a string key");
+				startToken(TOKEN_STRING, true, at);
+				break;
+			case EXPECT_COLON:
+				if (c != ':') error(at, "expected ':'");
+				expect = EXPECT_VALUE;
+				break;
+			case EXPECT_COMMA: {
+				bool isArray = builder.stack.back().index >= 0;
+				if (c == ',') {
+					expect = isArray ? EXPECT_VALUE : EXPECT_KEY;
+				} else if (c == (isArray ? ']' : '}')) {
+					close(callback);
+				} else {
+					error(at, isArray ? "expected ',' or ']'" : "expected ',' or '}'");
+				}
+				break;
+			}
+			}
+			++i;
+		}
+		//keep the unfinished token for the next chunk
+		if (tokenKind != TOKEN_NONE) {
+			if (token.empty()) {
+				token.assign(data + tokenStart, n - tokenStart);
+			} else {
+				token.append(data, n);
+			}
+		}
+		offset += n;
+	}
+
+	void finish(const std::function<void(const Object&)>& callback) {
+		//a number or literal at the very end has nothing after it to end it
+		if (tokenKind == TOKEN_NUMBER || tokenKind == TOKEN_LITERAL) {
+			std::string whole;
+			whole.swap(token);
+			finishToken(whole.data(), whole.size(), callback);
+		}
+		if (tokenKind != TOKEN_NONE) error(offset, "unterminated string");
+		if (!builder.stack.empty() || top == TOP_ARRAY_FIRST || top == TOP_ARRAY_VALUE || top == TOP_ARRAY_COMMA) {
+			error(offset, "unexpected end of input");
+		}
+	}
+};
+
+JSONStream::JSONStream(std::function<void(const Object&)> callback_)
+: callback(callback_), parser(new JSONStreamParser()) {}
+
+JSONStream::~JSONStream() {}
+
+void JSONStream::feed(const char* data, size_t size) {
+	parser->feed(data, size, callback);
+}
+
+void JSONStream::feed(const std::string& s) {
+	feed(s.data(), s.size());
+}
+
+void JSONStream::finish() {
+	parser->finish(callback);
+}
+
+
+Object JSON::makeTable() {
+	return Object({
+		{"decode", [=](VarArg args)->VarArg{
+			return decodeJSON(args[1]);
+		}},
+		{"encode", [=](VarArg args)->VarArg{
+			return encodeJSON(args[1]);
+		}},
+	});
+}
+
+JSON json;
+
+}
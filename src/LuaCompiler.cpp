@@ -0,0 +1,1937 @@
+#include "CxxAsLua/LuaBytecode.h"
+#include "CxxAsLua/LuaSyntax.h"
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <unordered_map>
+
+namespace CxxAsLua {
+
+const char* const luaOpcodeNames[LUA_NUM_OPCODES] = {
+#define LUA_OPCODE_NAME(name) #name,
+	LUA_OPCODES(LUA_OPCODE_NAME)
+#undef LUA_OPCODE_NAME
+};
+
+std::string luaChunkId(const std::string& chunkname) {
+	if (!chunkname.empty() && (chunkname[0] == '=' || chunkname[0] == '@')) return chunkname.substr(1);
+	//the source itself: show its first line, shortened
+	static const size_t maxLength = 40;
+	size_t n = std::min(chunkname.find_first_of("\r\n"), maxLength);
+	bool cut = n < chunkname.size();
+	return "[string \"" + chunkname.substr(0, n) + (cut ? "...\"]" : "\"]");
+}
+
+/*
+lexer
+*/
+
+static const char* const luaTokenNames[] = {
+	"and", "break", "do", "else", "elseif", "end",
+	"false", "for", "function", "goto", "if", "in",
+	"local", "nil", "not", "or", "repeat", "return",
+	"then", "true", "until", "while",
+	"//", "..", "...", "==", ">=", "<=", "~=",
+	"<<", ">>", "::",
+	"<eof>", "<number>", "<name>", "<string>"
+};
+
+static int luaKeyword(const std::string& s) {
+	static const std::unordered_map<std::string, int> keywords = [] {
+		std::unordered_map<std::string, int> m;
+		for (int t = LUA_TK_AND; t <= LUA_TK_WHILE; ++t) m[luaTokenNames[t - LUA_TK_AND]] = t;
+		return m;
+	}();
+	std::unordered_map<std::string, int>::const_iterator i = keywords.find(s);
+	return i == keywords.end() ? 0 : i->second;
+}
+
+struct LuaToken {
+	int type = LUA_TK_EOS;
+	std::string string;	//names and strings
+	double number = 0;
+	int line = 1;
+};
+
+struct LuaLexer {
+	const char* p;
+	const char* end;
+	int line;
+	std::string chunkId;
+
+	LuaToken current;
+	LuaToken ahead;
+	bool hasAhead;
+
+	LuaLexer(const char* data, size_t size, const std::string& chunkId_)
+	: p(data), end(data + size), line(1), chunkId(chunkId_), hasAhead(false) {
+		//skip a #! line
+		if (p < end && *p == '#') {
+			while (p < end && *p != '\n' && *p != '\r') ++p;
+		}
+	}
+
+	void next() {
+		if (hasAhead) {
+			current = std::move(ahead);
+			hasAhead = false;
+		} else {
+			read(current);
+		}
+	}
+
+	const LuaToken& peek() {
+		if (!hasAhead) {
+			read(ahead);
+			hasAhead = true;
+		}
+		return ahead;
+	}
+
+	[[noreturn]] void error(const std::string& msg, int atLine) const {
+		throw std::runtime_error(chunkId + ":" + std::to_string(atLine) + ": " + msg);
+	}
+
+	std::string tokenText(const LuaToken& t) const {
+		switch (t.type) {
+		case LUA_TK_NAME:
+		case LUA_TK_STRING:
+			return t.string;
+		case LUA_TK_NUMBER: {
+			char buf[Object_Details_Number::formatSize];
+			return std::string(buf, Object_Details_Number::format(t.number, buf));
+		}
+		default:
+			if (t.type < LUA_TK_AND) return std::string(1, (char)t.type);
+			return luaTokenNames[t.type - LUA_TK_AND];
+		}
+	}
+
+	[[noreturn]] void syntaxError(const std::string& msg) const {
+		if (current.type == LUA_TK_EOS) error(msg + " near <eof>", current.line);
+		error(msg + " near '" + tokenText(current) + "'", current.line);
+	}
+
+	int at(size_t k) const { return p + k < end ? (unsigned char)p[k] : -1; }
+
+	//\n, \r, \n\r or \r\n
+	void newline() {
+		char c = *p++;
+		if (p < end && (*p == '\n' || *p == '\r') && *p != c) ++p;
+		++line;
+	}
+
+	//at a '[', returns the level of the long bracket ([==[ is 2), or -1 if it isn't one
+	int longBracket() const {
+		size_t k = 1;
+		while (at(k) == '=') ++k;
+		return at(k) == '[' ? (int)k - 1 : -1;
+	}
+
+	void readLong(int level, std::string* out, bool isComment) {
+		int startLine = line;
+		p += level + 2;
+		if (p < end && (*p == '\n' || *p == '\r')) newline();
+		for (;;) {
+			if (p >= end) error(isComment ? "unfinished long comment" : "unfinished long string", startLine);
+			char c = *p;
+			if (c == ']') {
+				int k = 1;
+				while (at(k) == '=') ++k;
+				if (k - 1 == level && at(k) == ']') {
+					p += k + 1;
+					return;
+				}
+				if (out) out->push_back(c);
+				++p;
+			} else if (c == '\n' || c == '\r') {
+				newline();
+				if (out) out->push_back('\n');
+			} else {
+				if (out) out->push_back(c);
+				++p;
+			}
+		}
+	}
+
+	static int hexValue(int c) {
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	static void appendUtf8(std::string& s, unsigned long c) {
+		if (c < 0x80) {
+			s.push_back((char)c);
+		} else if (c < 0x800) {
+			s.push_back((char)(0xC0 | (c >> 6)));
+			s.push_back((char)(0x80 | (c & 0x3F)));
+		} else if (c < 0x10000) {
+			s.push_back((char)(0xE0 | (c >> 12)));
+			s.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+			s.push_back((char)(0x80 | (c & 0x3F)));
+		} else {
+			s.push_back((char)(0xF0 | (c >> 18)));
+			s.push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+			s.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+			s.push_back((char)(0x80 | (c & 0x3F)));
+		}
+	}
+
+	void readString(LuaToken& t) {
+		char quote = *p++;
+		t.string.clear();
+		for (;;) {
+			if (p >= end) error("unfinished string", line);
+			char c = *p;
+			if (c == quote) {
+				++p;
+				return;
+			}
+			if (c == '\n' || c == '\r') error("unfinished string", line);
+			if (c != '\\') {
+				t.string.push_back(c);
+				++p;
+				continue;
+			}
+			++p;
+			if (p >= end) error("unfinished string", line);
+			c = *p;
+			switch (c) {
+			case 'a': t.string.push_back('\a'); ++p; break;
+			case 'b': t.string.push_back('\b'); ++p; break;
+			case 'f': t.string.push_back('\f'); ++p; break;
+			case 'n': t.string.push_back('\n'); ++p; break;
+			case 'r': t.string.push_back('\r'); ++p; break;
+			case 't': t.string.push_back('\t'); ++p; break;
+			case 'v': t.string.push_back('\v'); ++p; break;
+			case '\\': case '"': case '\'':
+				t.string.push_back(c);
+				++p;
+				break;
+			case '\n': case '\r':
+				newline();
+				t.string.push_back('\n');
+				break;
+			case 'x': {
+				int h1 = hexValue(at(1)), h2 = hexValue(at(2));
+				if (h1 < 0 || h2 < 0) error("hexadecimal digit expected in escape sequence", line);
+				t.string.push_back((char)(h1 * 16 + h2));
+				p += 3;
+				break;
+			}
+			case 'z':
+				++p;
+				while (p < end && isspace((unsigned char)*p)) {
+					if (*p == '\n' || *p == '\r') newline(); else ++p;
+				}
+				break;
+			case 'u': {
+				if (at(1) != '{') error("missing '{' in \\u{xxxx}", line);
+				p += 2;
+				unsigned long v = 0;
+				int digits = 0;
+				for (int h; (h = hexValue(at(0))) >= 0; ++p, ++digits) {
+					v = v * 16 + h;
+					if (v > 0x7FFFFFFFul) error("UTF-8 value too large", line);
+				}
+				if (!digits) error("hexadecimal digit expected in escape sequence", line);
+				if (at(0) != '}') error("missing '}' in \\u{xxxx}", line);
+				++p;
+				appendUtf8(t.string, v);
+				break;
+			}
+			default: {
+				if (!isdigit((unsigned char)c)) error("invalid escape sequence", line);
+				int v = 0;
+				for (int k = 0; k < 3 && p < end && isdigit((unsigned char)*p); ++k, ++p) v = v * 10 + (*p - '0');
+				if (v > 255) error("decimal escape too large", line);
+				t.string.push_back((char)v);
+				break;
+			}
+			}
+		}
+	}
+
+	void readNumber(LuaToken& t) {
+		const char* start = p;
+		if (*p == '0' && (at(1) == 'x' || at(1) == 'X')) {
+			//hex integers wrap around like Lua's 64-bit integers, hex floats are computed exactly
+			p += 2;
+			uint64_t whole = 0;
+			double mantissa = 0;
+			int exponent = 0;
+			bool isFloat = false, any = false;
+			for (int h; (h = hexValue(at(0))) >= 0; ++p) {
+				whole = whole * 16 + h;
+				mantissa = mantissa * 16 + h;
+				any = true;
+			}
+			if (at(0) == '.') {
+				isFloat = true;
+				++p;
+				for (int h; (h = hexValue(at(0))) >= 0; ++p) {
+					mantissa = mantissa * 16 + h;
+					exponent -= 4;
+					any = true;
+				}
+			}
+			if (!any) error("malformed number near '" + std::string(start, p) + "'", line);
+			if (at(0) == 'p' || at(0) == 'P') {
+				isFloat = true;
+				++p;
+				int sign = 1;
+				if (at(0) == '+' || at(0) == '-') sign = *p++ == '-' ? -1 : 1;
+				if (!isdigit(at(0))) error("malformed number near '" + std::string(start, p) + "'", line);
+				int e = 0;
+				for (; isdigit(at(0)); ++p) e = std::min(e * 10 + (*p - '0'), 100000);
+				exponent += sign * e;
+			}
+			t.number = isFloat ? ldexp(mantissa, exponent) : (double)(int64_t)whole;
+		} else {
+			while (isdigit(at(0)) || at(0) == '.') ++p;
+			if (at(0) == 'e' || at(0) == 'E') {
+				++p;
+				if (at(0) == '+' || at(0) == '-') ++p;
+				while (isdigit(at(0))) ++p;
+			}
+			std::string s(start, p);
+			char* stop = nullptr;
+			t.number = strtod(s.c_str(), &stop);
+			if (stop != s.c_str() + s.size()) error("malformed number near '" + s + "'", line);
+		}
+		if (isalnum(at(0)) || at(0) == '_' || at(0) == '.') {
+			while (isalnum(at(0)) || at(0) == '_' || at(0) == '.') ++p;
+			error("malformed number near '" + std::string(start, p) + "'", line);
+		}
+		t.type = LUA_TK_NUMBER;
+	}
+
+	void read(LuaToken& t) {
+		for (;;) {
+			t.line = line;
+			if (p >= end) {
+				t.type = LUA_TK_EOS;
+				return;
+			}
+			char c = *p;
+			switch (c) {
+			case '\n': case '\r':
+				newline();
+				continue;
+			case ' ': case '\t': case '\f': case '\v':
+				++p;
+				continue;
+			case '-':
+				if (at(1) != '-') break;
+				p += 2;
+				if (p < end && *p == '[') {
+					int level = longBracket();
+					if (level >= 0) {
+						readLong(level, nullptr, true);
+						continue;
+					}
+				}
+				while (p < end && *p != '\n' && *p != '\r') ++p;
+				continue;
+			case '[': {
+				int level = longBracket();
+				if (level < 0) break;
+				t.string.clear();
+				readLong(level, &t.string, false);
+				t.type = LUA_TK_STRING;
+				return;
+			}
+			case '"': case '\'':
+				readString(t);
+				t.type = LUA_TK_STRING;
+				return;
+			case '=':
+				if (at(1) == '=') { p += 2; t.type = LUA_TK_EQ; return; }
+				break;
+			case '<':
+				if (at(1) == '=') { p += 2; t.type = LUA_TK_LE; return; }
+				if (at(1) == '<') { p += 2; t.type = LUA_TK_SHL; return; }
+				break;
+			case '>':
+				if (at(1) == '=') { p += 2; t.type = LUA_TK_GE; return; }
+				if (at(1) == '>') { p += 2; t.type = LUA_TK_SHR; return; }
+				break;
+			case '/':
+				if (at(1) == '/') { p += 2; t.type = LUA_TK_IDIV; return; }
+				break;
+			case '~':
+				if (at(1) == '=') { p += 2; t.type = LUA_TK_NE; return; }
+				break;
+			case ':':
+				if (at(1) == ':') { p += 2; t.type = LUA_TK_DBCOLON; return; }
+				break;
+			case '.':
+				if (at(1) == '.') {
+					if (at(2) == '.') { p += 3; t.type = LUA_TK_DOTS; return; }
+					p += 2;
+					t.type = LUA_TK_CONCAT;
+					return;
+				}
+				if (isdigit(at(1))) {
+					readNumber(t);
+					return;
+				}
+				break;
+			default:
+				if (isdigit((unsigned char)c)) {
+					readNumber(t);
+					return;
+				}
+				if (isalpha((unsigned char)c) || c == '_') {
+					const char* start = p;
+					while (isalnum(at(0)) || at(0) == '_') ++p;
+					t.string.assign(start, p);
+					int keyword = luaKeyword(t.string);
+					t.type = keyword ? keyword : LUA_TK_NAME;
+					return;
+				}
+				break;
+			}
+			//single-character token
+			++p;
+			t.type = (unsigned char)c;
+			return;
+		}
+	}
+};
+
+/*
+parser
+*/
+
+struct LuaParser {
+	LuaLexer lex;
+	LuaFuncNode* fs;
+	LuaSyntaxTree& tree;
+
+	LuaParser(const char* data, size_t size, LuaSyntaxTree& tree_)
+	: lex(data, size, tree_.chunkId), fs(nullptr), tree(tree_) {}
+
+	LuaExpr* newExpr(LuaExprKind kind, int line) {
+		tree.exprs.emplace_back(new LuaExpr());
+		LuaExpr* e = tree.exprs.back().get();
+		e->kind = kind;
+		e->line = line;
+		return e;
+	}
+
+	LuaStat* newStat(LuaStatKind kind, int line) {
+		tree.stats.emplace_back(new LuaStat());
+		LuaStat* s = tree.stats.back().get();
+		s->kind = kind;
+		s->line = line;
+		return s;
+	}
+
+	LuaLocal* newLocal(const std::string& name) {
+		tree.locals.emplace_back(new LuaLocal());
+		LuaLocal* l = tree.locals.back().get();
+		l->name = name;
+		l->func = fs;
+		return l;
+	}
+
+	int type() const { return lex.current.type; }
+	int line() const { return lex.current.line; }
+
+	bool testNext(int t) {
+		if (type() != t) return false;
+		lex.next();
+		return true;
+	}
+
+	static std::string tokenName(int t) {
+		if (t < LUA_TK_AND) return std::string(1, (char)t);
+		return luaTokenNames[t - LUA_TK_AND];
+	}
+
+	void check(int t) {
+		if (type() != t) lex.syntaxError("'" + tokenName(t) + "' expected");
+	}
+
+	void checkNext(int t) {
+		check(t);
+		lex.next();
+	}
+
+	//closes what was opened on line 'where'
+	void checkMatch(int what, int who, int where) {
+		if (type() == what) {
+			lex.next();
+			return;
+		}
+		if (where == line()) lex.syntaxError("'" + tokenName(what) + "' expected");
+		lex.syntaxError("'" + tokenName(what) + "' expected (to close '" + tokenName(who) + "' at line " + std::to_string(where) + ")");
+	}
+
+	std::string checkName() {
+		check(LUA_TK_NAME);
+		std::string s = std::move(lex.current.string);
+		lex.next();
+		return s;
+	}
+
+	//scoping
+
+	static LuaLocal* findLocal(LuaFuncNode* f, const std::string& name) {
+		for (size_t i = f->actives.size(); i-- > 0;) {
+			if (f->actives[i]->name == name) return f->actives[i];
+		}
+		return nullptr;
+	}
+
+	static int addUpvalue(LuaFuncNode* f, LuaLocal* l, int parentUpvalue) {
+		for (size_t i = 0; i < f->upvalues.size(); ++i) {
+			if (f->upvalues[i].local == l) return (int)i;
+		}
+		f->upvalues.push_back(LuaFuncNode::Upvalue{l, parentUpvalue});
+		return (int)f->upvalues.size() - 1;
+	}
+
+	//-1 if 'name' isn't a local of any enclosing function, so it's a global
+	static int findUpvalue(LuaFuncNode* f, const std::string& name) {
+		if (!f->parent) return -1;
+		LuaLocal* l = findLocal(f->parent, name);
+		if (l) {
+			l->captured = true;
+			return addUpvalue(f, l, -1);
+		}
+		int i = findUpvalue(f->parent, name);
+		if (i < 0) return -1;
+		return addUpvalue(f, f->parent->upvalues[i].local, i);
+	}
+
+	LuaExpr* singleVar(const std::string& name, int atLine) {
+		LuaLocal* l = findLocal(fs, name);
+		if (l) {
+			LuaExpr* e = newExpr(LUA_EXPR_LOCAL, atLine);
+			e->local = l;
+			return e;
+		}
+		int i = findUpvalue(fs, name);
+		if (i >= 0) {
+			LuaExpr* e = newExpr(LUA_EXPR_UPVALUE, atLine);
+			e->upvalue = i;
+			return e;
+		}
+		LuaExpr* e = newExpr(LUA_EXPR_GLOBAL, atLine);
+		e->string = name;
+		return e;
+	}
+
+	//chunk and blocks
+
+	LuaFuncNode* chunk() {
+		tree.funcs.emplace_back(new LuaFuncNode());
+		LuaFuncNode* f = tree.funcs.back().get();
+		f->isVararg = true;
+		fs = f;
+		lex.next();
+		f->body = block();
+		check(LUA_TK_EOS);
+		return f;
+	}
+
+	bool blockFollow(bool withUntil) const {
+		switch (type()) {
+		case LUA_TK_ELSE: case LUA_TK_ELSEIF: case LUA_TK_END: case LUA_TK_EOS:
+			return true;
+		case LUA_TK_UNTIL:
+			return withUntil;
+		default:
+			return false;
+		}
+	}
+
+	//a block with its own scope
+	LuaBlock* block() {
+		size_t scope = fs->actives.size();
+		LuaBlock* b = statList();
+		fs->actives.resize(scope);
+		return b;
+	}
+
+	LuaBlock* statList() {
+		tree.blocks.emplace_back(new LuaBlock());
+		LuaBlock* b = tree.blocks.back().get();
+		while (!blockFollow(true)) {
+			if (type() == LUA_TK_RETURN) {
+				b->stats.push_back(retStat());
+				break;
+			}
+			LuaStat* s = statement();
+			if (s) b->stats.push_back(s);
+		}
+		return b;
+	}
+
+	LuaStat* retStat() {
+		LuaStat* s = newStat(LUA_STAT_RETURN, line());
+		lex.next();
+		if (!blockFollow(true) && type() != ';') s->exprs = exprList();
+		testNext(';');
+		if (!blockFollow(true)) lex.syntaxError("'<eof>' expected");
+		return s;
+	}
+
+	LuaStat* statement() {
+		int atLine = line();
+		switch (type()) {
+		case ';':
+			lex.next();
+			return nullptr;
+		case LUA_TK_IF:
+			return ifStat();
+		case LUA_TK_WHILE: {
+			lex.next();
+			LuaStat* s = newStat(LUA_STAT_WHILE, atLine);
+			s->exprs.push_back(expr());
+			checkNext(LUA_TK_DO);
+			s->blocks.push_back(block());
+			checkMatch(LUA_TK_END, LUA_TK_WHILE, atLine);
+			return s;
+		}
+		case LUA_TK_DO: {
+			lex.next();
+			LuaStat* s = newStat(LUA_STAT_DO, atLine);
+			s->blocks.push_back(block());
+			checkMatch(LUA_TK_END, LUA_TK_DO, atLine);
+			return s;
+		}
+		case LUA_TK_FOR:
+			return forStat();
+		case LUA_TK_REPEAT: {
+			lex.next();
+			LuaStat* s = newStat(LUA_STAT_REPEAT, atLine);
+			//the condition can see the body's locals
+			size_t scope = fs->actives.size();
+			s->blocks.push_back(statList());
+			checkMatch(LUA_TK_UNTIL, LUA_TK_REPEAT, atLine);
+			s->exprs.push_back(expr());
+			fs->actives.resize(scope);
+			return s;
+		}
+		case LUA_TK_FUNCTION:
+			return funcStat();
+		case LUA_TK_LOCAL:
+			lex.next();
+			if (testNext(LUA_TK_FUNCTION)) return localFunc(atLine);
+			return localStat(atLine);
+		case LUA_TK_DBCOLON: {
+			lex.next();
+			LuaStat* s = newStat(LUA_STAT_LABEL, atLine);
+			s->label = checkName();
+			checkNext(LUA_TK_DBCOLON);
+			return s;
+		}
+		case LUA_TK_RETURN:
+			return retStat();
+		case LUA_TK_BREAK:
+			lex.next();
+			return newStat(LUA_STAT_BREAK, atLine);
+		case LUA_TK_GOTO: {
+			lex.next();
+			LuaStat* s = newStat(LUA_STAT_GOTO, atLine);
+			s->label = checkName();
+			return s;
+		}
+		default:
+			return exprStat();
+		}
+	}
+
+	LuaStat* ifStat() {
+		int atLine = line();
+		LuaStat* s = newStat(LUA_STAT_IF, atLine);
+		do {
+			lex.next();	//'if' or 'elseif'
+			s->exprs.push_back(expr());
+			checkNext(LUA_TK_THEN);
+			s->blocks.push_back(block());
+		} while (type() == LUA_TK_ELSEIF);
+		if (testNext(LUA_TK_ELSE)) s->blocks.push_back(block());
+		checkMatch(LUA_TK_END, LUA_TK_IF, atLine);
+		return s;
+	}
+
+	LuaStat* forStat() {
+		int atLine = line();
+		lex.next();
+		std::string name = checkName();
+		LuaStat* s;
+		size_t scope = fs->actives.size();
+		if (type() == '=') {
+			lex.next();
+			s = newStat(LUA_STAT_NUMFOR, atLine);
+			s->exprs.push_back(expr());
+			checkNext(',');
+			s->exprs.push_back(expr());
+			if (testNext(',')) s->exprs.push_back(expr());
+			s->locals.push_back(newLocal(name));
+		} else if (type() == ',' || type() == LUA_TK_IN) {
+			s = newStat(LUA_STAT_GENFOR, atLine);
+			s->locals.push_back(newLocal(name));
+			while (testNext(',')) s->locals.push_back(newLocal(checkName()));
+			checkNext(LUA_TK_IN);
+			s->exprs = exprList();
+		} else {
+			lex.syntaxError("'=' or 'in' expected");
+		}
+		checkNext(LUA_TK_DO);
+		for (LuaLocal* l : s->locals) fs->actives.push_back(l);
+		s->blocks.push_back(block());
+		fs->actives.resize(scope);
+		checkMatch(LUA_TK_END, LUA_TK_FOR, atLine);
+		return s;
+	}
+
+	LuaStat* funcStat() {
+		int atLine = line();
+		lex.next();
+		//funcname: NAME {'.' NAME} [':' NAME]
+		int nameLine = line();
+		LuaExpr* target = singleVar(checkName(), nameLine);
+		bool isMethod = false;
+		while (type() == '.' || type() == ':') {
+			isMethod = type() == ':';
+			lex.next();
+			LuaExpr* key = newExpr(LUA_EXPR_STRING, line());
+			key->string = checkName();
+			LuaExpr* index = newExpr(LUA_EXPR_INDEX, key->line);
+			index->a = target;
+			index->b = key;
+			target = index;
+			if (isMethod) break;
+		}
+		LuaStat* s = newStat(LUA_STAT_ASSIGN, atLine);
+		s->targets.push_back(target);
+		s->exprs.push_back(body(isMethod, atLine));
+		return s;
+	}
+
+	LuaStat* localFunc(int atLine) {
+		LuaStat* s = newStat(LUA_STAT_LOCALFUNCTION, atLine);
+		LuaLocal* l = newLocal(checkName());
+		//in scope inside its own body, so it can recurse
+		fs->actives.push_back(l);
+		s->locals.push_back(l);
+		s->exprs.push_back(body(false, atLine));
+		return s;
+	}
+
+	LuaStat* localStat(int atLine) {
+		LuaStat* s = newStat(LUA_STAT_LOCAL, atLine);
+		do {
+			s->locals.push_back(newLocal(checkName()));
+			if (testNext('<')) {
+				//Lua 5.4 attributes: <const> is accepted and ignored, <close> isn't supported
+				std::string attrib = checkName();
+				if (attrib != "const") lex.error("unknown attribute '" + attrib + "'", atLine);
+				checkNext('>');
+			}
+		} while (testNext(','));
+		if (testNext('=')) s->exprs = exprList();
+		//the new locals aren't in scope until after the statement
+		for (LuaLocal* l : s->locals) fs->actives.push_back(l);
+		return s;
+	}
+
+	LuaStat* exprStat() {
+		int atLine = line();
+		LuaExpr* e = suffixedExpr();
+		if (type() == '=' || type() == ',') {
+			LuaStat* s = newStat(LUA_STAT_ASSIGN, atLine);
+			s->targets.push_back(e);
+			while (testNext(',')) s->targets.push_back(suffixedExpr());
+			checkNext('=');
+			s->exprs = exprList();
+			for (LuaExpr* t : s->targets) {
+				switch (t->kind) {
+				case LUA_EXPR_LOCAL: case LUA_EXPR_UPVALUE: case LUA_EXPR_GLOBAL: case LUA_EXPR_INDEX:
+					break;
+				default:
+					lex.error("syntax error (cannot assign to this expression)", t->line);
+				}
+			}
+			return s;
+		}
+		if (e->kind != LUA_EXPR_CALL && e->kind != LUA_EXPR_METHOD) lex.syntaxError("syntax error");
+		LuaStat* s = newStat(LUA_STAT_CALL, atLine);
+		s->exprs.push_back(e);
+		return s;
+	}
+
+	//expressions
+
+	std::vector<LuaExpr*> exprList() {
+		std::vector<LuaExpr*> list;
+		list.push_back(expr());
+		while (testNext(',')) list.push_back(expr());
+		return list;
+	}
+
+	LuaExpr* body(bool isMethod, int atLine) {
+		tree.funcs.emplace_back(new LuaFuncNode());
+		LuaFuncNode* f = tree.funcs.back().get();
+		f->parent = fs;
+		f->line = atLine;
+		fs = f;
+		if (isMethod) {
+			LuaLocal* self = newLocal("self");
+			f->params.push_back(self);
+			f->actives.push_back(self);
+		}
+		checkNext('(');
+		if (type() != ')') {
+			do {
+				if (testNext(LUA_TK_DOTS)) {
+					f->isVararg = true;
+					break;
+				}
+				LuaLocal* l = newLocal(checkName());
+				f->params.push_back(l);
+				f->actives.push_back(l);
+			} while (testNext(','));
+		}
+		checkNext(')');
+		f->body = block();
+		checkMatch(LUA_TK_END, LUA_TK_FUNCTION, atLine);
+		fs = f->parent;
+		LuaExpr* e = newExpr(LUA_EXPR_FUNCTION, atLine);
+		e->func = f;
+		return e;
+	}
+
+	LuaExpr* primaryExpr() {
+		int atLine = line();
+		switch (type()) {
+		case LUA_TK_NAME:
+			return singleVar(checkName(), atLine);
+		case '(': {
+			lex.next();
+			LuaExpr* e = expr();
+			checkMatch(')', '(', atLine);
+			if (e->kind == LUA_EXPR_CALL || e->kind == LUA_EXPR_METHOD || e->kind == LUA_EXPR_VARARG) {
+				LuaExpr* p = newExpr(LUA_EXPR_PAREN, atLine);
+				p->a = e;
+				return p;
+			}
+			//still not assignable
+			if (e->kind == LUA_EXPR_LOCAL || e->kind == LUA_EXPR_UPVALUE || e->kind == LUA_EXPR_GLOBAL || e->kind == LUA_EXPR_INDEX) {
+				LuaExpr* p = newExpr(LUA_EXPR_PAREN, atLine);
+				p->a = e;
+				return p;
+			}
+			return e;
+		}
+		default:
+			lex.syntaxError("unexpected symbol");
+		}
+	}
+
+	LuaExpr* suffixedExpr() {
+		LuaExpr* e = primaryExpr();
+		for (;;) {
+			int atLine = line();
+			switch (type()) {
+			case '.': {
+				lex.next();
+				LuaExpr* key = newExpr(LUA_EXPR_STRING, atLine);
+				key->string = checkName();
+				LuaExpr* index = newExpr(LUA_EXPR_INDEX, atLine);
+				index->a = e;
+				index->b = key;
+				e = index;
+				break;
+			}
+			case '[': {
+				lex.next();
+				LuaExpr* index = newExpr(LUA_EXPR_INDEX, atLine);
+				index->a = e;
+				index->b = expr();
+				checkNext(']');
+				e = index;
+				break;
+			}
+			case ':': {
+				lex.next();
+				LuaExpr* call = newExpr(LUA_EXPR_METHOD, atLine);
+				call->a = e;
+				call->string = checkName();
+				call->list = callArgs();
+				e = call;
+				break;
+			}
+			case '(': case LUA_TK_STRING: case '{': {
+				LuaExpr* call = newExpr(LUA_EXPR_CALL, atLine);
+				call->a = e;
+				call->list = callArgs();
+				e = call;
+				break;
+			}
+			default:
+				return e;
+			}
+		}
+	}
+
+	std::vector<LuaExpr*> callArgs() {
+		std::vector<LuaExpr*> args;
+		int atLine = line();
+		switch (type()) {
+		case LUA_TK_STRING: {
+			LuaExpr* s = newExpr(LUA_EXPR_STRING, atLine);
+			s->string = std::move(lex.current.string);
+			lex.next();
+			args.push_back(s);
+			break;
+		}
+		case '{':
+			args.push_back(constructor());
+			break;
+		case '(':
+			lex.next();
+			if (type() != ')') args = exprList();
+			checkMatch(')', '(', atLine);
+			break;
+		default:
+			lex.syntaxError("function arguments expected");
+		}
+		return args;
+	}
+
+	LuaExpr* constructor() {
+		int atLine = line();
+		LuaExpr* t = newExpr(LUA_EXPR_TABLE, atLine);
+		checkNext('{');
+		while (type() != '}') {
+			if (type() == LUA_TK_NAME && lex.peek().type == '=') {
+				LuaExpr* key = newExpr(LUA_EXPR_STRING, line());
+				key->string = checkName();
+				lex.next();	//'='
+				t->keys.push_back(key);
+				t->list.push_back(expr());
+			} else if (type() == '[') {
+				lex.next();
+				LuaExpr* key = expr();
+				checkNext(']');
+				checkNext('=');
+				t->keys.push_back(key);
+				t->list.push_back(expr());
+			} else {
+				t->keys.push_back(nullptr);
+				t->list.push_back(expr());
+			}
+			if (!testNext(',') && !testNext(';')) break;
+		}
+		checkMatch('}', '{', atLine);
+		return t;
+	}
+
+	LuaExpr* simpleExpr() {
+		int atLine = line();
+		LuaExpr* e;
+		switch (type()) {
+		case LUA_TK_NUMBER:
+			e = newExpr(LUA_EXPR_NUMBER, atLine);
+			e->number = lex.current.number;
+			break;
+		case LUA_TK_STRING:
+			e = newExpr(LUA_EXPR_STRING, atLine);
+			e->string = std::move(lex.current.string);
+			break;
+		case LUA_TK_NIL:
+			e = newExpr(LUA_EXPR_NIL, atLine);
+			break;
+		case LUA_TK_TRUE:
+			e = newExpr(LUA_EXPR_TRUE, atLine);
+			break;
+		case LUA_TK_FALSE:
+			e = newExpr(LUA_EXPR_FALSE, atLine);
+			break;
+		case LUA_TK_DOTS:
+			if (!fs->isVararg) lex.syntaxError("cannot use '...' outside a vararg function");
+			e = newExpr(LUA_EXPR_VARARG, atLine);
+			break;
+		case '{':
+			return constructor();
+		case LUA_TK_FUNCTION:
+			lex.next();
+			return body(false, atLine);
+		default:
+			return suffixedExpr();
+		}
+		lex.next();
+		return e;
+	}
+
+	//binary operator priorities, as in Lua 5.3
+	struct Priority {
+		int left, right;
+	};
+
+	static bool binaryPriority(int op, Priority& pr) {
+		switch (op) {
+		case '+': case '-': pr = {10, 10}; return true;
+		case '*': case '/': case '%': case LUA_TK_IDIV: pr = {11, 11}; return true;
+		case '^': pr = {14, 13}; return true;	//right associative
+		case '&': pr = {6, 6}; return true;
+		case '|': pr = {4, 4}; return true;
+		case '~': pr = {5, 5}; return true;
+		case LUA_TK_SHL: case LUA_TK_SHR: pr = {7, 7}; return true;
+		case LUA_TK_CONCAT: pr = {9, 8}; return true;	//right associative
+		case LUA_TK_EQ: case LUA_TK_NE: case '<': case LUA_TK_LE: case '>': case LUA_TK_GE: pr = {3, 3}; return true;
+		case LUA_TK_AND: pr = {2, 2}; return true;
+		case LUA_TK_OR: pr = {1, 1}; return true;
+		default: return false;
+		}
+	}
+
+	enum { UNARY_PRIORITY = 12 };
+
+	LuaExpr* expr(int limit = 0) {
+		LuaExpr* e;
+		int op = type();
+		if (op == LUA_TK_NOT || op == '-' || op == '#' || op == '~') {
+			int atLine = line();
+			lex.next();
+			e = foldUnary(op, expr(UNARY_PRIORITY), atLine);
+		} else {
+			e = simpleExpr();
+		}
+		Priority pr;
+		while (binaryPriority(op = type(), pr) && pr.left > limit) {
+			int atLine = line();
+			lex.next();
+			LuaExpr* b = expr(pr.right);
+			e = foldBinary(op, e, b, atLine);
+		}
+		return e;
+	}
+
+	//constant folding, for numbers only, and never where the result could differ at run time
+	LuaExpr* foldUnary(int op, LuaExpr* a, int atLine) {
+		if (op == '-' && a->kind == LUA_EXPR_NUMBER && a->number != 0) {
+			a->number = -a->number;
+			return a;
+		}
+		LuaExpr* e = newExpr(LUA_EXPR_UNARY, atLine);
+		e->op = op;
+		e->a = a;
+		return e;
+	}
+
+	LuaExpr* foldBinary(int op, LuaExpr* a, LuaExpr* b, int atLine) {
+		if (a->kind == LUA_EXPR_NUMBER && b->kind == LUA_EXPR_NUMBER) {
+			double x = a->number, y = b->number, r;
+			bool folded = true;
+			switch (op) {
+			case '+': r = x + y; break;
+			case '-': r = x - y; break;
+			case '*': r = x * y; break;
+			case '/': folded = y != 0; r = x / y; break;
+			case '^': r = ::pow(x, y); break;
+			default: folded = false; break;
+			}
+			if (folded && !std::isnan(r) && r != 0) {
+				a->number = r;
+				return a;
+			}
+		}
+		LuaExpr* e = newExpr(LUA_EXPR_BINARY, atLine);
+		e->op = op;
+		e->a = a;
+		e->b = b;
+		return e;
+	}
+};
+
+/*
+code generator
+registers are allocated as a stack: locals first in declaration order, temporaries above them
+*/
+
+struct LuaFuncState {
+	LuaFuncState* parent;
+	LuaFuncNode* node;
+	std::shared_ptr<LuaProto> proto;
+	const std::string& chunkId;
+
+	int freeReg = 0;	//first free register
+	int activeRegs = 0;	//registers held by locals in scope
+	int line = 0;	//for the instructions being emitted
+
+	std::unordered_map<uint64_t, int> numberConstants;	//by bit pattern, so 0 and -0 stay apart
+	std::unordered_map<std::string, int> stringConstants;
+	int nilConstant = -1, trueConstant = -1, falseConstant = -1;
+
+	std::vector<std::vector<int>> breaks;	//for each enclosing loop, the jumps to its end
+
+	struct Label {
+		std::string name;
+		int pc;
+		int level;
+	};
+	struct Goto {
+		std::string name;
+		int jump;
+		int level;
+		int line;
+	};
+	std::vector<Label> labels;	//in enclosing blocks
+	std::vector<Goto> gotos;	//not resolved yet
+	int level = 0;	//block nesting
+
+	LuaFuncState(LuaFuncState* parent_, LuaFuncNode* node_, const std::string& chunkId_)
+	: parent(parent_), node(node_), proto(std::make_shared<LuaProto>()), chunkId(chunkId_) {}
+
+	[[noreturn]] void error(const std::string& msg) const {
+		throw std::runtime_error(chunkId + ":" + std::to_string(line) + ": " + msg);
+	}
+
+	int pc() const { return (int)proto->code.size(); }
+
+	int emit(uint32_t i) {
+		proto->code.push_back(i);
+		proto->lines.push_back(line);
+		return pc() - 1;
+	}
+
+	int emitABC(LuaOpcode op, int a, int b, int c) { return emit(luaCodeABC(op, a, b, c)); }
+	int emitABx(LuaOpcode op, int a, int bx) { return emit(luaCodeABx(op, a, bx)); }
+
+	int emitJump() { return emit(luaCodeAsBx(LUA_OP_JMP, 0, 0)); }
+
+	void patch(int at, int target) {
+		int offset = target - (at + 1);
+		if (offset > LUA_MAXARG_sBx || -offset > LUA_MAXARG_sBx) error("control structure too long");
+		uint32_t& i = proto->code[at];
+		i = luaCodeAsBx(luaGetOp(i), luaGetA(i), offset);
+	}
+
+	void patchList(const std::vector<int>& jumps, int target) {
+		for (int j : jumps) patch(j, target);
+	}
+
+	void setFreeReg(int r) {
+		freeReg = r;
+		if (r > LUA_MAX_REGISTERS) error("function or expression needs too many registers");
+		if (r > proto->maxStack) proto->maxStack = r;
+	}
+
+	int reserve(int n = 1) {
+		int r = freeReg;
+		setFreeReg(freeReg + n);
+		return r;
+	}
+
+	int addConstant(const Object& o) {
+		if (proto->constants.size() > (size_t)LUA_MAXARG_Bx) error("too many constants");
+		proto->constants.push_back(o);
+		return (int)proto->constants.size() - 1;
+	}
+
+	int numberConstant(double d) {
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof(bits));
+		std::unordered_map<uint64_t, int>::iterator i = numberConstants.find(bits);
+		if (i != numberConstants.end()) return i->second;
+		int k = addConstant(Object(d));
+		numberConstants.emplace(bits, k);
+		return k;
+	}
+
+	int stringConstant(const std::string& s) {
+		std::unordered_map<std::string, int>::iterator i = stringConstants.find(s);
+		if (i != stringConstants.end()) return i->second;
+		int k = addConstant(Object(s));
+		stringConstants.emplace(s, k);
+		return k;
+	}
+
+	//the constant for a literal, or -1
+	int literalConstant(LuaExpr* e) {
+		switch (e->kind) {
+		case LUA_EXPR_NUMBER: return numberConstant(e->number);
+		case LUA_EXPR_STRING: return stringConstant(e->string);
+		case LUA_EXPR_NIL: return nilConstant >= 0 ? nilConstant : (nilConstant = addConstant(nil));
+		case LUA_EXPR_TRUE: return trueConstant >= 0 ? trueConstant : (trueConstant = addConstant(Object(true)));
+		case LUA_EXPR_FALSE: return falseConstant >= 0 ? falseConstant : (falseConstant = addConstant(Object(false)));
+		default: return -1;
+		}
+	}
+
+	int newCell() {
+		if (proto->numCells > LUA_MAXARG_B) error("too many captured local variables");
+		return proto->numCells++;
+	}
+
+	//a local comes into scope in register 'reg'
+	void activate(LuaLocal* l, int reg) {
+		l->reg = reg;
+		if (l->captured) {
+			l->cell = newCell();
+			emitABC(LUA_OP_NEWCELL, 0, l->cell, 0);
+			emitABC(LUA_OP_SETCELL, reg, l->cell, 0);
+		}
+	}
+
+	static bool isMulti(const LuaExpr* e) {
+		return e->kind == LUA_EXPR_CALL || e->kind == LUA_EXPR_METHOD || e->kind == LUA_EXPR_VARARG;
+	}
+
+	//expressions that write their target before they're done reading their operands
+	static bool writesEarly(const LuaExpr* e) {
+		switch (e->kind) {
+		case LUA_EXPR_TABLE:
+			return true;
+		case LUA_EXPR_BINARY:
+			switch (e->op) {
+			case LUA_TK_AND: case LUA_TK_OR:
+			case LUA_TK_EQ: case LUA_TK_NE: case '<': case LUA_TK_LE: case '>': case LUA_TK_GE:
+				return true;
+			}
+			return false;
+		default:
+			return false;
+		}
+	}
+
+	//expressions
+
+	static LuaOpcode arithOpcode(int op) {
+		switch (op) {
+		case '+': return LUA_OP_ADD;
+		case '-': return LUA_OP_SUB;
+		case '*': return LUA_OP_MUL;
+		case '/': return LUA_OP_DIV;
+		case '%': return LUA_OP_MOD;
+		case '^': return LUA_OP_POW;
+		case LUA_TK_IDIV: return LUA_OP_IDIV;
+		case '&': return LUA_OP_BAND;
+		case '|': return LUA_OP_BOR;
+		case '~': return LUA_OP_BXOR;
+		case LUA_TK_SHL: return LUA_OP_SHL;
+		case LUA_TK_SHR: return LUA_OP_SHR;
+		default: return LUA_NUM_OPCODES;
+		}
+	}
+
+	//a register holding the value, which may be a local's own register
+	int exprAnyReg(LuaExpr* e) {
+		if (e->kind == LUA_EXPR_LOCAL && e->local->cell < 0) return e->local->reg;
+		int r = reserve();
+		exprTo(e, r);
+		return r;
+	}
+
+	//a constant if it fits in an operand, otherwise a register
+	int exprRK(LuaExpr* e) {
+		int k = literalConstant(e);
+		if (k >= 0 && k < LUA_RK_CONSTANT) return k + LUA_RK_CONSTANT;
+		return exprAnyReg(e);
+	}
+
+	void exprTo(LuaExpr* e, int reg) {
+		int saveLine = line;
+		line = e->line;
+		int save = freeReg;
+		if (reg < activeRegs && writesEarly(e)) {
+			//assigning to a local that the expression may still read
+			int t = reserve();
+			exprTo(e, t);
+			emitABC(LUA_OP_MOVE, reg, t, 0);
+			freeReg = save;
+			line = saveLine;
+			return;
+		}
+		switch (e->kind) {
+		case LUA_EXPR_NIL:
+			emitABC(LUA_OP_LOADNIL, reg, 0, 0);
+			break;
+		case LUA_EXPR_TRUE:
+		case LUA_EXPR_FALSE:
+			emitABC(LUA_OP_LOADBOOL, reg, e->kind == LUA_EXPR_TRUE, 0);
+			break;
+		case LUA_EXPR_NUMBER:
+		case LUA_EXPR_STRING:
+			emitABx(LUA_OP_LOADK, reg, literalConstant(e));
+			break;
+		case LUA_EXPR_VARARG:
+			emitABC(LUA_OP_VARARG, reg, 2, 0);
+			break;
+		case LUA_EXPR_FUNCTION: {
+			std::shared_ptr<LuaProto> p = compileFunction(e->func);
+			if (proto->protos.size() > (size_t)LUA_MAXARG_Bx) error("too many functions");
+			proto->protos.push_back(p);
+			emitABx(LUA_OP_CLOSURE, reg, (int)proto->protos.size() - 1);
+			break;
+		}
+		case LUA_EXPR_TABLE:
+			table(e, reg);
+			break;
+		case LUA_EXPR_LOCAL:
+			if (e->local->cell >= 0) {
+				emitABC(LUA_OP_GETCELL, reg, e->local->cell, 0);
+			} else if (e->local->reg != reg) {
+				emitABC(LUA_OP_MOVE, reg, e->local->reg, 0);
+			}
+			break;
+		case LUA_EXPR_UPVALUE:
+			emitABC(LUA_OP_GETUPVAL, reg, e->upvalue, 0);
+			break;
+		case LUA_EXPR_GLOBAL:
+			emitABx(LUA_OP_GETGLOBAL, reg, stringConstant(e->string));
+			break;
+		case LUA_EXPR_INDEX: {
+			int t = exprAnyReg(e->a);
+			int k = exprRK(e->b);
+			line = e->line;
+			emitABC(LUA_OP_GETTABLE, reg, t, k);
+			break;
+		}
+		case LUA_EXPR_CALL:
+		case LUA_EXPR_METHOD: {
+			//if the target is the top register the call can go there directly
+			int base = freeReg;
+			if (reg == freeReg - 1 && reg >= activeRegs) base = reg;
+			call(e, base, 1, false);
+			if (base != reg) emitABC(LUA_OP_MOVE, reg, base, 0);
+			break;
+		}
+		case LUA_EXPR_PAREN:
+			exprTo(e->a, reg);
+			break;
+		case LUA_EXPR_UNARY: {
+			int b = exprAnyReg(e->a);
+			line = e->line;
+			LuaOpcode op = LUA_OP_UNM;
+			switch (e->op) {
+			case LUA_TK_NOT: op = LUA_OP_NOT; break;
+			case '#': op = LUA_OP_LEN; break;
+			case '~': op = LUA_OP_BNOT; break;
+			}
+			emitABC(op, reg, b, 0);
+			break;
+		}
+		case LUA_EXPR_BINARY:
+			binary(e, reg);
+			break;
+		}
+		freeReg = save;
+		line = saveLine;
+	}
+
+	void binary(LuaExpr* e, int reg) {
+		LuaOpcode op = arithOpcode(e->op);
+		if (op != LUA_NUM_OPCODES) {
+			int b = exprRK(e->a);
+			int c = exprRK(e->b);
+			line = e->line;
+			emitABC(op, reg, b, c);
+			return;
+		}
+		switch (e->op) {
+		case LUA_TK_CONCAT: {
+			//a .. b .. c is a .. (b .. c), all of which goes into consecutive registers for one CONCAT
+			std::vector<LuaExpr*> parts;
+			LuaExpr* x = e;
+			while (x->kind == LUA_EXPR_BINARY && x->op == LUA_TK_CONCAT) {
+				parts.push_back(x->a);
+				x = x->b;
+			}
+			parts.push_back(x);
+			int base = freeReg;
+			for (LuaExpr* part : parts) exprTo(part, reserve());
+			line = e->line;
+			emitABC(LUA_OP_CONCAT, reg, base, base + (int)parts.size() - 1);
+			return;
+		}
+		case LUA_TK_AND:
+		case LUA_TK_OR: {
+			//the left side's value is the result, unless it's false (for and) or true (for or)
+			exprTo(e->a, reg);
+			emitABC(LUA_OP_TEST, reg, 0, e->op == LUA_TK_OR);
+			int skip = emitJump();
+			exprTo(e->b, reg);
+			patch(skip, pc());
+			return;
+		}
+		default: {
+			//a comparison, as a value
+			std::vector<int> isTrue;
+			condJump(e, true, isTrue);
+			emitABC(LUA_OP_LOADBOOL, reg, 0, 1);
+			patchList(isTrue, pc());
+			emitABC(LUA_OP_LOADBOOL, reg, 1, 0);
+			return;
+		}
+		}
+	}
+
+	//emits code that jumps (adding the jump to 'jumps') if e is true, or false if jumpIf is false, and otherwise falls through
+	void condJump(LuaExpr* e, bool jumpIf, std::vector<int>& jumps) {
+		int saveLine = line;
+		line = e->line;
+		int save = freeReg;
+		switch (e->kind) {
+		case LUA_EXPR_NIL:
+		case LUA_EXPR_FALSE:
+			if (!jumpIf) jumps.push_back(emitJump());
+			break;
+		case LUA_EXPR_TRUE:
+		case LUA_EXPR_NUMBER:
+		case LUA_EXPR_STRING:
+			if (jumpIf) jumps.push_back(emitJump());
+			break;
+		case LUA_EXPR_PAREN:
+			condJump(e->a, jumpIf, jumps);
+			break;
+		case LUA_EXPR_UNARY:
+			if (e->op == LUA_TK_NOT) {
+				condJump(e->a, !jumpIf, jumps);
+				break;
+			}
+			testJump(e, jumpIf, jumps);
+			break;
+		case LUA_EXPR_BINARY:
+			switch (e->op) {
+			case LUA_TK_AND:
+			case LUA_TK_OR: {
+				//'a and b' is false if a is, 'a or b' is true if a is
+				bool shortCircuit = e->op == LUA_TK_OR;
+				if (jumpIf == shortCircuit) {
+					condJump(e->a, jumpIf, jumps);
+					condJump(e->b, jumpIf, jumps);
+				} else {
+					std::vector<int> skip;
+					condJump(e->a, shortCircuit, skip);
+					condJump(e->b, jumpIf, jumps);
+					patchList(skip, pc());
+				}
+				break;
+			}
+			case LUA_TK_EQ: case LUA_TK_NE: case '<': case LUA_TK_LE: case '>': case LUA_TK_GE: {
+				int b = exprRK(e->a);
+				int c = exprRK(e->b);
+				line = e->line;
+				bool cond = jumpIf;
+				LuaOpcode op = LUA_OP_EQ;
+				switch (e->op) {
+				case LUA_TK_NE: cond = !jumpIf; break;
+				case '<': op = LUA_OP_LT; break;
+				case LUA_TK_LE: op = LUA_OP_LE; break;
+				case '>': op = LUA_OP_LT; std::swap(b, c); break;
+				case LUA_TK_GE: op = LUA_OP_LE; std::swap(b, c); break;
+				}
+				emitABC(op, cond, b, c);
+				jumps.push_back(emitJump());
+				break;
+			}
+			default:
+				testJump(e, jumpIf, jumps);
+				break;
+			}
+			break;
+		default:
+			testJump(e, jumpIf, jumps);
+			break;
+		}
+		freeReg = save;
+		line = saveLine;
+	}
+
+	void testJump(LuaExpr* e, bool jumpIf, std::vector<int>& jumps) {
+		int r = exprAnyReg(e);
+		line = e->line;
+		emitABC(LUA_OP_TEST, r, 0, jumpIf);
+		jumps.push_back(emitJump());
+	}
+
+	/*
+	a call with the function at 'base' and arguments after it
+	nresults is the number of results to leave at base, or -1 for all of them (up to top)
+	*/
+	void call(LuaExpr* e, int base, int nresults, bool tail) {
+		setFreeReg(base);
+		if (e->kind == LUA_EXPR_METHOD) {
+			reserve(2);
+			int obj = exprAnyReg(e->a);
+			LuaExpr key;
+			key.kind = LUA_EXPR_STRING;
+			key.line = e->line;
+			key.string = e->string;
+			int k = exprRK(&key);
+			line = e->line;
+			emitABC(LUA_OP_SELF, base, obj, k);
+			setFreeReg(base + 2);
+		} else {
+			exprTo(e->a, reserve());
+		}
+		int n = exprList(e->list, -1);
+		int b = n < 0 ? 0 : freeReg - base;
+		line = e->line;
+		if (tail) {
+			emitABC(LUA_OP_TAILCALL, base, b, 0);
+		} else {
+			emitABC(LUA_OP_CALL, base, b, nresults + 1);
+		}
+		setFreeReg(base + (nresults > 0 ? nresults : 0));
+	}
+
+	//a call or '...' at 'base', leaving n values (-1 for all of them)
+	void multi(LuaExpr* e, int base, int n) {
+		if (e->kind == LUA_EXPR_VARARG) {
+			setFreeReg(base);
+			line = e->line;
+			if (n != 0) emitABC(LUA_OP_VARARG, base, n + 1, 0);
+			setFreeReg(base + (n > 0 ? n : 0));
+		} else {
+			call(e, base, n, false);
+		}
+	}
+
+	/*
+	evaluates a list into consecutive registers from freeReg
+	'want' adjusts it to that many values, or -1 leaves the last one open if it's a call or '...'
+	returns how many values there are, or -1 if the last one was left open
+	*/
+	int exprList(const std::vector<LuaExpr*>& list, int want) {
+		int base = freeReg;
+		int n = (int)list.size();
+		for (int i = 0; i < n; ++i) {
+			LuaExpr* e = list[i];
+			if (i == n - 1 && isMulti(e)) {
+				if (want < 0) {
+					multi(e, base + i, -1);
+					return -1;
+				}
+				if (want > i) {
+					multi(e, base + i, want - i);
+				} else {
+					multi(e, freeReg, 0);
+				}
+				setFreeReg(base + want);
+				return want;
+			}
+			exprTo(e, reserve());
+		}
+		if (want < 0) return n;
+		if (n < want) {
+			line = n ? list[n - 1]->line : line;
+			emitABC(LUA_OP_LOADNIL, base + n, want - n - 1, 0);
+		}
+		setFreeReg(base + want);
+		return want;
+	}
+
+	void table(LuaExpr* e, int reg) {
+		if (reg != freeReg - 1) {
+			//the items go in the registers after the table
+			int t = reserve();
+			table(e, t);
+			emitABC(LUA_OP_MOVE, reg, t, 0);
+			return;
+		}
+		line = e->line;
+		emitABC(LUA_OP_NEWTABLE, reg, 0, 0);
+		int pending = 0, flushed = 0;
+		for (size_t i = 0; i < e->list.size(); ++i) {
+			LuaExpr* value = e->list[i];
+			if (e->keys[i]) {
+				int k = exprRK(e->keys[i]);
+				int v = exprRK(value);
+				line = value->line;
+				emitABC(LUA_OP_SETTABLE, reg, k, v);
+				setFreeReg(reg + 1 + pending);
+				continue;
+			}
+			if (i == e->list.size() - 1 && isMulti(value)) {
+				multi(value, freeReg, -1);
+				setList(reg, 0, ++flushed);
+				pending = 0;
+				break;
+			}
+			exprTo(value, reserve());
+			if (++pending == LUA_FIELDS_PER_FLUSH) {
+				setList(reg, pending, ++flushed);
+				pending = 0;
+			}
+		}
+		if (pending) setList(reg, pending, ++flushed);
+		setFreeReg(reg + 1);
+	}
+
+	void setList(int reg, int count, int batch) {
+		if (batch <= LUA_MAXARG_C) {
+			emitABC(LUA_OP_SETLIST, reg, count, batch);
+		} else {
+			emitABC(LUA_OP_SETLIST, reg, count, 0);
+			emit((uint32_t)batch);
+		}
+		setFreeReg(reg + 1);
+	}
+
+	//assignment
+
+	void storeLocal(LuaLocal* l, LuaExpr* value) {
+		if (l->cell >= 0) {
+			int r = exprAnyReg(value);
+			emitABC(LUA_OP_SETCELL, r, l->cell, 0);
+		} else {
+			exprTo(value, l->reg);
+		}
+	}
+
+	//stores register 'r' into a variable, with the table and key of an index already evaluated into t and k
+	void storeReg(LuaExpr* target, int r, int t, int k) {
+		line = target->line;
+		switch (target->kind) {
+		case LUA_EXPR_LOCAL:
+			if (target->local->cell >= 0) {
+				emitABC(LUA_OP_SETCELL, r, target->local->cell, 0);
+			} else if (target->local->reg != r) {
+				emitABC(LUA_OP_MOVE, target->local->reg, r, 0);
+			}
+			break;
+		case LUA_EXPR_UPVALUE:
+			emitABC(LUA_OP_SETUPVAL, r, target->upvalue, 0);
+			break;
+		case LUA_EXPR_GLOBAL:
+			emitABx(LUA_OP_SETGLOBAL, r, stringConstant(target->string));
+			break;
+		case LUA_EXPR_INDEX:
+			emitABC(LUA_OP_SETTABLE, t, k, r);
+			break;
+		default:
+			error("cannot assign");
+		}
+	}
+
+	void assign(LuaStat* s) {
+		if (s->targets.size() == 1 && s->exprs.size() == 1) {
+			LuaExpr* target = s->targets[0];
+			LuaExpr* value = s->exprs[0];
+			switch (target->kind) {
+			case LUA_EXPR_LOCAL:
+				storeLocal(target->local, value);
+				return;
+			case LUA_EXPR_INDEX: {
+				int t = exprAnyReg(target->a);
+				int k = exprRK(target->b);
+				int v = exprRK(value);
+				line = target->line;
+				emitABC(LUA_OP_SETTABLE, t, k, v);
+				return;
+			}
+			default:
+				storeReg(target, exprAnyReg(value), 0, 0);
+				return;
+			}
+		}
+		//everything on the right is evaluated before anything is assigned
+		//tables and keys are copied out first, in case one of the targets is a local they're read from
+		std::vector<int> tables(s->targets.size()), keys(s->targets.size());
+		for (size_t i = 0; i < s->targets.size(); ++i) {
+			LuaExpr* target = s->targets[i];
+			if (target->kind != LUA_EXPR_INDEX) continue;
+			tables[i] = reserve();
+			exprTo(target->a, tables[i]);
+			keys[i] = literalConstant(target->b);
+			if (keys[i] >= 0 && keys[i] < LUA_RK_CONSTANT) {
+				keys[i] += LUA_RK_CONSTANT;
+			} else {
+				keys[i] = reserve();
+				exprTo(target->b, keys[i]);
+			}
+		}
+		int base = freeReg;
+		exprList(s->exprs, (int)s->targets.size());
+		for (size_t i = s->targets.size(); i-- > 0;) {
+			storeReg(s->targets[i], base + (int)i, tables[i], keys[i]);
+		}
+	}
+
+	//statements
+
+	void block(LuaBlock* b) {
+		int saveActive = activeRegs;
+		size_t saveLabels = labels.size();
+		++level;
+		for (LuaStat* s : b->stats) statement(s);
+		--level;
+		labels.resize(saveLabels);
+		//gotos still looking for a label can find it in the enclosing block
+		for (Goto& g : gotos) {
+			if (g.level > level) g.level = level;
+		}
+		activeRegs = saveActive;
+		setFreeReg(activeRegs);
+	}
+
+	void loopBody(LuaBlock* b) {
+		breaks.emplace_back();
+		block(b);
+	}
+
+	void endLoop() {
+		patchList(breaks.back(), pc());
+		breaks.pop_back();
+	}
+
+	void statement(LuaStat* s) {
+		line = s->line;
+		switch (s->kind) {
+		case LUA_STAT_LOCAL: {
+			int base = freeReg;
+			exprList(s->exprs, (int)s->locals.size());
+			line = s->line;
+			for (size_t i = 0; i < s->locals.size(); ++i) activate(s->locals[i], base + (int)i);
+			activeRegs = freeReg;
+			break;
+		}
+		case LUA_STAT_LOCALFUNCTION: {
+			LuaLocal* l = s->locals[0];
+			int r = reserve();
+			activate(l, r);
+			activeRegs = freeReg;
+			if (l->cell >= 0) {
+				int t = reserve();
+				exprTo(s->exprs[0], t);
+				emitABC(LUA_OP_SETCELL, t, l->cell, 0);
+			} else {
+				exprTo(s->exprs[0], r);
+			}
+			break;
+		}
+		case LUA_STAT_ASSIGN:
+			assign(s);
+			break;
+		case LUA_STAT_CALL:
+			call(s->exprs[0], freeReg, 0, false);
+			break;
+		case LUA_STAT_DO:
+			block(s->blocks[0]);
+			break;
+		case LUA_STAT_WHILE: {
+			int start = pc();
+			std::vector<int> exits;
+			condJump(s->exprs[0], false, exits);
+			loopBody(s->blocks[0]);
+			line = s->line;
+			patch(emitJump(), start);
+			patchList(exits, pc());
+			endLoop();
+			break;
+		}
+		case LUA_STAT_REPEAT: {
+			int start = pc();
+			breaks.emplace_back();
+			//the condition is inside the body's scope
+			int saveActive = activeRegs;
+			size_t saveLabels = labels.size();
+			++level;
+			for (LuaStat* b : s->blocks[0]->stats) statement(b);
+			std::vector<int> back;
+			condJump(s->exprs[0], false, back);
+			patchList(back, start);
+			--level;
+			labels.resize(saveLabels);
+			for (Goto& g : gotos) {
+				if (g.level > level) g.level = level;
+			}
+			activeRegs = saveActive;
+			setFreeReg(activeRegs);
+			endLoop();
+			break;
+		}
+		case LUA_STAT_IF: {
+			std::vector<int> ends;
+			for (size_t i = 0; i < s->exprs.size(); ++i) {
+				std::vector<int> next;
+				condJump(s->exprs[i], false, next);
+				block(s->blocks[i]);
+				if (i + 1 < s->blocks.size()) ends.push_back(emitJump());
+				patchList(next, pc());
+			}
+			if (s->blocks.size() > s->exprs.size()) block(s->blocks.back());
+			patchList(ends, pc());
+			break;
+		}
+		case LUA_STAT_NUMFOR: {
+			int base = freeReg;
+			exprTo(s->exprs[0], reserve());
+			exprTo(s->exprs[1], reserve());
+			if (s->exprs.size() > 2) {
+				exprTo(s->exprs[2], reserve());
+			} else {
+				emitABx(LUA_OP_LOADK, reserve(), numberConstant(1));
+			}
+			line = s->line;
+			int prep = emit(luaCodeAsBx(LUA_OP_FORPREP, base, 0));
+			int saveActive = activeRegs;
+			activeRegs = base + 3;
+			int body = pc();
+			activate(s->locals[0], reserve());
+			activeRegs = freeReg;
+			loopBody(s->blocks[0]);
+			line = s->line;
+			patch(prep, pc());
+			int loop = emit(luaCodeAsBx(LUA_OP_FORLOOP, base, 0));
+			patch(loop, body);
+			endLoop();
+			activeRegs = saveActive;
+			setFreeReg(base);
+			break;
+		}
+		case LUA_STAT_GENFOR: {
+			int base = freeReg;
+			exprList(s->exprs, 3);
+			int saveActive = activeRegs;
+			activeRegs = base + 3;
+			int nvars = (int)s->locals.size();
+			if (nvars > LUA_MAXARG_C) error("too many variables in for loop");
+			reserve(nvars);
+			line = s->line;
+			int enter = emitJump();
+			int body = pc();
+			for (int i = 0; i < nvars; ++i) activate(s->locals[i], base + 3 + i);
+			activeRegs = freeReg;
+			loopBody(s->blocks[0]);
+			line = s->line;
+			patch(enter, pc());
+			emitABC(LUA_OP_TFORLOOP, base, 0, nvars);
+			patch(emitJump(), body);
+			endLoop();
+			activeRegs = saveActive;
+			setFreeReg(base);
+			break;
+		}
+		case LUA_STAT_RETURN: {
+			if (s->exprs.size() == 1 && (s->exprs[0]->kind == LUA_EXPR_CALL || s->exprs[0]->kind == LUA_EXPR_METHOD)) {
+				call(s->exprs[0], freeReg, -1, true);
+				break;
+			}
+			if (s->exprs.size() == 1 && s->exprs[0]->kind == LUA_EXPR_LOCAL && s->exprs[0]->local->cell < 0) {
+				emitABC(LUA_OP_RETURN, s->exprs[0]->local->reg, 2, 0);
+				break;
+			}
+			int base = freeReg;
+			int n = exprList(s->exprs, -1);
+			line = s->line;
+			emitABC(LUA_OP_RETURN, base, n < 0 ? 0 : n + 1, 0);
+			break;
+		}
+		case LUA_STAT_BREAK:
+			if (breaks.empty()) error("break outside a loop");
+			breaks.back().push_back(emitJump());
+			break;
+		case LUA_STAT_GOTO: {
+			int jump = emitJump();
+			for (size_t i = labels.size(); i-- > 0;) {
+				if (labels[i].name == s->label) {
+					patch(jump, labels[i].pc);
+					return;
+				}
+			}
+			gotos.push_back(Goto{s->label, jump, level, s->line});
+			break;
+		}
+		case LUA_STAT_LABEL: {
+			for (const Label& l : labels) {
+				if (l.name == s->label) error("label '" + s->label + "' already defined");
+			}
+			labels.push_back(Label{s->label, pc(), level});
+			for (size_t i = 0; i < gotos.size();) {
+				if (gotos[i].name == s->label && gotos[i].level >= level) {
+					patch(gotos[i].jump, pc());
+					gotos.erase(gotos.begin() + i);
+				} else {
+					++i;
+				}
+			}
+			break;
+		}
+		}
+		setFreeReg(activeRegs);
+	}
+
+	std::shared_ptr<LuaProto> compileFunction(LuaFuncNode* child) {
+		LuaFuncState f(this, child, chunkId);
+		return f.compile();
+	}
+
+	std::shared_ptr<LuaProto> compile() {
+		LuaProto& p = *proto;
+		p.source = chunkId;
+		p.line = node->line;
+		p.isVararg = node->isVararg;
+		p.numParams = (int)node->params.size();
+		line = node->line;
+		for (LuaLocal* l : node->params) activate(l, reserve());
+		activeRegs = freeReg;
+		block(node->body);
+		emitABC(LUA_OP_RETURN, 0, 1, 0);
+		if (!gotos.empty()) {
+			line = gotos[0].line;
+			error("no visible label '" + gotos[0].name + "' for goto");
+		}
+		if (node->upvalues.size() > (size_t)LUA_MAXARG_B + 1) error("too many upvalues");
+		for (const LuaFuncNode::Upvalue& u : node->upvalues) {
+			if (u.parentUpvalue < 0) {
+				p.upvalues.push_back(LuaProto::Upvalue{true, u.local->cell});
+			} else {
+				p.upvalues.push_back(LuaProto::Upvalue{false, u.parentUpvalue});
+			}
+		}
+		p.globalSlots.resize(p.constants.size());
+		return proto;
+	}
+};
+
+std::unique_ptr<LuaSyntaxTree> parseLua(const char* source, size_t size, const std::string& chunkname) {
+	std::unique_ptr<LuaSyntaxTree> tree(new LuaSyntaxTree());
+	tree->chunkId = luaChunkId(chunkname);
+	LuaParser parser(source, size, *tree);
+	tree->main = parser.chunk();
+	return tree;
+}
+
+std::shared_ptr<LuaProto> compileLua(const char* source, size_t size, const std::string& chunkname) {
+	std::unique_ptr<LuaSyntaxTree> tree = parseLua(source, size, chunkname);
+	LuaFuncState f(nullptr, tree->main, tree->chunkId);
+	return f.compile();
+}
+
+std::string LuaProto::disassemble() const {
+	std::string s = "function <" + source + ":" + std::to_string(line) + "> (" + std::to_string(code.size()) + " instructions)\n";
+	for (size_t pc = 0; pc < code.size(); ++pc) {
+		uint32_t i = code[pc];
+		LuaOpcode op = luaGetOp(i);
+		char buf[128];
+		switch (op) {
+		case LUA_OP_LOADK: case LUA_OP_GETGLOBAL: case LUA_OP_SETGLOBAL: case LUA_OP_CLOSURE:
+			snprintf(buf, sizeof(buf), "\t%d\t[%d]\t%-10s%d %d\n", (int)pc + 1, lines[pc], luaOpcodeNames[op], luaGetA(i), luaGetBx(i));
+			break;
+		case LUA_OP_JMP: case LUA_OP_FORPREP: case LUA_OP_FORLOOP:
+			snprintf(buf, sizeof(buf), "\t%d\t[%d]\t%-10s%d %d\n", (int)pc + 1, lines[pc], luaOpcodeNames[op], luaGetA(i), luaGetsBx(i));
+			break;
+		default:
+			snprintf(buf, sizeof(buf), "\t%d\t[%d]\t%-10s%d %d %d\n", (int)pc + 1, lines[pc], luaOpcodeNames[op], luaGetA(i), luaGetB(i), luaGetC(i));
+			break;
+		}
+		s += buf;
+		if (op == LUA_OP_SETLIST && luaGetC(i) == 0) ++pc;
+	}
+	for (const std::shared_ptr<LuaProto>& p : protos) s += p->disassemble();
+	return s;
+}
+
+}
@@ -0,0 +1,1441 @@
+#include "CxxAsLua/LuaTranslator.h"
+#include "CxxAsLua/LuaSyntax.h"
+#include "CxxAsLua/LuaBytecode.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <unordered_map>
+
+namespace CxxAsLua {
+
+/*
+analysis
+what the translator knows about each local and function before it writes any C++
+*/
+
+struct LuaTranslateLocal {
+	std::string cname;
+	bool number = false;	//only ever holds numbers, so it's a double
+	bool reassigned = false;	//the target of an assignment
+	bool cell = false;	//captured and assigned after its declaration, so closures share it through a cell
+	bool param = false;
+	int valueUses = 0;	//uses other than as the function of a call
+	const LuaFuncNode* function = nullptr;	//for 'local function's
+	bool direct = false;	//a 'local function' written as a static C++ function
+
+	//the values it's given, with the function each appears in, null for nil or values of unknown type
+	std::vector<std::pair<const LuaExpr*, const LuaFuncNode*>> sources;
+
+	//calls of a 'local function', with the function each appears in
+	std::vector<std::pair<const LuaExpr*, const LuaFuncNode*>> calls;
+};
+
+struct LuaTranslateFunc {
+	const LuaLocal* local = nullptr;	//for 'local function's
+	std::vector<const LuaStat*> returns;
+	bool returnsNumber = false;	//a direct function returning one number on every path
+	bool usesVarargs = false;
+};
+
+//math functions called directly when the chunk leaves the global 'math' alone
+struct LuaKnownMath {
+	const char* name;
+	size_t args;
+	const char* cxx;
+};
+
+static const LuaKnownMath luaKnownMath[] = {
+	{"abs", 1, "std::fabs"},
+	{"acos", 1, "std::acos"},
+	{"asin", 1, "std::asin"},
+	{"atan", 1, "std::atan"},
+	{"atan2", 2, "std::atan2"},
+	{"ceil", 1, "std::ceil"},
+	{"cos", 1, "std::cos"},
+	{"cosh", 1, "std::cosh"},
+	{"exp", 1, "std::exp"},
+	{"floor", 1, "std::floor"},
+	{"log", 1, "std::log"},
+	{"log10", 1, "std::log10"},
+	{"max", 2, "std::max"},
+	{"min", 2, "std::min"},
+	{"pow", 2, "std::pow"},
+	{"sin", 1, "std::sin"},
+	{"sinh", 1, "std::sinh"},
+	{"sqrt", 1, "std::sqrt"},
+	{"tan", 1, "std::tan"},
+	{"tanh", 1, "std::tanh"},
+};
+
+static bool luaIsArithmetic(int op) {
+	switch (op) {
+	case '+': case '-': case '*': case '/': case '%': case '^': case LUA_TK_IDIV:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool luaIsMulti(const LuaExpr* e) {
+	return e->kind == LUA_EXPR_CALL || e->kind == LUA_EXPR_METHOD || e->kind == LUA_EXPR_VARARG;
+}
+
+//true if every path through the block ends in a return
+static bool luaAlwaysReturns(const LuaBlock* b) {
+	if (b->stats.empty()) return false;
+	const LuaStat* s = b->stats.back();
+	switch (s->kind) {
+	case LUA_STAT_RETURN:
+		return true;
+	case LUA_STAT_DO:
+		return luaAlwaysReturns(s->blocks[0]);
+	case LUA_STAT_IF:
+		if (s->blocks.size() == s->exprs.size()) return false;	//no else
+		for (const LuaBlock* branch : s->blocks) {
+			if (!luaAlwaysReturns(branch)) return false;
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+//the shortest literal that reads back as the same double
+static std::string luaNumberLiteral(double d) {
+	if (std::isinf(d)) return d > 0 ? "HUGE_VAL" : "(-HUGE_VAL)";
+	if (std::isnan(d)) return "NAN";
+	char buf[32];
+	for (int precision = 15; precision <= 17; ++precision) {
+		snprintf(buf, sizeof(buf), "%.*g", precision, d);
+		if (strtod(buf, nullptr) == d) break;
+	}
+	std::string s = buf;
+	if (s.find_first_of(".e") == std::string::npos) s += ".";
+	if (d < 0) s = "(" + s + ")";
+	return s;
+}
+
+static std::string luaStringLiteral(const std::string& s) {
+	std::string out = "\"";
+	for (unsigned char c : s) {
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\t': out += "\\t"; break;
+		case '?': out += "\\?"; break;	//no trigraphs
+		default:
+			if (c < 32 || c >= 127) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\%03o", c);
+				out += buf;
+			} else {
+				out += (char)c;
+			}
+		}
+	}
+	return out + "\"";
+}
+
+struct LuaTranslator {
+	const LuaSyntaxTree& tree;
+	std::string functionName;
+
+	std::unordered_map<const LuaLocal*, LuaTranslateLocal> locals;
+	std::unordered_map<const LuaFuncNode*, LuaTranslateFunc> funcs;
+	std::set<std::string> assignedGlobals;
+	std::vector<const LuaStat*> genericFors;
+	LuaExpr numberSource;	//stands for a value known to be a number, like a numeric for's variable
+	int nextId = 0;
+
+	//the function being analysed or written
+	const LuaFuncNode* fn = nullptr;
+
+	LuaTranslator(const LuaSyntaxTree& tree_, const std::string& functionName_)
+	: tree(tree_), functionName(functionName_) {
+		numberSource.kind = LUA_EXPR_NUMBER;
+		numberSource.line = 0;
+	}
+
+	LuaTranslateLocal& info(const LuaLocal* l) { return locals[l]; }
+
+	static const LuaLocal* localOf(const LuaExpr* e, const LuaFuncNode* f) {
+		if (e->kind == LUA_EXPR_LOCAL) return e->local;
+		if (e->kind == LUA_EXPR_UPVALUE) return f->upvalues[e->upvalue].local;
+		return nullptr;
+	}
+
+	void declare(const LuaLocal* l) {
+		info(l).cname = l->name + "_" + std::to_string(++nextId);
+	}
+
+	void addSource(const LuaLocal* l, const LuaExpr* e) {
+		info(l).sources.push_back(std::make_pair(e, fn));
+	}
+
+	//walking the tree
+
+	void walkFunc(const LuaFuncNode* f) {
+		const LuaFuncNode* saved = fn;
+		fn = f;
+		funcs[f];
+		for (const LuaLocal* p : f->params) {
+			declare(p);
+			info(p).param = true;
+		}
+		walkBlock(f->body);
+		fn = saved;
+	}
+
+	void walkBlock(const LuaBlock* b) {
+		for (const LuaStat* s : b->stats) walkStat(s);
+	}
+
+	void walkTarget(const LuaExpr* t, const LuaExpr* value) {
+		switch (t->kind) {
+		case LUA_EXPR_LOCAL:
+		case LUA_EXPR_UPVALUE: {
+			const LuaLocal* l = localOf(t, fn);
+			info(l).reassigned = true;
+			addSource(l, value);
+			break;
+		}
+		case LUA_EXPR_GLOBAL:
+			assignedGlobals.insert(t->string);
+			break;
+		default:
+			walkExpr(t->a);
+			walkExpr(t->b);
+			break;
+		}
+	}
+
+	void walkStat(const LuaStat* s) {
+		switch (s->kind) {
+		case LUA_STAT_LOCAL:
+			for (const LuaExpr* e : s->exprs) walkExpr(e);
+			for (size_t i = 0; i < s->locals.size(); ++i) {
+				declare(s->locals[i]);
+				addSource(s->locals[i], i < s->exprs.size() ? s->exprs[i] : nullptr);
+			}
+			break;
+		case LUA_STAT_LOCALFUNCTION: {
+			const LuaLocal* l = s->locals[0];
+			declare(l);
+			const LuaFuncNode* f = s->exprs[0]->func;
+			info(l).function = f;
+			addSource(l, nullptr);
+			walkExpr(s->exprs[0]);
+			funcs[f].local = l;
+			break;
+		}
+		case LUA_STAT_ASSIGN:
+			for (const LuaExpr* e : s->exprs) walkExpr(e);
+			for (size_t i = 0; i < s->targets.size(); ++i) {
+				walkTarget(s->targets[i], i < s->exprs.size() ? s->exprs[i] : nullptr);
+			}
+			break;
+		case LUA_STAT_NUMFOR:
+			for (const LuaExpr* e : s->exprs) walkExpr(e);
+			declare(s->locals[0]);
+			addSource(s->locals[0], &numberSource);
+			walkBlock(s->blocks[0]);
+			break;
+		case LUA_STAT_GENFOR:
+			for (const LuaExpr* e : s->exprs) walkExpr(e);
+			for (const LuaLocal* l : s->locals) {
+				declare(l);
+				addSource(l, nullptr);
+			}
+			genericFors.push_back(s);
+			walkBlock(s->blocks[0]);
+			break;
+		case LUA_STAT_RETURN:
+			funcs[fn].returns.push_back(s);
+			for (const LuaExpr* e : s->exprs) walkExpr(e);
+			break;
+		default:
+			for (const LuaExpr* e : s->exprs) walkExpr(e);
+			for (const LuaBlock* b : s->blocks) walkBlock(b);
+			break;
+		}
+	}
+
+	void walkExpr(const LuaExpr* e) {
+		if (!e) return;
+		switch (e->kind) {
+		case LUA_EXPR_VARARG:
+			funcs[fn].usesVarargs = true;
+			break;
+		case LUA_EXPR_FUNCTION:
+			walkFunc(e->func);
+			break;
+		case LUA_EXPR_TABLE:
+			for (const LuaExpr* k : e->keys) walkExpr(k);
+			for (const LuaExpr* v : e->list) walkExpr(v);
+			break;
+		case LUA_EXPR_LOCAL:
+		case LUA_EXPR_UPVALUE:
+			info(localOf(e, fn)).valueUses++;
+			break;
+		case LUA_EXPR_CALL: {
+			const LuaLocal* l = localOf(e->a, fn);
+			if (l) {
+				info(l).calls.push_back(std::make_pair(e, fn));
+			} else {
+				walkExpr(e->a);
+			}
+			for (const LuaExpr* a : e->list) walkExpr(a);
+			break;
+		}
+		default:
+			walkExpr(e->a);
+			walkExpr(e->b);
+			for (const LuaExpr* a : e->list) walkExpr(a);
+			break;
+		}
+	}
+
+	//types
+
+	const LuaKnownMath* knownMath(const LuaExpr* index) const {
+		if (index->kind != LUA_EXPR_INDEX || index->a->kind != LUA_EXPR_GLOBAL || index->a->string != "math") return nullptr;
+		if (index->b->kind != LUA_EXPR_STRING || assignedGlobals.count("math")) return nullptr;
+		for (const LuaKnownMath& m : luaKnownMath) {
+			if (index->b->string == m.name) return &m;
+		}
+		return nullptr;
+	}
+
+	bool knownMathConstant(const LuaExpr* index, double& d) const {
+		if (index->kind != LUA_EXPR_INDEX || index->a->kind != LUA_EXPR_GLOBAL || index->a->string != "math") return false;
+		if (index->b->kind != LUA_EXPR_STRING || assignedGlobals.count("math")) return false;
+		if (index->b->string == "pi") {
+			d = std::acos(-1.);
+			return true;
+		}
+		if (index->b->string == "huge") {
+			d = HUGE_VAL;
+			return true;
+		}
+		return false;
+	}
+
+	//the direct function a call calls, if it does
+	const LuaFuncNode* directCallee(const LuaExpr* call, const LuaFuncNode* f) {
+		if (call->kind != LUA_EXPR_CALL) return nullptr;
+		const LuaLocal* l = localOf(call->a, f);
+		if (!l || !info(l).direct) return nullptr;
+		return info(l).function;
+	}
+
+	//a call to a known math function with the right number of number arguments
+	const LuaKnownMath* mathCall(const LuaExpr* call, const LuaFuncNode* f) {
+		if (call->kind != LUA_EXPR_CALL) return nullptr;
+		const LuaKnownMath* m = knownMath(call->a);
+		if (!m || call->list.size() != m->args) return nullptr;
+		for (const LuaExpr* a : call->list) {
+			if (luaIsMulti(a) || !isNumber(a, f)) return nullptr;
+		}
+		return m;
+	}
+
+	bool isNumber(const LuaExpr* e, const LuaFuncNode* f) {
+		if (!e) return false;
+		if (e == &numberSource) return true;
+		double d;
+		switch (e->kind) {
+		case LUA_EXPR_NUMBER:
+			return true;
+		case LUA_EXPR_LOCAL:
+		case LUA_EXPR_UPVALUE:
+			return info(localOf(e, f)).number;
+		case LUA_EXPR_PAREN:
+			return isNumber(e->a, f);
+		case LUA_EXPR_UNARY:
+			return e->op == '-' && isNumber(e->a, f);
+		case LUA_EXPR_BINARY:
+			return luaIsArithmetic(e->op) && isNumber(e->a, f) && isNumber(e->b, f);
+		case LUA_EXPR_CALL: {
+			const LuaFuncNode* callee = directCallee(e, f);
+			if (callee) return funcs[callee].returnsNumber;
+			return mathCall(e, f) != nullptr;
+		}
+		case LUA_EXPR_INDEX:
+			return knownMathConstant(e, d);
+		default:
+			return false;
+		}
+	}
+
+	//the value of a number expression that doesn't change, including locals only ever given one
+	bool constantNumber(const LuaExpr* e, const LuaFuncNode* f, double& d) {
+		if (e == &numberSource) return false;
+		double x, y;
+		switch (e->kind) {
+		case LUA_EXPR_NUMBER:
+			d = e->number;
+			return true;
+		case LUA_EXPR_LOCAL:
+		case LUA_EXPR_UPVALUE: {
+			LuaTranslateLocal& l = info(localOf(e, f));
+			if (!l.number || l.reassigned || l.sources.size() != 1) return false;
+			return constantNumber(l.sources[0].first, l.sources[0].second, d);
+		}
+		case LUA_EXPR_PAREN:
+			return constantNumber(e->a, f, d);
+		case LUA_EXPR_UNARY:
+			if (e->op != '-' || !constantNumber(e->a, f, x)) return false;
+			d = -x;
+			return true;
+		case LUA_EXPR_BINARY:
+			if (!luaIsArithmetic(e->op) || !constantNumber(e->a, f, x) || !constantNumber(e->b, f, y)) return false;
+			switch (e->op) {
+			case '+': d = x + y; break;
+			case '-': d = x - y; break;
+			case '*': d = x * y; break;
+			case '/': d = x / y; break;
+			case '%': d = ::fmod(x, y); if (d != 0 && (d < 0) != (y < 0)) d += y; break;
+			case '^': d = ::pow(x, y); break;
+			default: d = ::floor(x / y); break;
+			}
+			return !std::isnan(d);
+		case LUA_EXPR_INDEX:
+			return knownMathConstant(e, d);
+		default:
+			return false;
+		}
+	}
+
+	void analyse() {
+		walkFunc(tree.main);
+
+		//captured locals that change after the closure is made need a cell
+		//a 'local function' that calls itself is assigned after its closure captures it
+		for (std::pair<const LuaLocal* const, LuaTranslateLocal>& i : locals) {
+			const LuaLocal* l = i.first;
+			LuaTranslateLocal& t = i.second;
+			bool selfCaptured = false;
+			if (t.function) {
+				for (const LuaFuncNode::Upvalue& u : t.function->upvalues) {
+					if (u.local == l) selfCaptured = true;
+				}
+			}
+			t.cell = l->captured && (t.reassigned || selfCaptured);
+		}
+
+		//direct functions: only called, never reassigned, and only capturing other direct functions
+		for (std::pair<const LuaLocal* const, LuaTranslateLocal>& i : locals) {
+			LuaTranslateLocal& t = i.second;
+			if (!t.function || t.reassigned || t.valueUses || t.function->isVararg) continue;
+			t.direct = true;
+			size_t numParams = t.function->params.size();
+			for (const std::pair<const LuaExpr*, const LuaFuncNode*>& c : t.calls) {
+				//a call or ... spreading over more than one parameter
+				const std::vector<LuaExpr*>& args = c.first->list;
+				if (!args.empty() && luaIsMulti(args.back()) && args.size() < numParams) t.direct = false;
+			}
+		}
+		for (bool changed = true; changed;) {
+			changed = false;
+			for (std::pair<const LuaLocal* const, LuaTranslateLocal>& i : locals) {
+				LuaTranslateLocal& t = i.second;
+				if (!t.direct) continue;
+				for (const LuaFuncNode::Upvalue& u : t.function->upvalues) {
+					if (!info(u.local).direct) {
+						t.direct = false;
+						changed = true;
+						break;
+					}
+				}
+			}
+		}
+
+		//a direct function's parameters get what its calls pass
+		for (std::pair<const LuaLocal* const, LuaTranslateLocal>& i : locals) {
+			LuaTranslateLocal& t = i.second;
+			if (!t.direct) continue;
+			const std::vector<LuaLocal*>& params = t.function->params;
+			for (const std::pair<const LuaExpr*, const LuaFuncNode*>& c : t.calls) {
+				for (size_t p = 0; p < params.size(); ++p) {
+					const LuaExpr* arg = p < c.first->list.size() ? c.first->list[p] : nullptr;
+					info(params[p]).sources.push_back(std::make_pair(arg, c.second));
+				}
+			}
+			LuaTranslateFunc& f = funcs[t.function];
+			f.returnsNumber = luaAlwaysReturns(t.function->body);
+			for (const LuaStat* r : f.returns) {
+				if (r->exprs.size() != 1) f.returnsNumber = false;
+			}
+		}
+
+		//ipairs loops count up from 1
+		for (const LuaStat* s : genericFors) {
+			if (isIpairs(s)) info(s->locals[0]).sources[0].first = &numberSource;
+		}
+
+		//start by assuming every local that could be a number is one, then take back what doesn't hold
+		for (std::pair<const LuaLocal* const, LuaTranslateLocal>& i : locals) {
+			LuaTranslateLocal& t = i.second;
+			t.number = !t.cell && !t.function && !t.sources.empty();
+			if (t.param) {
+				const LuaLocal* owner = funcs[i.first->func].local;
+				if (!owner || !locals[owner].direct) t.number = false;
+			}
+			for (const std::pair<const LuaExpr*, const LuaFuncNode*>& s : t.sources) {
+				if (!s.first) t.number = false;
+			}
+		}
+		for (bool changed = true; changed;) {
+			changed = false;
+			for (std::pair<const LuaLocal* const, LuaTranslateLocal>& i : locals) {
+				LuaTranslateLocal& t = i.second;
+				if (!t.number) continue;
+				for (const std::pair<const LuaExpr*, const LuaFuncNode*>& s : t.sources) {
+					if (!isNumber(s.first, s.second)) {
+						t.number = false;
+						changed = true;
+						break;
+					}
+				}
+			}
+			for (std::pair<const LuaFuncNode* const, LuaTranslateFunc>& i : funcs) {
+				LuaTranslateFunc& f = i.second;
+				if (!f.returnsNumber) continue;
+				for (const LuaStat* r : f.returns) {
+					if (!isNumber(r->exprs[0], i.first)) {
+						f.returnsNumber = false;
+						changed = true;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	//for k, v in ipairs(t), with the global ipairs left alone
+	bool isIpairs(const LuaStat* s) const {
+		if (s->exprs.size() != 1 || s->locals.size() > 2) return false;
+		const LuaExpr* call = s->exprs[0];
+		if (call->kind != LUA_EXPR_CALL || call->a->kind != LUA_EXPR_GLOBAL || call->a->string != "ipairs") return false;
+		if (assignedGlobals.count("ipairs")) return false;
+		return call->list.size() == 1 && !luaIsMulti(call->list[0]);
+	}
+
+	/*
+	writing C++
+	*/
+
+	enum FunctionKind {
+		FUNCTION_MAIN,	//the chunk, called as a C++ function
+		FUNCTION_LAMBDA,	//a closure, called through Object::call so it can make tail calls
+		FUNCTION_DIRECT,	//a static C++ function
+	};
+
+	std::string* out = nullptr;
+	int indent = 0;
+	FunctionKind kind = FUNCTION_MAIN;
+	std::vector<std::unordered_map<std::string, std::string>> labels;
+	bool usedGlobals = false;	//whether the function being written needs env
+	int nextTemp = 0;
+
+	std::vector<std::string> constantInits;
+	std::unordered_map<std::string, int> constantIndex;
+	std::unordered_map<std::string, int> globalIndex;	//each global's LuaGlobalSlot, shared by every place that uses it
+	std::string declarations;	//of direct functions
+	std::string definitions;
+
+	void line(const std::string& s) {
+		out->append(indent, '\t');
+		*out += s;
+		*out += '\n';
+	}
+
+	std::string temp() {
+		return "tmp" + std::to_string(++nextTemp);
+	}
+
+	std::string constant(const std::string& key, const std::string& init) {
+		std::unordered_map<std::string, int>::iterator i = constantIndex.find(key);
+		if (i == constantIndex.end()) {
+			i = constantIndex.emplace(key, (int)constantInits.size()).first;
+			constantInits.push_back(init);
+		}
+		return "luaK[" + std::to_string(i->second) + "]";
+	}
+
+	//the LuaGlobalSlot for luaGetGlobal and luaSetGlobal
+	std::string globalSlot(const std::string& name) {
+		std::unordered_map<std::string, int>::iterator i = globalIndex.find(name);
+		if (i == globalIndex.end()) i = globalIndex.emplace(name, (int)globalIndex.size()).first;
+		return "luaG[" + std::to_string(i->second) + "]";
+	}
+
+	std::string stringConstant(const std::string& s) {
+		return constant("s" + s, "Object(std::string(" + luaStringLiteral(s) + ", " + std::to_string(s.size()) + "))");
+	}
+
+	std::string numberConstant(double d) {
+		return constant("n" + luaNumberLiteral(d), "Object(" + luaNumberLiteral(d) + ")");
+	}
+
+	static std::string join(const std::vector<std::string>& list) {
+		std::string s;
+		for (size_t i = 0; i < list.size(); ++i) {
+			if (i) s += ", ";
+			s += list[i];
+		}
+		return s;
+	}
+
+	/*
+	evaluation order
+	Lua evaluates operands and arguments left to right, where C++ leaves the order of function arguments and most operators' operands unspecified
+	so when more than one operand can have side effects, all but the last of those are evaluated first into temporaries,
+	in a lambda called in place, as 'and' and 'or' are
+	*/
+
+	struct Operand {
+		const char* type;	//"Object", "double" or "VarArg"
+		const LuaExpr* e;	//null for code without side effects that isn't an expression
+		std::string code;
+	};
+
+	Operand operand(const LuaExpr* e) {
+		return isNumber(e) ? Operand{"double", e, num(e)} : Operand{"Object", e, obj(e)};
+	}
+
+	//whether evaluating e can do anything, or see what evaluating something else did
+	//locals in cells can be changed by any call, so only constants and other locals are left out
+	bool sideEffects(const LuaExpr* e) {
+		double d;
+		if (constantNumber(e, fn, d)) return false;
+		switch (e->kind) {
+		case LUA_EXPR_NIL:
+		case LUA_EXPR_TRUE:
+		case LUA_EXPR_FALSE:
+		case LUA_EXPR_NUMBER:
+		case LUA_EXPR_STRING:
+		case LUA_EXPR_VARARG:
+		case LUA_EXPR_FUNCTION:
+			return false;
+		case LUA_EXPR_LOCAL:
+		case LUA_EXPR_UPVALUE:
+			return info(localOf(e, fn)).cell;
+		case LUA_EXPR_PAREN:
+			return sideEffects(e->a);
+		case LUA_EXPR_UNARY:
+			//anything else can call a metamethod
+			if (e->op == LUA_TK_NOT || isNumber(e)) return sideEffects(e->a);
+			return true;
+		case LUA_EXPR_BINARY:
+			if (e->op == LUA_TK_AND || e->op == LUA_TK_OR || isNumber(e)) return sideEffects(e->a) || sideEffects(e->b);
+			return true;
+		default:
+			return true;
+		}
+	}
+
+	//declarations of the temporaries the operands need, changing their code to the temporaries
+	//with 'all', every operand with side effects gets one, for when the last's has to come after the rest too
+	std::string sequence(std::vector<Operand>& operands, bool all = false) {
+		size_t count = 0, last = 0;
+		for (size_t i = 0; i < operands.size(); ++i) {
+			if (operands[i].e && sideEffects(operands[i].e)) {
+				++count;
+				last = i;
+			}
+		}
+		if (count < (all ? 1 : 2)) return std::string();
+		std::string before;
+		for (size_t i = 0; i < operands.size(); ++i) {
+			if (!operands[i].e || !sideEffects(operands[i].e) || (i == last && !all)) continue;
+			std::string t = temp();
+			before += std::string(operands[i].type) + " " + t + " = " + operands[i].code + "; ";
+			operands[i].code = t;
+		}
+		return before;
+	}
+
+	static std::string after(const std::string& before, const char* type, const std::string& expr) {
+		if (before.empty()) return expr;
+		return std::string("[&]() -> ") + type + " { " + before + "return " + expr + "; }()";
+	}
+
+	//prefix a middle b suffix, with a evaluated before b however they're written
+	std::string binary(const char* type, Operand a, Operand b, const std::string& prefix, const std::string& middle, const std::string& suffix, bool swapped = false) {
+		std::vector<Operand> o = {a, b};
+		std::string before = sequence(o);
+		if (swapped) std::swap(o[0], o[1]);
+		return after(before, type, prefix + o[0].code + middle + o[1].code + suffix);
+	}
+
+	static const char* opcodeName(int op) {
+		switch (op) {
+		case '+': return "LUA_OP_ADD";
+		case '-': return "LUA_OP_SUB";
+		case '*': return "LUA_OP_MUL";
+		case '/': return "LUA_OP_DIV";
+		case '%': return "LUA_OP_MOD";
+		case '^': return "LUA_OP_POW";
+		case LUA_TK_IDIV: return "LUA_OP_IDIV";
+		case '&': return "LUA_OP_BAND";
+		case '|': return "LUA_OP_BOR";
+		case '~': return "LUA_OP_BXOR";
+		case LUA_TK_SHL: return "LUA_OP_SHL";
+		case LUA_TK_SHR: return "LUA_OP_SHR";
+		default: return nullptr;
+		}
+	}
+
+	bool isNumber(const LuaExpr* e) { return isNumber(e, fn); }
+
+	//a single call of a function returning one value
+	bool singleValued(const LuaExpr* e) {
+		if (e->kind != LUA_EXPR_CALL) return false;
+		const LuaFuncNode* callee = directCallee(e, fn);
+		if (callee) return funcs[callee].returnsNumber;
+		return mathCall(e, fn) != nullptr;
+	}
+
+	//expressions as doubles, for isNumber(e)
+	std::string num(const LuaExpr* e) {
+		double d;
+		if (constantNumber(e, fn, d)) return luaNumberLiteral(d);
+		switch (e->kind) {
+		case LUA_EXPR_LOCAL:
+		case LUA_EXPR_UPVALUE:
+			return info(localOf(e, fn)).cname;
+		case LUA_EXPR_PAREN:
+			return num(e->a);
+		case LUA_EXPR_UNARY:
+			return "(-" + num(e->a) + ")";
+		case LUA_EXPR_BINARY:
+			switch (e->op) {
+			case '%': return binary("double", operand(e->a), operand(e->b), "luaMod(", ", ", ")");
+			case '^': return binary("double", operand(e->a), operand(e->b), "std::pow(", ", ", ")");
+			case LUA_TK_IDIV: return binary("double", operand(e->a), operand(e->b), "std::floor(", " / ", ")");
+			default: return binary("double", operand(e->a), operand(e->b), "(", std::string(" ") + (char)e->op + " ", ")");
+			}
+		case LUA_EXPR_CALL: {
+			if (directCallee(e, fn)) return directCall(e);
+			const LuaKnownMath* m = mathCall(e, fn);
+			std::vector<Operand> o;
+			for (const LuaExpr* a : e->list) o.push_back(operand(a));
+			std::string before = sequence(o);
+			std::vector<std::string> args;
+			for (const Operand& a : o) args.push_back(a.code);
+			return after(before, "double", std::string(m->cxx) + "(" + join(args) + ")");
+		}
+		default:
+			return luaNumberLiteral(e->number);
+		}
+	}
+
+	//expressions as one Object
+	std::string obj(const LuaExpr* e) {
+		if (isNumber(e)) {
+			double d;
+			if (constantNumber(e, fn, d)) return numberConstant(d);
+			return "Object(" + num(e) + ")";
+		}
+		switch (e->kind) {
+		case LUA_EXPR_NIL:
+			return "nil";
+		case LUA_EXPR_TRUE:
+			return "Object(true)";
+		case LUA_EXPR_FALSE:
+			return "Object(false)";
+		case LUA_EXPR_STRING:
+			return stringConstant(e->string);
+		case LUA_EXPR_VARARG:
+			return "varargs[1]";
+		case LUA_EXPR_FUNCTION:
+			return lambda(e->func);
+		case LUA_EXPR_TABLE:
+			return table(e);
+		case LUA_EXPR_LOCAL:
+		case LUA_EXPR_UPVALUE: {
+			const LuaTranslateLocal& l = info(localOf(e, fn));
+			return l.cell ? "(*" + l.cname + ")" : l.cname;
+		}
+		case LUA_EXPR_GLOBAL:
+			usedGlobals = true;
+			return "luaGetGlobal(env, " + stringConstant(e->string) + ", " + globalSlot(e->string) + ")";
+		case LUA_EXPR_INDEX:
+			return binary("Object", Operand{"Object", e->a, obj(e->a)}, Operand{"Object", e->b, obj(e->b)}, "luaIndex(", ", ", ")");
+		case LUA_EXPR_CALL:
+		case LUA_EXPR_METHOD:
+			return multi(e) + ".get()";
+		case LUA_EXPR_PAREN:
+			return obj(e->a);
+		case LUA_EXPR_UNARY:
+			switch (e->op) {
+			case '-': return "luaUnm(" + obj(e->a) + ")";
+			case '#': return "luaLen(" + obj(e->a) + ")";
+			case '~': return "luaBnot(" + obj(e->a) + ")";
+			default: return "Object(!" + cond(e->a) + ")";
+			}
+		case LUA_EXPR_BINARY:
+			switch (e->op) {
+			case LUA_TK_CONCAT: {
+				//the elements of a braced list are evaluated in order
+				std::vector<std::string> parts;
+				while (e->kind == LUA_EXPR_BINARY && e->op == LUA_TK_CONCAT) {
+					parts.push_back(obj(e->a));
+					e = e->b;
+				}
+				parts.push_back(obj(e));
+				return "luaConcat({" + join(parts) + "})";
+			}
+			case LUA_TK_AND:
+			case LUA_TK_OR: {
+				std::string t = temp();
+				return "[&]() -> Object { Object " + t + " = " + obj(e->a) + "; if (" + (e->op == LUA_TK_AND ? "!" : "")
+					+ "luaTruthy(" + t + ")) return " + t + "; return " + obj(e->b) + "; }()";
+			}
+			default: {
+				const char* op = opcodeName(e->op);
+				if (op) return binary("Object", Operand{"Object", e->a, obj(e->a)}, Operand{"Object", e->b, obj(e->b)}, std::string("luaArithmetic(") + op + ", ", ", ", ")");
+				return "Object(" + cond(e) + ")";
+			}
+			}
+		default:
+			return "nil";
+		}
+	}
+
+	//expressions as conditions
+	std::string cond(const LuaExpr* e) {
+		switch (e->kind) {
+		case LUA_EXPR_NIL:
+		case LUA_EXPR_FALSE:
+			return "false";
+		case LUA_EXPR_TRUE:
+		case LUA_EXPR_NUMBER:
+		case LUA_EXPR_STRING:
+			return "true";
+		case LUA_EXPR_PAREN:
+			return cond(e->a);
+		case LUA_EXPR_UNARY:
+			if (e->op == LUA_TK_NOT) return "!" + cond(e->a);
+			break;
+		case LUA_EXPR_BINARY: {
+			const LuaExpr* a = e->a;
+			const LuaExpr* b = e->b;
+			bool numbers = isNumber(a) && isNumber(b);
+			switch (e->op) {
+			case LUA_TK_AND: return "(" + cond(a) + " && " + cond(b) + ")";
+			case LUA_TK_OR: return "(" + cond(a) + " || " + cond(b) + ")";
+			default: break;
+			}
+			const char* op = nullptr;
+			const char* compare = nullptr;
+			bool swapped = false;
+			switch (e->op) {
+			case LUA_TK_EQ: op = " == "; compare = "luaEquals("; break;
+			case LUA_TK_NE: op = " != "; compare = "!luaEquals("; break;
+			case '<': op = " < "; compare = "luaLessThan("; break;
+			case LUA_TK_LE: op = " <= "; compare = "luaLessEqual("; break;
+			case '>': op = " > "; compare = "luaLessThan("; swapped = true; break;
+			case LUA_TK_GE: op = " >= "; compare = "luaLessEqual("; swapped = true; break;
+			default: break;
+			}
+			if (!op) break;
+			if (numbers) return binary("bool", Operand{"double", a, num(a)}, Operand{"double", b, num(b)}, "(", op, ")");
+			return binary("bool", Operand{"Object", a, obj(a)}, Operand{"Object", b, obj(b)}, compare, ", ", ")", swapped);
+		}
+		default:
+			break;
+		}
+		if (isNumber(e)) {
+			if (e->kind == LUA_EXPR_LOCAL || e->kind == LUA_EXPR_UPVALUE) return "true";
+			return "((void)" + num(e) + ", true)";
+		}
+		return "luaTruthy(" + obj(e) + ")";
+	}
+
+	//an argument, as a double if it's a number
+	std::string arg(const LuaExpr* e) {
+		return isNumber(e) ? num(e) : obj(e);
+	}
+
+	bool spreads(const std::vector<LuaExpr*>& exprs) {
+		return !exprs.empty() && luaIsMulti(exprs.back()) && !singleValued(exprs.back());
+	}
+
+	//operands for a list of expressions, the last one giving all its values
+	void listOperands(const std::vector<LuaExpr*>& exprs, std::vector<Operand>& o) {
+		for (size_t i = 0; i < exprs.size(); ++i) {
+			const LuaExpr* e = exprs[i];
+			o.push_back(i + 1 == exprs.size() && spreads(exprs) ? Operand{"VarArg", e, multi(e)} : Operand{isNumber(e) ? "double" : "Object", e, arg(e)});
+		}
+	}
+
+	//the VarArg of the list whose operands start at o[from]
+	static std::string listOf(const std::vector<Operand>& o, size_t from) {
+		if (from == o.size()) return "VarArg()";
+		std::vector<std::string> values;
+		for (size_t i = from; i < o.size(); ++i) values.push_back(o[i].code);
+		if (std::string(o.back().type) != "VarArg") return "VarArg(" + join(values) + ")";
+		if (values.size() == 1) return values[0];
+		values.pop_back();
+		return "luaAppend(VarArg(" + join(values) + "), " + o.back().code + ")";
+	}
+
+	//a list of expressions as a VarArg
+	std::string list(const std::vector<LuaExpr*>& exprs) {
+		std::vector<Operand> o;
+		listOperands(exprs, o);
+		std::string before = sequence(o);
+		return after(before, "VarArg", listOf(o, 0));
+	}
+
+	//calls and ... as all their values
+	std::string multi(const LuaExpr* e) {
+		switch (e->kind) {
+		case LUA_EXPR_VARARG:
+			return "varargs";
+		case LUA_EXPR_METHOD: {
+			std::vector<Operand> o = {Operand{"Object", e->a, obj(e->a)}};
+			listOperands(e->list, o);
+			std::string before = sequence(o);
+			return after(before, "VarArg", "luaCallMethod(" + o[0].code + ", " + stringConstant(e->string) + ", " + listOf(o, 1) + ")");
+		}
+		case LUA_EXPR_CALL: {
+			const LuaFuncNode* callee = directCallee(e, fn);
+			if (callee) return funcs[callee].returnsNumber ? "VarArg(" + directCall(e) + ")" : directCall(e);
+			if (mathCall(e, fn)) return "VarArg(" + num(e) + ")";
+			//the function too is evaluated before its arguments
+			std::vector<Operand> o = {Operand{"Object", e->a, obj(e->a)}};
+			listOperands(e->list, o);
+			std::string before = sequence(o);
+			if (spreads(e->list)) return after(before, "VarArg", o[0].code + ".call(" + listOf(o, 1) + ")");
+			std::vector<std::string> args;
+			for (size_t i = 1; i < o.size(); ++i) args.push_back(o[i].code);
+			return after(before, "VarArg", o[0].code + "(" + join(args) + ")");
+		}
+		default:
+			return "VarArg(" + obj(e) + ")";
+		}
+	}
+
+	std::string directCall(const LuaExpr* e) {
+		const LuaLocal* l = localOf(e->a, fn);
+		const std::vector<LuaLocal*>& params = info(l).function->params;
+		std::vector<Operand> o;
+		for (size_t i = 0; i < params.size(); ++i) {
+			if (i >= e->list.size()) {
+				o.push_back(Operand{"Object", nullptr, "nil"});
+			} else if (info(params[i]).number) {
+				o.push_back(Operand{"double", e->list[i], num(e->list[i])});
+			} else {
+				o.push_back(Operand{"Object", e->list[i], obj(e->list[i])});
+			}
+		}
+		//arguments with nowhere to go are still evaluated, after the rest
+		bool extras = false;
+		for (size_t i = params.size(); i < e->list.size(); ++i) {
+			const LuaExpr* extra = e->list[i];
+			o.push_back(luaIsMulti(extra) ? Operand{"VarArg", extra, multi(extra)} : Operand{"Object", extra, obj(extra)});
+			extras = extras || sideEffects(extra);
+		}
+		std::string before = sequence(o, extras);
+		std::vector<std::string> args;
+		for (size_t i = 0; i < params.size(); ++i) args.push_back(o[i].code);
+		return after(before, funcs[info(l).function].returnsNumber ? "double" : "VarArg", info(l).cname + "(" + join(args) + ")");
+	}
+
+	std::string table(const LuaExpr* e) {
+		//items, fields and the rest are separate arguments, so they're put in order as they're written
+		std::vector<Operand> o;
+		for (size_t i = 0; i < e->list.size(); ++i) {
+			const LuaExpr* value = e->list[i];
+			if (e->keys[i]) {
+				o.push_back(Operand{"Object", e->keys[i], obj(e->keys[i])});
+				o.push_back(Operand{"Object", value, obj(value)});
+			} else if (i + 1 == e->list.size() && spreads(e->list)) {
+				o.push_back(Operand{"VarArg", value, multi(value)});
+			} else {
+				o.push_back(operand(value));
+			}
+		}
+		std::string before = sequence(o);
+		std::vector<std::string> items, fields;
+		std::string rest;
+		for (size_t i = 0, j = 0; i < e->list.size(); ++i, ++j) {
+			if (e->keys[i]) {
+				fields.push_back("{" + o[j].code + ", " + o[j + 1].code + "}");
+				++j;
+			} else if (i + 1 == e->list.size() && spreads(e->list)) {
+				rest = o[j].code;
+			} else {
+				items.push_back(o[j].code);
+			}
+		}
+		std::string s = "luaMakeTable({" + join(items) + "}";
+		if (!fields.empty() || !rest.empty()) s += ", {" + join(fields) + "}";
+		if (!rest.empty()) s += ", " + rest;
+		return after(before, "Object", s + ")");
+	}
+
+	//statements
+
+	void declareLocal(const LuaLocal* l, const std::string& value, bool valueIsNumber) {
+		const LuaTranslateLocal& t = info(l);
+		std::string asObject = valueIsNumber ? "Object(" + value + ")" : value;
+		if (!t.valueUses && t.calls.empty() && !t.reassigned) {
+			line("(void)" + value + ";");	//like _, never used
+		} else if (t.cell) {
+			line("upvalue " + t.cname + " = " + asObject + ";");
+		} else if (t.number) {
+			line((t.reassigned ? "double " : "const double ") + t.cname + " = " + value + ";");
+		} else {
+			line("Object " + t.cname + " = " + asObject + ";");
+		}
+	}
+
+	void declareLocal(const LuaLocal* l, const LuaExpr* e) {
+		double d;
+		if (!e) {
+			declareLocal(l, "nil", false);
+		} else if (info(l).number && !info(l).reassigned && constantNumber(e, fn, d)) {
+			//folded into every use
+		} else if (info(l).number) {
+			declareLocal(l, num(e), true);
+		} else {
+			declareLocal(l, obj(e), false);
+		}
+	}
+
+	//'e' is the value's expression, if it has one that hasn't been evaluated yet
+	void assign(const LuaExpr* target, const std::string& value, bool valueIsNumber, const LuaExpr* e = nullptr) {
+		std::string asObject = valueIsNumber ? "Object(" + value + ")" : value;
+		switch (target->kind) {
+		case LUA_EXPR_LOCAL:
+		case LUA_EXPR_UPVALUE: {
+			const LuaTranslateLocal& t = info(localOf(target, fn));
+			if (t.cell) {
+				line("*" + t.cname + " = " + asObject + ";");
+			} else {
+				line(t.cname + " = " + (t.number ? value : asObject) + ";");
+			}
+			break;
+		}
+		case LUA_EXPR_GLOBAL:
+			usedGlobals = true;
+			line("luaSetGlobal(env, " + stringConstant(target->string) + ", " + asObject + ", " + globalSlot(target->string) + ");");
+			break;
+		default: {
+			std::vector<Operand> o = {Operand{"Object", target->a, obj(target->a)}, Operand{"Object", target->b, obj(target->b)}, Operand{"Object", e, asObject}};
+			std::string before = sequence(o);
+			std::string set = "luaSetIndex(" + o[0].code + ", " + o[1].code + ", " + o[2].code + ");";
+			line(before.empty() ? set : "{ " + before + set + " }");
+			break;
+		}
+		}
+	}
+
+	void assign(const LuaExpr* target, const LuaExpr* e) {
+		const LuaLocal* l = localOf(target, fn);
+		if (l && info(l).number) {
+			assign(target, num(e), true, e);
+		} else {
+			assign(target, obj(e), false, e);
+		}
+	}
+
+	//values of locals or targets from a list of expressions, evaluating all of them in order
+	//the last one, if it's a call or ..., fills the rest
+	std::vector<std::pair<std::string, bool>> values(const std::vector<LuaExpr*>& exprs, size_t count, bool useTemps) {
+		std::vector<std::pair<std::string, bool>> v;
+		for (size_t i = 0; i < exprs.size(); ++i) {
+			const LuaExpr* e = exprs[i];
+			bool spreads = i + 1 == exprs.size() && luaIsMulti(e) && !singleValued(e) && count > exprs.size();
+			if (spreads) {
+				std::string t = temp();
+				line("VarArg " + t + " = " + multi(e) + ";");
+				for (size_t j = i; j < count; ++j) v.push_back(std::make_pair(t + "[" + std::to_string(j - i + 1) + "]", false));
+			} else if (i >= count) {
+				line("(void)" + (luaIsMulti(e) ? multi(e) : obj(e)) + ";");
+			} else if (useTemps) {
+				std::string t = temp();
+				bool number = isNumber(e);
+				line((number ? "double " : "Object ") + t + " = " + arg(e) + ";");
+				v.push_back(std::make_pair(t, number));
+			} else {
+				v.push_back(std::make_pair(std::string(), false));
+			}
+		}
+		while (v.size() < count) v.push_back(std::make_pair(std::string("nil"), false));
+		return v;
+	}
+
+	void localStat(const LuaStat* s) {
+		const std::vector<LuaExpr*>& exprs = s->exprs;
+		size_t n = s->locals.size();
+		bool spreads = !exprs.empty() && luaIsMulti(exprs.back()) && !singleValued(exprs.back()) && n > exprs.size();
+		if (!spreads) {
+			//declared one by one, as the new locals aren't in scope for the expressions
+			for (size_t i = 0; i < n; ++i) declareLocal(s->locals[i], i < exprs.size() ? exprs[i] : nullptr);
+			for (size_t i = n; i < exprs.size(); ++i) line("(void)" + (luaIsMulti(exprs[i]) ? multi(exprs[i]) : obj(exprs[i])) + ";");
+			return;
+		}
+		for (size_t i = 0; i + 1 < exprs.size(); ++i) declareLocal(s->locals[i], exprs[i]);
+		std::string t = temp();
+		line("VarArg " + t + " = " + multi(exprs.back()) + ";");
+		for (size_t i = exprs.size() - 1; i < n; ++i) {
+			declareLocal(s->locals[i], t + "[" + std::to_string(i - exprs.size() + 2) + "]", false);
+		}
+	}
+
+	//an expression's value kept in a temporary, unless it's a constant
+	std::string evaluated(const LuaExpr* e) {
+		double d;
+		if (e->kind == LUA_EXPR_STRING || constantNumber(e, fn, d)) return obj(e);
+		std::string t = temp();
+		line("Object " + t + " = " + obj(e) + ";");
+		return t;
+	}
+
+	void assignStat(const LuaStat* s) {
+		if (s->targets.size() == 1 && s->exprs.size() == 1) {
+			assign(s->targets[0], s->exprs[0]);
+			return;
+		}
+		//the targets' tables and keys, then everything on the right, are evaluated before anything is assigned
+		line("{");
+		++indent;
+		std::vector<std::pair<std::string, std::string>> indexes;
+		for (const LuaExpr* target : s->targets) {
+			if (target->kind != LUA_EXPR_INDEX) continue;
+			indexes.push_back(std::make_pair(evaluated(target->a), evaluated(target->b)));
+		}
+		std::vector<std::pair<std::string, bool>> v = values(s->exprs, s->targets.size(), true);
+		for (size_t i = 0, j = 0; i < s->targets.size(); ++i) {
+			if (s->targets[i]->kind == LUA_EXPR_INDEX) {
+				const std::pair<std::string, std::string>& index = indexes[j++];
+				line("luaSetIndex(" + index.first + ", " + index.second + ", " + (v[i].second ? "Object(" + v[i].first + ")" : v[i].first) + ");");
+			} else {
+				assign(s->targets[i], v[i].first, v[i].second);
+			}
+		}
+		--indent;
+		line("}");
+	}
+
+	void numericFor(const LuaStat* s) {
+		line("{");
+		++indent;
+		std::string i = temp(), limit = temp();
+		line("double " + i + " = " + forValue(s->exprs[0], "initial value") + ";");
+		line("double " + limit + " = " + forValue(s->exprs[1], "limit") + ";");
+		double step = 1;
+		std::string test, increment;
+		if (s->exprs.size() < 3 || constantNumber(s->exprs[2], fn, step)) {
+			if (step == 0) line("throw std::runtime_error(\"'for' step is zero\");");
+			test = i + (step > 0 ? " <= " : " >= ") + limit;
+			increment = i + " += " + luaNumberLiteral(step);
+		} else {
+			std::string t = temp();
+			line("double " + t + " = " + forValue(s->exprs[2], "step") + ";");
+			line("if (" + t + " == 0) throw std::runtime_error(\"'for' step is zero\");");
+			test = "(" + t + " > 0 ? " + i + " <= " + limit + " : " + i + " >= " + limit + ")";
+			increment = i + " += " + t;
+		}
+		line("for (; " + test + "; " + increment + ") {");
+		++indent;
+		declareLocal(s->locals[0], i, true);
+		block(s->blocks[0]);
+		--indent;
+		line("}");
+		--indent;
+		line("}");
+	}
+
+	std::string forValue(const LuaExpr* e, const char* what) {
+		if (isNumber(e)) return num(e);
+		return "luaForNumber(" + obj(e) + ", \"" + what + "\")";
+	}
+
+	void genericFor(const LuaStat* s) {
+		line("{");
+		++indent;
+		if (isIpairs(s)) {
+			std::string t = temp(), i = temp(), v = temp();
+			line("Object " + t + " = " + obj(s->exprs[0]->list[0]) + ";");
+			line("for (double " + i + " = 1;; ++" + i + ") {");
+			++indent;
+			line("Object " + v + " = luaIndex(" + t + ", " + i + ");");
+			line("if (" + v + ".is_nil()) break;");
+			declareLocal(s->locals[0], i, true);
+			if (s->locals.size() > 1) declareLocal(s->locals[1], v, false);
+		} else {
+			std::string in = temp(), f = temp(), state = temp(), control = temp(), r = temp();
+			line("VarArg " + in + " = " + list(s->exprs) + ";");
+			line("Object " + f + " = " + in + "[1], " + state + " = " + in + "[2], " + control + " = " + in + "[3];");
+			line("for (;;) {");
+			++indent;
+			line("VarArg " + r + " = " + f + "(" + state + ", " + control + ");");
+			line(control + " = " + r + "[1];");
+			line("if (" + control + ".is_nil()) break;");
+			for (size_t i = 0; i < s->locals.size(); ++i) {
+				declareLocal(s->locals[i], i ? r + "[" + std::to_string(i + 1) + "]" : control, false);
+			}
+		}
+		block(s->blocks[0]);
+		--indent;
+		line("}");
+		--indent;
+		line("}");
+	}
+
+	void returnStat(const LuaStat* s) {
+		if (kind == FUNCTION_DIRECT && funcs[fn].returnsNumber) {
+			line("return " + num(s->exprs[0]) + ";");
+			return;
+		}
+		//calls through Object::call don't grow the stack
+		if (kind == FUNCTION_LAMBDA && s->exprs.size() == 1) {
+			const LuaExpr* e = s->exprs[0];
+			if (e->kind == LUA_EXPR_CALL && !directCallee(e, fn) && !mathCall(e, fn) && !spreads(e->list)) {
+				std::vector<Operand> o = {Operand{"Object", e->a, obj(e->a)}};
+				listOperands(e->list, o);
+				std::string before = sequence(o);
+				std::vector<std::string> args;
+				for (const Operand& a : o) args.push_back(a.code);
+				line("return " + after(before, "VarArg", "tailcall(" + join(args) + ")") + ";");
+				return;
+			}
+		}
+		line("return " + list(s->exprs) + ";");
+	}
+
+	std::string label(const std::string& name) {
+		for (size_t i = labels.size(); i-- > 0;) {
+			std::unordered_map<std::string, std::string>::const_iterator l = labels[i].find(name);
+			if (l != labels[i].end()) return l->second;
+		}
+		return name;	//compileLua has already checked it's there
+	}
+
+	void statement(const LuaStat* s) {
+		switch (s->kind) {
+		case LUA_STAT_LOCAL:
+			localStat(s);
+			break;
+		case LUA_STAT_LOCALFUNCTION: {
+			const LuaTranslateLocal& t = info(s->locals[0]);
+			if (t.direct) {
+				directFunction(s->locals[0]);
+			} else if (t.cell) {
+				line("upvalue " + t.cname + ";");
+				line("*" + t.cname + " = " + lambda(t.function) + ";");
+			} else {
+				line("Object " + t.cname + " = " + lambda(t.function) + ";");
+			}
+			break;
+		}
+		case LUA_STAT_ASSIGN:
+			assignStat(s);
+			break;
+		case LUA_STAT_CALL: {
+			const LuaExpr* e = s->exprs[0];
+			line((directCallee(e, fn) ? directCall(e) : multi(e)) + ";");
+			break;
+		}
+		case LUA_STAT_DO:
+			line("{");
+			++indent;
+			block(s->blocks[0]);
+			--indent;
+			line("}");
+			break;
+		case LUA_STAT_WHILE:
+			line("while (" + cond(s->exprs[0]) + ") {");
+			++indent;
+			block(s->blocks[0]);
+			--indent;
+			line("}");
+			break;
+		case LUA_STAT_REPEAT:
+			line("for (;;) {");
+			++indent;
+			block(s->blocks[0], s->exprs[0]);
+			--indent;
+			line("}");
+			break;
+		case LUA_STAT_IF:
+			for (size_t i = 0; i < s->blocks.size(); ++i) {
+				if (i == 0) {
+					line("if (" + cond(s->exprs[0]) + ") {");
+				} else if (i < s->exprs.size()) {
+					line("} else if (" + cond(s->exprs[i]) + ") {");
+				} else {
+					line("} else {");
+				}
+				++indent;
+				block(s->blocks[i]);
+				--indent;
+			}
+			line("}");
+			break;
+		case LUA_STAT_NUMFOR:
+			numericFor(s);
+			break;
+		case LUA_STAT_GENFOR:
+			genericFor(s);
+			break;
+		case LUA_STAT_RETURN:
+			returnStat(s);
+			break;
+		case LUA_STAT_BREAK:
+			line("break;");
+			break;
+		case LUA_STAT_GOTO:
+			line("goto " + label(s->label) + ";");
+			break;
+		case LUA_STAT_LABEL:
+			line(label(s->label) + ":;");
+			break;
+		}
+	}
+
+	/*
+	a block's statements, with 'until' as a repeat loop's condition
+	labels at the end of a block are outside the scope of its locals, as in Lua,
+	so the statements before them get their own scope for C++'s gotos to jump out of
+	*/
+	void block(const LuaBlock* b, const LuaExpr* until = nullptr) {
+		labels.emplace_back();
+		for (const LuaStat* s : b->stats) {
+			if (s->kind == LUA_STAT_LABEL) labels.back()[s->label] = s->label + "_" + std::to_string(++nextId);
+		}
+		size_t end = b->stats.size();
+		while (end > 0 && b->stats[end - 1]->kind == LUA_STAT_LABEL) --end;
+		bool scoped = !until && end > 0 && end < b->stats.size();
+		if (scoped) {
+			line("{");
+			++indent;
+		}
+		for (size_t i = 0; i < end; ++i) statement(b->stats[i]);
+		if (scoped) {
+			--indent;
+			line("}");
+		}
+		for (size_t i = end; i < b->stats.size(); ++i) statement(b->stats[i]);
+		if (until) line("if (" + cond(until) + ") break;");
+		labels.pop_back();
+	}
+
+	void functionBody(const LuaFuncNode* f, FunctionKind k) {
+		const LuaFuncNode* savedFn = fn;
+		FunctionKind savedKind = kind;
+		bool savedUsedGlobals = usedGlobals;
+		std::vector<std::unordered_map<std::string, std::string>> savedLabels;
+		savedLabels.swap(labels);
+		fn = f;
+		kind = k;
+
+		const LuaTranslateFunc& t = funcs[f];
+		std::string* body = out;
+		std::string rest;
+		out = &rest;
+		usedGlobals = false;
+		for (size_t i = 0; i < f->params.size(); ++i) {
+			const LuaTranslateLocal& p = info(f->params[i]);
+			if (k == FUNCTION_DIRECT) {
+				if (p.cell) line("upvalue " + p.cname + " = " + p.cname + "_in;");
+			} else {
+				declareLocal(f->params[i], "args[" + std::to_string(i + 1) + "]", false);
+			}
+		}
+		if (t.usesVarargs) line("VarArg varargs = luaVarargs(args, " + std::to_string(f->params.size()) + ");");
+		block(f->body);
+		if (!luaAlwaysReturns(f->body)) line("return VarArg();");
+		out = body;
+		if (usedGlobals) line("const Object& env = luaEnvironment();");
+		*out += rest;
+
+		fn = savedFn;
+		kind = savedKind;
+		usedGlobals = savedUsedGlobals;
+		labels.swap(savedLabels);
+	}
+
+	std::string lambda(const LuaFuncNode* f) {
+		std::string body;
+		std::string* savedOut = out;
+		int savedIndent = indent;
+		out = &body;
+		++indent;
+		functionBody(f, FUNCTION_LAMBDA);
+		out = savedOut;
+		indent = savedIndent;
+		return "Object([=](const VarArg& args) -> VarArg {\n" + body + std::string(indent, '\t') + "})";
+	}
+
+	//written at namespace scope, wherever its 'local function' is
+	void directFunction(const LuaLocal* l) {
+		const LuaTranslateLocal& t = info(l);
+		const LuaFuncNode* f = t.function;
+		std::vector<std::string> params;
+		for (const LuaLocal* p : f->params) {
+			const LuaTranslateLocal& pt = info(p);
+			if (pt.cell) {
+				params.push_back("Object " + pt.cname + "_in");
+			} else {
+				params.push_back((pt.number ? "double " : "Object ") + pt.cname);
+			}
+		}
+		std::string signature = std::string("static ") + (funcs[f].returnsNumber ? "double " : "VarArg ") + t.cname + "(" + join(params) + ")";
+		declarations += signature + ";\n";
+
+		std::string body;
+		std::string* savedOut = out;
+		int savedIndent = indent;
+		out = &body;
+		indent = 1;
+		functionBody(f, FUNCTION_DIRECT);
+		out = savedOut;
+		indent = savedIndent;
+		definitions += "\n" + signature + " {\n" + body + "}\n";
+	}
+
+	std::string translate() {
+		analyse();
+
+		std::string main;
+		out = &main;
+		indent = 1;
+		functionBody(tree.main, FUNCTION_MAIN);
+
+		std::string s = "//translated from " + tree.chunkId + " by translateLua\n";
+		s += "#include \"CxxAsLua/LuaRuntime.h\"\n";
+		s += "#include <algorithm>\n";
+		s += "#include <cmath>\n";
+		s += "#include <memory>\n";
+		s += "\nusing namespace CxxAsLua;\n";
+		if (!constantInits.empty()) {
+			s += "\nstatic const Object luaK[] = {\n";
+			for (const std::string& c : constantInits) s += "\t" + c + ",\n";
+			s += "};\n";
+		}
+		if (!globalIndex.empty()) s += "static LuaGlobalSlot luaG[" + std::to_string(globalIndex.size()) + "];\n";
+		if (!declarations.empty()) s += "\n" + declarations;
+		s += definitions;
+		s += "\nVarArg " + functionName + "(const VarArg& args) {\n" + main + "}\n";
+		return s;
+	}
+};
+
+std::string translateLua(const std::string& source, const std::string& chunkname, const std::string& functionName) {
+	//the compiler checks what the parser leaves for later, like gotos
+	compileLua(source.data(), source.size(), chunkname);
+	std::unique_ptr<LuaSyntaxTree> tree = parseLua(source.data(), source.size(), chunkname);
+	LuaTranslator translator(*tree, functionName);
+	return translator.translate();
+}
+
+}
@@ -0,0 +1,1510 @@
+#include "CxxAsLua/LuaRuntime.h"
+#include "CxxAsLua/Constant.h"
+#include "CxxAsLua/Coroutine.h"
+#include "CxxAsLua/JSON.h"
+#include "CxxAsLua/String.h"
+#include "CxxAsLua/Userdata.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace CxxAsLua {
+
+/*
+closures
+a Lua function is an ordinary function Object whose Callable holds one of these
+*/
+
+struct LuaClosure {
+	std::shared_ptr<const LuaProto> proto;
+	std::vector<std::shared_ptr<Object>> upvalues;	//cells shared with the functions that made them
+	Object env;	//where globals are looked up
+};
+
+static void luaInvoke(const Callable& self, const VarArg& args, VarArg& results);
+
+//error(message, level): the Lua function 'level' calls up from error gives the message its position
+struct LuaLevelError : public std::runtime_error {
+	int level;
+	LuaLevelError(const std::string& message, int level_) : std::runtime_error(message), level(level_) {}
+};
+
+static Object luaClosureObject(const std::shared_ptr<LuaClosure>& c) {
+	return Object(std::shared_ptr<Object_Details>(std::make_shared<Object_Details_Function>(Callable::create(c, luaInvoke))));
+}
+
+/*
+value helpers
+these read details directly rather than through Object's conversions, which throw or allocate
+*/
+
+static const ConstantString luaEventIndex("__index");
+static const ConstantString luaEventNewIndex("__newindex");
+static const ConstantString luaEventCall("__call");
+static const ConstantString luaEventEq("__eq");
+static const ConstantString luaEventLt("__lt");
+static const ConstantString luaEventLe("__le");
+static const ConstantString luaEventLen("__len");
+static const ConstantString luaEventConcat("__concat");
+static const ConstantString luaEventUnm("__unm");
+static const ConstantString luaEventBnot("__bnot");
+static const ConstantString luaEventToString("__tostring");
+static const ConstantString luaEventPairs("__pairs");
+static const ConstantString luaEventMetatable("__metatable");
+
+//indexed by opcode - LUA_OP_ADD
+static const ConstantString luaArithEvents[] = {
+	{"__add"}, {"__sub"}, {"__mul"}, {"__div"}, {"__mod"}, {"__pow"},
+	{"__idiv"}, {"__band"}, {"__bor"}, {"__bxor"}, {"__shl"}, {"__shr"},
+};
+
+//the smallest string, so the map's number keys are the ones before it
+static const ConstantString luaFirstString("");
+
+//for 'for' loops to say "the next index of an ipairs loop" without a call
+static Object luaIpairsIterator;
+static Object luaNextFunction;
+
+//how far above the end of the stack calls stop with "stack overflow"
+static const size_t LUA_STACK_RESERVE = 32 * 1024;
+
+//how many __index or __newindex tables are followed before giving up
+static const int LUA_MAX_META_CHAIN = 100;
+
+static inline bool luaIsNumber(const Object& o) { return o.details->typeIndex == Object::TYPE_NUMBER; }
+static inline bool luaIsTable(const Object& o) { return o.details->typeIndex == Object::TYPE_TABLE; }
+
+static inline double luaNumber(const Object& o) {
+	return static_cast<const Object_Details_Number*>(o.details.get())->value;
+}
+
+static inline const std::string& luaString(const Object& o) {
+	return static_cast<const Object_Details_String*>(o.details.get())->value;
+}
+
+static inline Object::Map& luaTable(const Object& o) {
+	return static_cast<Object_Details_Table*>(o.details.get())->value;
+}
+
+//overwrites the number in place if nothing else refers to it, as the expression templates do
+static inline void luaSetNumber(Object& o, double d) {
+	Object_Details* details = o.details.get();
+	if (details->typeIndex == Object::TYPE_NUMBER && o.details.use_count() == 1 && !details->metatable) {
+		static_cast<Object_Details_Number*>(details)->value = d;
+	} else {
+		o.details = std::make_shared<Object_Details_Number>(d);
+	}
+}
+
+static Object luaStringObject(std::string&& s) {
+	return Object(std::shared_ptr<Object_Details>(std::make_shared<Object_Details_String>(std::move(s))));
+}
+
+static Object luaNewTable() {
+	return Object(std::shared_ptr<Object_Details>(std::make_shared<Object_Details_Table>()));
+}
+
+//unlike Object::getMetaHandler this doesn't add the event to the metatable when it's missing
+static bool luaMetaHandler(const Object& o, const Object& event, Object& handler) {
+	const Object_Details* mt = o.details->metatable.get();
+	if (!mt || mt->typeIndex != Object::TYPE_TABLE) return false;
+	const Object::Map& m = static_cast<const Object_Details_Table*>(mt)->value;
+	Object::Map::const_iterator i = m.find(event);
+	if (i == m.end() || i->second.is_nil()) return false;
+	handler = i->second;
+	return true;
+}
+
+static Object luaCallFirst(Object f, const VarArg& args) {
+	VarArg results;
+	f.call(args, results);
+	return results.get();
+}
+
+//Lua's rules for strings as numbers: surrounding spaces, hex, no inf or nan
+static bool luaStringToNumber(const std::string& s, double& out) {
+	if (s.find_first_of("nN") != std::string::npos) return false;
+	const char* start = s.c_str();
+	char* end = nullptr;
+	double d = strtod(start, &end);
+	if (end == start) return false;
+	while (*end && isspace((unsigned char)*end)) ++end;
+	if (end != start + s.size()) return false;
+	out = d;
+	return true;
+}
+
+static bool luaToNumber(const Object& o, double& out) {
+	switch (o.details->typeIndex) {
+	case Object::TYPE_NUMBER:
+		out = luaNumber(o);
+		return true;
+	case Object::TYPE_STRING:
+		return luaStringToNumber(luaString(o), out);
+	default:
+		return false;
+	}
+}
+
+static bool luaDoubleToInteger(double d, int64_t& out) {
+	if (d != ::floor(d) || d < -9223372036854775808. || d >= 9223372036854775808.) return false;
+	out = (int64_t)d;
+	return true;
+}
+
+//appends a string or number, returning false for anything else
+static bool luaAppendString(std::string& s, const Object& o) {
+	switch (o.details->typeIndex) {
+	case Object::TYPE_STRING:
+		s += luaString(o);
+		return true;
+	case Object::TYPE_NUMBER: {
+		char buf[Object_Details_Number::formatSize];
+		s.append(buf, Object_Details_Number::format(luaNumber(o), buf));
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+Object luaToString(const Object& o) {
+	Object h = nil;
+	if (luaMetaHandler(o, luaEventToString, h)) {
+		Object s = luaCallFirst(h, VarArg(o));
+		if (!s.is_string()) throw std::runtime_error("'__tostring' must return a string");
+		return s;
+	}
+	switch (o.details->typeIndex) {
+	case Object::TYPE_STRING:
+		return o;
+	case Object::TYPE_NUMBER:
+		return Object_Details_Number::format(luaNumber(o));
+	default:
+		return o.tostring();
+	}
+}
+
+/*
+indexing
+tables without metatables are handled inline by the VM, these are for everything else
+*/
+
+Object luaIndex(Object t, const Object& key) {
+	for (int depth = 0; depth < LUA_MAX_META_CHAIN; ++depth) {
+		Object h = nil;
+		if (luaIsTable(t)) {
+			const Object::Map& m = luaTable(t);
+			Object::Map::const_iterator i = m.find(key);
+			if (i != m.end() && !i->second.is_nil()) return i->second;
+			if (!luaMetaHandler(t, luaEventIndex, h)) return nil;
+		} else {
+			Object value = nil;
+			if (t.details->rawget(key, value)) return value;
+			if (!luaMetaHandler(t, luaEventIndex, h)) {
+				if (t.details->typeIndex != Object::TYPE_STRING) throw std::runtime_error("attempt to index a " + t.type() + " value");
+				//strings without a metatable of their own have the string library's functions as methods
+				h = string;
+			}
+		}
+		if (h.is_function()) return luaCallFirst(h, VarArg(t, key));
+		t = h;
+	}
+	throw std::runtime_error("'__index' chain too long; possible loop");
+}
+
+//the table's version, for when a key is removed
+static inline uint64_t& luaTableVersion(const Object& o) {
+	return static_cast<Object_Details_Table*>(o.details.get())->version;
+}
+
+//nil values remove the key, so they don't linger in the map
+void luaRawSet(const Object& t, const Object& key, const Object& value) {
+	Object::Map& m = luaTable(t);
+	switch (key.details->typeIndex) {
+	case Object::TYPE_NIL:
+		throw std::runtime_error("index is nil");
+	case Object::TYPE_NUMBER:
+		if (std::isnan(luaNumber(key))) throw std::runtime_error("index is NaN");
+		break;
+	default:
+		break;
+	}
+	if (value.is_nil()) {
+		if (m.erase(key)) ++luaTableVersion(t);
+		return;
+	}
+	std::pair<Object::Map::iterator, bool> i = m.emplace(key, value);
+	if (!i.second) i.first->second = value;
+}
+
+void luaSetIndex(Object t, const Object& key, const Object& value) {
+	for (int depth = 0; depth < LUA_MAX_META_CHAIN; ++depth) {
+		Object h = nil;
+		if (luaIsTable(t)) {
+			Object::Map& m = luaTable(t);
+			Object::Map::iterator i = m.find(key);
+			if (i != m.end() && !i->second.is_nil()) {
+				if (value.is_nil()) {
+					m.erase(i);
+					++luaTableVersion(t);
+				} else {
+					i->second = value;
+				}
+				return;
+			}
+			if (!luaMetaHandler(t, luaEventNewIndex, h)) {
+				luaRawSet(t, key, value);
+				return;
+			}
+		} else {
+			if (t.details->rawset(key, value)) return;
+			if (!luaMetaHandler(t, luaEventNewIndex, h)) {
+				throw std::runtime_error("attempt to index a " + t.type() + " value");
+			}
+		}
+		if (h.is_function()) {
+			VarArg results;
+			h.call(VarArg(t, key, value), results);
+			return;
+		}
+		t = h;
+	}
+	throw std::runtime_error("'__newindex' chain too long; possible loop");
+}
+
+Object luaFindGlobal(const Object& env, const Object& name, LuaGlobalSlot& slot) {
+	if (luaIsTable(env)) {
+		Object::Map& m = luaTable(env);
+		Object::Map::iterator i = m.find(name);
+		if (i != m.end() && !i->second.is_nil()) {
+			slot.table = env.details;
+			slot.version = luaTableVersion(env);
+			slot.value = &i->second;
+			return i->second;
+		}
+	}
+	return luaIndex(env, name);
+}
+
+//the largest integer key with a value, which is a border as Lua defines them
+static double luaBorder(const Object::Map& m) {
+	Object::Map::const_iterator i = m.lower_bound(luaFirstString);
+	while (i != m.begin()) {
+		--i;
+		double k = luaNumber(i->first);
+		if (k < 1) break;
+		if (k == ::floor(k) && !i->second.is_nil()) return k;
+	}
+	return 0;
+}
+
+Object luaLen(const Object& o) {
+	Object h = nil;
+	switch (o.details->typeIndex) {
+	case Object::TYPE_STRING:
+		return (double)luaString(o).size();
+	case Object::TYPE_TABLE:
+		if (luaMetaHandler(o, luaEventLen, h)) return luaCallFirst(h, VarArg(o));
+		return luaBorder(luaTable(o));
+	default: {
+		double n;
+		if (o.details->rawlen(n)) return n;
+		if (luaMetaHandler(o, luaEventLen, h)) return luaCallFirst(h, VarArg(o));
+		throw std::runtime_error("attempt to get length of a " + o.type() + " value");
+	}
+	}
+}
+
+/*
+arithmetic
+numbers are doubles, so / and // are always float division and integers only appear for the bitwise operators
+*/
+
+static inline int64_t luaShiftLeft(int64_t x, int64_t y) {
+	if (y <= -64 || y >= 64) return 0;
+	if (y >= 0) return (int64_t)((uint64_t)x << y);
+	return (int64_t)((uint64_t)x >> -y);
+}
+
+static inline double luaArith(LuaOpcode op, double x, double y) {
+	switch (op) {
+	case LUA_OP_ADD: return x + y;
+	case LUA_OP_SUB: return x - y;
+	case LUA_OP_MUL: return x * y;
+	case LUA_OP_DIV: return x / y;
+	case LUA_OP_MOD: return luaMod(x, y);
+	case LUA_OP_POW: return ::pow(x, y);
+	case LUA_OP_IDIV: return ::floor(x / y);
+	default: return 0;
+	}
+}
+
+static inline int64_t luaBitwise(LuaOpcode op, int64_t x, int64_t y) {
+	switch (op) {
+	case LUA_OP_BAND: return x & y;
+	case LUA_OP_BOR: return x | y;
+	case LUA_OP_BXOR: return x ^ y;
+	case LUA_OP_SHL: return luaShiftLeft(x, y);
+	case LUA_OP_SHR: return luaShiftLeft(x, -y);
+	default: return 0;
+	}
+}
+
+static inline bool luaIsBitwise(LuaOpcode op) {
+	return op >= LUA_OP_BAND && op <= LUA_OP_SHR;
+}
+
+//strings convert to numbers first, then metamethods, as in Lua 5.3
+static Object luaArithSlow(LuaOpcode op, const Object& a, const Object& b) {
+	double x, y;
+	bool numbers = luaToNumber(a, x) && luaToNumber(b, y);
+	if (numbers) {
+		if (!luaIsBitwise(op)) return luaArith(op, x, y);
+		int64_t i, j;
+		if (luaDoubleToInteger(x, i) && luaDoubleToInteger(y, j)) return (double)luaBitwise(op, i, j);
+	}
+	Object h = nil;
+	const Object& event = luaArithEvents[op - LUA_OP_ADD];
+	if (luaMetaHandler(a, event, h) || luaMetaHandler(b, event, h)) return luaCallFirst(h, VarArg(a, b));
+	if (luaIsBitwise(op)) {
+		if (numbers) throw std::runtime_error("number has no integer representation");
+		throw std::runtime_error("attempt to perform bitwise operation on a " + (luaToNumber(a, x) ? b : a).type() + " value");
+	}
+	throw std::runtime_error("attempt to perform arithmetic on a " + (luaToNumber(a, x) ? b : a).type() + " value");
+}
+
+Object luaArithmetic(LuaOpcode op, const Object& a, const Object& b) {
+	if (luaIsNumber(a) && luaIsNumber(b) && !luaIsBitwise(op)) return luaArith(op, luaNumber(a), luaNumber(b));
+	return luaArithSlow(op, a, b);
+}
+
+Object luaUnm(const Object& a) {
+	double x;
+	if (luaToNumber(a, x)) return -x;
+	Object h = nil;
+	if (luaMetaHandler(a, luaEventUnm, h)) return luaCallFirst(h, VarArg(a, a));
+	throw std::runtime_error("attempt to perform arithmetic on a " + a.type() + " value");
+}
+
+Object luaBnot(const Object& a) {
+	double x;
+	int64_t i;
+	bool number = luaToNumber(a, x);
+	if (number && luaDoubleToInteger(x, i)) return (double)~i;
+	Object h = nil;
+	if (luaMetaHandler(a, luaEventBnot, h)) return luaCallFirst(h, VarArg(a, a));
+	if (number) throw std::runtime_error("number has no integer representation");
+	throw std::runtime_error("attempt to perform bitwise operation on a " + a.type() + " value");
+}
+
+static Object luaConcatHandler(const Object& a, const Object& b) {
+	std::string s;
+	if (luaAppendString(s, a) && luaAppendString(s, b)) return luaStringObject(std::move(s));
+	Object h = nil;
+	if (luaMetaHandler(a, luaEventConcat, h) || luaMetaHandler(b, luaEventConcat, h)) return luaCallFirst(h, VarArg(a, b));
+	bool aIsString = a.is_string() || a.is_number();
+	throw std::runtime_error("attempt to concatenate a " + (aIsString ? b : a).type() + " value");
+}
+
+//all of a .. b .. c at once when they're strings and numbers, otherwise pairwise from the right
+Object luaConcat(const Object* first, int n) {
+	std::string s;
+	int i = 0;
+	while (i < n && luaAppendString(s, first[i])) ++i;
+	if (i == n) return luaStringObject(std::move(s));
+	Object result = first[n - 1];
+	for (i = n - 2; i >= 0; --i) result = luaConcatHandler(first[i], result);
+	return result;
+}
+
+/*
+comparison
+*/
+
+static bool luaCompareHandler(const Object& a, const Object& b, const Object& event, bool& result) {
+	Object h = nil;
+	if (!luaMetaHandler(a, event, h) && !luaMetaHandler(b, event, h)) return false;
+	result = luaTruthy(luaCallFirst(h, VarArg(a, b)));
+	return true;
+}
+
+bool luaEquals(const Object& a, const Object& b) {
+	if (a.details == b.details) return true;
+	Object::Type_t type = a.details->typeIndex;
+	if (type != b.details->typeIndex) return false;
+	switch (type) {
+	case Object::TYPE_NUMBER:
+		return luaNumber(a) == luaNumber(b);
+	case Object::TYPE_STRING:
+		return luaString(a) == luaString(b);
+	case Object::TYPE_BOOLEAN:
+		return luaTruthy(a) == luaTruthy(b);
+	case Object::TYPE_NIL:
+		return true;
+	case Object::TYPE_USERDATA: {
+		const Object_Details_Userdata* la = tolightuserdata(a);
+		const Object_Details_Userdata* lb = tolightuserdata(b);
+		if (la || lb) return la && lb && la->ptr == lb->ptr;
+	}
+	//fall through
+	case Object::TYPE_TABLE: {
+		bool result = false;
+		luaCompareHandler(a, b, luaEventEq, result);
+		return result;
+	}
+	default:
+		return false;
+	}
+}
+
+static std::runtime_error luaCompareError(const Object& a, const Object& b) {
+	std::string ta = a.type(), tb = b.type();
+	if (ta == tb) return std::runtime_error("attempt to compare two " + ta + " values");
+	return std::runtime_error("attempt to compare " + ta + " with " + tb);
+}
+
+bool luaLessThan(const Object& a, const Object& b) {
+	Object::Type_t type = a.details->typeIndex;
+	if (type == b.details->typeIndex) {
+		if (type == Object::TYPE_NUMBER) return luaNumber(a) < luaNumber(b);
+		if (type == Object::TYPE_STRING) return luaString(a) < luaString(b);
+	}
+	bool result;
+	if (luaCompareHandler(a, b, luaEventLt, result)) return result;
+	throw luaCompareError(a, b);
+}
+
+bool luaLessEqual(const Object& a, const Object& b) {
+	Object::Type_t type = a.details->typeIndex;
+	if (type == b.details->typeIndex) {
+		if (type == Object::TYPE_NUMBER) return luaNumber(a) <= luaNumber(b);
+		if (type == Object::TYPE_STRING) return luaString(a) <= luaString(b);
+	}
+	bool result;
+	if (luaCompareHandler(a, b, luaEventLe, result)) return result;
+	//a <= b as not (b < a)
+	if (luaCompareHandler(b, a, luaEventLt, result)) return !result;
+	throw luaCompareError(a, b);
+}
+
+/*
+the rest of what translated code needs
+*/
+
+Object luaMakeTable(std::initializer_list<Object> items, std::initializer_list<std::pair<Object, Object>> fields, const VarArg& rest) {
+	Object t = luaNewTable();
+	//positional items win over keyed ones for the same index, as they're stored after them
+	for (const std::pair<Object, Object>& f : fields) luaRawSet(t, f.first, f.second);
+	double n = 0;
+	for (const Object& v : items) {
+		++n;
+		if (!v.is_nil()) luaRawSet(t, Object(n), v);
+	}
+	for (const Object& v : rest.objects) {
+		++n;
+		if (!v.is_nil()) luaRawSet(t, Object(n), v);
+	}
+	return t;
+}
+
+double luaForNumber(const Object& o, const char* what) {
+	double d;
+	if (!luaToNumber(o, d)) throw std::runtime_error(std::string("'for' ") + what + " must be a number");
+	return d;
+}
+
+VarArg luaVarargs(const VarArg& args, size_t skip) {
+	VarArg results;
+	size_t n = args.objects.size();
+	if (n > skip) results.objects.reserve(n - skip);
+	for (size_t i = skip; i < n; ++i) results.objects.push_back(args.objects[i]);
+	return results;
+}
+
+VarArg luaAppend(VarArg head, const VarArg& tail) {
+	head.objects.reserve(head.objects.size() + tail.objects.size());
+	for (const Object& o : tail.objects) head.objects.push_back(o);
+	return head;
+}
+
+VarArg luaCallMethod(const Object& self, const Object& name, const VarArg& args) {
+	Object f = luaIndex(self, name);
+	VarArg callArgs;
+	callArgs.objects.reserve(args.objects.size() + 1);
+	callArgs.objects.push_back(self);
+	for (const Object& o : args.objects) callArgs.objects.push_back(o);
+	return f.call(callArgs);
+}
+
+/*
+register frames
+each call takes a vector of registers from a per-thread pool, so calls don't allocate once it's warm
+kept trivially-destructible, as the coroutine stack pool is, so frames unwound during static destruction still have somewhere to go
+*/
+
+struct LuaFramePool {
+	enum { MAX_POOLED = 64 };
+	std::vector<Object>* frames[MAX_POOLED];
+	size_t count;
+	bool closed;
+
+	std::vector<Object>* acquire() {
+		if (count) return frames[--count];
+		return new std::vector<Object>();
+	}
+
+	void release(std::vector<Object>* frame) {
+		frame->clear();
+		if (!closed && count < MAX_POOLED) {
+			frames[count++] = frame;
+		} else {
+			delete frame;
+		}
+	}
+
+	void close() {
+		while (count) delete frames[--count];
+		closed = true;
+	}
+};
+
+static thread_local LuaFramePool framePool;
+
+static thread_local struct LuaFramePoolCloser {
+	~LuaFramePoolCloser() { framePool.close(); }
+} framePoolCloser;
+
+struct LuaFrame {
+	std::vector<Object>* regs;
+
+	LuaFrame(size_t size) : regs(framePool.acquire()) {
+		(void)&framePoolCloser;	//odr-use, so it is constructed for this thread
+		regs->assign(size, nil);
+	}
+	~LuaFrame() { framePool.release(regs); }
+};
+
+/*
+the interpreter
+with GCC and Clang each instruction's handler is found in a table of label addresses, without a switch's range check
+otherwise it's a switch in a loop
+either way a handler ends by going back to the top of the loop: a computed goto out of it would skip the destructors of its locals
+*/
+
+#if defined(__GNUC__)
+#define LUA_VM_JUMPTABLE 1
+#else
+#define LUA_VM_JUMPTABLE 0
+#endif
+
+#if LUA_VM_JUMPTABLE
+#define vmdispatch(o) goto *jumpTable[o];
+#define vmcase(name) op_##name:
+#define vmbreak goto vmnext;
+#else
+#define vmdispatch(o) switch (o)
+#define vmcase(name) case LUA_OP_##name:
+#define vmbreak break;
+#endif
+
+static void luaExecute(const LuaClosure& cl, const VarArg& args, VarArg& results) {
+	const LuaProto& p = *cl.proto;
+
+	char marker;
+	if (&marker < stackLimit() + LUA_STACK_RESERVE) throw std::runtime_error("stack overflow");
+
+	LuaFrame frame(std::max(p.maxStack, p.numParams));
+	Object* base = frame.regs->data();
+
+	//grows the registers for results whose count isn't known until run time
+	auto ensure = [&](int n) {
+		if (n > (int)frame.regs->size()) {
+			frame.regs->resize(n, nil);
+			base = frame.regs->data();
+		}
+	};
+
+	int nargs = (int)args.objects.size();
+	for (int j = 0; j < p.numParams && j < nargs; ++j) base[j] = args.objects[j];
+	const Object* varargs = nargs > p.numParams ? args.objects.data() + p.numParams : nullptr;
+	int nvarargs = p.isVararg && nargs > p.numParams ? nargs - p.numParams : 0;
+
+	std::vector<std::shared_ptr<Object>> cells(p.numCells);
+
+	const uint32_t* code = p.code.data();
+	const Object* k = p.constants.data();
+	int pc = 0;
+	int top = 0;	//one past the last value of a call or vararg whose count is open
+
+	//reused by each call made from this function
+	VarArg callArgs, callResults;
+
+#define RA base[luaGetA(i)]
+#define RB base[luaGetB(i)]
+#define RK(x) ((x) >= LUA_RK_CONSTANT ? k[(x) - LUA_RK_CONSTANT] : base[x])
+#define RKB RK(luaGetB(i))
+#define RKC RK(luaGetC(i))
+//for tests followed by a jump: take the jump now, rather than going through the dispatch for it
+#define DOJUMP pc += luaGetsBx(code[pc]) + 1
+
+#define LUA_VM_ARITH(name) vmcase(name) {\
+	const Object& b = RKB;\
+	const Object& c = RKC;\
+	if (luaIsNumber(b) && luaIsNumber(c)) {\
+		luaSetNumber(RA, luaArith(LUA_OP_##name, luaNumber(b), luaNumber(c)));\
+	} else {\
+		RA = luaArithSlow(LUA_OP_##name, b, c);\
+	}\
+	vmbreak\
+}
+
+#define LUA_VM_BITWISE(name) vmcase(name) {\
+	const Object& b = RKB;\
+	const Object& c = RKC;\
+	int64_t x, y;\
+	if (luaIsNumber(b) && luaIsNumber(c) && luaDoubleToInteger(luaNumber(b), x) && luaDoubleToInteger(luaNumber(c), y)) {\
+		luaSetNumber(RA, (double)luaBitwise(LUA_OP_##name, x, y));\
+	} else {\
+		RA = luaArithSlow(LUA_OP_##name, b, c);\
+	}\
+	vmbreak\
+}
+
+#if LUA_VM_JUMPTABLE
+	static const void* const jumpTable[LUA_NUM_OPCODES] = {
+#define LUA_OPCODE_LABEL(name) &&op_##name,
+		LUA_OPCODES(LUA_OPCODE_LABEL)
+#undef LUA_OPCODE_LABEL
+	};
+#endif
+
+	try {
+		for (;;) {
+#if LUA_VM_JUMPTABLE
+		vmnext:
+#endif
+			uint32_t i = code[pc++];
+			vmdispatch(luaGetOp(i)) {
+			vmcase(MOVE) {
+				RA = RB;
+				vmbreak
+			}
+			vmcase(LOADK) {
+				RA = k[luaGetBx(i)];
+				vmbreak
+			}
+			vmcase(LOADBOOL) {
+				RA = Object(luaGetB(i) != 0);
+				if (luaGetC(i)) ++pc;
+				vmbreak
+			}
+			vmcase(LOADNIL) {
+				Object* r = &RA;
+				for (int n = luaGetB(i); n >= 0; --n) *r++ = nil;
+				vmbreak
+			}
+			vmcase(GETUPVAL) {
+				RA = *cl.upvalues[luaGetB(i)];
+				vmbreak
+			}
+			vmcase(SETUPVAL) {
+				*cl.upvalues[luaGetB(i)] = RA;
+				vmbreak
+			}
+			vmcase(NEWCELL) {
+				cells[luaGetB(i)] = std::make_shared<Object>(nil);
+				vmbreak
+			}
+			vmcase(GETCELL) {
+				RA = *cells[luaGetB(i)];
+				vmbreak
+			}
+			vmcase(SETCELL) {
+				*cells[luaGetB(i)] = RA;
+				vmbreak
+			}
+			vmcase(GETGLOBAL) {
+				int bx = luaGetBx(i);
+				LuaGlobalSlot& slot = p.globalSlots[bx];
+				const Object* v = luaCachedGlobal(cl.env, slot);
+				if (v) {
+					RA = *v;
+				} else {
+					RA = luaFindGlobal(cl.env, k[bx], slot);
+				}
+				vmbreak
+			}
+			vmcase(SETGLOBAL) {
+				int bx = luaGetBx(i);
+				luaSetGlobal(cl.env, k[bx], RA, p.globalSlots[bx]);
+				vmbreak
+			}
+			vmcase(GETTABLE) {
+				const Object& t = RB;
+				const Object& key = RKC;
+				if (luaIsTable(t) && !t.details->metatable) {
+					const Object::Map& m = luaTable(t);
+					Object::Map::const_iterator v = m.find(key);
+					RA = v == m.end() ? nil : v->second;
+				} else {
+					RA = luaIndex(t, key);
+				}
+				vmbreak
+			}
+			vmcase(SETTABLE) {
+				const Object& t = RA;
+				const Object& key = RKB;
+				const Object& value = RKC;
+				if (luaIsTable(t) && !t.details->metatable) {
+					luaRawSet(t, key, value);
+				} else {
+					luaSetIndex(t, key, value);
+				}
+				vmbreak
+			}
+			vmcase(NEWTABLE) {
+				RA = luaNewTable();
+				vmbreak
+			}
+			vmcase(SELF) {
+				int a = luaGetA(i);
+				Object self = RB;
+				const Object& key = RKC;
+				if (luaIsTable(self) && !self.details->metatable) {
+					const Object::Map& m = luaTable(self);
+					Object::Map::const_iterator v = m.find(key);
+					base[a] = v == m.end() ? nil : v->second;
+				} else {
+					base[a] = luaIndex(self, key);
+				}
+				base[a + 1] = self;
+				vmbreak
+			}
+			LUA_VM_ARITH(ADD)
+			LUA_VM_ARITH(SUB)
+			LUA_VM_ARITH(MUL)
+			LUA_VM_ARITH(DIV)
+			LUA_VM_ARITH(MOD)
+			LUA_VM_ARITH(POW)
+			LUA_VM_ARITH(IDIV)
+			LUA_VM_BITWISE(BAND)
+			LUA_VM_BITWISE(BOR)
+			LUA_VM_BITWISE(BXOR)
+			LUA_VM_BITWISE(SHL)
+			LUA_VM_BITWISE(SHR)
+			vmcase(UNM) {
+				const Object& b = RB;
+				if (luaIsNumber(b)) {
+					luaSetNumber(RA, -luaNumber(b));
+				} else {
+					RA = luaUnm(b);
+				}
+				vmbreak
+			}
+			vmcase(NOT) {
+				RA = Object(!luaTruthy(RB));
+				vmbreak
+			}
+			vmcase(LEN) {
+				const Object& b = RB;
+				if (luaIsTable(b) && !b.details->metatable) {
+					luaSetNumber(RA, luaBorder(luaTable(b)));
+				} else {
+					RA = luaLen(b);
+				}
+				vmbreak
+			}
+			vmcase(BNOT) {
+				RA = luaBnot(RB);
+				vmbreak
+			}
+			vmcase(CONCAT) {
+				int b = luaGetB(i);
+				RA = luaConcat(base + b, luaGetC(i) - b + 1);
+				vmbreak
+			}
+			vmcase(JMP) {
+				pc += luaGetsBx(i);
+				vmbreak
+			}
+			vmcase(EQ) {
+				const Object& b = RKB;
+				const Object& c = RKC;
+				bool equal = luaIsNumber(b) && luaIsNumber(c) ? luaNumber(b) == luaNumber(c) : luaEquals(b, c);
+				if (equal != (luaGetA(i) != 0)) ++pc; else DOJUMP;
+				vmbreak
+			}
+			vmcase(LT) {
+				const Object& b = RKB;
+				const Object& c = RKC;
+				bool less = luaIsNumber(b) && luaIsNumber(c) ? luaNumber(b) < luaNumber(c) : luaLessThan(b, c);
+				if (less != (luaGetA(i) != 0)) ++pc; else DOJUMP;
+				vmbreak
+			}
+			vmcase(LE) {
+				const Object& b = RKB;
+				const Object& c = RKC;
+				bool lessEqual = luaIsNumber(b) && luaIsNumber(c) ? luaNumber(b) <= luaNumber(c) : luaLessEqual(b, c);
+				if (lessEqual != (luaGetA(i) != 0)) ++pc; else DOJUMP;
+				vmbreak
+			}
+			vmcase(TEST) {
+				if (luaTruthy(RA) != (luaGetC(i) != 0)) ++pc; else DOJUMP;
+				vmbreak
+			}
+			vmcase(CALL) {
+				int a = luaGetA(i), b = luaGetB(i), c = luaGetC(i);
+				int n = b ? b - 1 : top - a - 1;
+				callArgs.objects.reserve(n);
+				for (int j = 1; j <= n; ++j) callArgs.objects.push_back(base[a + j]);
+				base[a].call(callArgs, callResults);
+				callArgs.objects.clear();
+				n = (int)callResults.objects.size();
+				if (c == 0) {
+					top = a + n;
+					ensure(top);
+					for (int j = 0; j < n; ++j) base[a + j] = callResults.objects[j];
+				} else {
+					for (int j = 0; j < c - 1; ++j) base[a + j] = j < n ? callResults.objects[j] : nil;
+				}
+				callResults.objects.clear();
+				vmbreak
+			}
+			vmcase(TAILCALL) {
+				int a = luaGetA(i), b = luaGetB(i);
+				int n = b ? b : top - a;
+				results.objects.reserve(n);
+				for (int j = 0; j < n; ++j) results.objects.push_back(base[a + j]);
+				results.tailcall = true;
+				return;
+			}
+			vmcase(RETURN) {
+				int a = luaGetA(i), b = luaGetB(i);
+				int n = b ? b - 1 : top - a;
+				results.objects.reserve(n);
+				for (int j = 0; j < n; ++j) results.objects.push_back(base[a + j]);
+				return;
+			}
+			vmcase(FORPREP) {
+				int a = luaGetA(i);
+				double init = luaForNumber(base[a], "initial value");
+				double limit = luaForNumber(base[a + 1], "limit");
+				double step = luaForNumber(base[a + 2], "step");
+				if (step == 0) throw std::runtime_error("'for' step is zero");
+				luaSetNumber(base[a], init - step);
+				luaSetNumber(base[a + 1], limit);
+				luaSetNumber(base[a + 2], step);
+				pc += luaGetsBx(i);
+				vmbreak
+			}
+			vmcase(FORLOOP) {
+				int a = luaGetA(i);
+				double step = luaNumber(base[a + 2]);
+				double index = luaNumber(base[a]) + step;
+				double limit = luaNumber(base[a + 1]);
+				if (step > 0 ? index <= limit : index >= limit) {
+					luaSetNumber(base[a], index);
+					luaSetNumber(base[a + 3], index);
+					pc += luaGetsBx(i);
+				}
+				vmbreak
+			}
+			vmcase(TFORLOOP) {
+				int a = luaGetA(i), c = luaGetC(i);
+				const Object& f = base[a];
+				const Object& state = base[a + 1];
+				if (f.details == luaNextFunction.details && luaIsTable(state)) {
+					//pairs() over a table: step through the map directly
+					const Object::Map& m = luaTable(state);
+					Object::Map::const_iterator v = base[a + 2].is_nil() ? m.begin() : m.upper_bound(base[a + 2]);
+					while (v != m.end() && v->second.is_nil()) ++v;
+					if (v == m.end()) {
+						++pc;
+						vmbreak
+					}
+					base[a + 2] = v->first;
+					base[a + 3] = v->first;
+					if (c > 1) base[a + 4] = v->second;
+					for (int j = 2; j < c; ++j) base[a + 3 + j] = nil;
+				} else if (f.details == luaIpairsIterator.details && luaIsTable(state) && !state.details->metatable) {
+					const Object::Map& m = luaTable(state);
+					luaSetNumber(base[a + 2], luaNumber(base[a + 2]) + 1);
+					Object::Map::const_iterator v = m.find(base[a + 2]);
+					if (v == m.end() || v->second.is_nil()) {
+						++pc;
+						vmbreak
+					}
+					luaSetNumber(base[a + 3], luaNumber(base[a + 2]));
+					if (c > 1) base[a + 4] = v->second;
+					for (int j = 2; j < c; ++j) base[a + 3 + j] = nil;
+				} else {
+					callArgs.objects.push_back(state);
+					callArgs.objects.push_back(base[a + 2]);
+					base[a].call(callArgs, callResults);
+					callArgs.objects.clear();
+					int n = (int)callResults.objects.size();
+					for (int j = 0; j < c; ++j) base[a + 3 + j] = j < n ? callResults.objects[j] : nil;
+					callResults.objects.clear();
+					if (base[a + 3].is_nil()) {
+						++pc;
+						vmbreak
+					}
+					base[a + 2] = base[a + 3];
+				}
+				vmbreak
+			}
+			vmcase(SETLIST) {
+				int a = luaGetA(i), b = luaGetB(i), c = luaGetC(i);
+				if (c == 0) c = (int)code[pc++];
+				int n = b ? b : top - a - 1;
+				Object::Map& m = luaTable(base[a]);
+				double offset = (double)(c - 1) * (double)LUA_FIELDS_PER_FLUSH;
+				for (int j = 1; j <= n; ++j) {
+					const Object& value = base[a + j];
+					if (value.is_nil()) continue;
+					std::pair<Object::Map::iterator, bool> v = m.emplace(Object(offset + j), value);
+					if (!v.second) v.first->second = value;
+				}
+				vmbreak
+			}
+			vmcase(CLOSURE) {
+				const std::shared_ptr<LuaProto>& child = p.protos[luaGetBx(i)];
+				std::shared_ptr<LuaClosure> c = std::make_shared<LuaClosure>();
+				c->proto = child;
+				c->env = cl.env;
+				c->upvalues.reserve(child->upvalues.size());
+				for (const LuaProto::Upvalue& u : child->upvalues) {
+					c->upvalues.push_back(u.fromCell ? cells[u.index] : cl.upvalues[u.index]);
+				}
+				RA = luaClosureObject(c);
+				vmbreak
+			}
+			vmcase(VARARG) {
+				int a = luaGetA(i), b = luaGetB(i);
+				int n = b ? b - 1 : nvarargs;
+				if (!b) {
+					top = a + n;
+					ensure(top);
+				}
+				for (int j = 0; j < n; ++j) base[a + j] = j < nvarargs ? varargs[j] : nil;
+				vmbreak
+			}
+			}
+		}
+	} catch (Error&) {
+		//error values, and LuaErrors that already say where, go through as they are
+		throw;
+	} catch (LuaLevelError& e) {
+		if (e.level > 1) {
+			--e.level;
+			throw;
+		}
+		throw LuaError(p.source + ":" + std::to_string(p.lines[pc - 1]) + ": " + e.what());
+	} catch (std::exception& e) {
+		//errors from operators and C++ functions get the position of the instruction that ran into them
+		throw LuaError(p.source + ":" + std::to_string(p.lines[pc - 1]) + ": " + e.what());
+	}
+
+#undef RA
+#undef RB
+#undef RK
+#undef RKB
+#undef RKC
+#undef DOJUMP
+#undef LUA_VM_ARITH
+#undef LUA_VM_BITWISE
+}
+
+#undef vmdispatch
+#undef vmcase
+#undef vmbreak
+
+static void luaInvoke(const Callable& self, const VarArg& args, VarArg& results) {
+	luaExecute(*self.target<std::shared_ptr<LuaClosure>>(), args, results);
+}
+
+/*
+loading
+*/
+
+Object load(const std::string& chunk, const std::string& chunkname, const Object& env) {
+	std::shared_ptr<LuaClosure> c = std::make_shared<LuaClosure>();
+	try {
+		c->proto = compileLua(chunk.data(), chunk.size(), chunkname.empty() ? chunk : chunkname);
+	} catch (LuaError&) {
+		throw;
+	} catch (std::exception& e) {
+		throw LuaError(e.what());
+	}
+	//made even when unused, as it sets the functions TFORLOOP looks for, which until then are nil like any other
+	luaEnvironment();
+	c->env = env;
+	return luaClosureObject(c);
+}
+
+Object load(const std::string& chunk, const std::string& chunkname) {
+	return load(chunk, chunkname, luaEnvironment());
+}
+
+Object loadstring(const std::string& chunk, const std::string& chunkname) {
+	return load(chunk, chunkname);
+}
+
+static bool luaReadFile(const std::string& path, std::string& out) {
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f) return false;
+	char buf[1 << 16];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+Object loadfile(const std::string& path, const Object& env) {
+	std::string source;
+	if (!luaReadFile(path, source)) throw LuaError("cannot open " + path);
+	return load(source, "@" + path, env);
+}
+
+Object loadfile(const std::string& path) {
+	return loadfile(path, luaEnvironment());
+}
+
+VarArg dofile(const std::string& path) {
+	return loadfile(path).call(VarArg());
+}
+
+/*
+the base library, as the globals of luaEnvironment()
+*/
+
+static std::runtime_error luaArgError(int arg, const char* func, const std::string& msg) {
+	return std::runtime_error("bad argument #" + std::to_string(arg) + " to '" + func + "' (" + msg + ")");
+}
+
+static const Object& luaCheckTable(const VarArg& args, int arg, const char* func) {
+	if ((size_t)arg > args.objects.size() || !luaIsTable(args.objects[arg - 1])) {
+		std::string got = (size_t)arg > args.objects.size() ? "no value" : args.objects[arg - 1].type();
+		throw luaArgError(arg, func, "table expected, got " + got);
+	}
+	return args.objects[arg - 1];
+}
+
+static int64_t luaCheckInteger(const VarArg& args, int arg, const char* func) {
+	double d;
+	Object o = args[arg];
+	if (!luaToNumber(o, d)) throw luaArgError(arg, func, "number expected, got " + ((size_t)arg > args.objects.size() ? std::string("no value") : o.type()));
+	int64_t n;
+	if (!luaDoubleToInteger(d, n)) throw luaArgError(arg, func, "number has no integer representation");
+	return n;
+}
+
+static int64_t luaOptInteger(const VarArg& args, int arg, const char* func, int64_t def) {
+	if ((size_t)arg > args.objects.size() || args.objects[arg - 1].is_nil()) return def;
+	return luaCheckInteger(args, arg, func);
+}
+
+static VarArg luaBasePrint(const VarArg& args) {
+	for (size_t j = 0; j < args.objects.size(); ++j) {
+		if (j) writeOutput("\t", 1);
+		writeOutput(luaToString(args.objects[j]));
+	}
+	writeOutput("\n", 1);
+	return VarArg();
+}
+
+static VarArg luaBaseType(const VarArg& args) {
+	if (args.objects.empty()) throw luaArgError(1, "type", "value expected");
+	return Object(args.objects[0].type());
+}
+
+static VarArg luaBaseToString(const VarArg& args) {
+	if (args.objects.empty()) throw luaArgError(1, "tostring", "value expected");
+	return luaToString(args.objects[0]);
+}
+
+static VarArg luaBaseToNumber(const VarArg& args) {
+	Object v = args[1];
+	if (args.objects.size() < 2 || args.objects[1].is_nil()) {
+		double d;
+		if (luaToNumber(v, d)) return Object(d);
+		if (args.objects.empty()) throw luaArgError(1, "tonumber", "value expected");
+		return nil;
+	}
+	int64_t b = luaCheckInteger(args, 2, "tonumber");
+	if (b < 2 || b > 36) throw luaArgError(2, "tonumber", "base out of range");
+	if (!v.is_string()) throw luaArgError(1, "tonumber", "string expected, got " + v.type());
+	const std::string& s = luaString(v);
+	size_t j = 0;
+	while (j < s.size() && isspace((unsigned char)s[j])) ++j;
+	bool negative = j < s.size() && s[j] == '-';
+	if (j < s.size() && (s[j] == '-' || s[j] == '+')) ++j;
+	size_t digits = 0;
+	double n = 0;
+	for (; j < s.size() && isalnum((unsigned char)s[j]); ++j, ++digits) {
+		int c = (unsigned char)s[j];
+		int d = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+		if (d >= b) return nil;
+		n = n * b + d;
+	}
+	while (j < s.size() && isspace((unsigned char)s[j])) ++j;
+	if (!digits || j != s.size()) return nil;
+	return Object(negative ? -n : n);
+}
+
+static VarArg luaBaseNext(const VarArg& args) {
+	const Object::Map& m = luaTable(luaCheckTable(args, 1, "next"));
+	Object key = args[2];
+	Object::Map::const_iterator v = key.is_nil() ? m.begin() : m.upper_bound(key);
+	while (v != m.end() && v->second.is_nil()) ++v;
+	if (v == m.end()) return nil;
+	return VarArg(v->first, v->second);
+}
+
+static VarArg luaBasePairs(const VarArg& args) {
+	Object t = args[1];
+	Object h = nil;
+	if (luaMetaHandler(t, luaEventPairs, h)) {
+		VarArg results;
+		h.call(VarArg(t), results);
+		while (results.objects.size() < 3) results.objects.push_back(nil);
+		return results;
+	}
+	luaCheckTable(args, 1, "pairs");
+	return VarArg(luaNextFunction, t, nil);
+}
+
+static VarArg luaBaseIpairsAux(const VarArg& args) {
+	double i = (double)args[2] + 1;
+	Object v = luaIndex(args[1], i);
+	if (v.is_nil()) return nil;
+	return VarArg(i, v);
+}
+
+static VarArg luaBaseIpairs(const VarArg& args) {
+	if (args.objects.empty()) throw luaArgError(1, "ipairs", "table expected, got no value");
+	return VarArg(luaIpairsIterator, args.objects[0], 0);
+}
+
+static VarArg luaBaseSelect(const VarArg& args) {
+	int n = (int)args.objects.size() - 1;
+	Object which = args[1];
+	if (which.is_string() && luaString(which) == "#") return Object((double)n);
+	int64_t i = luaCheckInteger(args, 1, "select");
+	if (i < 0) {
+		i = n + i;
+		if (i < 0) throw luaArgError(1, "select", "index out of range");
+	} else if (i == 0) {
+		throw luaArgError(1, "select", "index out of range");
+	} else {
+		--i;
+	}
+	VarArg results;
+	for (int64_t j = i; j < n; ++j) results.objects.push_back(args.objects[j + 1]);
+	return results;
+}
+
+static VarArg luaBaseRawGet(const VarArg& args) {
+	const Object::Map& m = luaTable(luaCheckTable(args, 1, "rawget"));
+	Object::Map::const_iterator v = m.find(args[2]);
+	return v == m.end() ? nil : v->second;
+}
+
+static VarArg luaBaseRawSet(const VarArg& args) {
+	Object t = luaCheckTable(args, 1, "rawset");
+	luaRawSet(t, args[2], args[3]);
+	return t;
+}
+
+static VarArg luaBaseRawEqual(const VarArg& args) {
+	Object a = args[1], b = args[2];
+	if (a.details == b.details) return Object(true);
+	if (a.getTypeIndex() != b.getTypeIndex()) return Object(false);
+	if (a.is_table() || (a.is_userdata() && !tolightuserdata(a))) return Object(false);
+	return Object(luaEquals(a, b));
+}
+
+static VarArg luaBaseRawLen(const VarArg& args) {
+	Object v = args[1];
+	if (v.is_table()) return luaBorder(luaTable(v));
+	if (v.is_string()) return (double)luaString(v).size();
+	throw luaArgError(1, "rawlen", "table or string expected");
+}
+
+static VarArg luaBaseSetMetatable(const VarArg& args) {
+	Object t = luaCheckTable(args, 1, "setmetatable");
+	Object mt = args[2];
+	if (!mt.is_nil() && !mt.is_table()) throw luaArgError(2, "setmetatable", "nil or table expected");
+	Object h = nil;
+	if (luaMetaHandler(t, luaEventMetatable, h)) throw std::runtime_error("cannot change a protected metatable");
+	return setmetatable(t, mt);
+}
+
+static VarArg luaBaseGetMetatable(const VarArg& args) {
+	Object v = args[1];
+	if (!v.details->metatable) return nil;
+	Object h = nil;
+	if (luaMetaHandler(v, luaEventMetatable, h)) return h;
+	return Object(v.details->metatable);
+}
+
+static VarArg luaBaseAssert(const VarArg& args) {
+	if (args.objects.empty()) throw luaArgError(1, "assert", "value expected");
+	if (luaTruthy(args.objects[0])) return args;
+	if (args.objects.size() < 2) throw LuaError("assertion failed!");
+	throw LuaError(luaToString(args.objects[1]).tostring());
+}
+
+//level 1 (the default) adds the position where error was called, level 2 where that function was called and so on
+//level 0, or a value that isn't a string, is raised as it is
+static VarArg luaBaseError(const VarArg& args) {
+	Object value = args[1];
+	int64_t level = luaOptInteger(args, 2, "error", 1);
+	if (value.is_string() && level > 0) throw LuaLevelError(luaString(value), (int)std::min<int64_t>(level, INT_MAX));
+	error(value);
+}
+
+static VarArg luaBasePcall(const VarArg& args) {
+	if (args.objects.empty()) throw luaArgError(1, "pcall", "value expected");
+	return pcall(args.objects[0], luaVarargs(args, 1));
+}
+
+static VarArg luaBaseXpcall(const VarArg& args) {
+	if (args.objects.size() < 2) throw luaArgError(2, "xpcall", "value expected");
+	return xpcall(args.objects[0], args.objects[1], luaVarargs(args, 2));
+}
+
+static VarArg luaUnpack(const VarArg& args, const char* func) {
+	Object t = args[1];
+	int64_t i = luaOptInteger(args, 2, func, 1);
+	int64_t j = (size_t)3 <= args.objects.size() && !args.objects[2].is_nil()
+		? luaCheckInteger(args, 3, func)
+		: (int64_t)(double)luaLen(t);
+	VarArg results;
+	if (i > j) return results;
+	if (j - i >= 1000000) throw std::runtime_error("too many results to unpack");
+	results.objects.reserve((size_t)(j - i + 1));
+	for (int64_t n = i; n <= j; ++n) results.objects.push_back(luaIndex(t, (double)n));
+	return results;
+}
+
+static VarArg luaBaseUnpack(const VarArg& args) {
+	return luaUnpack(args, "unpack");
+}
+
+//chunks are strings, or functions returning pieces of one until they return nil or ""
+static VarArg luaBaseLoad(const VarArg& args) {
+	Object chunk = args[1];
+	std::string source;
+	std::string chunkname;
+	if (chunk.is_string()) {
+		source = luaString(chunk);
+		chunkname = source;
+	} else if (chunk.is_function()) {
+		chunkname = "=(load)";
+		for (;;) {
+			Object piece = luaCallFirst(chunk, VarArg());
+			if (piece.is_nil()) break;
+			if (!piece.is_string()) return VarArg(nil, "reader function must return a string");
+			if (luaString(piece).empty()) break;
+			source += luaString(piece);
+		}
+	} else {
+		throw luaArgError(1, "load", "string expected, got " + chunk.type());
+	}
+	Object name = args[2];
+	if (name.is_string()) chunkname = luaString(name);
+	Object env = args.objects.size() >= 4 ? args.objects[3] : luaEnvironment();
+	try {
+		return load(source, chunkname, env);
+	} catch (LuaError& e) {
+		return VarArg(nil, e.what());
+	}
+}
+
+static VarArg luaBaseLoadString(const VarArg& args) {
+	Object s = args[1];
+	if (!s.is_string()) throw luaArgError(1, "loadstring", "string expected, got " + s.type());
+	Object name = args[2];
+	try {
+		return load(luaString(s), name.is_string() ? luaString(name) : std::string());
+	} catch (LuaError& e) {
+		return VarArg(nil, e.what());
+	}
+}
+
+static VarArg luaBaseLoadFile(const VarArg& args) {
+	Object path = args[1];
+	if (!path.is_string()) throw luaArgError(1, "loadfile", "string expected, got " + path.type());
+	Object env = args.objects.size() >= 3 ? args.objects[2] : luaEnvironment();
+	try {
+		return loadfile(luaString(path), env);
+	} catch (LuaError& e) {
+		return VarArg(nil, e.what());
+	}
+}
+
+static VarArg luaBaseDoFile(const VarArg& args) {
+	Object path = args[1];
+	if (!path.is_string()) throw luaArgError(1, "dofile", "string expected, got " + path.type());
+	return dofile(luaString(path));
+}
+
+/*
+the table library
+what scripts commonly need, going through metamethods as Lua 5.3's does
+*/
+
+static VarArg luaTableInsert(const VarArg& args) {
+	Object t = luaCheckTable(args, 1, "insert");
+	int64_t n = (int64_t)(double)luaLen(t);
+	switch (args.objects.size()) {
+	case 2:
+		luaSetIndex(t, (double)(n + 1), args.objects[1]);
+		break;
+	case 3: {
+		int64_t pos = luaCheckInteger(args, 2, "insert");
+		if (pos < 1 || pos > n + 1) throw luaArgError(2, "insert", "position out of bounds");
+		for (int64_t j = n; j >= pos; --j) luaSetIndex(t, (double)(j + 1), luaIndex(t, (double)j));
+		luaSetIndex(t, (double)pos, args.objects[2]);
+		break;
+	}
+	default:
+		throw std::runtime_error("wrong number of arguments to 'insert'");
+	}
+	return VarArg();
+}
+
+static VarArg luaTableRemove(const VarArg& args) {
+	Object t = luaCheckTable(args, 1, "remove");
+	int64_t n = (int64_t)(double)luaLen(t);
+	int64_t pos = luaOptInteger(args, 2, "remove", n);
+	if (args.objects.size() >= 2 && n + 1 != pos && (pos < 1 || pos > n + 1)) {
+		if (!(n == 0 && pos == 0)) throw luaArgError(2, "remove", "position out of bounds");
+	}
+	Object removed = luaIndex(t, (double)pos);
+	for (int64_t j = pos; j < n; ++j) luaSetIndex(t, (double)j, luaIndex(t, (double)(j + 1)));
+	if (pos <= n) luaSetIndex(t, (double)n, nil);
+	return removed;
+}
+
+static VarArg luaTableConcat(const VarArg& args) {
+	Object t = luaCheckTable(args, 1, "concat");
+	Object sep = args[2];
+	std::string separator;
+	if (!sep.is_nil() && !luaAppendString(separator, sep)) throw luaArgError(2, "concat", "string expected, got " + sep.type());
+	int64_t i = luaOptInteger(args, 3, "concat", 1);
+	int64_t j = args.objects.size() >= 4 && !args.objects[3].is_nil()
+		? luaCheckInteger(args, 4, "concat")
+		: (int64_t)(double)luaLen(t);
+	std::string s;
+	for (int64_t n = i; n <= j; ++n) {
+		Object v = luaIndex(t, (double)n);
+		if (!luaAppendString(s, v)) {
+			throw std::runtime_error("invalid value (at index " + std::to_string(n) + ") in table for 'concat'");
+		}
+		if (n < j) s += separator;
+	}
+	return luaStringObject(std::move(s));
+}
+
+static VarArg luaTablePack(const VarArg& args) {
+	Object t = luaNewTable();
+	Object::Map& m = luaTable(t);
+	for (size_t j = 0; j < args.objects.size(); ++j) {
+		if (!args.objects[j].is_nil()) m.emplace(Object((double)(j + 1)), args.objects[j]);
+	}
+	m.emplace(Object("n"), Object((double)args.objects.size()));
+	return t;
+}
+
+static VarArg luaTableUnpack(const VarArg& args) {
+	return luaUnpack(args, "unpack");
+}
+
+//stable, so an inconsistent comparison can't run off the ends as std::sort could
+static VarArg luaTableSort(const VarArg& args) {
+	Object t = luaCheckTable(args, 1, "sort");
+	Object comp = args[2];
+	if (!comp.is_nil() && !comp.is_function()) throw luaArgError(2, "sort", "function expected, got " + comp.type());
+	int64_t n = (int64_t)(double)luaLen(t);
+	std::vector<Object> values;
+	values.reserve((size_t)std::max<int64_t>(n, 0));
+	for (int64_t j = 1; j <= n; ++j) values.push_back(luaIndex(t, (double)j));
+	if (comp.is_nil()) {
+		std::stable_sort(values.begin(), values.end(), luaLessThan);
+	} else {
+		VarArg callArgs, callResults;
+		std::stable_sort(values.begin(), values.end(), [&](const Object& a, const Object& b) {
+			callArgs.objects.clear();
+			callArgs.objects.push_back(a);
+			callArgs.objects.push_back(b);
+			comp.call(callArgs, callResults);
+			return luaTruthy(callResults.get());
+		});
+	}
+	for (int64_t j = 1; j <= n; ++j) luaSetIndex(t, (double)j, values[(size_t)(j - 1)]);
+	return VarArg();
+}
+
+static const ConstantField luaTableLibrary[] = {
+	{"concat", luaTableConcat},
+	{"insert", luaTableInsert},
+	{"pack", luaTablePack},
+	{"remove", luaTableRemove},
+	{"sort", luaTableSort},
+	{"unpack", luaTableUnpack},
+};
+
+static const ConstantField luaBaseLibrary[] = {
+	{"_VERSION", "Lua 5.3"},	//and _G, which is the table itself
+	{"assert", luaBaseAssert},
+	{"coroutine", &coroutine},
+	{"dofile", luaBaseDoFile},
+	{"error", luaBaseError},
+	{"getmetatable", luaBaseGetMetatable},
+	{"io", &io},
+	{"ipairs", luaBaseIpairs},
+	{"json", &json},
+	{"load", luaBaseLoad},
+	{"loadfile", luaBaseLoadFile},
+	{"loadstring", luaBaseLoadString},
+	{"math", &math},
+	{"next", &luaNextFunction},
+	{"pairs", luaBasePairs},
+	{"pcall", luaBasePcall},
+	{"print", luaBasePrint},
+	{"rawequal", luaBaseRawEqual},
+	{"rawget", luaBaseRawGet},
+	{"rawlen", luaBaseRawLen},
+	{"rawset", luaBaseRawSet},
+	{"select", luaBaseSelect},
+	{"setmetatable", luaBaseSetMetatable},
+	{"string", &string},
+	{"table", luaTableLibrary},
+	{"tonumber", luaBaseToNumber},
+	{"tostring", luaBaseToString},
+	{"type", luaBaseType},
+	{"unpack", luaBaseUnpack},
+	{"xpcall", luaBaseXpcall},
+};
+
+static Object luaNewEnvironment() {
+	luaNextFunction = luaBaseNext;
+	luaIpairsIterator = luaBaseIpairsAux;
+	Object env = constantTable(luaBaseLibrary);
+	luaRawSet(env, Object("_G"), env);
+	return env;
+}
+
+Object& luaEnvironment() {
+	static Object env = luaNewEnvironment();
+	return env;
+}
+
+}
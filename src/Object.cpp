@@ -1,7 +1,15 @@
 #include "CxxAsLua/Object.h"
+#include "CxxAsLua/Constant.h"
+#include "CxxAsLua/Vectorized.h"
+#include "CxxAsLua/Array.h"
+#include "CxxAsLua/Random.h"
+#include "CxxAsLua/Userdata.h"
+#include "CxxAsLua/File.h"
 #include <limits>
 #include <cmath>
 #include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
 
 namespace CxxAsLua {
 
@@ -108,13 +116,24 @@ bool MapCompare::operator()(const Object& a, const Object& b) const {
 	case Object::TYPE_BOOLEAN:
 		return a.details->to_boolean() < b.details->to_boolean();
 	case Object::TYPE_NUMBER:
-		return a.details->to_number() < b.details->to_number();
+		return static_cast<const Object_Details_Number*>(a.details.get())->value < static_cast<const Object_Details_Number*>(b.details.get())->value;
 	case Object::TYPE_STRING:
-		return a.details->to_string() < b.details->to_string();
+		//by reference, to_string() would copy both strings on every comparison
+		if (a.details == b.details) return false;	//interned
+		return static_cast<const Object_Details_String*>(a.details.get())->value < static_cast<const Object_Details_String*>(b.details.get())->value;
 	//by-pointer
 	case Object::TYPE_TABLE:
 	case Object::TYPE_FUNCTION:
+	case Object::TYPE_THREAD:
 		return a.details.get() < b.details.get();
+	case Object::TYPE_USERDATA: {
+		//light userdata go first, by the pointer they hold
+		const Object_Details_Userdata* la = tolightuserdata(a);
+		const Object_Details_Userdata* lb = tolightuserdata(b);
+		if (la && lb) return std::less<void*>()(la->ptr, lb->ptr);
+		if (la || lb) return la != nullptr;
+		return a.details.get() < b.details.get();
+	}
 	}
 	//unknown type?
 	throw std::runtime_error("tried to compare objects of unknown types");
@@ -133,11 +152,17 @@ Object::~Object() {
 	v->second(*this);
 }
 	
-Object::Object() : details(std::make_shared<Object_Details_Nil>()) {}
+//nil, true and false never change (setmetatable only takes tables and userdata), so every one shares details laid out at compile time
+//this keeps default construction and comparison results from allocating
+static const StaticDetails<Object_Details_Nil> nilDetails;
+static const StaticDetails<Object_Details_Boolean> trueDetails(true);
+static const StaticDetails<Object_Details_Boolean> falseDetails(false);
+
+Object::Object() : details(nilDetails.share()) {}
 Object::Object(const Object& x) : details(x.details) {}
 Object::Object(const Object&& x) : details(x.details) {}
 Object::Object(const std::shared_ptr<Object_Details>& details_) : details(details_) {}
-Object::Object(bool x) : details(std::make_shared<Object_Details_Boolean>(x)) {}
+Object::Object(bool x) : details((x ? trueDetails : falseDetails).share()) {}
 Object::Object(char x) : details(std::make_shared<Object_Details_String>(std::string{x})) {}
 Object::Object(unsigned char x) : details(std::make_shared<Object_Details_String>(std::string{(char)x})) {}
 Object::Object(signed char x) : details(std::make_shared<Object_Details_String>(std::string{(char)x})) {}
@@ -168,7 +193,7 @@ Object::Object(const std::u32string& x) : details(std::make_shared<Object_Detail
 Object::Object(const Map& x) : details(std::make_shared<Object_Details_Table>(x)) {}
 
 Object& Object::operator=(const Object& x) { details = x.details; return *this; }
-Object& Object::operator=(bool x) { details = std::make_shared<Object_Details_Boolean>(x); return *this; }
+Object& Object::operator=(bool x) { details = (x ? trueDetails : falseDetails).share(); return *this; }
 Object& Object::operator=(char x) { details = std::make_shared<Object_Details_String>(std::string{x}); return *this; }
 Object& Object::operator=(signed char x) { details = std::make_shared<Object_Details_String>(std::string{(char)x}); return *this; }
 Object& Object::operator=(unsigned char x) { details = std::make_shared<Object_Details_String>(std::string{(char)x}); return *this; }
@@ -219,29 +244,30 @@ Object::operator std::u16string() const { return utfToU16str(details->to_string(
 Object::operator std::u32string() const { return utfToU32str(details->to_string()); }
 Object::operator Map() const { return details->to_table(); }
 
-bool Object::is_boolean() const { return !!std::dynamic_pointer_cast<Object_Details_Boolean>(details); }
-bool Object::is_number() const { return !!std::dynamic_pointer_cast<Object_Details_Number>(details); }
-bool Object::is_string() const { return !!std::dynamic_pointer_cast<Object_Details_String>(details); }
-bool Object::is_table() const { return !!std::dynamic_pointer_cast<Object_Details_Table>(details); }
-bool Object::is_function() const { return !!std::dynamic_pointer_cast<Object_Details_Function>(details); }
-bool Object::is_nil() const { return !!std::dynamic_pointer_cast<Object_Details_Nil>(details); }
+bool Object::is_boolean() const { return details->typeIndex == TYPE_BOOLEAN; }
+bool Object::is_number() const { return details->typeIndex == TYPE_NUMBER; }
+bool Object::is_string() const { return details->typeIndex == TYPE_STRING; }
+bool Object::is_table() const { return details->typeIndex == TYPE_TABLE; }
+bool Object::is_function() const { return details->typeIndex == TYPE_FUNCTION; }
+bool Object::is_nil() const { return details->typeIndex == TYPE_NIL; }
+bool Object::is_thread() const { return details->typeIndex == TYPE_THREAD; }
+bool Object::is_userdata() const { return details->typeIndex == TYPE_USERDATA; }
 
 std::string Object::type() const { return details->type(); }
 
 bool Object::tonumber(double& out) const {
-	std::shared_ptr<Object_Details_Number> nptr = std::dynamic_pointer_cast<Object_Details_Number>(details);
-	if (nptr) {
-		out = nptr->value;
+	switch (details->typeIndex) {
+	case TYPE_NUMBER:
+		out = static_cast<const Object_Details_Number*>(details.get())->value;
 		return true;
+	case TYPE_STRING:
+		{
+			std::istringstream ss(static_cast<const Object_Details_String*>(details.get())->value);
+			return !!(ss >> out);
+		}
+	default:
+		return false;
 	}
-
-	std::shared_ptr<Object_Details_String> sptr = std::dynamic_pointer_cast<Object_Details_String>(details);
-	if (sptr) {
-		std::istringstream ss(sptr->value);
-		return !!(ss >> out);
-	}
-
-	return false;
 }
 
 std::string Object::tostring() const {
@@ -255,19 +281,73 @@ std::ostream& operator<<(std::ostream& o, const Object& x) {
 Access Object::operator[](Object key) { return Access(this, key); }
 Access Object::operator[](const char* key) { return Access(this, Object(key)); }	//...or else C++ chokes with literal string dereferences: "ambiguous overloaded operator"
 
+const Object& Library::load() const {
+	Object* t = new Object(make());
+	Object* expected = nullptr;
+	//another thread got there first
+	if (!table.compare_exchange_strong(expected, t, std::memory_order_acq_rel)) {
+		delete t;
+		return *expected;
+	}
+	return *t;
+}
+
+Access Library::operator[](Object key) const { return Access(const_cast<Object*>(&get()), key); }
+Access Library::operator[](const char* key) const { return Access(const_cast<Object*>(&get()), Object(key)); }
+
+const Object& LibraryField::load() const {
+	Object_Details_Table* t = static_cast<Object_Details_Table*>(library->get().details.get());
+	Object::Map::iterator i = t->value.find(Object(name));
+	if (i != t->value.end() && !i->second.is_nil()) {
+		//map nodes stay put until they're erased, which bumps the version
+		version.store(t->version, std::memory_order_relaxed);
+		value.store(&i->second, std::memory_order_release);
+		return i->second;
+	}
+	//missing, so whatever __index finds, held here until this thread's next miss
+	static thread_local Object missing;
+	missing = (*library)[name].get();
+	return missing;
+}
+
 //using VarArg's cast operator instead.  go back to this if that becomes a problem.
 //Object& Object::operator=(const VarArg& x) { details = x.objects[0].get().details; return *this; }
 
 
-VarArg Object::call(VarArg args) {
-	std::shared_ptr<Object_Details_Function> fptr = std::dynamic_pointer_cast<Object_Details_Function>(details);
-	if (fptr) {
-		return fptr->value(args);
+VarArg Object::call(const VarArg& args) {
+	VarArg results;
+	call(args, results);
+	return results;
+}
+
+void Object::call(const VarArg& args, VarArg& results) {
+	results.objects.clear();
+	results.tailcall = false;
+	dispatch(args, results);
+
+	//run any pending tail calls here, rather than in a nested call of their own
+	while (results.tailcall) {
+		VarArg next(std::move(results));
+		next.tailcall = false;
+		Object f = next.objects[0];
+		next.objects.erase(next.objects.begin());
+		results.objects.clear();
+		results.tailcall = false;
+		f.dispatch(next, results);
+	}
+}
+
+void Object::dispatch(const VarArg& args, VarArg& results) {
+	if (details->typeIndex == TYPE_FUNCTION) {
+		//hold a reference in case the callee reassigns the variable it was called through
+		std::shared_ptr<Object_Details> keep = details;
+		static_cast<const Object_Details_Function*>(keep.get())->value(args, results);
 	} else {
 		Object h = getMetaHandler("__call");
 		if (h) {
-			args.objects.insert(args.objects.begin(), *this);
-			return h(args);
+			VarArg hargs(args);
+			hargs.objects.insert(hargs.objects.begin(), *this);
+			h.dispatch(hargs, results);
 		} else {
 			throw std::runtime_error(
 				std::string("attempted to call a ")
@@ -278,13 +358,7 @@ VarArg Object::call(VarArg args) {
 }
 
 Object::Type_t Object::getTypeIndex() const {
-	if (is_number()) return TYPE_NUMBER;
-	if (is_string()) return TYPE_STRING;
-	if (is_table()) return TYPE_TABLE;
-	if (is_boolean()) return TYPE_BOOLEAN;
-	if (is_function()) return TYPE_FUNCTION;
-	if (is_nil()) return TYPE_NIL;
-	throw std::runtime_error("unable to determine what type an object is");
+	return details->typeIndex;
 }
 
 //helper function
@@ -317,71 +391,45 @@ Object Object::getBinHandler(const Object& op1, const Object& op2, const std::st
 	return op1.getMetaHandler(event) || op2.getMetaHandler(event);
 }
 
-Object Object::invokeNumberMetaBinary(Object op1, Object op2, const std::string& event, std::function<double(double,double)> f) {
-	double o1, o2;
-	bool op1_isnumber = op1.tonumber(o1);
-	bool op2_isnumber = op2.tonumber(o2);
-	if (op1_isnumber && op2_isnumber) {
-		return Object(f(o1,o2));
+Object Object::invokeArithmeticHandler(const Object& op1, const Object& op2, const std::string& event) {
+	Object h = getBinHandler(op1, op2, event);
+	if (h) {
+		return h(op1, op2);
 	} else {
-		Object h = getBinHandler(op1, op2, event);
-		if (h) {
-			return h(op1, op2);
-		} else {
-			throw std::runtime_error(
-				std::string("attempt to perform arithmetic on a ")
-				+ (op1_isnumber ? op2 : op1).details->type() +
-				std::string(" value"));	//no handler available
-		}
+		double o1;
+		bool op1_isnumber = op1.tonumber(o1);
+		throw std::runtime_error(
+			std::string("attempt to perform arithmetic on a ")
+			+ (op1_isnumber ? op2 : op1).details->type() +
+			std::string(" value"));	//no handler available
 	}
 }
 
-Object Object::invokeStringMetaBinary(
-	Object op1,
-	Object op2,
-	const std::string& event,
-	std::function<bool(const Object&)> testType,
-	std::function<std::string(std::string,std::string)> func
-) {
-	bool op1_istype = testType(op1);
-	bool op2_istype = testType(op2);
-	if (op1_istype && op2_istype) {
-		return Object(func((std::string)op1, (std::string)op2));
+Object Object::invokeConcatHandler(const Object& op1, const Object& op2) {
+	Object h = getBinHandler(op1, op2, "__concat");
+	if (h) {
+		return h(op1, op2);
 	} else {
-		Object h = getBinHandler(op1, op2, event);
-		if (h) {
-			return h(op1, op2);
-		} else {
-			throw std::runtime_error(
-				std::string("attempt to concatenate a ")
-				+ (op1_istype ? op2 : op1).details->type() +
-				std::string(" value"));	//no handler available
-		}
+		bool op1_istype = op1.is_number() || op1.is_string();
+		throw std::runtime_error(
+			std::string("attempt to concatenate a ")
+			+ (op1_istype ? op2 : op1).details->type() +
+			std::string(" value"));	//no handler available
 	}
 }
 
-Object Object::operator-() const { 
-	if (is_number()) return Object(-((double)*this));
-	Object m = getMetaHandler("__unm");
+Object Object::invokeNumberMetaUnary(const Object& op, const std::string& event) {
+	Object m = op.getMetaHandler(event);
 	if (m) {
-		return m(*this);
+		return m(op);
 	} else {
 		throw std::runtime_error(
 			std::string("attempt to perform arithmetic on a ")
-			+ details->type() +
+			+ op.details->type() +
 			std::string(" value"));
 	}
 }
 
-Object Object::concat(const Object& o) const {
-	return invokeStringMetaBinary(
-		*this, o, "__concat",
-		std::function<bool(const Object&)>([=](const Object& o)->bool{
-			return o.is_number() || o.is_string();
-		}),
-		std::plus<std::string>());
-}
-
 
 Object Object::len() const {
 	//string check
@@ -405,6 +453,9 @@ Object Object::len() const {
 		return Object(max);
 	}
 
+	double n;
+	if (details->rawlen(n)) return Object(n);
+
 	//meta:
 	Object h = getMetaHandler("__len");
 	if (h) {
@@ -428,10 +479,76 @@ Object Object::getCompareHandler(Object op1, Object op2, const std::string& even
 
 //extras
 Object Object::operator~() const { return Object(~(Int)details->to_number()); }
-Object& Object::operator++() { details = std::make_shared<Object_Details_Number>(details->to_number() + 1); return *this; }
-Object Object::operator++(int) { Object copy(*this); details = std::make_shared<Object_Details_Number>(details->to_number() + 1); return copy; }
-Object& Object::operator--() { details = std::make_shared<Object_Details_Number>(details->to_number() - 1); return *this; }
-Object Object::operator--(int) { Object copy(*this); details = std::make_shared<Object_Details_Number>(details->to_number() - 1); return copy; }
+Object& Object::operator++() { return *this += 1; }
+Object Object::operator++(int) { Object copy(*this); *this += 1; return copy; }
+Object& Object::operator--() { return *this -= 1; }
+Object Object::operator--(int) { Object copy(*this); *this -= 1; return copy; }
+
+Object Object::equals(const Object& op1, const Object& op2) {
+	if (op1.getTypeIndex() != op2.getTypeIndex()) return false;
+	if (op1.details.get() == op2.details.get()) return true;	//compare pointers, used for tables and functions ... and any other primitive
+	//light userdata are equal by pointer, and have no __eq
+	const Object_Details_Userdata* la = tolightuserdata(op1);
+	const Object_Details_Userdata* lb = tolightuserdata(op2);
+	if (la || lb) return la && lb && la->ptr == lb->ptr;
+	if (!(op1.is_table() || op1.is_function() || op1.is_userdata())) {	//otherwise use built-in primitive compare
+		return Object(op1.details->compare(op2));
+	}
+	//by here it's a table (or function or userdata) and isn't identical, so fall back on metamethods
+	Object h = getCompareHandler(op1, op2, "__eq");
+	if (h) {
+		return h(op1, op2);
+	} else {
+		return false;
+	}
+}
+
+Object Object::lessThan(const Object& op1, const Object& op2) {
+	int ai = op1.getTypeIndex();
+	int bi = op2.getTypeIndex();
+
+	if (ai == bi) {
+		switch (ai) {
+		case TYPE_NUMBER:
+			return Object(op1.details->to_number() < op2.details->to_number());
+		case TYPE_STRING:
+			return Object(op1.details->to_string() < op2.details->to_string());
+		}
+	}
+
+	Object h = getCompareHandler(op1, op2, "__lt");
+	if (h) {
+		return h(op1, op2);
+	} else {
+		throw std::bad_cast();
+	}
+}
+
+Object Object::lessEqual(const Object& op1, const Object& op2) {
+	int ai = op1.getTypeIndex();
+	int bi = op2.getTypeIndex();
+
+	if (ai == bi) {
+		switch (ai) {
+		case TYPE_NUMBER:
+			return Object(op1.details->to_number() <= op2.details->to_number());
+		case TYPE_STRING:
+			return Object(op1.details->to_string() <= op2.details->to_string());
+		}
+	}
+
+	Object h = getCompareHandler(op1, op2, "__le");
+	if (h) {
+		return h(op1, op2);
+	} else {
+		h = getCompareHandler(op1, op2, "__lt");
+		if (h) {
+			return !(Object)h(op2, op1);
+		} else {
+			throw std::bad_cast();
+		}
+	}
+}
 
 Object type(Object o) {
 	return o.type();
@@ -442,10 +559,16 @@ Object tostring(Object o) {
 }
 
 Object getmetatable(Object x) {
+	if (!x.details->metatable) return nil;
 	return Object(x.details->metatable);
 }
 
 Object setmetatable(Object x, Object m) {
+	//other values' details may be shared by every value of their type (nil, true, false, constants) or by unrelated copies
+	//so a metatable set on one would show up on all of them
+	if (x.details->typeIndex != Object::TYPE_TABLE && x.details->typeIndex != Object::TYPE_USERDATA) {
+		throw std::runtime_error("bad argument #1 to 'setmetatable' (table expected, got " + x.type() + ")");
+	}
 	if (m.is_nil()) {
 		x.details->metatable.reset();
 	} else {
@@ -456,9 +579,106 @@ Object setmetatable(Object x, Object m) {
 	return x;
 }
 
+const char* Error::what() const noexcept {
+	if (value.is_string()) return static_cast<const Object_Details_String*>(value.details.get())->value.c_str();
+	if (message.empty()) {
+		try {
+			message = value.is_number() ? value.tostring() : "(error object is a " + value.type() + " value)";
+		} catch (...) {
+			return "error";
+		}
+	}
+	return message.c_str();
+}
+
+void error(const Object& value) {
+	throw Error(value);
+}
+
+VarArg pcall(const Object& f, const VarArg& args) {
+	VarArg results;
+	try {
+		const_cast<Object&>(f).call(args, results);
+	} catch (Error& e) {
+		return VarArg(false, e.value);
+	} catch (std::exception& e) {
+		return VarArg(false, e.what());
+	}
+	results.objects.insert(results.objects.begin(), Object(true));
+	return results;
+}
+
+VarArg xpcall(const Object& f, const Object& handler, const VarArg& args) {
+	VarArg results;
+	Object value;
+	try {
+		const_cast<Object&>(f).call(args, results);
+		results.objects.insert(results.objects.begin(), Object(true));
+		return results;
+	} catch (Error& e) {
+		value = e.value;
+	} catch (std::exception& e) {
+		value = e.what();
+	}
+	//outside the catch, so the handler can throw without the first error still in flight
+	results.objects.clear();
+	const_cast<Object&>(handler).call(VarArg(value), results);
+	results.objects.insert(results.objects.begin(), Object(false));
+	return results;
+}
+
 const Object nil;
 
 
+Callable::Callable() : invoke(nullptr), manage(nullptr) {}
+
+Callable::Callable(const Callable& x) : invoke(x.invoke), manage(x.manage) {
+	if (manage) {
+		manage(MANAGE_COPY, *this, const_cast<Callable*>(&x));
+	} else {
+		storage = x.storage;
+	}
+}
+
+Callable::Callable(Callable&& x) : invoke(x.invoke), manage(x.manage) {
+	if (manage) {
+		manage(MANAGE_MOVE, *this, &x);
+	} else {
+		storage = x.storage;
+	}
+	x.invoke = nullptr;
+	x.manage = nullptr;
+}
+
+Callable::~Callable() {
+	if (manage) manage(MANAGE_DESTROY, *this, nullptr);
+}
+
+Callable& Callable::operator=(const Callable& x) {
+	if (this != &x) {
+		Callable copy(x);
+		*this = std::move(copy);
+	}
+	return *this;
+}
+
+Callable& Callable::operator=(Callable&& x) {
+	if (this != &x) {
+		if (manage) manage(MANAGE_DESTROY, *this, nullptr);
+		invoke = x.invoke;
+		manage = x.manage;
+		if (manage) {
+			manage(MANAGE_MOVE, *this, &x);
+		} else {
+			storage = x.storage;
+		}
+		x.invoke = nullptr;
+		x.manage = nullptr;
+	}
+	return *this;
+}
+
+
 Object_Details::~Object_Details() {}
 
 std::string Object_Details::type() const { return "none"; }
@@ -473,15 +693,28 @@ std::string Object_Details::explicit_to_string() const { return to_string(); }
 
 bool Object_Details::compare(const Object& o) const { return false; }
 
+bool Object_Details::rawget(const Object& key, Object& value) const { return false; }
+bool Object_Details::rawset(const Object& key, const Object& value) { return false; }
+bool Object_Details::rawlen(double& out) const { return false; }
+
 
 std::string Object_Details_Number::type() const { return "number"; }
 
 double Object_Details_Number::to_number() const { return value; }
 
 std::string Object_Details_Number::to_string() const { 
-	std::ostringstream ss;
-	ss << value;
-	return ss.str();
+	return format(value);
+}
+
+std::string Object_Details_Number::format(double value) {
+	char buf[formatSize];
+	return std::string(buf, format(value, buf));
+}
+
+//%g is what an ostream writes doubles as by default
+size_t Object_Details_Number::format(double value, char* buf) {
+	int n = snprintf(buf, formatSize, "%g", value);
+	return n < 0 ? 0 : (size_t)n;
 }
 
 bool Object_Details_Number::to_boolean() const { return true; }
@@ -572,7 +805,7 @@ bool Object_Details_Nil::compare(const Object& o) const {
 void InitializerListOptionMap<Object>::exec(
 	VarArgType<ObjectType>& owner, const Type& x)
 {
-	owner.objects = std::vector<ObjectType>(x);
+	owner.objects = x;
 }
 	
 void InitializerListOptionMap<std::reference_wrapper<Object>>::exec(
@@ -596,6 +829,8 @@ Object Access::get() const {
 		h = owner->getMetaHandler("__index");
 		if (h.is_nil()) return nil;
 	} else {
+		Object value = nil;
+		if (owner->details->rawget(key, value)) return value;
 		h = owner->getMetaHandler("__index");
 		if (h.is_nil()) throw std::runtime_error(
 			std::string("attempt to index a ")
@@ -624,6 +859,7 @@ void Access::set(Object value) {
 			return;
 		}
 	} else {
+		if (owner->details->rawset(key, value)) return;
 		h = owner->getMetaHandler("__newindex");
 		if (!h) throw std::runtime_error(
 			std::string("attempt to index a ")
@@ -644,107 +880,312 @@ Access::operator Object() const { return get(); }
 
 static double pi = 4 * std::atan(1);
 
-Math::Math() : Object({
-	{"abs", ::fabs},
-	{"acos", ::acos},
-	{"asin", ::asin},
-	{"atan", ::atan},
-	{"atan2", ::atan2},
-	{"ceil", ::ceil},
-	{"cos", ::cos},
-	{"cosh", ::cosh},
-	{"deg", function(x) { return x*180/::CxxAsLua::pi; }},
-	{"exp", ::exp},
-	{"floor", ::floor},
-	{"fmod", Object::lmod},
-	{"frexp", function(x) {
-		int exp = std::numeric_limits<int>::lowest();
-		double a = ::frexp(x, &exp);
-		return VarArg(a, exp);
-	}},
-	{"huge", INFINITY},
-	{"ldexp", ::ldexp},
-	{"log", ::log},
-	{"log10", ::log10},
-	{"max", function(a,b) { return a>b?a:b; }},
-	{"min", function(a,b) { return a<b?a:b; }},
-	{"mod", Object::lmod},	//alias for fmod
-	{"modf", function(x) {
-		double intpart = std::numeric_limits<double>::quiet_NaN();
-		double fracpart = ::modf(x, &intpart);
-		return VarArg(intpart, fracpart);
-	}},
-	{"pi", ::CxxAsLua::pi},
-	{"pow", ::pow},
-	{"rad", function(x) { return x*::CxxAsLua::pi/180; }},
-	{"random", [=](VarArg args)->VarArg {
-		if (args.len() == 0) {
-			return (double)::rand()/(double)RAND_MAX;
-		} else if (args.len() == 1) {
-			int max = args[1];
-			if (max < 1) throw std::runtime_error("bad argument #1 to 'random' (interval is empty)");
-			return (::rand() % max) + 1;
-		} else if (args.len() == 2) {
-			int min = args[1];
-			int max = args[2];
-			int span = max - min + 1;
-			if (span <= 0) throw std::runtime_error("bad argument #2 to 'random' (interval is empty)");
-			return (::rand() % span) + min;
+//Lua's luaL_checkinteger
+static int64_t checkInteger(const Object& o, int arg, const char* func) {
+	double d;
+	if (!o.tonumber(d)) {
+		throw std::runtime_error("bad argument #" + std::to_string(arg) + " to '" + func + "' (number expected, got " + o.type() + ")");
+	}
+	if (d != ::floor(d) || d < -9223372036854775808. || d >= 9223372036854775808.) {
+		throw std::runtime_error("bad argument #" + std::to_string(arg) + " to '" + func + "' (number has no integer representation)");
+	}
+	return (int64_t)d;
+}
+
+//seeds are integers when they can be, otherwise the number's bits, so different floats still seed differently
+static uint64_t seedInteger(const Object& o) {
+	double d;
+	if (!o.tonumber(d)) throw std::runtime_error("bad argument #1 to 'randomseed' (number expected, got " + o.type() + ")");
+	if (d == ::floor(d) && d >= -9223372036854775808. && d < 9223372036854775808.) return (uint64_t)(int64_t)d;
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	return bits;
+}
+
+/*
+bulk math helpers
+typed arrays and all-number tables go through the kernels in Vectorized.cpp
+anything else goes element by element through Objects, so strings and metamethods behave as usual
+*/
+
+static Object bulkMap(Object t, Object op) {
+	if (op.is_string()) {
+		VectorUnaryOp kernel = vectorUnaryOp((std::string)op);
+		std::vector<double> buffer;
+		const double* x;
+		size_t n;
+		if (kernel && numbersOf(t, buffer, x, n)) {
+			//arrays map to float64 arrays, tables to tables
+			if (t.is_userdata()) {
+				Object result = array<double>(n);
+				kernel(toarray<double>(result)->data, x, n);
+				return result;
+			}
+			buffer.resize(n);
+			kernel(buffer.data(), x, n);
+			return vectorToTable(buffer.data(), n);
 		}
-		throw std::runtime_error("wrong number of arguments");
-	}},
-	{"randomseed", ::srand}, 
-	{"sin", ::sin},
-	{"sinh", ::sinh},
-	{"sqrt", ::sqrt},
-	{"tan", ::tan},
-	{"tanh", ::tanh}
-})
-, abs(this, "abs")
-, acos(this, "acos")
-, asin(this, "asin")
-, atan(this, "atan")
-, atan2(this, "atan2")
-, ceil(this, "ceil")
-, cos(this, "cos")
-, cosh(this, "cosh")
-, deg(this, "deg")
-, exp(this, "exp")
-, floor(this, "floor")
-, fmod(this, "fmod,")
-, frexp(this, "frexp")
-, huge(this, "huge")
-, ldexp(this, "ldexp")
-, log(this, "log")
-, log10(this, "log10")
-, max(this, "max")
-, min(this, "min")
-, mod(this, "mod")
-, modf(this, "modf")
-, pi(this, "pi")
-, pow(this, "pow")
-, rad(this, "rad,")
-, random(this, "random")
-, randomseed(this, "randomseed")
-, sin(this, "sin")
-, sinh(this, "sinh")
-, sqrt(this, "sqrt")
-, tan(this, "tan")
-, tanh(this, "tanh")
-{}
+		op = math[op];
+	}
+	if (!op.is_function()) throw std::runtime_error("bad argument #2 to 'map' (function or math function name expected)");
+	Object result = Object::Map();
+	for (int i = 1;; ++i) {
+		Object v = t[i];
+		if (v.is_nil()) break;
+		result[i] = op(v);
+	}
+	return result;
+}
+
+static Object bulkSum(Object t) {
+	std::vector<double> buffer;
+	const double* x;
+	size_t n;
+	if (numbersOf(t, buffer, x, n)) return vectorSum(x, n);
+	Object total = 0;
+	for (int i = 1;; ++i) {
+		Object v = t[i];
+		if (v.is_nil()) break;
+		total = total + v;
+	}
+	return total;
+}
+
+static Object bulkDot(Object a, Object b) {
+	std::vector<double> abuffer, bbuffer;
+	const double *x, *y;
+	size_t xn, yn;
+	if (numbersOf(a, abuffer, x, xn) && numbersOf(b, bbuffer, y, yn)) {
+		if (xn != yn) throw std::runtime_error("bad argument #2 to 'dot' (tables have different lengths)");
+		return vectorDot(x, y, xn);
+	}
+	Object total = 0;
+	for (int i = 1;; ++i) {
+		Object u = a[i];
+		Object v = b[i];
+		if (u.is_nil() != v.is_nil()) throw std::runtime_error("bad argument #2 to 'dot' (tables have different lengths)");
+		if (u.is_nil()) break;
+		total = total + u * v;
+	}
+	return total;
+}
+
+//'isMin' picks between minof and maxof
+static Object bulkMinMax(Object t, bool isMin) {
+	std::vector<double> buffer;
+	const double* x;
+	size_t n;
+	if (numbersOf(t, buffer, x, n) && n) {
+		return isMin ? vectorMin(x, n) : vectorMax(x, n);
+	}
+	Object result = t[1];
+	if (result.is_nil()) {
+		throw std::runtime_error(std::string("bad argument #1 to '") + (isMin ? "minof" : "maxof") + "' (table is empty)");
+	}
+	for (int i = 2;; ++i) {
+		Object v = t[i];
+		if (v.is_nil()) break;
+		if (isMin ? (bool)(v < result) : (bool)(v > result)) result = v;
+	}
+	return result;
+}
+
+Object Math::makeTable() {
+	return Object({
+		{"abs", ::fabs},
+		{"acos", ::acos},
+		{"asin", ::asin},
+		{"atan", ::atan},
+		{"atan2", ::atan2},
+		{"ceil", ::ceil},
+		{"cos", ::cos},
+		{"cosh", ::cosh},
+		{"deg", function(x) { return x*180/::CxxAsLua::pi; }},
+		{"dot", bulkDot},
+		{"exp", ::exp},
+		{"floor", ::floor},
+		{"fmod", Object::lmod},
+		{"frexp", function(x) {
+			int exp = std::numeric_limits<int>::lowest();
+			double a = ::frexp(x, &exp);
+			return VarArg(a, exp);
+		}},
+		{"huge", INFINITY},
+		{"ldexp", ::ldexp},
+		{"log", ::log},
+		{"log10", ::log10},
+		{"map", bulkMap},
+		{"max", function(a,b) { return a>b?a:b; }},
+		{"maxof", [=](Object t)->Object { return bulkMinMax(t, false); }},
+		{"min", function(a,b) { return a<b?a:b; }},
+		{"minof", [=](Object t)->Object { return bulkMinMax(t, true); }},
+		{"mod", Object::lmod},	//alias for fmod
+		{"modf", function(x) {
+			double intpart = std::numeric_limits<double>::quiet_NaN();
+			double fracpart = ::modf(x, &intpart);
+			return VarArg(intpart, fracpart);
+		}},
+		{"pi", ::CxxAsLua::pi},
+		{"pow", ::pow},
+		{"rad", function(x) { return x*::CxxAsLua::pi/180; }},
+		{"random", [=](VarArg args)->VarArg {
+			RandomState& state = randomState();
+			int64_t low, up;
+			switch (args.len()) {
+			case 0:
+				return state.nextFloat();
+			case 1:
+				low = 1;
+				up = checkInteger(args[1], 1, "random");
+				if (up == 0) return (double)(int64_t)state.next();	//all the bits
+				if (low > up) throw std::runtime_error("bad argument #1 to 'random' (interval is empty)");
+				break;
+			case 2:
+				low = checkInteger(args[1], 1, "random");
+				up = checkInteger(args[2], 2, "random");
+				if (low > up) throw std::runtime_error("bad argument #2 to 'random' (interval is empty)");
+				break;
+			default:
+				throw std::runtime_error("wrong number of arguments");
+			}
+			return (double)state.nextInRange(low, up);
+		}},
+		//t, n fills t[1..n] with random(), and t, n, m or t, n, low, up with random(m) or random(low, up)
+		{"random_fill", [=](VarArg args)->VarArg {
+			//everything is checked before anything is made
+			size_t nargs = args.len();
+			if (nargs < 2 || nargs > 4) throw std::runtime_error("wrong number of arguments");
+			Object t = args[1];
+			if (!t.is_table() && !t.is_userdata()) throw std::runtime_error("bad argument #1 to 'random_fill' (table expected, got " + t.type() + ")");
+			int64_t n = checkInteger(args[2], 2, "random_fill");
+			int64_t low = 0, up = 0;
+			if (nargs > 2) {
+				low = nargs == 3 ? 1 : checkInteger(args[3], 3, "random_fill");
+				up = checkInteger(args[nargs], (int)nargs, "random_fill");
+				if (low > up) throw std::runtime_error("bad argument #" + std::to_string(nargs) + " to 'random_fill' (interval is empty)");
+			}
+			//a block at a time, straight into the table's map, each key inserted next to the last;
+			//a __newindex handler may want to see the new keys, so those tables go through t[i] as before
+			Object_Details_Table* table = t.is_table() && !t.getMetaHandler("__newindex") ? static_cast<Object_Details_Table*>(t.details.get()) : nullptr;
+			Object::Map::iterator hint;
+			if (table) hint = table->value.lower_bound(Object(1.));
+			double block[256];
+			for (int64_t i = 0; i < n;) {
+				size_t count = (size_t)std::min<int64_t>(n - i, sizeof(block) / sizeof(block[0]));
+				if (nargs == 2) {
+					randomFill(block, count);
+				} else {
+					randomFill(block, count, low, up);
+				}
+				for (size_t j = 0; j < count; ++j, ++i) {
+					Object key((double)(i + 1));
+					if (!table) {
+						//userdata, such as typed arrays, and tables with a __newindex
+						t[key] = block[j];
+					} else if (hint != table->value.end() && !table->value.key_comp()(key, hint->first)) {
+						hint->second = block[j];
+						++hint;
+					} else {
+						hint = ++table->value.emplace_hint(hint, key, Object(block[j]));
+					}
+				}
+			}
+			return t;
+		}},
+		{"randomseed", [=](VarArg args)->VarArg {
+			RandomState& state = randomState();
+			uint64_t n1, n2;
+			if (args.len() == 0) {
+				state.randomize(n1, n2);
+			} else {
+				n1 = seedInteger(args[1]);
+				n2 = args.len() > 1 ? seedInteger(args[2]) : 0;
+				state.seed(n1, n2);
+			}
+			return VarArg((double)(int64_t)n1, (double)(int64_t)n2);
+		}},
+		{"sin", ::sin},
+		{"sinh", ::sinh},
+		{"sqrt", ::sqrt},
+		{"sum", bulkSum},
+		{"tan", ::tan},
+		{"tanh", ::tanh}
+	});
+}
 
 Math math;
 
-IO::IO() : Object({
-	{"write", [=](VarArg args)->VarArg{
-		for (const Object& o : args.objects) {
-			std::cout << o.tostring();
-		}
-		return nil;
-	}}
-})
-, write(this, "write")
-{}
+void writeOutput(const char* s, size_t n) {
+	fwrite(s, 1, n, stdout);
+}
+
+void writeOutput(const std::string& s) {
+	fwrite(s.data(), 1, s.size(), stdout);
+}
+
+void writeOutput(double d) {
+	char buf[Object_Details_Number::formatSize];
+	fwrite(buf, 1, Object_Details_Number::format(d, buf), stdout);
+}
+
+void writeOutput(const Object& o) {
+	switch (o.details->typeIndex) {
+	case Object::TYPE_STRING:
+		writeOutput(static_cast<const Object_Details_String*>(o.details.get())->value);
+		break;
+	case Object::TYPE_NUMBER:
+		writeOutput(static_cast<const Object_Details_Number*>(o.details.get())->value);
+		break;
+	default:
+		writeOutput(o.tostring());
+		break;
+	}
+}
+
+void flushOutput() {
+	//std::cout is synced with stdio by default, but flush it as well in case it isn't
+	std::cout.flush();
+	fflush(stdout);
+}
+
+bool bufferOutput(size_t size) {
+	return setvbuf(stdout, nullptr, isatty(fileno(stdout)) ? _IOLBF : _IOFBF, size) == 0;
+}
+
+Object IO::makeTable() {
+	//io.write returns it, for chains like io.write(a):write(b)
+	Object output = fileHandle(stdout);
+	return Object({
+		{"close", [=](VarArg args)->VarArg{
+			return ioClose(args);
+		}},
+		{"flush", [=](VarArg args)->VarArg{
+			flushOutput();
+			return nil;
+		}},
+		{"lines", [=](VarArg args)->VarArg{
+			return ioLines(args);
+		}},
+		{"open", [=](VarArg args)->VarArg{
+			return ioOpen(args);
+		}},
+		{"read", [=](VarArg args)->VarArg{
+			return ioRead(args);
+		}},
+		{"stderr", fileHandle(stderr)},
+		{"stdin", fileHandle(stdin)},
+		{"stdout", output},
+		{"type", [=](VarArg args)->VarArg{
+			return ioType(args);
+		}},
+		{"write", [=](VarArg args)->VarArg{
+			for (const Object& o : args.objects) {
+				writeOutput(o);
+			}
+			return output;
+		}}
+	});
+}
 
 IO io;
 
@@ -0,0 +1,86 @@
+#include "CxxAsLua/Random.h"
+#include <ctime>
+
+namespace CxxAsLua {
+
+static inline uint64_t rotl(uint64_t x, int n) {
+	return (x << n) | (x >> (64 - n));
+}
+
+RandomState::RandomState() {
+	randomize();
+}
+
+void RandomState::randomize() {
+	uint64_t n1, n2;
+	randomize(n1, n2);
+}
+
+void RandomState::randomize(uint64_t& n1, uint64_t& n2) {
+	n1 = (uint64_t)time(nullptr);
+	//kept to 53 bits, so the seed survives being handed to Lua as a number and back
+	n2 = (uint64_t)(size_t)this & (((uint64_t)1 << 53) - 1);
+	seed(n1, n2);
+}
+
+uint64_t RandomState::next() {
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+void RandomState::seed(uint64_t n1, uint64_t n2) {
+	s[0] = n1;
+	s[1] = 0xff;	//avoid a zero state
+	s[2] = n2;
+	s[3] = 0;
+	//discard initial values to "spread" the seed
+	for (int i = 0; i < 16; ++i) next();
+}
+
+double RandomState::nextFloat() {
+	//the top 53 bits, scaled by 2^-53
+	return (double)(next() >> 11) * (0.5 / ((uint64_t)1 << 52));
+}
+
+uint64_t RandomState::project(uint64_t ran, uint64_t n) {
+	if ((n & (n + 1)) == 0) return ran & n;	//n+1 is a power of 2: no bias
+	//smallest 2^b-1 not smaller than n
+	uint64_t lim = n;
+	lim |= (lim >> 1);
+	lim |= (lim >> 2);
+	lim |= (lim >> 4);
+	lim |= (lim >> 8);
+	lim |= (lim >> 16);
+	lim |= (lim >> 32);
+	//outside [0, n]? try again
+	while ((ran &= lim) > n) ran = next();
+	return ran;
+}
+
+int64_t RandomState::nextInRange(int64_t low, int64_t up) {
+	return (int64_t)(project(next(), (uint64_t)up - (uint64_t)low) + (uint64_t)low);
+}
+
+RandomState& randomState() {
+	static thread_local RandomState state;
+	return state;
+}
+
+void randomFill(double* dst, size_t n) {
+	RandomState& state = randomState();
+	for (size_t i = 0; i < n; ++i) dst[i] = state.nextFloat();
+}
+
+void randomFill(double* dst, size_t n, int64_t low, int64_t up) {
+	RandomState& state = randomState();
+	for (size_t i = 0; i < n; ++i) dst[i] = (double)state.nextInRange(low, up);
+}
+
+}
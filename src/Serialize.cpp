@@ -0,0 +1,370 @@
+#include "CxxAsLua/Serialize.h"
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace CxxAsLua {
+
+static const char serializeMagic[4] = {'C', 'X', 'L', 'B'};
+static const uint8_t serializeVersion = 1;
+
+enum SerializeTag {
+	TAG_NIL,
+	TAG_FALSE,
+	TAG_TRUE,
+	TAG_NUMBER,
+	TAG_INTEGER,
+	TAG_STRING,
+	TAG_TABLE,
+};
+
+struct SerializeWriter {
+	std::string body;
+
+	std::unordered_map<std::string, size_t> stringIds;
+	std::vector<const std::string*> strings;	//keys of stringIds, in id order
+
+	std::unordered_map<const Object_Details*, size_t> tableIds;
+	std::vector<Object> tables;	//in id order, their entries are written after the root
+
+	void varint(std::string& out, uint64_t v) {
+		while (v >= 0x80) {
+			out += (char)(v | 0x80);
+			v >>= 7;
+		}
+		out += (char)v;
+	}
+
+	void fixed64(std::string& out, uint64_t v) {
+		for (int i = 0; i < 8; ++i) out += (char)(v >> (8 * i));
+	}
+
+	void string(const std::string& s) {
+		std::pair<std::unordered_map<std::string, size_t>::iterator, bool> i = stringIds.insert(std::make_pair(s, strings.size()));
+		if (i.second) strings.push_back(&i.first->first);
+		body += (char)TAG_STRING;
+		varint(body, i.first->second);
+	}
+
+	void number(double d) {
+		//integers in double's exact range are shorter as varints
+		if (d == std::floor(d) && std::fabs(d) < 9007199254740992. && !(d == 0 && std::signbit(d))) {
+			int64_t i = (int64_t)d;
+			body += (char)TAG_INTEGER;
+			varint(body, ((uint64_t)i << 1) ^ (uint64_t)(i >> 63));
+			return;
+		}
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof(bits));
+		body += (char)TAG_NUMBER;
+		fixed64(body, bits);
+	}
+
+	void table(const Object& t) {
+		std::pair<std::unordered_map<const Object_Details*, size_t>::iterator, bool> i = tableIds.insert(std::make_pair(t.details.get(), tables.size()));
+		if (i.second) tables.push_back(t);
+		body += (char)TAG_TABLE;
+		varint(body, i.first->second);
+	}
+
+	void value(const Object& o) {
+		switch (o.details->typeIndex) {
+		case Object::TYPE_NIL:
+			body += (char)TAG_NIL;
+			return;
+		case Object::TYPE_BOOLEAN:
+			body += (char)(static_cast<const Object_Details_Boolean*>(o.details.get())->value ? TAG_TRUE : TAG_FALSE);
+			return;
+		case Object::TYPE_NUMBER:
+			number(static_cast<const Object_Details_Number*>(o.details.get())->value);
+			return;
+		case Object::TYPE_STRING:
+			string(static_cast<const Object_Details_String*>(o.details.get())->value);
+			return;
+		case Object::TYPE_TABLE:
+			table(o);
+			return;
+		default:
+			if (testudata<Object_Details_SnapshotTable>(o)) {
+				table(o);
+				return;
+			}
+			throw std::runtime_error("cannot serialize a " + o.type() + " value");
+		}
+	}
+
+	void entries(const Object::Map& map) {
+		varint(body, map.size());
+		for (const Object::Map::value_type& pair : map) {
+			value(pair.first);
+			value(pair.second);
+		}
+	}
+};
+
+Object serialize(const Object& o) {
+	SerializeWriter w;
+	w.value(o);
+	std::vector<size_t> tableOffsets;
+	for (size_t i = 0; i < w.tables.size(); ++i) {	//grows as subtables are found
+		tableOffsets.push_back(w.body.size());
+		const Object& t = w.tables[i];
+		Object_Details_SnapshotTable* snapshot = testudata<Object_Details_SnapshotTable>(t);
+		if (snapshot) {
+			snapshot->load();
+			w.entries(snapshot->value);
+		} else {
+			w.entries(static_cast<const Object_Details_Table*>(t.details.get())->value);
+		}
+	}
+
+	std::string out(serializeMagic, sizeof(serializeMagic));
+	out += (char)serializeVersion;
+	w.varint(out, w.strings.size());
+	for (const std::string* s : w.strings) {
+		w.varint(out, s->size());
+		out += *s;
+	}
+	size_t bodyStart = out.size();
+	out += w.body;
+	for (size_t offset : tableOffsets) w.fixed64(out, bodyStart + offset);
+	w.fixed64(out, tableOffsets.size());
+	return Object(std::make_shared<Object_Details_String>(std::move(out)));
+}
+
+
+//the parsed outline of serialized data: where its strings, root and tables are
+struct SerializedData {
+	const char* data;
+	size_t size;
+	std::shared_ptr<void> owner;	//keeps 'data' alive
+
+	std::vector<size_t> stringOffsets;
+	std::vector<Object> strings;	//decoded on first use, nil until then
+	size_t rootOffset;
+	std::vector<size_t> tableOffsets;
+	std::vector<std::weak_ptr<Object_Details>> snapshotTables;
+
+	SerializedData(const char* data_, size_t size_, std::shared_ptr<void> owner_)
+	: data(data_), size(size_), owner(owner_), rootOffset(0)
+	{
+		if (size < sizeof(serializeMagic) + 1 + 8 || memcmp(data, serializeMagic, sizeof(serializeMagic)) != 0) {
+			throw std::runtime_error("not serialized data");
+		}
+		if ((uint8_t)data[sizeof(serializeMagic)] != serializeVersion) {
+			throw std::runtime_error("unsupported serialized data version");
+		}
+		size_t pos = sizeof(serializeMagic) + 1;
+		uint64_t count = varint(pos);
+		if (count > size) corrupt();
+		stringOffsets.reserve(count);
+		for (uint64_t i = 0; i < count; ++i) {
+			stringOffsets.push_back(pos);
+			uint64_t length = varint(pos);
+			if (length > size - pos) corrupt();
+			pos += length;
+		}
+		strings.resize(count);
+		rootOffset = pos;
+
+		uint64_t tables = fixed64(size - 8);
+		if (tables > (size - 8 - pos) / 8) corrupt();
+		size_t index = size - 8 - 8 * tables;
+		tableOffsets.reserve(tables);
+		for (uint64_t i = 0; i < tables; ++i) {
+			uint64_t offset = fixed64(index + 8 * i);
+			if (offset < rootOffset || offset >= index) corrupt();
+			tableOffsets.push_back(offset);
+		}
+		snapshotTables.resize(tables);
+	}
+
+	[[noreturn]] static void corrupt() {
+		throw std::runtime_error("corrupt serialized data");
+	}
+
+	uint8_t byte(size_t& pos) const {
+		if (pos >= size) corrupt();
+		return (uint8_t)data[pos++];
+	}
+
+	uint64_t varint(size_t& pos) const {
+		uint64_t v = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			uint8_t b = byte(pos);
+			v |= (uint64_t)(b & 0x7f) << shift;
+			if (!(b & 0x80)) return v;
+		}
+		corrupt();
+	}
+
+	uint64_t fixed64(size_t pos) const {
+		if (pos > size || size - pos < 8) corrupt();
+		uint64_t v = 0;
+		for (int i = 0; i < 8; ++i) v |= (uint64_t)(uint8_t)data[pos + i] << (8 * i);
+		return v;
+	}
+
+	const Object& string(uint64_t id) {
+		if (id >= strings.size()) corrupt();
+		Object& s = strings[id];
+		if (s.is_nil()) {
+			size_t pos = stringOffsets[id];
+			uint64_t length = varint(pos);
+			s = Object(std::make_shared<Object_Details_String>(std::string(data + pos, length)));
+		}
+		return s;
+	}
+
+	//'table' turns a table id into its Object
+	template<typename TableFunc>
+	Object value(size_t& pos, TableFunc table) {
+		switch (byte(pos)) {
+		case TAG_NIL:
+			return nil;
+		case TAG_FALSE:
+			return Object(false);
+		case TAG_TRUE:
+			return Object(true);
+		case TAG_NUMBER: {
+			uint64_t bits = fixed64(pos);
+			pos += 8;
+			double d;
+			memcpy(&d, &bits, sizeof(d));
+			return Object(d);
+		}
+		case TAG_INTEGER: {
+			uint64_t z = varint(pos);
+			return Object((double)(int64_t)((z >> 1) ^ (~(z & 1) + 1)));
+		}
+		case TAG_STRING:
+			return string(varint(pos));
+		case TAG_TABLE: {
+			uint64_t id = varint(pos);
+			if (id >= tableOffsets.size()) corrupt();
+			return table((size_t)id);
+		}
+		default:
+			corrupt();
+		}
+	}
+
+	template<typename TableFunc>
+	void entries(size_t id, Object::Map& map, TableFunc table) {
+		size_t pos = tableOffsets[id];
+		uint64_t count = varint(pos);
+		for (uint64_t i = 0; i < count; ++i) {
+			Object k = value(pos, table);
+			Object v = value(pos, table);
+			if (!k.is_nil()) map[k] = v;
+		}
+	}
+};
+
+Object deserialize(const char* data, size_t size) {
+	SerializedData source(data, size, nullptr);
+	//create every table first, so shared and cyclic references can point at them
+	std::vector<Object> tables;
+	tables.reserve(source.tableOffsets.size());
+	for (size_t i = 0; i < source.tableOffsets.size(); ++i) {
+		tables.push_back(Object(std::make_shared<Object_Details_Table>()));
+	}
+	auto table = [&](size_t id)->Object{ return tables[id]; };
+	for (size_t i = 0; i < tables.size(); ++i) {
+		source.entries(i, static_cast<Object_Details_Table*>(tables[i].details.get())->value, table);
+	}
+	size_t pos = source.rootOffset;
+	return source.value(pos, table);
+}
+
+Object deserialize(const Object& bytes) {
+	if (!bytes.is_string()) throw std::runtime_error("bad argument #1 to 'deserialize' (string expected, got " + bytes.type() + ")");
+	const std::string& s = static_cast<const Object_Details_String*>(bytes.details.get())->value;
+	return deserialize(s.data(), s.size());
+}
+
+
+//each table id has at most one snapshot table alive at a time, so identity is kept
+static Object snapshotTable(const std::shared_ptr<SerializedData>& source, size_t id) {
+	std::shared_ptr<Object_Details> t = source->snapshotTables[id].lock();
+	if (!t) {
+		t = std::make_shared<Object_Details_SnapshotTable>(source, id);
+		source->snapshotTables[id] = t;
+	}
+	return Object(t);
+}
+
+Object_Details_SnapshotTable::Object_Details_SnapshotTable(std::shared_ptr<SerializedData> source_, size_t id_)
+: Super(&UserdataType<Object_Details_SnapshotTable>::id, this)
+, source(source_)
+, id(id_)
+, loaded(false)
+{}
+
+std::string Object_Details_SnapshotTable::explicit_to_string() const {
+	std::ostringstream ss;
+	ss << "snapshot table: 0x" << std::hex << this;
+	return ss.str();
+}
+
+void Object_Details_SnapshotTable::load() const {
+	if (loaded) return;
+	std::shared_ptr<SerializedData> s = source;
+	s->entries(id, value, [&](size_t id)->Object{ return snapshotTable(s, id); });
+	loaded = true;
+}
+
+Object::Map Object_Details_SnapshotTable::to_table() const {
+	load();
+	return value;
+}
+
+bool Object_Details_SnapshotTable::rawget(const Object& key, Object& result) const {
+	load();
+	Object::Map::const_iterator i = value.find(key);
+	result = i == value.end() ? nil : i->second;
+	return true;
+}
+
+bool Object_Details_SnapshotTable::rawset(const Object& key, const Object& v) {
+	throw std::runtime_error("attempt to modify a snapshot table");
+}
+
+//same as a table's length
+bool Object_Details_SnapshotTable::rawlen(double& out) const {
+	load();
+	out = 0;
+	for (const Object::Map::value_type& pair : value) {
+		if (pair.first.is_number()) {
+			double v = (double)pair.first;
+			if (v == floor(v)) out = std::max(out, v);
+		}
+	}
+	return true;
+}
+
+Object mapSnapshot(const std::string& path) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) throw std::runtime_error(path + ": " + strerror(errno));
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		throw std::runtime_error(path + ": not serialized data");
+	}
+	size_t size = (size_t)st.st_size;
+	void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) throw std::runtime_error(path + ": " + strerror(errno));
+	std::shared_ptr<void> owner(p, [size](void* p) { munmap(p, size); });
+
+	std::shared_ptr<SerializedData> source = std::make_shared<SerializedData>((const char*)p, size, owner);
+	size_t pos = source->rootOffset;
+	return source->value(pos, [&](size_t id)->Object{ return snapshotTable(source, id); });
+}
+
+}
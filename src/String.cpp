@@ -0,0 +1,1089 @@
+#include "CxxAsLua/String.h"
+#include "CxxAsLua/Constant.h"
+#include "CxxAsLua/LuaRuntime.h"
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+namespace CxxAsLua {
+
+/*
+arguments
+numbers are accepted where strings are expected and the other way around, as Lua does
+*/
+
+static std::runtime_error stringArgError(int arg, const char* func, const std::string& msg) {
+	return std::runtime_error("bad argument #" + std::to_string(arg) + " to '" + func + "' (" + msg + ")");
+}
+
+static std::string stringArgType(const VarArg& args, int arg) {
+	return (size_t)arg > args.objects.size() ? std::string("no value") : args.objects[arg - 1].type();
+}
+
+//'holder' keeps a number's string alive while it's used
+static const std::string& checkString(const VarArg& args, int arg, const char* func, Object& holder) {
+	if ((size_t)arg <= args.objects.size()) {
+		const Object& o = args.objects[arg - 1];
+		if (o.details->typeIndex == Object::TYPE_STRING) return static_cast<const Object_Details_String*>(o.details.get())->value;
+		if (o.details->typeIndex == Object::TYPE_NUMBER) {
+			holder = luaToString(o);
+			return static_cast<const Object_Details_String*>(holder.details.get())->value;
+		}
+	}
+	throw stringArgError(arg, func, "string expected, got " + stringArgType(args, arg));
+}
+
+static double checkNumber(const VarArg& args, int arg, const char* func) {
+	double d;
+	if ((size_t)arg > args.objects.size() || !args.objects[arg - 1].tonumber(d)) {
+		throw stringArgError(arg, func, "number expected, got " + stringArgType(args, arg));
+	}
+	return d;
+}
+
+static int64_t checkInteger(const VarArg& args, int arg, const char* func) {
+	double d = checkNumber(args, arg, func);
+	if (d != ::floor(d) || d < -9223372036854775808. || d >= 9223372036854775808.) {
+		throw stringArgError(arg, func, "number has no integer representation");
+	}
+	return (int64_t)d;
+}
+
+static int64_t optInteger(const VarArg& args, int arg, const char* func, int64_t def) {
+	if ((size_t)arg > args.objects.size() || args.objects[arg - 1].is_nil()) return def;
+	return checkInteger(args, arg, func);
+}
+
+//a string built here, moved into the Object rather than copied
+static Object stringObject(std::string&& s) {
+	return Object(std::make_shared<Object_Details_String>(std::move(s)));
+}
+
+//a position counting from the end when negative, clamped at 0 before the start
+static int64_t stringPosition(int64_t pos, size_t len) {
+	if (pos >= 0) return pos;
+	if ((uint64_t)-pos > len) return 0;
+	return (int64_t)len + pos + 1;
+}
+
+/*
+patterns
+compiled into items: each single-character class becomes a 256-bit set, so matching a character is one bit test
+matching backtracks as Lua's does, over the items rather than the pattern's text
+*/
+
+enum {
+	PATTERN_MAX_CAPTURES = 32,
+	PATTERN_MAX_CALLS = 200,
+	CAPTURE_UNFINISHED = -1,
+	CAPTURE_POSITION = -2,
+};
+
+struct PatternItem {
+	enum Kind {
+		SINGLE,	//a character in 'set', repeated as 'rep' says
+		OPEN,	//(
+		POSITION,	//()
+		CLOSE,	//)
+		BACKREF,	//%1 to %9, with the digit in 'a'
+		BALANCE,	//%bxy, with x and y in 'a' and 'b'
+		FRONTIER,	//%f[set]
+		END,	//$ at the end
+	};
+
+	Kind kind;
+	char rep;	//0, '*', '+', '-' or '?'
+	unsigned char a, b;
+	uint64_t set[4];
+
+	explicit PatternItem(Kind kind_) : kind(kind_), rep(0), a(0), b(0), set{0, 0, 0, 0} {}
+
+	bool test(unsigned char c) const { return (set[c >> 6] >> (c & 63)) & 1; }
+	void add(unsigned char c) { set[c >> 6] |= (uint64_t)1 << (c & 63); }
+};
+
+struct Pattern {
+	std::vector<PatternItem> items;
+	bool anchored = false;
+	std::string prefix;	//characters every match starts with
+	const PatternItem* first = nullptr;	//or a class the first character of every match is in
+};
+
+static bool patternClass(unsigned char cl, unsigned char c) {
+	bool res;
+	switch (tolower(cl)) {
+	case 'a': res = isalpha(c); break;
+	case 'c': res = iscntrl(c); break;
+	case 'd': res = isdigit(c); break;
+	case 'g': res = isgraph(c); break;
+	case 'l': res = islower(c); break;
+	case 'p': res = ispunct(c); break;
+	case 's': res = isspace(c); break;
+	case 'u': res = isupper(c); break;
+	case 'w': res = isalnum(c); break;
+	case 'x': res = isxdigit(c); break;
+	case 'z': res = c == 0; break;	//deprecated, as \0 can be used
+	default: return cl == c;
+	}
+	return isupper(cl) ? !res : res;
+}
+
+static void addClass(PatternItem& item, unsigned char cl) {
+	for (int c = 0; c < 256; ++c) {
+		if (patternClass(cl, (unsigned char)c)) item.add((unsigned char)c);
+	}
+}
+
+//[set], with p just past the '['
+static const char* compileSet(PatternItem& item, const char* p, const char* end) {
+	bool negate = p < end && *p == '^';
+	if (negate) ++p;
+	//the first character is part of the set even if it's ']'
+	do {
+		if (p >= end) throw std::runtime_error("malformed pattern (missing ']')");
+		unsigned char c = (unsigned char)*p++;
+		if (c == '%') {
+			if (p >= end) throw std::runtime_error("malformed pattern (missing ']')");
+			addClass(item, (unsigned char)*p++);
+		} else if (p + 1 < end && *p == '-' && p[1] != ']') {
+			unsigned char last = (unsigned char)p[1];
+			for (int x = c; x <= last; ++x) item.add((unsigned char)x);
+			p += 2;
+		} else {
+			item.add(c);
+		}
+	} while (p >= end || *p != ']');
+	if (negate) {
+		for (uint64_t& bits : item.set) bits = ~bits;
+	}
+	return p + 1;
+}
+
+//'anchors' says whether a leading '^' is an anchor, or just a character as gmatch has it
+static void compilePattern(Pattern& pattern, const std::string& source, bool anchors) {
+	const char* p = source.data();
+	const char* end = p + source.size();
+	if (anchors && p < end && *p == '^') {
+		pattern.anchored = true;
+		++p;
+	}
+	while (p < end) {
+		switch (*p) {
+		case '(':
+			if (p + 1 < end && p[1] == ')') {
+				pattern.items.emplace_back(PatternItem::POSITION);
+				p += 2;
+			} else {
+				pattern.items.emplace_back(PatternItem::OPEN);
+				++p;
+			}
+			continue;
+		case ')':
+			pattern.items.emplace_back(PatternItem::CLOSE);
+			++p;
+			continue;
+		case '$':
+			if (p + 1 == end) {
+				pattern.items.emplace_back(PatternItem::END);
+				++p;
+				continue;
+			}
+			break;
+		case '%':
+			if (p + 1 >= end) throw std::runtime_error("malformed pattern (ends with '%')");
+			if (p[1] == 'b') {
+				if (p + 3 >= end) throw std::runtime_error("malformed pattern (missing arguments to '%b')");
+				PatternItem item(PatternItem::BALANCE);
+				item.a = (unsigned char)p[2];
+				item.b = (unsigned char)p[3];
+				pattern.items.push_back(item);
+				p += 4;
+				continue;
+			}
+			if (p[1] == 'f') {
+				p += 2;
+				if (p >= end || *p != '[') throw std::runtime_error("missing '[' after '%f' in pattern");
+				PatternItem item(PatternItem::FRONTIER);
+				p = compileSet(item, p + 1, end);
+				pattern.items.push_back(item);
+				continue;
+			}
+			if (isdigit((unsigned char)p[1])) {
+				PatternItem item(PatternItem::BACKREF);
+				item.a = (unsigned char)p[1];
+				pattern.items.push_back(item);
+				p += 2;
+				continue;
+			}
+			break;
+		default:
+			break;
+		}
+
+		PatternItem item(PatternItem::SINGLE);
+		if (*p == '%') {
+			addClass(item, (unsigned char)p[1]);
+			p += 2;
+		} else if (*p == '[') {
+			p = compileSet(item, p + 1, end);
+		} else if (*p == '.') {
+			for (uint64_t& bits : item.set) bits = ~(uint64_t)0;
+			++p;
+		} else {
+			item.add((unsigned char)*p++);
+		}
+		if (p < end && (*p == '*' || *p == '+' || *p == '-' || *p == '?')) item.rep = *p++;
+		pattern.items.push_back(item);
+	}
+
+	//literal characters at the start let the search skip ahead with memchr
+	for (const PatternItem& item : pattern.items) {
+		if (item.kind != PatternItem::SINGLE || item.rep) break;
+		int count = 0, literal = 0;
+		for (int c = 0; c < 256; ++c) {
+			if (item.test((unsigned char)c)) {
+				++count;
+				literal = c;
+			}
+		}
+		if (count != 1) break;
+		pattern.prefix += (char)literal;
+	}
+	if (pattern.prefix.empty() && !pattern.items.empty()) {
+		const PatternItem& item = pattern.items[0];
+		if (item.kind == PatternItem::SINGLE && (!item.rep || item.rep == '+')) pattern.first = &item;
+	}
+}
+
+static void compilePattern(Pattern& pattern, const std::string& source) {
+	compilePattern(pattern, source, true);
+}
+
+static void compileGmatchPattern(Pattern& pattern, const std::string& source) {
+	compilePattern(pattern, source, false);
+}
+
+/*
+compiled patterns and formats, kept per thread by their text
+the last one used is checked first by its string's details, so a constant pattern isn't even hashed
+kept trivially-destructible, as the VM's frame pool is, so it can be closed once at thread exit
+*/
+template<typename T, void (*Compile)(T&, const std::string&)>
+struct CompiledCache {
+	typedef std::shared_ptr<const T> Compiled;
+	enum { MAX_ENTRIES = 256 };	//beyond this the strings are probably data, so start over
+	std::unordered_map<std::string, Compiled>* entries;
+	std::shared_ptr<Object_Details>* lastSource;
+	const Compiled* last;
+	bool closed;
+
+	Compiled get(const Object& source) {
+		if (lastSource && lastSource->get() == source.details.get()) return *last;
+		const std::string& s = static_cast<const Object_Details_String*>(source.details.get())->value;
+		if (closed) return compile(s);
+		if (!entries) {
+			entries = new std::unordered_map<std::string, Compiled>();
+			lastSource = new std::shared_ptr<Object_Details>();
+		}
+		auto i = entries->find(s);
+		if (i == entries->end()) {
+			if (entries->size() >= MAX_ENTRIES) entries->clear();
+			i = entries->emplace(s, compile(s)).first;
+		}
+		*lastSource = source.details;
+		last = &i->second;
+		return i->second;
+	}
+
+	static Compiled compile(const std::string& s) {
+		std::shared_ptr<T> compiled = std::make_shared<T>();
+		Compile(*compiled, s);
+		return compiled;
+	}
+
+	void close() {
+		delete entries;
+		delete lastSource;
+		entries = nullptr;
+		lastSource = nullptr;
+		closed = true;
+	}
+};
+
+template<typename Cache>
+struct CompiledCacheCloser {
+	Cache& cache;
+	~CompiledCacheCloser() { cache.close(); }
+};
+
+//the compiled form of a string argument
+//taking the closer odr-uses it, so it is constructed for this thread
+template<typename Cache>
+static typename Cache::Compiled checkCompiled(Cache& cache, CompiledCacheCloser<Cache>&, const VarArg& args, int arg, const char* func) {
+	Object holder;
+	if ((size_t)arg <= args.objects.size() && args.objects[arg - 1].details->typeIndex == Object::TYPE_STRING) {
+		return cache.get(args.objects[arg - 1]);
+	}
+	checkString(args, arg, func, holder);
+	return cache.get(holder);
+}
+
+typedef CompiledCache<Pattern, compilePattern> PatternCache;
+static thread_local PatternCache patternCache;
+static thread_local CompiledCacheCloser<PatternCache> patternCacheCloser = {patternCache};
+
+static std::shared_ptr<const Pattern> checkPattern(const VarArg& args, int arg, const char* func) {
+	return checkCompiled(patternCache, patternCacheCloser, args, arg, func);
+}
+
+//gmatch's are kept apart, as the same text compiles differently without the anchor
+typedef CompiledCache<Pattern, compileGmatchPattern> GmatchPatternCache;
+static thread_local GmatchPatternCache gmatchPatternCache;
+static thread_local CompiledCacheCloser<GmatchPatternCache> gmatchPatternCacheCloser = {gmatchPatternCache};
+
+struct PatternMatch {
+	const char* srcInit;
+	const char* srcEnd;
+	const Pattern* pattern;
+	int level;
+	int depth;
+	struct {
+		const char* init;
+		ptrdiff_t len;
+	} capture[PATTERN_MAX_CAPTURES];
+
+	PatternMatch(const std::string& s, const Pattern& pattern_) : srcInit(s.data()), srcEnd(s.data() + s.size()), pattern(&pattern_), level(0), depth(0) {}
+
+	//where a match could start at or after s, or null if none can
+	const char* candidate(const char* s) const {
+		const std::string& prefix = pattern->prefix;
+		if (!prefix.empty()) {
+			while ((size_t)(srcEnd - s) >= prefix.size()) {
+				s = (const char*)memchr(s, prefix[0], (size_t)(srcEnd - s) - prefix.size() + 1);
+				if (!s) return nullptr;
+				if (memcmp(s + 1, prefix.data() + 1, prefix.size() - 1) == 0) return s;
+				++s;
+			}
+			return nullptr;
+		}
+		if (pattern->first) {
+			while (s < srcEnd && !pattern->first->test((unsigned char)*s)) ++s;
+			return s < srcEnd ? s : nullptr;
+		}
+		return s;
+	}
+
+	//the end of a match starting at s, or null
+	const char* start(const char* s) {
+		level = 0;
+		depth = 0;
+		return match(s, 0);
+	}
+
+	const char* match(const char* s, size_t i) {
+		if (++depth > PATTERN_MAX_CALLS) throw std::runtime_error("pattern too complex");
+		const std::vector<PatternItem>& items = pattern->items;
+		const char* result = nullptr;
+		while (true) {
+			if (i == items.size()) {
+				result = s;
+				break;
+			}
+			const PatternItem& item = items[i];
+			switch (item.kind) {
+			case PatternItem::OPEN:
+				result = startCapture(s, i + 1, CAPTURE_UNFINISHED);
+				break;
+			case PatternItem::POSITION:
+				result = startCapture(s, i + 1, CAPTURE_POSITION);
+				break;
+			case PatternItem::CLOSE:
+				result = endCapture(s, i + 1);
+				break;
+			case PatternItem::END:
+				result = s == srcEnd ? s : nullptr;
+				break;
+			case PatternItem::BALANCE:
+				s = matchBalance(s, item);
+				if (s) {
+					++i;
+					continue;
+				}
+				break;
+			case PatternItem::FRONTIER: {
+				unsigned char previous = s == srcInit ? 0 : (unsigned char)s[-1];
+				unsigned char current = s < srcEnd ? (unsigned char)*s : 0;
+				if (!item.test(previous) && item.test(current)) {
+					++i;
+					continue;
+				}
+				break;
+			}
+			case PatternItem::BACKREF:
+				s = matchCapture(s, item.a);
+				if (s) {
+					++i;
+					continue;
+				}
+				break;
+			case PatternItem::SINGLE: {
+				bool matched = s < srcEnd && item.test((unsigned char)*s);
+				switch (item.rep) {
+				case '?':
+					if (matched && (result = match(s + 1, i + 1))) break;
+					++i;
+					continue;
+				case '+':
+					result = matched ? maxExpand(s + 1, item, i + 1) : nullptr;
+					break;
+				case '*':
+					result = maxExpand(s, item, i + 1);
+					break;
+				case '-':
+					result = minExpand(s, item, i + 1);
+					break;
+				default:
+					if (!matched) break;
+					++s;
+					++i;
+					continue;
+				}
+				break;
+			}
+			}
+			break;
+		}
+		--depth;
+		return result;
+	}
+
+	const char* maxExpand(const char* s, const PatternItem& item, size_t next) {
+		ptrdiff_t n = 0;
+		while (s + n < srcEnd && item.test((unsigned char)s[n])) ++n;
+		//nothing follows, so the longest is the match
+		if (next == pattern->items.size()) return s + n;
+		for (; n >= 0; --n) {
+			const char* result = match(s + n, next);
+			if (result) return result;
+		}
+		return nullptr;
+	}
+
+	const char* minExpand(const char* s, const PatternItem& item, size_t next) {
+		while (true) {
+			const char* result = match(s, next);
+			if (result) return result;
+			if (s < srcEnd && item.test((unsigned char)*s)) {
+				++s;
+			} else {
+				return nullptr;
+			}
+		}
+	}
+
+	const char* startCapture(const char* s, size_t next, ptrdiff_t what) {
+		if (level >= PATTERN_MAX_CAPTURES) throw std::runtime_error("too many captures");
+		capture[level].init = s;
+		capture[level].len = what;
+		++level;
+		const char* result = match(s, next);
+		if (!result) --level;
+		return result;
+	}
+
+	const char* endCapture(const char* s, size_t next) {
+		int l = level - 1;
+		while (l >= 0 && capture[l].len != CAPTURE_UNFINISHED) --l;
+		if (l < 0) throw std::runtime_error("invalid pattern capture");
+		capture[l].len = s - capture[l].init;
+		const char* result = match(s, next);
+		if (!result) capture[l].len = CAPTURE_UNFINISHED;
+		return result;
+	}
+
+	const char* matchBalance(const char* s, const PatternItem& item) const {
+		if (s >= srcEnd || (unsigned char)*s != item.a) return nullptr;
+		int depth = 1;
+		while (++s < srcEnd) {
+			if ((unsigned char)*s == item.b) {
+				if (--depth == 0) return s + 1;
+			} else if ((unsigned char)*s == item.a) {
+				++depth;
+			}
+		}
+		return nullptr;
+	}
+
+	const char* matchCapture(const char* s, unsigned char digit) const {
+		int l = digit - '1';
+		if (l < 0 || l >= level || capture[l].len == CAPTURE_UNFINISHED) {
+			throw std::runtime_error("invalid capture index %" + std::to_string(l + 1));
+		}
+		size_t len = (size_t)capture[l].len;
+		if ((size_t)(srcEnd - s) >= len && memcmp(capture[l].init, s, len) == 0) return s + len;
+		return nullptr;
+	}
+
+	//capture i, or the whole match from s to e if there are none
+	Object get(int i, const char* s, const char* e) const {
+		if (i >= level) {
+			if (i != 0) throw std::runtime_error("invalid capture index %" + std::to_string(i + 1));
+			return Object(std::string(s, (size_t)(e - s)));
+		}
+		if (capture[i].len == CAPTURE_UNFINISHED) throw std::runtime_error("unfinished capture");
+		if (capture[i].len == CAPTURE_POSITION) return Object((double)(capture[i].init - srcInit + 1));
+		return Object(std::string(capture[i].init, (size_t)capture[i].len));
+	}
+
+	//all the captures, or the whole match
+	void push(VarArg& results, const char* s, const char* e) const {
+		int n = level == 0 ? 1 : level;
+		for (int i = 0; i < n; ++i) results.objects.push_back(get(i, s, e));
+	}
+};
+
+//no characters with a special meaning, so it can be searched for as it is
+static bool patternIsPlain(const std::string& p) {
+	return p.find_first_of("^$*+?.([%-") == std::string::npos;
+}
+
+static const char* plainFind(const char* s, size_t ls, const char* p, size_t lp) {
+	if (lp == 0) return s;
+	if (lp > ls) return nullptr;
+	const char* end = s + ls - lp + 1;
+	while (s < end) {
+		s = (const char*)memchr(s, p[0], (size_t)(end - s));
+		if (!s) return nullptr;
+		if (memcmp(s + 1, p + 1, lp - 1) == 0) return s;
+		++s;
+	}
+	return nullptr;
+}
+
+//find and match
+static VarArg stringFindAux(const VarArg& args, bool find) {
+	const char* func = find ? "find" : "match";
+	Object sHolder, pHolder;
+	const std::string& s = checkString(args, 1, func, sHolder);
+	const std::string& p = checkString(args, 2, func, pHolder);
+	int64_t init = stringPosition(optInteger(args, 3, func, 1), s.size());
+	if (init < 1) init = 1;
+	if (init > (int64_t)s.size() + 1) return VarArg(nil);
+
+	if (find && (((size_t)4 <= args.objects.size() && luaTruthy(args.objects[3])) || patternIsPlain(p))) {
+		const char* found = plainFind(s.data() + init - 1, s.size() - (size_t)(init - 1), p.data(), p.size());
+		if (!found) return VarArg(nil);
+		double start = (double)(found - s.data() + 1);
+		return VarArg(start, start + (double)p.size() - 1);
+	}
+
+	std::shared_ptr<const Pattern> pattern = checkPattern(args, 2, func);
+	PatternMatch m(s, *pattern);
+	const char* at = s.data() + init - 1;
+	do {
+		if (!pattern->anchored) {
+			at = m.candidate(at);
+			if (!at) break;
+		}
+		const char* e = m.start(at);
+		if (e) {
+			VarArg results;
+			if (find) {
+				results.objects.push_back(Object((double)(at - m.srcInit + 1)));
+				results.objects.push_back(Object((double)(e - m.srcInit)));
+				if (m.level) m.push(results, nullptr, nullptr);
+			} else {
+				m.push(results, at, e);
+			}
+			return results;
+		}
+	} while (at++ < m.srcEnd && !pattern->anchored);
+	return VarArg(nil);
+}
+
+static VarArg stringFind(const VarArg& args) {
+	return stringFindAux(args, true);
+}
+
+static VarArg stringMatch(const VarArg& args) {
+	return stringFindAux(args, false);
+}
+
+//what gmatch's iterator keeps between calls
+struct PatternIterator {
+	Object source;
+	std::shared_ptr<const Pattern> pattern;
+	size_t position;
+	const char* lastMatch;
+	bool done;
+};
+
+static VarArg stringGmatch(const VarArg& args) {
+	Object holder;
+	std::shared_ptr<PatternIterator> it = std::make_shared<PatternIterator>();
+	checkString(args, 1, "gmatch", holder);
+	it->source = holder.is_nil() ? args.objects[0] : holder;
+	//a leading '^' would stop it after one match, so it's just a character here, as in Lua
+	it->pattern = checkCompiled(gmatchPatternCache, gmatchPatternCacheCloser, args, 2, "gmatch");
+	it->position = 0;
+	it->lastMatch = nullptr;
+	it->done = false;
+	return Object([it](const VarArg&)->VarArg {
+		if (it->done) return VarArg(nil);
+		const std::string& s = static_cast<const Object_Details_String*>(it->source.details.get())->value;
+		PatternMatch m(s, *it->pattern);
+		const char* at = s.data() + it->position;
+		do {
+			at = m.candidate(at);
+			if (!at) break;
+			const char* e = m.start(at);
+			//an empty match right where the last one ended doesn't count
+			if (e && e != it->lastMatch) {
+				it->position = (size_t)(e - m.srcInit);
+				it->lastMatch = e;
+				VarArg results;
+				m.push(results, at, e);
+				return results;
+			}
+		} while (at++ < m.srcEnd);
+		it->done = true;
+		return VarArg(nil);
+	});
+}
+
+//appends the replacement for the match from s to e
+static void gsubAppend(std::string& out, const PatternMatch& m, const char* s, const char* e, const Object& repl) {
+	Object value;
+	switch (repl.details->typeIndex) {
+	case Object::TYPE_STRING:
+	case Object::TYPE_NUMBER: {
+		Object holder;
+		const std::string& r = repl.details->typeIndex == Object::TYPE_STRING
+			? static_cast<const Object_Details_String*>(repl.details.get())->value
+			: static_cast<const Object_Details_String*>((holder = luaToString(repl)).details.get())->value;
+		size_t start = 0;
+		while (true) {
+			size_t percent = r.find('%', start);
+			if (percent == std::string::npos) {
+				out.append(r, start, std::string::npos);
+				return;
+			}
+			out.append(r, start, percent - start);
+			if (percent + 1 >= r.size()) throw std::runtime_error("invalid use of '%' in replacement string");
+			char c = r[percent + 1];
+			if (c == '%') {
+				out += '%';
+			} else if (c == '0') {
+				out.append(s, (size_t)(e - s));
+			} else if (isdigit((unsigned char)c)) {
+				Object capture = m.get(c - '1', s, e);
+				if (capture.details->typeIndex == Object::TYPE_STRING) {
+					out += static_cast<const Object_Details_String*>(capture.details.get())->value;
+				} else {
+					out += static_cast<const Object_Details_String*>(luaToString(capture).details.get())->value;
+				}
+			} else {
+				throw std::runtime_error("invalid use of '%' in replacement string");
+			}
+			start = percent + 2;
+		}
+	}
+	case Object::TYPE_TABLE:
+		value = luaIndex(repl, m.get(0, s, e));
+		break;
+	default: {
+		VarArg captures;
+		m.push(captures, s, e);
+		value = const_cast<Object&>(repl).call(captures).get();
+		break;
+	}
+	}
+	if (!luaTruthy(value)) {
+		//false or nil keeps the original
+		out.append(s, (size_t)(e - s));
+	} else if (value.details->typeIndex == Object::TYPE_STRING) {
+		out += static_cast<const Object_Details_String*>(value.details.get())->value;
+	} else if (value.details->typeIndex == Object::TYPE_NUMBER) {
+		out += static_cast<const Object_Details_String*>(luaToString(value).details.get())->value;
+	} else {
+		throw std::runtime_error("invalid replacement value (a " + value.type() + ")");
+	}
+}
+
+static VarArg stringGsub(const VarArg& args) {
+	Object holder;
+	const std::string& s = checkString(args, 1, "gsub", holder);
+	std::shared_ptr<const Pattern> pattern = checkPattern(args, 2, "gsub");
+	const Object& repl = args[3];
+	switch (repl.details->typeIndex) {
+	case Object::TYPE_STRING:
+	case Object::TYPE_NUMBER:
+	case Object::TYPE_TABLE:
+	case Object::TYPE_FUNCTION:
+		break;
+	default:
+		throw stringArgError(3, "gsub", "string/function/table expected, got " + stringArgType(args, 3));
+	}
+	int64_t maxN = optInteger(args, 4, "gsub", (int64_t)s.size() + 1);
+
+	//everything is written into one buffer, which starts out the size of the input
+	std::string out;
+	out.reserve(s.size());
+	PatternMatch m(s, *pattern);
+	const char* at = m.srcInit;
+	const char* lastMatch = nullptr;
+	int64_t n = 0;
+	while (n < maxN) {
+		if (!pattern->anchored) {
+			const char* next = m.candidate(at);
+			if (!next) break;
+			out.append(at, (size_t)(next - at));
+			at = next;
+		}
+		const char* e = m.start(at);
+		if (e && e != lastMatch) {
+			++n;
+			gsubAppend(out, m, at, e, repl);
+			at = lastMatch = e;
+		} else if (at < m.srcEnd) {
+			out += *at++;
+		} else {
+			break;
+		}
+		if (pattern->anchored) break;
+	}
+	out.append(at, (size_t)(m.srcEnd - at));
+	return VarArg(stringObject(std::move(out)), (double)n);
+}
+
+static VarArg stringSub(const VarArg& args) {
+	Object holder;
+	const std::string& s = checkString(args, 1, "sub", holder);
+	int64_t i = stringPosition(checkInteger(args, 2, "sub"), s.size());
+	int64_t j = stringPosition(optInteger(args, 3, "sub", -1), s.size());
+	if (i < 1) i = 1;
+	if (j > (int64_t)s.size()) j = (int64_t)s.size();
+	if (i > j) return Object("");
+	return Object(s.substr((size_t)(i - 1), (size_t)(j - i + 1)));
+}
+
+static VarArg stringLen(const VarArg& args) {
+	Object holder;
+	return Object((double)checkString(args, 1, "len", holder).size());
+}
+
+static VarArg stringRep(const VarArg& args) {
+	Object sHolder, sepHolder;
+	const std::string& s = checkString(args, 1, "rep", sHolder);
+	int64_t n = checkInteger(args, 2, "rep");
+	const std::string& sep = (size_t)3 <= args.objects.size() && !args.objects[2].is_nil() ? checkString(args, 3, "rep", sepHolder) : std::string();
+	if (n <= 0) return Object("");
+	size_t unit = s.size() + sep.size();
+	if (unit && (uint64_t)n > (uint64_t)(std::string().max_size() / unit)) throw std::runtime_error("resulting string too large");
+	std::string out;
+	out.reserve(unit * (size_t)n);
+	for (int64_t i = 0; i < n; ++i) {
+		if (i) out += sep;
+		out += s;
+	}
+	return stringObject(std::move(out));
+}
+
+static VarArg stringByte(const VarArg& args) {
+	Object holder;
+	const std::string& s = checkString(args, 1, "byte", holder);
+	int64_t i = stringPosition(optInteger(args, 2, "byte", 1), s.size());
+	int64_t j = stringPosition(optInteger(args, 3, "byte", i), s.size());
+	if (i < 1) i = 1;
+	if (j > (int64_t)s.size()) j = (int64_t)s.size();
+	VarArg results;
+	if (i > j) return results;
+	results.objects.reserve((size_t)(j - i + 1));
+	for (int64_t k = i; k <= j; ++k) results.objects.push_back(Object((double)(unsigned char)s[(size_t)(k - 1)]));
+	return results;
+}
+
+static VarArg stringChar(const VarArg& args) {
+	std::string out(args.objects.size(), '\0');
+	for (size_t i = 0; i < args.objects.size(); ++i) {
+		int64_t c = checkInteger(args, (int)i + 1, "char");
+		if (c < 0 || c > 255) throw stringArgError((int)i + 1, "char", "value out of range");
+		out[i] = (char)c;
+	}
+	return stringObject(std::move(out));
+}
+
+static VarArg stringUpper(const VarArg& args) {
+	Object holder;
+	std::string out = checkString(args, 1, "upper", holder);
+	for (char& c : out) c = (char)toupper((unsigned char)c);
+	return stringObject(std::move(out));
+}
+
+static VarArg stringLower(const VarArg& args) {
+	Object holder;
+	std::string out = checkString(args, 1, "lower", holder);
+	for (char& c : out) c = (char)tolower((unsigned char)c);
+	return stringObject(std::move(out));
+}
+
+static VarArg stringReverse(const VarArg& args) {
+	Object holder;
+	const std::string& s = checkString(args, 1, "reverse", holder);
+	return Object(std::string(s.rbegin(), s.rend()));
+}
+
+/*
+format
+each format string is compiled once into its conversions, each with the literal text before it
+values are written straight into the result: plain %d, %c and %s by hand, anything else by snprintf with the compiled spec
+*/
+
+enum {
+	FORMAT_MAX_ITEM = 512,	//the most one conversion can write: %99.99f of the largest number is 410 characters
+	FORMAT_MAX_SPEC = 16,	//'%', 5 flags, width, '.', precision, "ll" and the conversion
+};
+
+struct FormatItem {
+	std::string text;	//written before the conversion, with %% already made %
+	char conversion;	//0 for the text after the last conversion
+	bool plain;	//no flags, width or precision
+	char spec[FORMAT_MAX_SPEC];
+};
+
+struct Format {
+	std::vector<FormatItem> items;
+	size_t textSize = 0;
+};
+
+static void compileFormat(Format& format, const std::string& source) {
+	static const char flags[] = "-+ #0";
+	//the string's terminating '\0' stops every scan below, as it does in Lua
+	const char* p = source.c_str();
+	const char* end = p + source.size();
+	FormatItem item;
+	while (true) {
+		if (p < end && *p != '%') {
+			item.text += *p++;
+			continue;
+		}
+		if (p < end && p[1] == '%') {
+			item.text += '%';
+			p += 2;
+			continue;
+		}
+		if (p == end) {
+			item.conversion = 0;
+			format.textSize += item.text.size();
+			format.items.push_back(std::move(item));
+			return;
+		}
+		const char* spec = ++p;
+		while (*p && strchr(flags, *p)) ++p;
+		if ((size_t)(p - spec) >= sizeof(flags)) throw std::runtime_error("invalid format (repeated flags)");
+		if (isdigit((unsigned char)*p)) ++p;
+		if (isdigit((unsigned char)*p)) ++p;
+		if (*p == '.') {
+			++p;
+			if (isdigit((unsigned char)*p)) ++p;
+			if (isdigit((unsigned char)*p)) ++p;
+		}
+		if (isdigit((unsigned char)*p)) throw std::runtime_error("invalid format (width or precision too long)");
+		char c = *p;
+		if (!c || !strchr("cdiouxXaAeEfgGqs", c)) {
+			throw std::runtime_error(std::string("invalid option '%") + (c ? std::string(1, c) : std::string()) + "' to 'format'");
+		}
+		char* out = item.spec;
+		*out++ = '%';
+		memcpy(out, spec, (size_t)(p - spec));
+		out += p - spec;
+		if (strchr("diouxX", c)) {
+			*out++ = 'l';
+			*out++ = 'l';
+		}
+		*out++ = c;
+		*out = 0;
+		item.conversion = c;
+		item.plain = p == spec;
+		format.textSize += item.text.size();
+		format.items.push_back(std::move(item));
+		item = FormatItem();
+		++p;
+	}
+}
+
+typedef CompiledCache<Format, compileFormat> FormatCache;
+static thread_local FormatCache formatCache;
+static thread_local CompiledCacheCloser<FormatCache> formatCacheCloser = {formatCache};
+
+template<typename T>
+static void formatValue(std::string& out, const FormatItem& item, T value) {
+	char buffer[FORMAT_MAX_ITEM];
+	int n = snprintf(buffer, sizeof(buffer), item.spec, value);
+	if (n > 0) out.append(buffer, (size_t)n);
+}
+
+//n in decimal, without going through printf
+static void formatInteger(std::string& out, int64_t n) {
+	char buffer[24];
+	char* end = buffer + sizeof(buffer);
+	char* p = end;
+	uint64_t u = n < 0 ? 0 - (uint64_t)n : (uint64_t)n;
+	do {
+		*--p = (char)('0' + u % 10);
+		u /= 10;
+	} while (u);
+	if (n < 0) *--p = '-';
+	out.append(p, (size_t)(end - p));
+}
+
+//%q: the value as Lua source that reads back as the same value
+static void formatLiteral(std::string& out, const VarArg& args, int arg) {
+	const Object& o = args.objects[arg - 1];
+	switch (o.details->typeIndex) {
+	case Object::TYPE_STRING: {
+		const std::string& s = static_cast<const Object_Details_String*>(o.details.get())->value;
+		out += '"';
+		for (size_t i = 0; i < s.size(); ++i) {
+			unsigned char c = (unsigned char)s[i];
+			if (c == '"' || c == '\\' || c == '\n') {
+				out += '\\';
+				out += (char)c;
+			} else if (iscntrl(c)) {
+				//all three digits when a digit follows, so it isn't read as part of the escape
+				char buffer[8];
+				bool digitNext = i + 1 < s.size() && isdigit((unsigned char)s[i + 1]);
+				int n = snprintf(buffer, sizeof(buffer), digitNext ? "\\%03d" : "\\%d", (int)c);
+				out.append(buffer, (size_t)n);
+			} else {
+				out += (char)c;
+			}
+		}
+		out += '"';
+		return;
+	}
+	case Object::TYPE_NUMBER: {
+		double d = static_cast<const Object_Details_Number*>(o.details.get())->value;
+		if (d == ::floor(d) && d >= -9223372036854775808. && d < 9223372036854775808. && !(d == 0 && std::signbit(d))) {
+			//the smallest integer has no positive counterpart to negate
+			if (d == -9223372036854775808.) {
+				out += "0x8000000000000000";
+			} else {
+				formatInteger(out, (int64_t)d);
+			}
+		} else if (d == HUGE_VAL) {
+			out += "1e9999";
+		} else if (d == -HUGE_VAL) {
+			out += "-1e9999";
+		} else if (d != d) {
+			out += "(0/0)";
+		} else {
+			char buffer[64];
+			int n = snprintf(buffer, sizeof(buffer), "%a", d);
+			out.append(buffer, (size_t)n);
+		}
+		return;
+	}
+	case Object::TYPE_NIL:
+	case Object::TYPE_BOOLEAN:
+		out += static_cast<const Object_Details_String*>(luaToString(o).details.get())->value;
+		return;
+	default:
+		throw stringArgError(arg, "format", "value has no literal form");
+	}
+}
+
+static VarArg stringFormat(const VarArg& args) {
+	std::shared_ptr<const Format> format = checkCompiled(formatCache, formatCacheCloser, args, 1, "format");
+	//everything is written into one buffer, guessing a few characters per conversion
+	std::string out;
+	out.reserve(format->textSize + format->items.size() * 8);
+	int arg = 1;
+	for (const FormatItem& item : format->items) {
+		out += item.text;
+		if (!item.conversion) break;
+		if ((size_t)++arg > args.objects.size()) throw stringArgError(arg, "format", "no value");
+		switch (item.conversion) {
+		case 'c': {
+			int c = (int)checkInteger(args, arg, "format");
+			if (item.plain) {
+				out += (char)c;
+			} else {
+				formatValue(out, item, c);
+			}
+			break;
+		}
+		case 'd':
+		case 'i': {
+			int64_t n = checkInteger(args, arg, "format");
+			if (item.plain) {
+				formatInteger(out, n);
+			} else {
+				formatValue(out, item, (long long)n);
+			}
+			break;
+		}
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			formatValue(out, item, (long long)checkInteger(args, arg, "format"));
+			break;
+		case 'a':
+		case 'A':
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'g':
+		case 'G':
+			formatValue(out, item, checkNumber(args, arg, "format"));
+			break;
+		case 'q':
+			formatLiteral(out, args, arg);
+			break;
+		case 's': {
+			const Object& o = args.objects[arg - 1];
+			Object holder = o.details->typeIndex == Object::TYPE_STRING ? o : luaToString(o);
+			const std::string& s = static_cast<const Object_Details_String*>(holder.details.get())->value;
+			if (item.plain) {
+				out += s;
+			} else if (s.size() != strlen(s.c_str())) {
+				throw stringArgError(arg, "format", "string contains zeros");
+			} else if (!strchr(item.spec, '.') && s.size() >= 100) {
+				//no precision to cut it, so it's kept whole rather than formatted
+				out += s;
+			} else {
+				formatValue(out, item, s.c_str());
+			}
+			break;
+		}
+		}
+	}
+	return stringObject(std::move(out));
+}
+
+static const ConstantField stringFunctions[] = {
+	{"byte", stringByte},
+	{"char", stringChar},
+	{"find", stringFind},
+	{"format", stringFormat},
+	{"gmatch", stringGmatch},
+	{"gsub", stringGsub},
+	{"len", stringLen},
+	{"lower", stringLower},
+	{"match", stringMatch},
+	{"rep", stringRep},
+	{"reverse", stringReverse},
+	{"sub", stringSub},
+	{"upper", stringUpper},
+};
+
+Object String::makeTable() {
+	return constantTable(stringFunctions);
+}
+
+String string;
+
+}
@@ -0,0 +1,257 @@
+#include "CxxAsLua/Vectorized.h"
+#include "CxxAsLua/Array.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+#endif
+
+namespace CxxAsLua {
+
+//one register's worth of doubles, so each kernel is written once
+#if defined(__AVX__)
+
+typedef __m256d Lanes;
+enum { LANES = 4 };
+static inline Lanes load(const double* p) { return _mm256_loadu_pd(p); }
+static inline void store(double* p, Lanes x) { _mm256_storeu_pd(p, x); }
+static inline Lanes splat(double x) { return _mm256_set1_pd(x); }
+static inline Lanes add(Lanes a, Lanes b) { return _mm256_add_pd(a, b); }
+static inline Lanes mul(Lanes a, Lanes b) { return _mm256_mul_pd(a, b); }
+static inline Lanes min(Lanes a, Lanes b) { return _mm256_min_pd(a, b); }
+static inline Lanes max(Lanes a, Lanes b) { return _mm256_max_pd(a, b); }
+static inline Lanes sqrt(Lanes x) { return _mm256_sqrt_pd(x); }
+static inline Lanes abs(Lanes x) { return _mm256_andnot_pd(_mm256_set1_pd(-0.), x); }
+#define CXXASLUA_HAS_ROUND
+static inline Lanes floor(Lanes x) { return _mm256_floor_pd(x); }
+static inline Lanes ceil(Lanes x) { return _mm256_ceil_pd(x); }
+
+#elif defined(__SSE2__)
+
+typedef __m128d Lanes;
+enum { LANES = 2 };
+static inline Lanes load(const double* p) { return _mm_loadu_pd(p); }
+static inline void store(double* p, Lanes x) { _mm_storeu_pd(p, x); }
+static inline Lanes splat(double x) { return _mm_set1_pd(x); }
+static inline Lanes add(Lanes a, Lanes b) { return _mm_add_pd(a, b); }
+static inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_pd(a, b); }
+static inline Lanes min(Lanes a, Lanes b) { return _mm_min_pd(a, b); }
+static inline Lanes max(Lanes a, Lanes b) { return _mm_max_pd(a, b); }
+static inline Lanes sqrt(Lanes x) { return _mm_sqrt_pd(x); }
+static inline Lanes abs(Lanes x) { return _mm_andnot_pd(_mm_set1_pd(-0.), x); }
+#if defined(__SSE4_1__)
+#define CXXASLUA_HAS_ROUND
+static inline Lanes floor(Lanes x) { return _mm_floor_pd(x); }
+static inline Lanes ceil(Lanes x) { return _mm_ceil_pd(x); }
+#endif
+
+#else
+
+struct Lanes { double x; };
+enum { LANES = 1 };
+static inline Lanes load(const double* p) { return Lanes{*p}; }
+static inline void store(double* p, Lanes x) { *p = x.x; }
+static inline Lanes splat(double x) { return Lanes{x}; }
+static inline Lanes add(Lanes a, Lanes b) { return Lanes{a.x + b.x}; }
+static inline Lanes mul(Lanes a, Lanes b) { return Lanes{a.x * b.x}; }
+static inline Lanes min(Lanes a, Lanes b) { return Lanes{a.x < b.x ? a.x : b.x}; }
+static inline Lanes max(Lanes a, Lanes b) { return Lanes{a.x > b.x ? a.x : b.x}; }
+static inline Lanes sqrt(Lanes x) { return Lanes{::sqrt(x.x)}; }
+static inline Lanes abs(Lanes x) { return Lanes{::fabs(x.x)}; }
+
+#endif
+
+//reductions keep two accumulators to hide the add latency
+//(so sums can round differently than adding in order)
+
+double vectorSum(const double* x, size_t n) {
+	Lanes a = splat(0), b = splat(0);
+	size_t i = 0;
+	for (; i + 2 * LANES <= n; i += 2 * LANES) {
+		a = add(a, load(x + i));
+		b = add(b, load(x + i + LANES));
+	}
+	double lanes[LANES];
+	store(lanes, add(a, b));
+	double sum = 0;
+	for (int j = 0; j < LANES; ++j) sum += lanes[j];
+	for (; i < n; ++i) sum += x[i];
+	return sum;
+}
+
+double vectorDot(const double* x, const double* y, size_t n) {
+	Lanes a = splat(0), b = splat(0);
+	size_t i = 0;
+	for (; i + 2 * LANES <= n; i += 2 * LANES) {
+		a = add(a, mul(load(x + i), load(y + i)));
+		b = add(b, mul(load(x + i + LANES), load(y + i + LANES)));
+	}
+	double lanes[LANES];
+	store(lanes, add(a, b));
+	double sum = 0;
+	for (int j = 0; j < LANES; ++j) sum += lanes[j];
+	for (; i < n; ++i) sum += x[i] * y[i];
+	return sum;
+}
+
+double vectorMin(const double* x, size_t n) {
+	Lanes a = splat(x[0]);
+	size_t i = 0;
+	for (; i + LANES <= n; i += LANES) a = min(a, load(x + i));
+	double lanes[LANES];
+	store(lanes, a);
+	double result = lanes[0];
+	for (int j = 1; j < LANES; ++j) if (lanes[j] < result) result = lanes[j];
+	for (; i < n; ++i) if (x[i] < result) result = x[i];
+	return result;
+}
+
+double vectorMax(const double* x, size_t n) {
+	Lanes a = splat(x[0]);
+	size_t i = 0;
+	for (; i + LANES <= n; i += LANES) a = max(a, load(x + i));
+	double lanes[LANES];
+	store(lanes, a);
+	double result = lanes[0];
+	for (int j = 1; j < LANES; ++j) if (lanes[j] > result) result = lanes[j];
+	for (; i < n; ++i) if (x[i] > result) result = x[i];
+	return result;
+}
+
+//elementwise kernels with a vector instruction
+#define CXXASLUA_LANES_KERNEL(name, scalar)\
+static void name##Kernel(double* dst, const double* src, size_t n) {\
+	size_t i = 0;\
+	for (; i + LANES <= n; i += LANES) store(dst + i, name(load(src + i)));\
+	for (; i < n; ++i) dst[i] = scalar(src[i]);\
+}
+
+CXXASLUA_LANES_KERNEL(sqrt, ::sqrt)
+CXXASLUA_LANES_KERNEL(abs, ::fabs)
+#if defined(CXXASLUA_HAS_ROUND)
+CXXASLUA_LANES_KERNEL(floor, ::floor)
+CXXASLUA_LANES_KERNEL(ceil, ::ceil)
+#endif
+#undef CXXASLUA_LANES_KERNEL
+
+//everything else is a plain loop over libm, still without any Object boxing
+//(deg and rad are written the same as math.deg and math.rad, so they round the same)
+static const double pi = 4 * std::atan(1);
+
+#define CXXASLUA_SCALAR_KERNEL(name, expr)\
+static void name##Kernel(double* dst, const double* src, size_t n) {\
+	for (size_t i = 0; i < n; ++i) {\
+		double x = src[i];\
+		dst[i] = expr;\
+	}\
+}
+
+#if !defined(CXXASLUA_HAS_ROUND)
+CXXASLUA_SCALAR_KERNEL(floor, ::floor(x))
+CXXASLUA_SCALAR_KERNEL(ceil, ::ceil(x))
+#endif
+CXXASLUA_SCALAR_KERNEL(acos, ::acos(x))
+CXXASLUA_SCALAR_KERNEL(asin, ::asin(x))
+CXXASLUA_SCALAR_KERNEL(atan, ::atan(x))
+CXXASLUA_SCALAR_KERNEL(cos, ::cos(x))
+CXXASLUA_SCALAR_KERNEL(cosh, ::cosh(x))
+CXXASLUA_SCALAR_KERNEL(deg, x * 180 / pi)
+CXXASLUA_SCALAR_KERNEL(exp, ::exp(x))
+CXXASLUA_SCALAR_KERNEL(log, ::log(x))
+CXXASLUA_SCALAR_KERNEL(log10, ::log10(x))
+CXXASLUA_SCALAR_KERNEL(rad, x * pi / 180)
+CXXASLUA_SCALAR_KERNEL(sin, ::sin(x))
+CXXASLUA_SCALAR_KERNEL(sinh, ::sinh(x))
+CXXASLUA_SCALAR_KERNEL(tan, ::tan(x))
+CXXASLUA_SCALAR_KERNEL(tanh, ::tanh(x))
+#undef CXXASLUA_SCALAR_KERNEL
+
+VectorUnaryOp vectorUnaryOp(const std::string& name) {
+	static const struct {
+		const char* name;
+		VectorUnaryOp op;
+	} ops[] = {
+		{"abs", absKernel},
+		{"acos", acosKernel},
+		{"asin", asinKernel},
+		{"atan", atanKernel},
+		{"ceil", ceilKernel},
+		{"cos", cosKernel},
+		{"cosh", coshKernel},
+		{"deg", degKernel},
+		{"exp", expKernel},
+		{"floor", floorKernel},
+		{"log", logKernel},
+		{"log10", log10Kernel},
+		{"rad", radKernel},
+		{"sin", sinKernel},
+		{"sinh", sinhKernel},
+		{"sqrt", sqrtKernel},
+		{"tan", tanKernel},
+		{"tanh", tanhKernel},
+	};
+	for (const auto& op : ops) {
+		if (name == op.name) return op.op;
+	}
+	return nullptr;
+}
+
+template<typename T>
+static bool gatherArray(const Object& t, std::vector<double>& buffer, const double*& data, size_t& n) {
+	Object_Details_Array<T>* a = toarray<T>(t);
+	if (!a) return false;
+	buffer.assign(a->begin(), a->end());
+	data = buffer.data();
+	n = buffer.size();
+	return true;
+}
+
+bool numbersOf(const Object& t, std::vector<double>& buffer, const double*& data, size_t& n) {
+	buffer.clear();
+	data = nullptr;
+	n = 0;
+	if (t.is_userdata()) {
+		if (Object_Details_Array<double>* a = toarray<double>(t)) {
+			data = a->data;
+			n = a->size;
+			return true;
+		}
+		return gatherArray<float>(t, buffer, data, n)
+			|| gatherArray<int32_t>(t, buffer, data, n)
+			|| gatherArray<int64_t>(t, buffer, data, n)
+			|| gatherArray<uint8_t>(t, buffer, data, n);
+	}
+	if (!t.is_table()) return false;
+	const Object::Map& map = static_cast<const Object_Details_Table*>(t.details.get())->value;
+	//number keys sort first and in order, so 1, 2, 3 ... are adjacent
+	Object::Map::const_iterator i = map.begin();
+	for (; i != map.end() && i->first.details->typeIndex == Object::TYPE_NUMBER; ++i) {
+		if (static_cast<const Object_Details_Number*>(i->first.details.get())->value >= 1) break;
+	}
+	for (; i != map.end() && i->first.details->typeIndex == Object::TYPE_NUMBER; ++i) {
+		if (static_cast<const Object_Details_Number*>(i->first.details.get())->value != (double)(buffer.size() + 1)) break;
+		const Object& v = i->second;
+		if (v.details->typeIndex == Object::TYPE_NIL) break;
+		if (v.details->typeIndex != Object::TYPE_NUMBER) return false;
+		buffer.push_back(static_cast<const Object_Details_Number*>(v.details.get())->value);
+	}
+	data = buffer.data();
+	n = buffer.size();
+	return true;
+}
+
+Object vectorToTable(const double* x, size_t n) {
+	Object::Map map;
+	for (size_t i = 0; i < n; ++i) {
+		map.emplace_hint(map.end(), Object((double)(i + 1)), Object(x[i]));
+	}
+	return Object(std::make_shared<Object_Details_Table>(std::move(map)));
+}
+
+}
@@ -1,7 +1,10 @@
+#include "CxxAsLua/Object.h"
+
 void test_main();
 void callable_main();
 
 int main() {
+	CxxAsLua::bufferOutput();
 	test_main();
 	callable_main();
 }
@@ -9,6 +9,8 @@ features:
 *) conversion to objects with constructors and operator=
 *) conversion from objects with cast operators
 *) implicit algebra operators
+ *) with C++ numbers on either side, and concat(a, b) for a .. b
+ *) they return expressions referencing their operands, so keep results in an Object (or local), never auto
 *) metatables, metamethods:
  *) arithmetic
  *) __index & __newindex
@@ -26,9 +28,26 @@ features:
   *) automatic casting to/from std::functions using function wrappers
  *) function() variadic macro for lambda creation
   *) implicit return nil (or implicit return type altogether)
+ *) proper tail calls with return tailcall(f, args...)
+ *) closure() and upvalue for closures that outlive their scope and share captured locals
+*) coroutine library (create/resume/yield/status/wrap) with pooled stacks
+*) typed number arrays (userdata), which can wrap C++ buffers without copying
+*) userdata holding any C++ type, inline or by pointer, with metatables for methods
+*) print and io.write straight into stdio, io.flush, and bufferOutput() to give stdout a large buffer
+*) io.open, io.lines, io.read and file handles, with read-only files mmap'd
+*) binary serialization, and mapped snapshots whose tables are built on access
+*) JSON decoding (whole, SAX or streaming) and encoding
+*) string library, with Lua patterns compiled once and cached
+ *) string.format, with format strings compiled once and written straight into the result
+*) Lua source loading (load/loadstring/dofile), compiled to register bytecode run by a VM
+*) ahead-of-time Lua to C++ translation (translateLua, luatocxx) with typed locals and direct calls
+*) constants laid out at compile time (ConstantString, ConstantNumber, constantTable), and nil and booleans that never allocate
+*) libraries (math, io, coroutine, json) made on first use, with members that keep where their function lives
+*) _G, with each global read or write site caching where its value lives
 *) vararg creation with comma operator
 *) swizzle assignment with comma operator (required separate VarArg and VarArgRef structures)
 *) correctly thrown exceptions / correctly thrown messages
+*) error() with any value, pcall and xpcall, with messages only made when asked for
 
 */
 
@@ -54,6 +73,16 @@ void operator delete(void* ptr) noexcept (true) {
 #endif
 
 #include "CxxAsLua/Object.h"
+#include "CxxAsLua/Coroutine.h"
+#include "CxxAsLua/Array.h"
+#include "CxxAsLua/Userdata.h"
+#include "CxxAsLua/File.h"
+#include "CxxAsLua/Serialize.h"
+#include "CxxAsLua/JSON.h"
+#include "CxxAsLua/Constant.h"
+#include "CxxAsLua/String.h"
+#include "CxxAsLua/Lua.h"
+#include "CxxAsLua/LuaTranslator.h"
 #include <typeinfo>
 
 using namespace CxxAsLua;
@@ -75,6 +104,9 @@ static void bar_vi(int i) { print("bar_vi", i); ASSERT_EQUALS(i, 20); }
 static int bar_iv() { print("bar_iv"); return 10; }
 static int bar_ii(int i) { print("bar_ii", i); ASSERT_EQUALS(i, 20); return 10; }
 
+//translated.cpp, made from translated.lua by luatocxx
+VarArg translated(const VarArg& args);
+
 void test_main() {
 
 #if 1
@@ -138,6 +170,24 @@ void test_main() {
 	O_ASSERT_EQUALS(o=1; o=o/2.5, .4)
 	O_ASSERT_EQUALS(o=-2.5; o=o%1, .5)
 	O_ASSERT_EQUALS(o=-2.5; o=o%1.5, .5)
+	O_ASSERT_EQUALS(o=2; o=o*o*o-o-1, 5)
+	O_ASSERT_EQUALS(o=2; o=-o+"3", 1)
+	O_ASSERT_EQUALS(o=1; local p=o; o=o+1; o=p, 1)	//in-place assignment mustn't touch p's number
+	O_ASSERT_EQUALS(o=1; o=o<2, true)
+	O_ASSERT_EQUALS(o=1; o=o>=1.5, false)
+	O_ASSERT_EQUALS(o="1"; o=o==1, false)	//no coercion for equality
+	O_ASSERT_EQUALS(o=3; o=o*o-10<0, true)
+	O_ASSERT_EQUALS(o=1; local p=o; o+=1; o=p, 1)
+	ASSERT_FAIL(o="a"; o=o<1)
+	O_ASSERT_EQUALS(o=4; o=2+o*3, 14)
+	O_ASSERT_EQUALS(o=4; o=1-o, -3)
+	O_ASSERT_EQUALS(o=4; o=10%o, 2)
+	O_ASSERT_EQUALS(o=4; o=1<o, true)
+	O_ASSERT_EQUALS(o=4; o=5<=o-1, false)
+	//a lambda deducing an expression as its return type would return references to its locals, so it's refused: say ->Object
+	static_assert(ObjectIsExpr<decltype(std::declval<Object>() * 2)>::value, "arithmetic builds expressions");
+	static_assert(!ObjectIsExpr<Object>::value, "Objects are values");
+	O_ASSERT_EQUALS(o=[](Object x)->Object { Object y = x + 1; return y * 2; }; o=o(3), 8)
 	O_ASSERT_EQUALS(o=1; o+=2, 3)
 	O_ASSERT_EQUALS(o=1; o+=2.5, 3.5)
 	O_ASSERT_EQUALS(o=1; o-=2, -1)
@@ -176,6 +226,8 @@ void test_main() {
 	O_ASSERT_EQUALS(o=2;o=o.concat(2), "22")
 	O_ASSERT_EQUALS(o=2;o=o.concat("a"), "2a")
 	O_ASSERT_EQUALS(o="a";o=o.concat(2), "a2")
+	O_ASSERT_EQUALS(o=2;o=concat("a", o), "a2")
+	O_ASSERT_EQUALS(o="b";o=concat(1.5, o), "1.5b")
 	ASSERT_FAIL(o=true;o=o.concat(1))
 	ASSERT_FAIL(o=Object{};o=o.concat(1))
 
@@ -208,6 +260,24 @@ void test_main() {
 	//assign to refs from refs
 	O_ASSERT_EQUALS(o=1; local p=2; (o,p)=(p,o), 2)
 	O_ASSERT_EQUALS(o=1; local p=2; (o,p)=(p,o); o=p, 1)
+	//longer lists are appended in-place
+	O_ASSERT_EQUALS(o=1; local p=2; local q=3; (o,p,q)=(q,o,p), 3)
+	O_ASSERT_EQUALS(o=1; local p=2; local q=3; (o,p,q)=(q,o,p); o=q, 2)
+	//lists longer than VarArg's inline storage spill onto the heap
+	O_ASSERT_EQUALS(VarArg v = (Object(1), Object(2), Object(3), Object(4), Object(5), Object(6), Object(7), Object(8)); o=v[8], 8)
+	O_ASSERT_EQUALS(VarArg v(1,2,3,4,5,6,7,8,9); o=(double)v.len(), 9)
+	//appending one of its own elements as it spills, which is read before the rest move
+	{
+		SmallVector<std::string, 6> v;
+		for (int i = 0; i < 6; ++i) v.push_back("an element too long to be stored inside a std::string " + std::to_string(i));
+		v.emplace_back(v[0]);
+		ASSERT_EQUALS(Object(v[6]), Object(v[0]));
+		SmallVector<std::string, 6> w;
+		for (int i = 0; i < 6; ++i) w.push_back("an element too long to be stored inside a std::string " + std::to_string(i));
+		w.push_back(std::move(w.back()));
+		ASSERT_EQUALS(Object(w[6]), Object("an element too long to be stored inside a std::string 5"));
+		ASSERT_EQUALS(Object((double)w.size()), Object(7));
+	}
 #endif
 
 #if 1
@@ -244,9 +314,20 @@ std::cout << "done constructing o" << std::endl;
 
 			print(o);
 			ASSERT_EQUALS(Object(o + 2), Object(20));	//test __add
+			ASSERT_EQUALS(Object(o + 2 + 1), Object(21));	//__add in the middle of a chain
 			ASSERT_EQUALS((Object)o("foo", 2), Object("bar"));	//test __call
 		}
 		ASSERT_EQUALS(destroyed, true);
+
+		//only tables and userdata take metatables: nil, true and false share their details with every other one
+		Object mt = Object::Map();
+		Object a;
+		ASSERT_FAIL(setmetatable(a, mt))
+		ASSERT_FAIL(setmetatable(true, mt))
+		ASSERT_FAIL(setmetatable(Object(1) == 1, mt))
+		ASSERT_FAIL(setmetatable(1, mt))
+		ASSERT_EQUALS(getmetatable(Object()), nil);
+		ASSERT_EQUALS(getmetatable(Object(1) == 1), nil);
 	}
 #endif
 
@@ -287,6 +368,778 @@ std::cout << "done constructing o" << std::endl;
 		std::function<double(double)> g = o;
 		print("g", g(2));
 	}
+
+	//callables too big for the inline buffer are stored on the heap
+	{
+		double a = 1, b = 2, c = 3, d = 4, e = 5;
+		Object o = [=](double x)->double{ return a+b+c+d+e+x; };
+		ASSERT_EQUALS((Object)o(1), 16);
+
+		//copies of the callable, and calling with a caller-provided result buffer
+		Object::Function f = o.details->to_function();
+		VarArg results;
+		f(VarArg(2), results);
+		ASSERT_EQUALS(results.len(), 1);
+		ASSERT_EQUALS((Object)results, 17);
+	}
+
+	//typed functions convert each argument straight to their parameter types
+	{
+		ASSERT_EQUALS((Object)math.sqrt(16), 4);
+		ASSERT_EQUALS((Object)math.floor("2.5"), 2);
+		ASSERT_EQUALS((Object)math.atan2(0, 1), 0);
+		//missing arguments are nil
+		Object o = [](Object a, Object b)->bool{ return b.is_nil(); };
+		ASSERT_EQUALS((Object)o(1), true);
+	}
+#endif
+
+#if 1
+	//bulk math over t[1..n]
+	{
+		Object t = {{1, 4}, {2, 9}, {3, 16}, {4, 1}, {5, 25}};
+		Object r = math.map(t, "sqrt");
+		ASSERT_EQUALS((Object)r[3], 4);
+		ASSERT_EQUALS((Object)math.sum(t), 55);
+		ASSERT_EQUALS((Object)math.minof(t), 1);
+		ASSERT_EQUALS((Object)math.maxof(t), 25);
+		ASSERT_EQUALS((Object)math.dot(t, t), 979);
+
+		Object u = Object::Map();
+		for (int i = 1; i <= 37; ++i) u[i] = i;
+		ASSERT_EQUALS((Object)math.sum(u), 703);
+		ASSERT_EQUALS((Object)math.maxof(u), 37);
+
+		//not all numbers: done element by element
+		Object s = {{1, "4"}, {2, 9}};
+		ASSERT_EQUALS((Object)math.sum(s), 13);
+		r = math.map(s, "sqrt");
+		ASSERT_EQUALS((Object)r[2], 3);
+		ASSERT_FAIL(math.sum(Object{{1, true}}))
+	}
+#endif
+
+#if 1
+	//math.random
+	{
+		math.randomseed(42);
+		Object a = math.random(1, 100);
+		Object b = math.random();
+		math.randomseed(42);
+		ASSERT_EQUALS((Object)math.random(1, 100), a);
+		ASSERT_EQUALS((Object)math.random(), b);
+
+		//without arguments it picks a seed, and returns it so the run can be repeated
+		VarArg seeds = math.randomseed();
+		ASSERT_EQUALS((Object)seeds[1].is_number(), true);
+		ASSERT_EQUALS((Object)seeds[2].is_number(), true);
+		a = math.random();
+		math.randomseed(seeds[1], seeds[2]);
+		ASSERT_EQUALS((Object)math.random(), a);
+
+		for (int i = 0; i < 1000; ++i) {
+			Object x = math.random(3, 5);
+			ASSERT_EQUALS(x >= 3 && x <= 5, true);
+			x = math.random();
+			ASSERT_EQUALS(x >= 0 && x < 1, true);
+		}
+		ASSERT_FAIL(math.random(2, 1))
+		ASSERT_FAIL(math.random(2.5))
+
+		Object t = Object::Map();
+		math.random_fill(t, 100, 6);
+		ASSERT_EQUALS((Object)math.minof(t) >= 1, true);
+		ASSERT_EQUALS((Object)math.maxof(t) <= 6, true);
+		ASSERT_EQUALS((Object)t[101], nil);
+		//arguments are checked before anything is allocated for n
+		ASSERT_FAIL(math.random_fill(1, 1e15))
+		ASSERT_FAIL(math.random_fill(t, 1e15, 2, 1))
+		ASSERT_FAIL(math.random_fill(t, 1e15, 1, 2, 3))
+		//more than one block, over keys already there and around other keys
+		Object u = Object::Map();
+		u[1] = "x"; u[500] = "y"; u["k"] = "z";
+		math.random_fill(u, 1000, 1, 2);
+		ASSERT_EQUALS(u.len(), 1000);
+		ASSERT_EQUALS((Object)math.minof(u) >= 1, true);
+		ASSERT_EQUALS((Object)math.maxof(u) <= 2, true);
+		ASSERT_EQUALS((Object)u["k"], Object("z"));
+		//tables with __newindex still see the new keys
+		Object seen = 0;
+		Object w = Object::Map();
+		setmetatable(w, Object::Map{{"__newindex", [&](VarArg args)->VarArg { seen = seen + 1; return nil; }}});
+		math.random_fill(w, 10);
+		ASSERT_EQUALS(seen, 10);
+	}
+#endif
+
+#if 1
+	//typed arrays
+	{
+		std::vector<double> v = {1, 4, 9};
+		const double* buffer = v.data();
+		Object a = array(std::move(v));
+		ASSERT_EQUALS(toarray<double>(a)->data, buffer);	//not copied
+		ASSERT_EQUALS(type(a), Object("userdata"));
+		ASSERT_EQUALS(a.len(), 3);
+		ASSERT_EQUALS((Object)a[2], 4);
+		ASSERT_EQUALS((Object)a[4], nil);
+		a[1] = 16;
+		ASSERT_EQUALS((Object)math.sum(a), 29);
+		Object r = math.map(a, "sqrt");
+		ASSERT_EQUALS((Object)r[1], 4);
+		ASSERT_FAIL(a[4] = 1)
+		ASSERT_FAIL(a[1] = "foo")
+
+		//a view onto C++ memory
+		int32_t ints[4] = {1, 2, 3, 4};
+		Object b = array(ints, 4);
+		b[4] = 2.5;
+		ASSERT_EQUALS(ints[3], 2);
+		double sum = 0;
+		for (int32_t i : *toarray<int32_t>(b)) sum += i;
+		ASSERT_EQUALS(sum, 8);
+		ASSERT_EQUALS((Object)math.dot(b, b), 18);
+
+		ASSERT_EQUALS(array<uint8_t>(10).len(), 10);
+	}
+#endif
+
+#if 1
+	//userdata
+	{
+		struct Point {
+			double x, y;
+			int* alive;
+			Point(double x_, double y_, int* alive_) : x(x_), y(y_), alive(alive_) { ++*alive; }
+			~Point() { --*alive; }
+		};
+		int alive = 0;
+		{
+			local p = newuserdata<Point>(3, 4, &alive);
+			ASSERT_EQUALS(alive, 1);
+			ASSERT_EQUALS(type(p), Object("userdata"));
+			checkudata<Point>(p).x = 6;
+			ASSERT_EQUALS(testudata<Point>(p)->x, 6);
+			ASSERT_EQUALS(testudata<int>(p), (int*)nullptr);
+			ASSERT_EQUALS(testudata<Point>(Object(1)), (Point*)nullptr);
+			ASSERT_FAIL(checkudata<double>(p))
+			ASSERT_FAIL(checkudata<Object_Details_Array<double>>(p))
+
+			//methods through the metatable
+			local methods = {
+				{"len", function(self) {
+					Point& pt = checkudata<Point>(self);
+					return std::sqrt(pt.x * pt.x + pt.y * pt.y);
+				}},
+			};
+			setmetatable(p, {
+				{"__index", methods},
+				{"__add", function(self, o) {
+					return checkudata<Point>(self).x + o;
+				}},
+			});
+			ASSERT_EQUALS((Object)p["len"](p), 7.2111025509279782);
+			ASSERT_EQUALS(Object(p + 1), 7);
+
+			//a light userdata refers to an object it doesn't own
+			Point q(1, 2, &alive);
+			Object l = lightuserdata(&q);
+			ASSERT_EQUALS(&checkudata<Point>(l), &q);
+			//light userdata are values, equal when their pointers are, and the same key in a table
+			ASSERT_EQUALS(l == lightuserdata(&q), true);
+			ASSERT_EQUALS(l == lightuserdata(&alive), false);
+			ASSERT_EQUALS(l == p, false);
+			Object byPointer = Object::Map();
+			byPointer[l] = "q";
+			ASSERT_EQUALS((Object)byPointer[lightuserdata(&q)], "q");
+			VarArg inLua = load("local a, b = ... return a == b, rawequal(a, b)")(l, lightuserdata(&q));
+			ASSERT_EQUALS(inLua[1], true);
+			ASSERT_EQUALS(inLua[2], true);
+			ASSERT_EQUALS(alive, 2);
+		}
+		ASSERT_EQUALS(alive, 0);
+	}
+#endif
+
+#if 1
+	//buffered output formats numbers the same way streams and tostring do
+	{
+		for (double d : {0., -1., 0.1, 1./3., 1234567., 1e-300, 1e300, HUGE_VAL, -HUGE_VAL}) {
+			std::ostringstream ss;
+			ss << d;
+			char buf[Object_Details_Number::formatSize];
+			ASSERT_EQUALS(std::string(buf, Object_Details_Number::format(d, buf)), ss.str());
+			ASSERT_EQUALS((std::string)tostring(d), ss.str());
+		}
+		io.write("io.write ", 1.5, " ", Object(true), "\n");
+		//it returns io.stdout, so writes chain
+		Object chained = load("return io.write('io.write '):write('chained', '\\n')")();
+		ASSERT_EQUALS(chained, (Object)io["stdout"]);
+		print("print", 1.5, 20, (int64_t)1 << 40, Object(nil));
+		io.flush();
+	}
+#endif
+
+#if 1
+	//files
+	{
+		const char* path = "CxxAsLua_test_io.txt";
+		{
+			Object f = io.open(path, "w");
+			ASSERT_EQUALS((Object)io["type"](f), Object("file"));
+			f["write"](f, "first line\n", 42, " 0x10 -.5e1\n", "last, no newline");
+			ASSERT_EQUALS((Object)f["close"](f), true);
+			ASSERT_EQUALS((Object)io["type"](f), Object("closed file"));
+			ASSERT_FAIL(f["write"](f, "more"))
+		}
+		{
+			//read-only, so mmap'd
+			Object f = io.open(path);
+			ASSERT_EQUALS((Object)f["read"](f), Object("first line"));
+			VarArg numbers = f["read"](f, "n", "n", "n", "n");
+			ASSERT_EQUALS(numbers[1], 42);
+			ASSERT_EQUALS(numbers[2], 16);
+			ASSERT_EQUALS(numbers[3], -5);
+			ASSERT_EQUALS(numbers[4], nil);	//"last" isn't a number, but the whitespace before it was skipped
+			ASSERT_EQUALS((Object)f["read"](f, 4), Object("last"));
+			ASSERT_EQUALS((Object)f["read"](f, "a"), Object(", no newline"));
+			ASSERT_EQUALS((Object)f["read"](f, "l"), nil);
+			ASSERT_EQUALS((Object)f["read"](f, "a"), Object(""));
+			ASSERT_EQUALS((Object)f["seek"](f, "set", 6), 6);
+			ASSERT_EQUALS((Object)f["read"](f, 4), Object("line"));
+			ASSERT_EQUALS((Object)f["read"](f, "L"), Object("\n"));
+			ASSERT_EQUALS((Object)f["seek"](f, "end"), 41);
+			ASSERT_EQUALS((Object)f["write"](f, "x"), nil);	//fails, returning nil and the error
+			ASSERT_FAIL(f["read"](f, "x"))
+
+			//C++ callers can read lines without copying them out of the mapping
+			f["seek"](f, "set");
+			File* file = tofile(f);
+			const char* s;
+			size_t n;
+			int count = 0;
+			while (file->readLine(s, n)) ++count;
+			ASSERT_EQUALS(count, 3);
+			f["close"](f);
+		}
+		{
+			int count = 0;
+			Object next = io.lines(path);
+			for (Object line; !(line = next()).is_nil();) ++count;
+			ASSERT_EQUALS(count, 3);
+		}
+		ASSERT_EQUALS(io.open("does/not/exist").len(), 3);	//nil, message, errno
+		ASSERT_FAIL(io.lines("does/not/exist"))
+		ASSERT_FAIL(io.open(path, "rw"))
+		ASSERT_EQUALS((Object)io.close(), nil);	//stdout
+		remove(path);
+	}
+#endif
+
+#if 1
+	//serialization
+	{
+		Object shared = {{"name", "shared"}};
+		Object t = {
+			{1, 1.5},
+			{2, -7},
+			{3, "name"},
+			{"big", 1e300},
+			{"neg", -0.},
+			{"yes", true},
+			{"no", false},
+			{"a", shared},
+			{"b", shared},
+		};
+		t["self"] = t;
+
+		Object bytes = serialize(t);
+		Object u = deserialize(bytes);
+		ASSERT_EQUALS(u.len(), 3);
+		ASSERT_EQUALS((Object)u[1], 1.5);
+		ASSERT_EQUALS((Object)u[2], -7);
+		ASSERT_EQUALS((Object)u[3], Object("name"));
+		ASSERT_EQUALS((Object)u["big"], 1e300);
+		ASSERT_EQUALS(std::signbit((double)(Object)u["neg"]), true);
+		ASSERT_EQUALS((Object)u["yes"], true);
+		ASSERT_EQUALS((Object)u["no"], false);
+		Object a = u["a"];
+		ASSERT_EQUALS((Object)a["name"], Object("shared"));
+		ASSERT_EQUALS((Object)u["a"], (Object)u["b"]);	//still shared
+		ASSERT_EQUALS((Object)u["self"], u);	//still cyclic
+		ASSERT_EQUALS(u == t, false);
+
+		ASSERT_EQUALS((Object)deserialize(serialize("just a string")), Object("just a string"));
+		ASSERT_FAIL(serialize(Object({{"f", function(){ return nil; }}})))
+		ASSERT_FAIL(deserialize(Object("not serialized")))
+		std::string truncated = bytes;
+		truncated.resize(truncated.size() - 4);
+		ASSERT_FAIL(deserialize(truncated.data(), truncated.size()))
+
+		//mapped, with tables built as they're used
+		const char* path = "CxxAsLua_test_snapshot.bin";
+		Object f = io.open(path, "wb");
+		f["write"](f, bytes);
+		f["close"](f);
+		{
+			Object m = mapSnapshot(path);
+			ASSERT_EQUALS(type(m), Object("userdata"));
+			ASSERT_EQUALS(m.len(), 3);
+			ASSERT_EQUALS((Object)m[3], Object("name"));
+			Object ma = m["a"];
+			ASSERT_EQUALS((Object)ma["name"], Object("shared"));
+			ASSERT_EQUALS((Object)m["a"], (Object)m["b"]);
+			ASSERT_EQUALS((Object)m["self"], m);
+			ASSERT_FAIL(m["yes"] = false)
+			//snapshot tables serialize like the tables they came from
+			Object again = deserialize(serialize(m));
+			ASSERT_EQUALS((Object)again["yes"], true);
+		}
+		remove(path);
+	}
+#endif
+
+#if 1
+	//JSON
+	{
+		Object t = decodeJSON(Object(" {\"name\": \"a\\\"b\\u00e9\\ud83d\\ude00\", \"list\": [1, -2.5e1, true, null, {\"name\": false}], \"big\": 12345678901234567890, \"n\": null} "));
+		ASSERT_EQUALS((Object)t["name"], Object("a\"b\xc3\xa9\xf0\x9f\x98\x80"));
+		Object list = t["list"];
+		ASSERT_EQUALS(list.len(), 5);
+		ASSERT_EQUALS((Object)list[2], -25);
+		ASSERT_EQUALS((Object)list[4], nil);
+		Object inner = list[5];
+		ASSERT_EQUALS((Object)inner["name"], false);
+		ASSERT_EQUALS((Object)t["big"], 12345678901234567890.);
+		ASSERT_EQUALS((Object)t["n"], nil);
+		ASSERT_EQUALS((Object)json.decode("0.1"), 0.1);
+
+		ASSERT_FAIL(decodeJSON(Object("[1, 2")))
+		ASSERT_FAIL(decodeJSON(Object("[1 2]")))
+		ASSERT_FAIL(decodeJSON(Object("{\"a\" 1}")))
+		ASSERT_FAIL(decodeJSON(Object("01")))
+		ASSERT_FAIL(decodeJSON(Object("[1.]")))
+		ASSERT_FAIL(decodeJSON(Object("\"\\ud800\"")))
+		ASSERT_FAIL(decodeJSON(Object("tru")))
+		ASSERT_FAIL(decodeJSON(Object("1 2")))
+
+		ASSERT_EQUALS(encodeJSON(Object({{1, 1}, {2, "two"}, {3, Object({{"x", 0.1}})}})), Object("[1,\"two\",{\"x\":0.1}]"));
+		ASSERT_EQUALS(encodeJSON(Object({{"a", "\n\x01"}, {2, true}})), Object("{\"2\":true,\"a\":\"\\n\\u0001\"}"));
+		ASSERT_EQUALS(encodeJSON(Object(Object::Map())), Object("{}"));
+		ASSERT_EQUALS(encodeJSON(Object(1./3.)), Object("0.3333333333333333"));
+		ASSERT_EQUALS(encodeJSON(array<int32_t>(2)), Object("[0,0]"));
+		ASSERT_FAIL(encodeJSON(Object(HUGE_VAL)))
+		Object cycle = Object::Map();
+		cycle["self"] = cycle;
+		ASSERT_FAIL(encodeJSON(cycle))
+		cycle["self"] = nil;
+		//round trip
+		Object again = decodeJSON(encodeJSON(t));
+		ASSERT_EQUALS((Object)again["name"], (Object)t["name"]);
+
+		//streaming, in chunks that split tokens
+		std::string input = "[{\"id\": 1}, {\"id\": 22}, 333, \"four\"]";
+		double sum = 0;
+		int count = 0;
+		JSONStream stream([&](const Object& o) {
+			++count;
+			if (o.is_table()) sum += (double)(Object)Object(o)["id"];
+			if (o.is_number()) sum += (double)o;
+		});
+		for (size_t i = 0; i < input.size(); i += 3) stream.feed(input.substr(i, 3));
+		stream.finish();
+		ASSERT_EQUALS(count, 4);
+		ASSERT_EQUALS(sum, 356);
+
+		//newline-delimited
+		count = 0;
+		JSONStream lines([&](const Object& o) { ++count; });
+		lines.feed("{\"a\": 1}\n{\"a\"");
+		ASSERT_EQUALS(count, 1);
+		lines.feed(": 2}\n12");
+		ASSERT_EQUALS(count, 2);
+		lines.finish();
+		ASSERT_EQUALS(count, 3);
+
+		//a single top-level object, a byte at a time, comes out as decodeJSON's
+		std::string nested = "{\"name\": \"a\\\"b\\u00e9\", \"list\": [1, -2.5e3, true, null, {\"k\": false}], \"n\": 12345}";
+		Object whole;
+		count = 0;
+		JSONStream bytes([&](const Object& o) { ++count; whole = o; });
+		for (char c : nested) bytes.feed(&c, 1);
+		bytes.finish();
+		ASSERT_EQUALS(count, 1);
+		ASSERT_EQUALS(encodeJSON(whole), encodeJSON(decodeJSON(nested)));
+
+		//errors are reported whichever chunk they fall in
+		JSONStream broken([&](const Object& o) {});
+		broken.feed("[1, {\"a\"");
+		ASSERT_FAIL(broken.feed(" 2}]"))
+		JSONStream unfinished([&](const Object& o) {});
+		unfinished.feed("[1, 2");
+		ASSERT_FAIL(unfinished.finish())
+		JSONStream badNumber([&](const Object& o) {});
+		badNumber.feed("[1.2.");
+		ASSERT_FAIL(badNumber.feed("3]"))
+	}
+#endif
+
+#if 1
+	//Lua source
+	{
+		Object chunk = load("local a, b = ... return a + b, a .. b");
+		VarArg results = chunk(1, 2);
+		ASSERT_EQUALS(results[1], 3);
+		ASSERT_EQUALS(results[2], "12");
+
+		//closures share their captured locals, and each loop iteration gets its own
+		Object counters = load(
+			"local function counter() local n = 0 return function() n = n + 1 return n end end\n"
+			"local c = counter() c() c()\n"
+			"local fs = {} for i = 1, 3 do fs[i] = function() return i end end\n"
+			"return c(), fs[1]() + fs[3]()");
+		results = counters();
+		ASSERT_EQUALS(results[1], 3);
+		ASSERT_EQUALS(results[2], 4);
+
+		//tables, metatables and C++ functions pass freely between Lua and C++
+		Object t = Object::Map();
+		t["scale"] = 10;
+		luaEnvironment()["cxxTable"] = t;
+		luaEnvironment()["cxxTwice"] = [=](const VarArg& args)->VarArg { return (double)args[1] * 2; };
+		Object fromLua = load(
+			"local mt = {__index = function(t, k) return k .. '!' end, __add = function(a, b) return cxxTable.scale end}\n"
+			"local o = setmetatable({}, mt)\n"
+			"cxxTable.total = 0 for i, v in ipairs({1, 2, 3}) do cxxTable.total = cxxTable.total + cxxTwice(v) end\n"
+			"return o.x, o + 1, #'abc', select('#', 1, nil, 3)")();
+		ASSERT_EQUALS(fromLua, "x!");
+		ASSERT_EQUALS((Object)t["total"], 12);
+		Object apply = load("return function(f, x) return f(x) + 1 end")();
+		ASSERT_EQUALS((Object)apply(function(x) { return x * 3; }, 5), 16);
+
+		//tail calls don't grow the stack, other recursion stops with an error before overflowing
+		ASSERT_EQUALS((Object)load("local function loop(n) if n == 0 then return 'done' end return loop(n - 1) end return loop(1000000)")(), "done");
+		ASSERT_FAIL(load("local function r() return 1 + r() end return r()")())
+
+		//goto, numeric and generic for, while and repeat
+		ASSERT_EQUALS((Object)load(
+			"local s = 0 for i = 10, 1, -2 do s = s + i end\n"
+			"for k, v in pairs({a = 1, b = 2}) do s = s + v end\n"
+			"while s > 30 do s = s - 1 end repeat s = s + 1 until s > 40\n"
+			"local i = 0 ::top:: i = i + 1 if i < 5 then goto top end\n"
+			"return s + i")(), 46);
+
+		//errors carry the chunk and line
+		try {
+			load("local x = nil\nreturn x.y", "=test")();
+			throw std::runtime_error("expected failure instead passed");
+		} catch (LuaError& e) {
+			ASSERT_EQUALS(Object(e.what()), "test:2: attempt to index a nil value");
+		}
+		ASSERT_FAIL(load("return 1 +"))
+		try {
+			load("error('boom')", "=test")();
+			throw std::runtime_error("expected failure instead passed");
+		} catch (LuaError& e) {
+			ASSERT_EQUALS(Object(e.what()), "test:1: boom");
+		}
+		results = load("return load('return 1 +')")();
+		ASSERT_EQUALS(results[1], nil);
+		//an env given, even a nil one, is used instead of the globals
+		results = load("return load('return x', 'env', 't', {x = 5})(), pcall(load('return print', 'env', 't', nil))")();
+		ASSERT_EQUALS(results[1], 5);
+		ASSERT_EQUALS(results[2], false);
+		ASSERT_FAIL(load("return print", "=env", nil)())
+		//closures made and methods called by the VM let go of what they hold
+		Object held = Object::Map();
+		held["m"] = [](VarArg args)->VarArg { return args[1]; };
+		long uses = held.details.use_count();
+		load("local t = ... for i = 1, 100 do local f = function() return t end t:m() end")(held);
+		ASSERT_EQUALS(Object((double)held.details.use_count()), Object((double)uses));
+		ASSERT_EQUALS((Object)load("return type")(), (Object)load("return type", "=env", luaEnvironment())());
+	}
+#endif
+
+#if 1
+	//Lua to C++
+	{
+		std::string cxx = translateLua(
+			"local function fib(n) if n < 2 then return n end return fib(n - 1) + fib(n - 2) end\n"
+			"return fib(20)", "=fib", "fib");
+		//a local function only ever called, on numbers, becomes a static function on doubles
+		ASSERT_EQUALS(Object(cxx.find("static double fib_1(double n_2)") != std::string::npos), true);
+		ASSERT_EQUALS(Object(cxx.find("VarArg fib(const VarArg& args)") != std::string::npos), true);
+
+		//one that's passed around stays an Object
+		cxx = translateLua("local function f(x) return x end return f", "=f", "f");
+		ASSERT_EQUALS(Object(cxx.find("static VarArg") == std::string::npos), true);
+
+		ASSERT_FAIL(translateLua("return 1 +", "=bad", "bad"))
+		ASSERT_FAIL(translateLua("goto nowhere", "=bad", "bad"))
+
+		//translated.lua, run by the VM and as translated.cpp, gives the same results
+		std::string dir = __FILE__;
+		dir = dir.substr(0, dir.find_last_of("/\\") + 1);
+		Object fixture = io.open(dir + "translated.lua");
+		if (!fixture) throw std::runtime_error("cannot open " + dir + "translated.lua");
+		std::string source = (std::string)(Object)fixture["read"](fixture, "a");
+		fixture["close"](fixture);
+		VarArg inLua = load(source, "@translated.lua")();
+		VarArg inCxx = translated(VarArg());
+		ASSERT_EQUALS(inCxx.len(), inLua.len());
+		for (size_t i = 1; i <= inLua.len(); ++i) ASSERT_EQUALS(inCxx[i], inLua[i]);
+		ASSERT_EQUALS(inLua[1], "1,2,3,4,5,6,1,2,p,q,r,k,ik,3,4,6,5,7,8,9,7,8,9,kk,10,mk,5,6,10,11,12,13,14");
+		//and translated.cpp is up to date
+		Object generated = io.open(dir + "translated.cpp");
+		ASSERT_EQUALS(translateLua(source, "@translated.lua", "translated"), (std::string)(Object)generated["read"](generated, "a"));
+		generated["close"](generated);
+	}
+#endif
+
+#if 1
+	//compile-time constants
+	{
+		//every nil, true and false shares static details
+		ASSERT_EQUALS(Object(Object().details == nil.details), true);
+		ASSERT_EQUALS(Object(Object(1 < 2).details == Object(true).details), true);
+
+		static const ConstantNumber answer(42.);
+		static const ConstantString name("answer");
+		Object t;
+		t = {};
+		t[name] = answer;
+		ASSERT_EQUALS((Object)t["answer"], 42);
+		ASSERT_EQUALS(Object(&name.get() == &name.get()), true);
+
+		static const ConstantField inner[] = {
+			{"x", 1},
+		};
+		static const ConstantField fields[] = {
+			{"pi", 3.5},
+			{"yes", true},
+			{"greeting", "hello"},
+			{"math", &math},
+			{"inner", inner},
+		};
+		Object c = constantTable(fields);
+		ASSERT_EQUALS((Object)c["pi"], 3.5);
+		ASSERT_EQUALS((Object)c["yes"], true);
+		ASSERT_EQUALS((Object)c["greeting"], "hello");
+		Object m = c["math"], i = c["inner"];
+		ASSERT_EQUALS((Object)m["floor"](2.5), 2);
+		ASSERT_EQUALS((Object)i["x"], 1);
+		//each call makes its own table
+		c["pi"] = 3;
+		ASSERT_EQUALS((Object)constantTable(fields)["pi"], 3.5);
+	}
+#endif
+
+#if 1
+	//strings
+	{
+		ASSERT_EQUALS((Object)string.upper("abc"), "ABC");
+		ASSERT_EQUALS((Object)string.sub("hello", 2, -2), "ell");
+		VarArg found = string.find("key = value", "(%w+)%s*=%s*(%w+)");
+		ASSERT_EQUALS(found[1], 1);
+		ASSERT_EQUALS(found[2], 11);
+		ASSERT_EQUALS(found[3], "key");
+		ASSERT_EQUALS(found[4], "value");
+		ASSERT_EQUALS((Object)string.find("a.b", ".", 1, true), 2);
+		VarArg replaced = string.gsub("hello world", "o", "0");
+		ASSERT_EQUALS(replaced[1], "hell0 w0rld");
+		ASSERT_EQUALS(replaced[2], 2);
+
+		//strings have the library's functions as methods in Lua
+		VarArg results = load(
+			"local s = 'The quick brown fox'\n"
+			"local words = {} for w in s:gmatch('%a+') do words[#words + 1] = w:lower() end\n"
+			"local swapped = ('k1=v1, k2=v2'):gsub('(%w+)=(%w+)', '%2=%1')\n"
+			"local counted = s:gsub('%w+', {quick = 'slow'})\n"
+			"local called = s:gsub('%f[%a]%a', function(c) return c:upper() end)\n"
+			"return table.concat(words, ','), swapped, counted, called, s:match('^(%a+)'), s:byte(-1), string.char(72, 105), ('ab'):rep(3, '-')")();
+		ASSERT_EQUALS(results[1], "the,quick,brown,fox");
+		ASSERT_EQUALS(results[2], "v1=k1, v2=k2");
+		ASSERT_EQUALS(results[3], "The slow brown fox");
+		ASSERT_EQUALS(results[4], "The Quick Brown Fox");
+		ASSERT_EQUALS(results[5], "The");
+		ASSERT_EQUALS(results[6], 120);
+		ASSERT_EQUALS(results[7], "Hi");
+		ASSERT_EQUALS(results[8], "ab-ab-ab");
+
+		//balanced matches, back references, position captures and anchors
+		results = load(
+			"return ('f(a(b)c) d'):match('%b()'), select(2, ('x=1;x=2'):match('(%a)=%d;%1=(%d)')), ('abc'):find('^b'), ('abc'):find('()b()')")();
+		ASSERT_EQUALS(results[1], "(a(b)c)");
+		ASSERT_EQUALS(results[2], "2");
+		ASSERT_EQUALS(results[3], nil);
+		ASSERT_EQUALS(results[4], 2);
+		ASSERT_EQUALS(results[5], 2);
+		ASSERT_EQUALS(results[6], 2);
+		ASSERT_EQUALS(results[7], 3);
+		//gmatch doesn't anchor: a leading '^' is just a character, while find and match still anchor on the same text
+		results = load("local n = 0 for m in ('^a^a'):gmatch('^a') do n = n + 1 end return n, ('^a^a'):find('^a')")();
+		ASSERT_EQUALS(results[1], 2);
+		ASSERT_EQUALS(results[2], nil);
+
+		ASSERT_FAIL(string.find("a", "[a"))
+		ASSERT_FAIL(string.gsub("a", "(a)", "%2"))
+		ASSERT_FAIL(load("return ('a'):nosuchmethod()")())
+
+		//format, with C's conversions and Lua's %q
+		ASSERT_EQUALS((Object)string.format("%d items, %5.2f%% done, %s", 12, 99.5, "ok"), "12 items, 99.50% done, ok");
+		results = load(
+			"return string.format('%x %X %o %5d|%-5d|%05i', 255, 255, 8, 42, 42, -42),\n"
+			"  string.format('%c%c%c', 76, 117, 97), string.format('%.3s|%10s|%-4s|', 'abcdef', 'right', 'l'),\n"
+			"  string.format('%g %e %.1f', 1e20, 12345.678, 0.05), string.format('%q', 'a\\n\\\"b\\0' .. '1\\r'),\n"
+			"  string.format('%q %q %q', 1/0, 2^63, 7), ('%s=%s'):format(true, nil), string.format('%d', -9007199254740991)")();
+		ASSERT_EQUALS(results[1], "ff FF 10    42|42   |-0042");
+		ASSERT_EQUALS(results[2], "Lua");
+		ASSERT_EQUALS(results[3], "abc|     right|l   |");
+		ASSERT_EQUALS(results[4], "1e+20 1.234568e+04 0.1");
+		ASSERT_EQUALS(results[5], "\"a\\\n\\\"b\\0001\\13\"");
+		ASSERT_EQUALS(results[6], "1e9999 0x1p+63 7");
+		ASSERT_EQUALS(results[7], "true=nil");
+		ASSERT_EQUALS(results[8], "-9007199254740991");
+
+		ASSERT_FAIL(string.format("%d", 1.5))
+		ASSERT_FAIL(string.format("%d %d", 1))
+		ASSERT_FAIL(string.format("%y", 1))
+		ASSERT_FAIL(string.format("%123d", 1))
+		ASSERT_FAIL(string.format("%q", Object::Map()))
+	}
+#endif
+
+#if 1
+	//errors
+	{
+		//any value can be raised, and pcall hands it back untouched
+		Object details = Object::Map();
+		details["code"] = 42;
+		VarArg caught = pcall(function() { error(details); return nil; });
+		ASSERT_EQUALS(caught[1], false);
+		ASSERT_EQUALS(Object(caught[2].details == details.details), true);
+		VarArg fine = pcall(function(a, b) { return VarArg(a + b, "ok"); }, 1, 2);
+		ASSERT_EQUALS(fine[1], true);
+		ASSERT_EQUALS(fine[2], 3);
+		ASSERT_EQUALS(fine[3], "ok");
+		VarArg thrown = pcall(function() { throw std::runtime_error("plain"); return nil; });
+		ASSERT_EQUALS(thrown[2], "plain");
+		try {
+			error(details);
+		} catch (std::exception& e) {
+			ASSERT_EQUALS(Object(e.what()), "(error object is a table value)");
+		}
+
+		//from Lua: messages get the position of the level asked for, other values go through as they are
+		VarArg results = load(
+			"local function check(r) if not r.id then error('no id', 2) end return r.id end\n"
+			"local ok, e = pcall(function() local id = check({}) return id end)\n"
+			"local ok2, t = pcall(error, {code = 7})\n"
+			"local ok3, v = pcall(check, {id = 5})\n"
+			"return e, t.code, v, select('#', pcall(error))", "=errors")();
+		ASSERT_EQUALS(results[1], "errors:2: no id");
+		ASSERT_EQUALS(results[2], 7);
+		ASSERT_EQUALS(results[3], 5);
+		ASSERT_EQUALS(results[4], 2);
+		results = load("return pcall(function() error('here') end)", "=errors")();
+		ASSERT_EQUALS(results[2], "errors:1: here");
+		results = load("return pcall(function() error('bare', 0) end)")();
+		ASSERT_EQUALS(results[2], "bare");
+		results = load("return pcall(function() local x = nil return x.y end)", "=errors")();
+		ASSERT_EQUALS(results[2], "errors:1: attempt to index a nil value");
+
+		//xpcall's handler gets the error and returns what the caller sees
+		results = load("return xpcall(function(a) error({a}) end, function(e) return e[1] * 2, 'handled' end, 21)")();
+		ASSERT_EQUALS(results[1], false);
+		ASSERT_EQUALS(results[2], 42);
+		ASSERT_EQUALS(results[3], "handled");
+		results = load("return xpcall(function(a, b) return a + b end, print, 1, 2)")();
+		ASSERT_EQUALS(results[1], true);
+		ASSERT_EQUALS(results[2], 3);
+
+		//errors thrown through C++ keep their value
+		try {
+			load("error({code = 3})")();
+			throw std::runtime_error("expected failure instead passed");
+		} catch (Error& e) {
+			ASSERT_EQUALS((Object)e.value["code"], 3);
+		}
+	}
+#endif
+
+#if 1
+	//globals
+	{
+		ASSERT_EQUALS((Object)load("return _G == _G._G and _G.print == print")(), true);
+
+		//a global read in a loop sees it change, go away and come back, however it's done
+		VarArg results = load(
+			"local seen = {}\n"
+			"for i = 1, 6 do\n"
+			"  seen[#seen + 1] = tostring(g)\n"
+			"  if i == 1 then g = 1 elseif i == 2 then _G.g = 2 elseif i == 3 then g = nil\n"
+			"  elseif i == 4 then rawset(_G, 'g', 4) elseif i == 5 then _G['g'] = nil end\n"
+			"end\n"
+			"return table.concat(seen, ',')")();
+		ASSERT_EQUALS(results[1], "nil,1,2,nil,4,nil");
+		Object env = luaEnvironment();
+		ASSERT_EQUALS((Object)env["g"], nil);
+
+		//C++ sees Lua's globals and the other way around
+		load("fromLua = 'lua'")();
+		ASSERT_EQUALS((Object)env["fromLua"], "lua");
+		env["fromLua"] = "cxx";
+		ASSERT_EQUALS((Object)load("return fromLua")(), "cxx");
+		env["fromLua"] = nil;
+
+		//a chunk with its own environment, which can fall back on the globals
+		Object sandbox = Object::Map();
+		Object chunk = load("x = (x or 0) + 1 return x, print", "=sandbox", sandbox);
+		chunk();
+		VarArg alone = chunk();
+		ASSERT_EQUALS(alone[1], 2);
+		ASSERT_EQUALS(alone[2], nil);
+		ASSERT_EQUALS((Object)env["x"], nil);
+		Object meta = Object::Map();
+		meta["__index"] = env;
+		setmetatable(sandbox, meta);
+		VarArg inherited = chunk();
+		ASSERT_EQUALS(inherited[1], 3);
+		ASSERT_EQUALS(inherited[2], (Object)env["print"]);
+	}
+#endif
+
+#if 1
+	//libraries
+	{
+		//members are the table's own functions
+		Object m = math;
+		ASSERT_EQUALS((Object)m["floor"], (Object)math.floor);
+		ASSERT_EQUALS((Object)math["floor"](2.5), 2);
+		ASSERT_EQUALS((Object)math.fmod(7, 3), 1);
+		ASSERT_EQUALS((Object)math.rad(180), (Object)math.pi);
+		ASSERT_EQUALS((Object)(math.pi * 2), 2 * M_PI);
+
+		//every way of reaching a library reaches the one table
+		Object j = json;
+		j["extra"] = 1;
+		ASSERT_EQUALS((Object)json["extra"], 1);
+		ASSERT_EQUALS((Object)load("return json.extra")(), 1);
+		j["extra"] = nil;
+
+		//members see the table's function replaced, from C++ or Lua, and removed and put back
+		Object decode = json.decode;
+		Object a = json.decode("[2]");
+		ASSERT_EQUALS((Object)a[1], 2);
+		j["decode"] = [](VarArg)->VarArg { return 42; };
+		ASSERT_EQUALS((Object)json.decode("[2]"), 42);
+		load("json.decode = nil")();
+		ASSERT_EQUALS((Object)json.decode, nil);
+		load("local d = ... json.decode = d")(decode);
+		a = json.decode("[3]");
+		ASSERT_EQUALS((Object)a[1], 3);
+		ASSERT_EQUALS((Object)json.decode, decode);
+	}
 #endif
 
 #if 1
@@ -303,6 +1156,17 @@ std::cout << "done constructing o" << std::endl;
 	}
 #endif
 
+#if 1
+	{
+		//tail calls run in a loop in Object::call, so this doesn't overflow the stack
+		local count = function(n, acc) {
+			if (n == 0) return acc;
+			return tailcall(count, n-1, acc+1);
+		};
+		ASSERT_EQUALS((Object)count(100000, 0), 100000);
+	}
+#endif
+
 #if 1	
 	{
 		local curry = function(f,x){
@@ -347,6 +1211,142 @@ std::cout << "done constructing o" << std::endl;
 	}
 #endif
 
+#if 1
+	{
+		//closures made by a function outlive it, and the ones made together share their upvalues
+		local makeCounter = function(start) {
+			upvalue n = start;
+			local inc = closure(by) { n = n + by; return n; };
+			local get = closure() { return n; };
+			return VarArg(inc, get);
+		};
+		local inc, get;
+		(inc, get) = makeCounter(10);
+		inc(1);
+		ASSERT_EQUALS((Object)inc(5), 16);
+		ASSERT_EQUALS((Object)get(), 16);
+		local inc2 = makeCounter(0)[1];
+		inc2(1);
+		ASSERT_EQUALS((Object)get(), 16);
+
+		//each declaration is a new variable, so closures made in a loop each get their own
+		local fs = Object::Map();
+		for (int i = 1; i <= 3; ++i) {
+			upvalue x = i * 10;
+			fs[i] = closure() { x = x + 1; return x; };
+		}
+		Object f1 = fs[1], f3 = fs[3];
+		f1();
+		ASSERT_EQUALS((Object)f1(), 12);
+		ASSERT_EQUALS((Object)f3(), 31);
+
+		//upvalues read and write like locals
+		upvalue u;
+		ASSERT_EQUALS(u, nil);
+		u = 2;
+		ASSERT_EQUALS(u * 3 - 1, 5);
+		ASSERT_EQUALS(1 + u, 3);
+		ASSERT_EQUALS(Object(u < 3 and u != 0), true);
+		ASSERT_EQUALS(u.concat("!"), "2!");
+		u = Object::Map();
+		u["k"] = "v";
+		ASSERT_EQUALS((Object)u["k"], "v");
+		upvalue twice = closure(x) { return x * 2; };
+		ASSERT_EQUALS((Object)twice(4), 8);
+	}
+#endif
+
+#if 1
+	{
+		//generators hand out values one at a time
+		local gen = coroutine.create(function(n) {
+			for (local i = 1; i <= n; ++i) coroutine.yield(i);
+			return "done";
+		});
+		ASSERT_EQUALS((Object)coroutine.status(gen), "suspended");
+		ASSERT_EQUALS(coroutine.resume(gen, 3)[2], 1);
+		ASSERT_EQUALS(coroutine.resume(gen)[2], 2);
+		ASSERT_EQUALS(coroutine.resume(gen)[2], 3);
+		ASSERT_EQUALS(coroutine.resume(gen)[2], "done");
+		ASSERT_EQUALS((Object)coroutine.status(gen), "dead");
+		ASSERT_EQUALS(coroutine.resume(gen)[1], false);
+
+		//values passed into resume come out of yield
+		local echo = coroutine.wrap(function(a) {
+			local b = coroutine.yield(a + 1);
+			return b * 2;
+		});
+		ASSERT_EQUALS((Object)echo(1), 2);
+		ASSERT_EQUALS((Object)echo(5), 10);
+
+		//errors come back through resume, or are rethrown by wrap
+		local bad = coroutine.create(function() {
+			throw std::runtime_error("oops");
+			return nil;
+		});
+		VarArg results = coroutine.resume(bad);
+		ASSERT_EQUALS(results[1], false);
+		ASSERT_EQUALS(results[2], "oops");
+		ASSERT_FAIL(o = coroutine.wrap(function() { throw std::runtime_error("oops"); return nil; }); o())
+		ASSERT_FAIL(coroutine.yield())
+
+		//the main thread is a coroutine too, which can't be resumed
+		VarArg running = coroutine.running();
+		ASSERT_EQUALS((Object)running[2], true);
+		ASSERT_EQUALS((Object)running[1].type(), "thread");
+		ASSERT_EQUALS((Object)coroutine.status(running[1]), "running");
+		ASSERT_EQUALS(coroutine.resume(running[1])[1], false);
+		local seen = coroutine.wrap(function() {
+			VarArg inner = coroutine.running();
+			return VarArg(coroutine.status(running[1]), inner[2]);
+		});
+		VarArg status = seen();
+		ASSERT_EQUALS(status[1], "normal");
+		ASSERT_EQUALS(status[2], false);
+
+		//destroying a suspended coroutine unwinds its stack
+		bool unwound = false;
+		{
+			struct Flag { bool& b; ~Flag() { b = true; } };
+			local co = coroutine.create(function() {
+				Flag flag{unwound};
+				coroutine.yield();
+				return nil;
+			});
+			coroutine.resume(co);
+		}
+		ASSERT_EQUALS(unwound, true);
+
+		//even when the body swallows the kill and yields again
+		int kills = 0;
+		bool returned = false;
+		{
+			local co = coroutine.create(function() {
+				for (;;) {
+					try {
+						coroutine.yield();
+					} catch (...) {
+						if (++kills == 2) break;
+					}
+				}
+				returned = true;
+				return "dropped";
+			});
+			coroutine.resume(co);
+		}
+		ASSERT_EQUALS(kills, 2);
+		ASSERT_EQUALS(returned, true);
+
+		//finished coroutines' stacks get reused
+		local sum = 0;
+		for (int i = 0; i < 1000; ++i) {
+			local co = coroutine.wrap(function(x) { return x + 1; });
+			sum = sum + co(i);
+		}
+		ASSERT_EQUALS(sum, 500500);
+	}
+#endif
+
 #if 1 //translated from the live demo site
 	
 	// bisect.lua
@@ -362,9 +1362,9 @@ std::cout << "done constructing o" << std::endl;
 		n=n+1;
 		local fc=f(c);
 		if (fa*fc<0) {
-			return bisect(f,a,c,fa,fc);
+			return tailcall(bisect,f,a,c,fa,fc);
 		}
-		return bisect(f,c,b,fc,fb);
+		return tailcall(bisect,f,c,b,fc,fb);
 	};
 
 	// find root of f in the inverval [a,b]. needs f(a)*f(b)<0
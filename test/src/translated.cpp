@@ -0,0 +1,157 @@
+//translated from translated.lua by translateLua
+#include "CxxAsLua/LuaRuntime.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+using namespace CxxAsLua;
+
+static const Object luaK[] = {
+	Object(0.),
+	Object(1.),
+	Object(10.),
+	Object(100.),
+	Object(std::string("setmetatable", 12)),
+	Object(std::string("__index", 7)),
+	Object(std::string("i", 1)),
+	Object(std::string("p", 1)),
+	Object(std::string("q", 1)),
+	Object(std::string("r", 1)),
+	Object(std::string("k", 1)),
+	Object(std::string("kk", 2)),
+	Object(std::string("mk", 2)),
+	Object(std::string("max", 3)),
+	Object(std::string("math", 4)),
+	Object(std::string("select", 6)),
+	Object(std::string("tostring", 8)),
+	Object(std::string("concat", 6)),
+	Object(std::string("table", 5)),
+	Object(std::string(",", 1)),
+	Object(3.),
+	Object(2.),
+	Object(5.),
+};
+static LuaGlobalSlot luaG[5];
+
+static double fib_1(double n_2);
+static VarArg counter_3();
+static VarArg pick_16(Object a_17, Object b_18, Object c_19);
+
+static double fib_1(double n_2) {
+	if ((n_2 < 2.)) {
+		return n_2;
+	}
+	return [&]() -> double { double tmp1 = fib_1((n_2 - 1.)); return (tmp1 + fib_1((n_2 - 2.))); }();
+}
+
+static VarArg counter_3() {
+	upvalue c_4 = luaK[0];
+	return VarArg(Object([=](const VarArg& args) -> VarArg {
+		*c_4 = luaArithmetic(LUA_OP_ADD, (*c_4), luaK[1]);
+		return VarArg((*c_4));
+	}));
+}
+
+static VarArg pick_16(Object a_17, Object b_18, Object c_19) {
+	return VarArg(luaArithmetic(LUA_OP_ADD, [&]() -> Object { Object tmp8 = luaArithmetic(LUA_OP_MUL, a_17, luaK[3]); return luaArithmetic(LUA_OP_ADD, tmp8, luaArithmetic(LUA_OP_MUL, b_18, luaK[2])); }(), c_19));
+}
+
+VarArg translated(const VarArg& args) {
+	const Object& env = luaEnvironment();
+	Object count_5 = counter_3().get();
+	count_5();
+	Object squares_6 = luaMakeTable({});
+	{
+		double tmp2 = 1.;
+		double tmp3 = 5.;
+		for (; tmp2 <= tmp3; tmp2 += 1.) {
+			const double k_7 = tmp2;
+			luaSetIndex(squares_6, Object(k_7), Object((k_7 * k_7)));
+		}
+	}
+	Object sum_8 = luaK[0];
+	{
+		Object tmp4 = squares_6;
+		for (double tmp5 = 1;; ++tmp5) {
+			Object tmp6 = luaIndex(tmp4, tmp5);
+			if (tmp6.is_nil()) break;
+			(void)tmp5;
+			Object sq_10 = tmp6;
+			sum_8 = luaArithmetic(LUA_OP_ADD, sum_8, sq_10);
+		}
+	}
+	Object log_11 = luaMakeTable({});
+	upvalue n_12 = luaK[0];
+	Object gen_13 = Object([=](const VarArg& args) -> VarArg {
+		*n_12 = luaArithmetic(LUA_OP_ADD, (*n_12), luaK[1]);
+		{ Object tmp7 = luaArithmetic(LUA_OP_ADD, luaLen(log_11), luaK[1]); luaSetIndex(log_11, tmp7, (*n_12)); }
+		return VarArg((*n_12));
+	});
+	Object s_14 = Object([=](const VarArg& args) -> VarArg {
+		Object x_15 = args[1];
+		luaSetIndex(log_11, luaArithmetic(LUA_OP_ADD, luaLen(log_11), luaK[1]), x_15);
+		return VarArg(x_15);
+	});
+	Object r1_20 = [&]() -> Object { Object tmp9 = gen_13().get(); Object tmp10 = gen_13().get(); return luaMakeTable({tmp9, tmp10}, {}, gen_13()); }();
+	Object a_21 = gen_13().get();
+	(void)gen_13().get();
+	Object c_23 = gen_13().get();
+	Object t_26 = [&]() -> VarArg { Object tmp12 = luaGetGlobal(env, luaK[4], luaG[0]); Object tmp13 = luaMakeTable({}); return tmp12(tmp13, luaMakeTable({}, {{luaK[5], Object([=](const VarArg& args) -> VarArg {
+		(void)args[1];
+		Object k_25 = args[2];
+		{ Object tmp11 = luaArithmetic(LUA_OP_ADD, luaLen(log_11), luaK[1]); luaSetIndex(log_11, tmp11, luaConcat({luaK[6], k_25})); }
+		return VarArg(k_25);
+	})}})); }().get();
+	Object x_27 = [&]() -> Object { Object tmp14 = s_14(1.).get(); return luaArithmetic(LUA_OP_ADD, tmp14, s_14(2.).get()); }();
+	Object y_28 = luaConcat({s_14(luaK[7]).get(), s_14(luaK[8]).get(), s_14(luaK[9]).get()});
+	Object z_29 = luaIndex(t_26, s_14(luaK[10]).get());
+	Object cmp_30 = Object([&]() -> bool { Object tmp15 = s_14(3.).get(); return luaLessThan(tmp15, s_14(4.).get()); }());
+	Object cmp2_31 = Object([&]() -> bool { Object tmp16 = s_14(6.).get(); return luaLessThan(s_14(5.).get(), tmp16); }());
+	Object v_32 = [&]() -> VarArg { Object tmp17 = gen_13().get(); Object tmp18 = gen_13().get(); return pick_16(tmp17, tmp18, gen_13().get()); }().get();
+	Object tab_33 = [&]() -> Object { Object tmp19 = s_14(7.).get(); Object tmp20 = s_14(8.).get(); Object tmp21 = s_14(9.).get(); Object tmp22 = s_14(luaK[11]).get(); return luaMakeTable({tmp19, tmp21}, {{luaK[10], tmp20}, {tmp22, s_14(10.).get()}}); }();
+	double i_34 = 1.;
+	Object arr_35 = luaMakeTable({});
+	{
+		Object tmp23 = Object(i_34);
+		Object tmp24 = arr_35;
+		double tmp25 = (i_34 + 1.);
+		double tmp26 = 20.;
+		i_34 = tmp25;
+		luaSetIndex(tmp24, tmp23, Object(tmp26));
+	}
+	double j_36 = 1.;
+	Object arr2_37 = luaMakeTable({});
+	{
+		Object tmp27 = Object(j_36);
+		Object tmp28 = arr2_37;
+		double tmp29 = 30.;
+		double tmp30 = (j_36 + 1.);
+		luaSetIndex(tmp28, tmp27, Object(tmp29));
+		j_36 = tmp30;
+	}
+	Object mk_38 = Object([=](const VarArg& args) -> VarArg {
+		luaSetIndex(log_11, luaArithmetic(LUA_OP_ADD, luaLen(log_11), luaK[1]), luaK[12]);
+		return VarArg(arr_35);
+	});
+	{ Object tmp31 = mk_38().get(); Object tmp32 = s_14(5.).get(); luaSetIndex(tmp31, tmp32, s_14(6.).get()); }
+	upvalue up_39 = luaK[0];
+	Object bump_40 = Object([=](const VarArg& args) -> VarArg {
+		*up_39 = luaArithmetic(LUA_OP_ADD, (*up_39), luaK[1]);
+		return VarArg((*up_39));
+	});
+	Object w_41 = [&]() -> Object { Object tmp33 = (*up_39); return luaArithmetic(LUA_OP_ADD, tmp33, bump_40().get()); }();
+	Object m_42 = [&]() -> VarArg { Object tmp34 = luaIndex(luaGetGlobal(env, luaK[14], luaG[1]), luaK[13]); Object tmp35 = gen_13().get(); return tmp34.call(luaAppend(VarArg(tmp35), gen_13())); }().get();
+	Object sel_43 = [&]() -> VarArg { Object tmp36 = luaGetGlobal(env, luaK[15], luaG[2]); Object tmp37 = gen_13().get(); Object tmp38 = gen_13().get(); return tmp36.call(luaAppend(VarArg(2., tmp37, tmp38), gen_13())); }().get();
+	Object out_44 = luaMakeTable({});
+	{
+		Object tmp39 = log_11;
+		for (double tmp40 = 1;; ++tmp40) {
+			Object tmp41 = luaIndex(tmp39, tmp40);
+			if (tmp41.is_nil()) break;
+			(void)tmp40;
+			Object e_46 = tmp41;
+			{ Object tmp42 = luaArithmetic(LUA_OP_ADD, luaLen(out_44), luaK[1]); luaSetIndex(out_44, tmp42, luaGetGlobal(env, luaK[16], luaG[3])(e_46).get()); }
+		}
+	}
+	return [&]() -> VarArg { Object tmp43 = luaIndex(luaGetGlobal(env, luaK[18], luaG[4]), luaK[17])(out_44, luaK[19]).get(); Object tmp44 = luaIndex(r1_20, luaK[1]); Object tmp45 = luaIndex(r1_20, luaK[20]); Object tmp46 = luaIndex(tab_33, luaK[1]); Object tmp47 = luaIndex(tab_33, luaK[21]); Object tmp48 = luaIndex(tab_33, luaK[10]); Object tmp49 = luaIndex(tab_33, luaK[11]); Object tmp50 = luaIndex(arr_35, luaK[1]); Object tmp51 = luaIndex(arr_35, luaK[21]); Object tmp52 = luaIndex(arr2_37, luaK[1]); Object tmp53 = luaIndex(arr_35, luaK[22]); double tmp54 = fib_1(15.); return VarArg(tmp43, tmp44, tmp45, a_21, c_23, x_27, y_28, z_29, cmp_30, cmp2_31, v_32, tmp46, tmp47, tmp48, tmp49, i_34, tmp50, tmp51, tmp52, j_36, w_41, m_42, tmp53, tmp54, count_5().get(), sum_8, sel_43); }();
+}
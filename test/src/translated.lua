@@ -0,0 +1,49 @@
+--[[
+run by the test both as Lua, through load, and as C++, as translated.cpp
+the two have to give the same results, and translated.cpp has to be what the translator makes of this now
+after changing either, from this directory:
+	luatocxx translated.lua translated.cpp
+]]
+
+--closures, loops and direct functions
+local function fib(n) if n < 2 then return n end return fib(n - 1) + fib(n - 2) end
+local function counter() local c = 0 return function() c = c + 1 return c end end
+local count = counter()
+count()
+local squares = {}
+for k = 1, 5 do squares[k] = k * k end
+local sum = 0
+for _, sq in ipairs(squares) do sum = sum + sq end
+
+--operands, arguments, table items and assignment targets are evaluated left to right
+local log = {}
+local n = 0
+local function gen() n = n + 1 log[#log + 1] = n return n end
+local function s(x) log[#log + 1] = x return x end
+local function pick(a, b, c) return a * 100 + b * 10 + c end
+local r1 = {gen(), gen(), gen()}
+local a, b, c = gen(), gen(), gen()
+local t = setmetatable({}, {__index = function(_, k) log[#log + 1] = 'i' .. k return k end})
+local x = s(1) + s(2)
+local y = s('p') .. s('q') .. s('r')
+local z = t[s('k')]
+local cmp = s(3) < s(4)
+local cmp2 = s(6) > s(5)
+local v = pick(gen(), gen(), gen())
+local tab = {s(7), k = s(8), s(9), [s('kk')] = s(10)}
+local i = 1
+local arr = {}
+i, arr[i] = i + 1, 20
+local j = 1
+local arr2 = {}
+arr2[j], j = 30, j + 1
+local function mk() log[#log + 1] = 'mk' return arr end
+mk()[s(5)] = s(6)
+local up = 0
+local function bump() up = up + 1 return up end
+local w = up + bump()
+local m = math.max(gen(), gen())
+local sel = select(2, gen(), gen(), gen())
+local out = {}
+for _, e in ipairs(log) do out[#out + 1] = tostring(e) end
+return table.concat(out, ','), r1[1], r1[3], a, c, x, y, z, cmp, cmp2, v, tab[1], tab[2], tab.k, tab.kk, i, arr[1], arr[2], arr2[1], j, w, m, arr[5], fib(15), count(), sum, sel